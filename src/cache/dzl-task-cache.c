@@ -26,12 +26,59 @@
 #include "util/dzl-heap.h"
 #include "util/dzl-macros.h"
 
+/* Counters are not available on win32 */
+#ifndef G_OS_WIN32
+# include "util/dzl-counter.h"
+#endif
+
+/*
+ * The number of shards used when the cache is thread-safe. Keys are
+ * spread across the shards by hash so that threads working with
+ * different keys rarely contend for the same lock.
+ */
+#define N_THREAD_SAFE_SHARDS 16
+
+/* The heap_index of items that never expire, and so are not in the heap */
+#define NOT_IN_HEAP G_MAXSIZE
+
+enum {
+  STAT_HITS,
+  STAT_MISSES,
+  STAT_EVICTIONS,
+  STAT_EXPIRATIONS,
+  STAT_COST,
+  N_STATS
+};
+
+#ifndef G_OS_WIN32
+static const struct {
+  const gchar *name;
+  const gchar *description;
+} stat_info [N_STATS] = {
+  { "Hits", "Number of requests answered from the cache" },
+  { "Misses", "Number of requests that had to populate the cache" },
+  { "Evictions", "Number of items evicted to stay within max-cost" },
+  { "Expirations", "Number of items evicted after their time-to-live" },
+  { "Cost", "Total cost of the items in the cache" },
+};
+#endif
+
 typedef struct
 {
   DzlTaskCache *self;
   gpointer      key;
   gpointer      value;
+  /* Set instead of value when caching a failed populate */
+  GError       *error;
+  /* When the value should be refreshed, zero if never */
+  gint64        stale_at;
+  /* When the item should be dropped, zero if never */
   gint64        evict_at;
+  /* Kept up to date by the evict heap so the item can be removed in O(log n) */
+  gsize         heap_index;
+  gsize         cost;
+  /* Embedded so that touching an item does not allocate, data is the item */
+  GList         lru_link;
 } CacheItem;
 
 typedef struct
@@ -44,8 +91,37 @@ typedef struct
 
 typedef struct
 {
-  GSource  source;
-  DzlHeap *heap;
+  /*
+   * Everything needed to manage a subset of the keys. The mutex is only
+   * used when the cache is thread-safe. Items are always freed and tasks
+   * completed after the mutex is dropped since doing so may re-enter the
+   * cache from a destroy notify or task callback.
+   */
+  GMutex      mutex;
+  GHashTable *cache;
+  GHashTable *in_flight;
+  GHashTable *queued;
+  DzlHeap    *evict_heap;
+
+  /*
+   * The items in least recently used order, the most recently used item
+   * being at the head. cost is the sum of the cost of every item.
+   */
+  GQueue      lru;
+  guint64     cost;
+
+  /*
+   * The evict_at of the item at the top of evict_heap, or -1 if it is
+   * empty. Written with the mutex held, but read without it so that the
+   * evict source can poll every shard on each main loop iteration.
+   */
+  gint64      next_evict_at;
+} CacheShard;
+
+typedef struct
+{
+  GSource       source;
+  DzlTaskCache *self;
 } EvictSource;
 
 struct _DzlTaskCache
@@ -58,22 +134,38 @@ struct _DzlTaskCache
   GBoxedFreeFunc        key_destroy_func;
   GBoxedCopyFunc        value_copy_func;
   GBoxedFreeFunc        value_destroy_func;
+  DzlTaskCacheCostFunc  value_cost_func;
 
   DzlTaskCacheCallback  populate_callback;
   gpointer              populate_callback_data;
   GDestroyNotify        populate_callback_data_destroy;
 
-  GHashTable           *cache;
-  GHashTable           *in_flight;
-  GHashTable           *queued;
+  CacheShard           *shards;
+  guint                 n_shards;
 
   gchar                *name;
 
-  DzlHeap              *evict_heap;
+#ifndef G_OS_WIN32
+  /*
+   * N_STATS counters, registered with the default arena when the cache
+   * is first used if it has a name. NULL otherwise.
+   */
+  DzlCounter           *counters;
+  gsize                 counters_initialized;
+#endif
+
   GSource              *evict_source;
   guint                 evict_source_id;
 
   gint64                time_to_live_usec;
+  gint64                stale_while_revalidate_usec;
+  gint64                error_time_to_live_usec;
+
+  /* Zero for no limit, each shard gets an equal share of max_cost */
+  guint64               max_cost;
+  guint64               shard_max_cost;
+
+  guint                 thread_safe : 1;
 };
 
 G_DEFINE_TYPE (DzlTaskCache, dzl_task_cache, G_TYPE_OBJECT)
@@ -83,58 +175,167 @@ enum {
   PROP_KEY_COPY_FUNC,
   PROP_KEY_DESTROY_FUNC,
   PROP_KEY_EQUAL_FUNC,
+  PROP_ERROR_TIME_TO_LIVE,
   PROP_KEY_HASH_FUNC,
+  PROP_MAX_COST,
   PROP_POPULATE_CALLBACK,
   PROP_POPULATE_CALLBACK_DATA,
   PROP_POPULATE_CALLBACK_DATA_DESTROY,
+  PROP_STALE_WHILE_REVALIDATE,
+  PROP_THREAD_SAFE,
   PROP_TIME_TO_LIVE,
   PROP_VALUE_COPY_FUNC,
+  PROP_VALUE_COST_FUNC,
   PROP_VALUE_DESTROY_FUNC,
   LAST_PROP
 };
 
 static GParamSpec *properties [LAST_PROP];
 
-static gboolean
-evict_source_check (GSource *source)
+static inline void
+dzl_task_cache_count (DzlTaskCache *self,
+                      guint         stat,
+                      gint64        count)
 {
-  EvictSource *ev = (EvictSource *)source;
+#ifndef G_OS_WIN32
+  DzlCounter *counters = g_atomic_pointer_get (&self->counters);
 
-  g_assert (ev != NULL);
-  g_assert (ev->heap != NULL);
+  if (counters != NULL)
+    dzl_counter_add (&counters [stat], count);
+#endif
+}
 
-  if (ev->heap->len > 0)
+/*
+ * Registers the counters of @self, named after the cache, the first time
+ * the cache is used. Caches without a name have no counters, so that the
+ * shared memory of the default arena is only created when useful.
+ */
+static void
+dzl_task_cache_ensure_counters (DzlTaskCache *self)
+{
+#ifndef G_OS_WIN32
+  if (g_once_init_enter (&self->counters_initialized))
     {
-      CacheItem *item;
-      gint64 now;
+      if (self->name != NULL)
+        {
+          DzlCounterArena *arena = dzl_counter_arena_get_default ();
+          DzlCounter *counters = g_new0 (DzlCounter, N_STATS);
 
-      now = g_source_get_time (source);
-      item = dzl_heap_peek (ev->heap, gpointer);
+          for (guint i = 0; i < N_STATS; i++)
+            {
+              counters [i].category = "TaskCache";
+              counters [i].name = g_strdup_printf ("%s %s", self->name, stat_info [i].name);
+              counters [i].description = stat_info [i].description;
+              dzl_counter_arena_register (arena, &counters [i]);
+            }
+
+          g_atomic_pointer_set (&self->counters, counters);
+        }
 
-      return (item->evict_at <= now);
+      g_once_init_leave (&self->counters_initialized, 1);
     }
+#endif
+}
+
+static inline CacheShard *
+cache_shard_get (DzlTaskCache  *self,
+                 gconstpointer  key)
+{
+  guint hash;
 
-  return FALSE;
+  if (self->n_shards == 1)
+    return &self->shards [0];
+
+  /* Mix the high bits in, many hash functions are weak in the low bits */
+  hash = self->key_hash_func (key);
+  hash ^= hash >> 16;
+
+  return &self->shards [hash & (self->n_shards - 1)];
+}
+
+static inline void
+cache_shard_lock (DzlTaskCache *self,
+                  CacheShard   *shard)
+{
+  if (self->thread_safe)
+    g_mutex_lock (&shard->mutex);
+}
+
+static inline void
+cache_shard_unlock (DzlTaskCache *self,
+                    CacheShard   *shard)
+{
+  if (self->thread_safe)
+    g_mutex_unlock (&shard->mutex);
+}
+
+/*
+ * Publishes the top of the evict heap after it changed. The shard must
+ * be locked.
+ */
+static inline void
+cache_shard_update_next_evict_at (CacheShard *shard)
+{
+  gint64 next_evict_at = -1;
+
+  if (shard->evict_heap->len > 0)
+    {
+      CacheItem *item = dzl_heap_peek (shard->evict_heap, gpointer);
+
+      next_evict_at = item->evict_at;
+    }
+
+  __atomic_store_n (&shard->next_evict_at, next_evict_at, __ATOMIC_RELAXED);
+}
+
+/*
+ * Gets the earliest time at which an item needs to be evicted from any of
+ * the shards, or -1 if there is nothing to evict. This does not take the
+ * shard locks, so it may be out of date by the time it returns. That is
+ * fine for the evict source, which is rearmed after every change.
+ */
+static gint64
+dzl_task_cache_get_next_evict_at (DzlTaskCache *self)
+{
+  gint64 ret = -1;
+
+  g_assert (DZL_IS_TASK_CACHE (self));
+
+  for (guint i = 0; i < self->n_shards; i++)
+    {
+      gint64 next_evict_at = __atomic_load_n (&self->shards [i].next_evict_at, __ATOMIC_RELAXED);
+
+      if (next_evict_at != -1 && (ret == -1 || next_evict_at < ret))
+        ret = next_evict_at;
+    }
+
+  return ret;
+}
+
+static gboolean
+evict_source_check (GSource *source)
+{
+  EvictSource *ev = (EvictSource *)source;
+  gint64 evict_at;
+
+  g_assert (ev != NULL);
+  g_assert (DZL_IS_TASK_CACHE (ev->self));
+
+  evict_at = dzl_task_cache_get_next_evict_at (ev->self);
+
+  return evict_at != -1 && evict_at <= g_source_get_time (source);
 }
 
 static void
 evict_source_rearm (GSource *source)
 {
   EvictSource *evict_source = (EvictSource *)source;
-  gint64 ready_time = -1;
 
   g_assert (source != NULL);
   g_assert (evict_source != NULL);
 
-  if (evict_source->heap->len > 0)
-    {
-      CacheItem *item;
-
-      item = dzl_heap_peek (evict_source->heap, gpointer);
-      ready_time = item->evict_at;
-    }
-
-  g_source_set_ready_time (source, ready_time);
+  /* g_source_set_ready_time() is safe to call from any thread */
+  g_source_set_ready_time (source, dzl_task_cache_get_next_evict_at (evict_source->self));
 }
 
 static gboolean
@@ -152,19 +353,11 @@ evict_source_dispatch (GSource     *source,
   return ret;
 }
 
-static void
-evict_source_finalize (GSource *source)
-{
-  EvictSource *ev = (EvictSource *)source;
-
-  g_clear_pointer (&ev->heap, dzl_heap_unref);
-}
-
 static GSourceFuncs evict_source_funcs = {
   NULL,
   evict_source_check,
   evict_source_dispatch,
-  evict_source_finalize,
+  NULL,
 };
 
 static void
@@ -172,14 +365,25 @@ cache_item_free (gpointer data)
 {
   CacheItem *item = data;
 
+  dzl_task_cache_count (item->self, STAT_COST, -(gint64)item->cost);
+
   g_clear_pointer (&item->key, item->self->key_destroy_func);
   g_clear_pointer (&item->value, item->self->value_destroy_func);
+  g_clear_error (&item->error);
   item->self = NULL;
   item->evict_at = 0;
 
   g_slice_free (CacheItem, item);
 }
 
+static void
+cache_item_free_foreach (gpointer key,
+                         gpointer value,
+                         gpointer user_data)
+{
+  cache_item_free (value);
+}
+
 static gint
 cache_item_compare_evict_at (gconstpointer a,
                              gconstpointer b)
@@ -204,21 +408,58 @@ cache_item_compare_evict_at (gconstpointer a,
     return 0;
 }
 
+static void
+cache_item_set_heap_index (gpointer element,
+                           gsize    index_)
+{
+  CacheItem *item = *(CacheItem **)element;
+
+  item->heap_index = index_;
+}
+
+/*
+ * Creates an item for @value or, when caching a failure, for @error.
+ */
 static CacheItem *
 cache_item_new (DzlTaskCache  *self,
                 gconstpointer  key,
-                gconstpointer  value)
+                gconstpointer  value,
+                const GError  *error)
 {
   CacheItem *ret;
 
   g_assert (DZL_IS_TASK_CACHE (self));
+  g_assert ((value == NULL) != (error == NULL));
 
   ret = g_slice_new0 (CacheItem);
   ret->self = self;
   ret->key = self->key_copy_func ((gpointer)key);
-  ret->value = self->value_copy_func ((gpointer)value);
-  if (self->time_to_live_usec > 0)
-    ret->evict_at = g_get_monotonic_time () + self->time_to_live_usec;
+  ret->heap_index = NOT_IN_HEAP;
+  ret->lru_link.data = ret;
+
+  if (error != NULL)
+    {
+      ret->error = g_error_copy (error);
+      ret->cost = 1;
+      ret->evict_at = g_get_monotonic_time () + self->error_time_to_live_usec;
+    }
+  else
+    {
+      ret->value = self->value_copy_func ((gpointer)value);
+      ret->cost = self->value_cost_func (ret->value);
+
+      if (self->time_to_live_usec > 0)
+        {
+          ret->stale_at = g_get_monotonic_time () + self->time_to_live_usec;
+          ret->evict_at = ret->stale_at + self->stale_while_revalidate_usec;
+
+          /* Without a grace period there is never a stale value to serve */
+          if (self->stale_while_revalidate_usec == 0)
+            ret->stale_at = 0;
+        }
+    }
+
+  dzl_task_cache_count (self, STAT_COST, ret->cost);
 
   return ret;
 }
@@ -265,49 +506,80 @@ dzl_task_cache_dummy_destroy_func (gpointer boxed)
 {
 }
 
-static gboolean
-dzl_task_cache_evict_full (DzlTaskCache  *self,
-                           gconstpointer  key,
-                           gboolean       check_heap)
+static gsize
+dzl_task_cache_dummy_cost_func (gconstpointer value)
 {
-  CacheItem *item;
+  return 1;
+}
 
-  g_return_val_if_fail (DZL_IS_TASK_CACHE (self), FALSE);
+/*
+ * Marks @item as the most recently used item of @shard. The shard must
+ * be locked.
+ */
+static inline void
+cache_shard_touch (CacheShard *shard,
+                   CacheItem  *item)
+{
+  if (shard->lru.head != &item->lru_link)
+    {
+      g_queue_unlink (&shard->lru, &item->lru_link);
+      g_queue_push_head_link (&shard->lru, &item->lru_link);
+    }
+}
 
-  if ((item = g_hash_table_lookup (self->cache, key)))
+/*
+ * Removes the item for @key from @shard, returning it so that it may be
+ * freed once the shard is unlocked. The shard must be locked.
+ */
+static CacheItem *
+cache_shard_steal (CacheShard    *shard,
+                   gconstpointer  key)
+{
+  CacheItem *item;
+
+  if ((item = g_hash_table_lookup (shard->cache, key)))
     {
-      if (check_heap)
+      if (item->heap_index != NOT_IN_HEAP)
         {
-          gsize i;
-
-          for (i = 0; i < self->evict_heap->len; i++)
-            {
-              if (item == dzl_heap_index (self->evict_heap, gpointer, i))
-                {
-                  dzl_heap_extract_index (self->evict_heap, i, NULL);
-                  break;
-                }
-            }
+          g_assert (dzl_heap_index (shard->evict_heap, gpointer, item->heap_index) == item);
+          dzl_heap_extract_index (shard->evict_heap, item->heap_index, NULL);
+          cache_shard_update_next_evict_at (shard);
         }
 
-      g_hash_table_remove (self->cache, key);
-
-      g_debug ("Evicted 1 item from %s", self->name ?: "unnamed cache");
-
-      if (self->evict_source != NULL)
-        evict_source_rearm (self->evict_source);
-
-      return TRUE;
+      g_hash_table_steal (shard->cache, key);
+      g_queue_unlink (&shard->lru, &item->lru_link);
+      shard->cost -= item->cost;
     }
 
-  return FALSE;
+  return item;
 }
 
 gboolean
 dzl_task_cache_evict (DzlTaskCache  *self,
                       gconstpointer  key)
 {
-  return dzl_task_cache_evict_full (self, key, TRUE);
+  CacheShard *shard;
+  CacheItem *item;
+
+  g_return_val_if_fail (DZL_IS_TASK_CACHE (self), FALSE);
+
+  shard = cache_shard_get (self, key);
+
+  cache_shard_lock (self, shard);
+  item = cache_shard_steal (shard, key);
+  cache_shard_unlock (self, shard);
+
+  if (item == NULL)
+    return FALSE;
+
+  cache_item_free (item);
+
+  g_debug ("Evicted 1 item from %s", self->name ?: "unnamed cache");
+
+  if (self->evict_source != NULL)
+    evict_source_rearm (self->evict_source);
+
+  return TRUE;
 }
 
 void
@@ -315,15 +587,33 @@ dzl_task_cache_evict_all (DzlTaskCache *self)
 {
   g_return_if_fail (DZL_IS_TASK_CACHE (self));
 
-  while (self->evict_heap->len > 0)
+  for (guint i = 0; i < self->n_shards; i++)
     {
-      CacheItem *item;
+      CacheShard *shard = &self->shards [i];
+      GHashTable *cache;
 
-      /* The cache item is owned by the hashtable, so safe to "leak" here */
-      dzl_heap_extract_index (self->evict_heap, self->evict_heap->len - 1, &item);
-    }
+      cache_shard_lock (self, shard);
 
-  g_hash_table_remove_all (self->cache);
+      while (shard->evict_heap->len > 0)
+        {
+          CacheItem *item;
+
+          /* The cache item is owned by the hashtable, so safe to "leak" here */
+          dzl_heap_extract_index (shard->evict_heap, shard->evict_heap->len - 1, &item);
+        }
+
+      cache_shard_update_next_evict_at (shard);
+
+      cache = shard->cache;
+      shard->cache = g_hash_table_new (self->key_hash_func, self->key_equal_func);
+      g_queue_init (&shard->lru);
+      shard->cost = 0;
+
+      cache_shard_unlock (self, shard);
+
+      g_hash_table_foreach (cache, cache_item_free_foreach, NULL);
+      g_hash_table_unref (cache);
+    }
 
   if (self->evict_source != NULL)
     evict_source_rearm (self->evict_source);
@@ -335,11 +625,12 @@ dzl_task_cache_evict_all (DzlTaskCache *self)
  * @key: The key for the cache
  *
  * Peeks to see @key is contained in the cache and returns the
- * matching #GObject if it does.
+ * matching #GObject if it does. The item is marked as recently used.
  *
  * The reference count of the resulting #GObject is not incremented.
  * For that reason, it is important to remember that this function
- * may only be called from the main thread.
+ * may only be called from the main thread. For thread-safe caches,
+ * use dzl_task_cache_lookup() from other threads instead.
  *
  * Returns: (type GObject.Object) (nullable) (transfer none): A #GObject or
  *   %NULL if the key was not found in the cache.
@@ -348,32 +639,92 @@ gpointer
 dzl_task_cache_peek (DzlTaskCache  *self,
                      gconstpointer  key)
 {
+  CacheShard *shard;
   CacheItem *item;
+  gpointer ret = NULL;
 
   g_return_val_if_fail (DZL_IS_TASK_CACHE (self), NULL);
 
-  if (NULL != (item = g_hash_table_lookup (self->cache, key)))
-    return item->value;
+  shard = cache_shard_get (self, key);
 
-  return NULL;
+  cache_shard_lock (self, shard);
+  if (NULL != (item = g_hash_table_lookup (shard->cache, key)) && item->error == NULL)
+    {
+      cache_shard_touch (shard, item);
+      ret = item->value;
+    }
+  cache_shard_unlock (self, shard);
+
+  return ret;
 }
 
-static void
-dzl_task_cache_propagate_error (DzlTaskCache  *self,
-                                gconstpointer  key,
-                                const GError  *error)
+/**
+ * dzl_task_cache_lookup:
+ * @self: An #DzlTaskCache
+ * @key: The key for the cache
+ *
+ * Like dzl_task_cache_peek(), but returns a copy of the value made with
+ * the value copy function while the cache is locked. For thread-safe
+ * caches, this may be called from any thread.
+ *
+ * Returns: (type GObject.Object) (nullable) (transfer full): A #GObject or
+ *   %NULL if the key was not found in the cache.
+ *
+ * Since: 3.46
+ */
+gpointer
+dzl_task_cache_lookup (DzlTaskCache  *self,
+                       gconstpointer  key)
 {
-  GPtrArray *queued;
+  CacheShard *shard;
+  CacheItem *item;
+  gpointer ret = NULL;
 
-  g_assert (DZL_IS_TASK_CACHE (self));
-  g_assert (error != NULL);
+  g_return_val_if_fail (DZL_IS_TASK_CACHE (self), NULL);
+
+  shard = cache_shard_get (self, key);
 
-  if (NULL != (queued = g_hash_table_lookup (self->queued, key)))
+  cache_shard_lock (self, shard);
+  if (NULL != (item = g_hash_table_lookup (shard->cache, key)) && item->error == NULL)
+    {
+      cache_shard_touch (shard, item);
+      ret = self->value_copy_func (item->value);
+    }
+  cache_shard_unlock (self, shard);
+
+  return ret;
+}
+
+/*
+ * Removes the tasks waiting on @key so they can be completed after the
+ * shard has been unlocked. The shard must be locked.
+ */
+static GPtrArray *
+cache_shard_steal_queued (CacheShard    *shard,
+                          gconstpointer  key)
+{
+  GPtrArray *queued;
+
+  if (NULL != (queued = g_hash_table_lookup (shard->queued, key)))
     {
       /* we can't use steal because we want the key freed */
       g_ptr_array_ref (queued);
-      g_hash_table_remove (self->queued, key);
+      g_hash_table_remove (shard->queued, key);
+    }
+
+  return queued;
+}
+
+static void
+dzl_task_cache_propagate_error (DzlTaskCache *self,
+                                GPtrArray    *queued,
+                                const GError *error)
+{
+  g_assert (DZL_IS_TASK_CACHE (self));
+  g_assert (error != NULL);
 
+  if (queued != NULL)
+    {
       for (guint i = 0; i < queued->len; i++)
         {
           GTask *task;
@@ -381,45 +732,59 @@ dzl_task_cache_propagate_error (DzlTaskCache  *self,
           task = g_ptr_array_index (queued, i);
           g_task_return_error (task, g_error_copy (error));
         }
-
-      g_ptr_array_unref (queued);
     }
 }
 
+/*
+ * Inserts @item as the most recently used item of @shard. The previous
+ * item for the key, and any least recently used items that no longer fit
+ * within the cost limit, are added to @stolen so that they may be freed
+ * once the shard is unlocked. The shard must be locked.
+ */
 static void
-dzl_task_cache_populate (DzlTaskCache  *self,
-                         gconstpointer  key,
-                         gpointer       value)
+dzl_task_cache_populate (DzlTaskCache *self,
+                         CacheShard   *shard,
+                         CacheItem    *item,
+                         GPtrArray    *stolen)
 {
-  CacheItem *item;
+  CacheItem *old_item;
 
   g_assert (DZL_IS_TASK_CACHE (self));
 
-  item = cache_item_new (self, key, value);
+  if ((old_item = cache_shard_steal (shard, item->key)))
+    g_ptr_array_add (stolen, old_item);
 
-  if (g_hash_table_contains (self->cache, key))
-    dzl_task_cache_evict (self, key);
-  g_hash_table_insert (self->cache, item->key, item);
-  dzl_heap_insert_val (self->evict_heap, item);
+  g_hash_table_insert (shard->cache, item->key, item);
+  if (item->evict_at != 0)
+    {
+      dzl_heap_insert_val (shard->evict_heap, item);
+      cache_shard_update_next_evict_at (shard);
+    }
+  g_queue_push_head_link (&shard->lru, &item->lru_link);
+  shard->cost += item->cost;
 
-  if (self->evict_source != NULL)
-    evict_source_rearm (self->evict_source);
+  if (self->max_cost == 0)
+    return;
+
+  /* Always keep the new item, even if it alone is over the limit */
+  while (shard->cost > self->shard_max_cost && shard->lru.tail != &item->lru_link)
+    {
+      CacheItem *victim = shard->lru.tail->data;
+
+      g_ptr_array_add (stolen, cache_shard_steal (shard, victim->key));
+      dzl_task_cache_count (self, STAT_EVICTIONS, 1);
+    }
 }
 
 static void
-dzl_task_cache_propagate_pointer (DzlTaskCache  *self,
-                                  gconstpointer  key,
-                                  gpointer       value)
+dzl_task_cache_propagate_pointer (DzlTaskCache *self,
+                                  GPtrArray    *queued,
+                                  gpointer      value)
 {
-  GPtrArray *queued = NULL;
-
   g_assert (DZL_IS_TASK_CACHE (self));
 
-  if (NULL != (queued = g_hash_table_lookup (self->queued, key)))
+  if (queued != NULL)
     {
-      g_ptr_array_ref (queued);
-      g_hash_table_remove (self->queued, key);
-
       for (guint i = 0; i < queued->len; i++)
         {
           GTask *task = g_ptr_array_index (queued, i);
@@ -428,8 +793,6 @@ dzl_task_cache_propagate_pointer (DzlTaskCache  *self,
                                  self->value_copy_func (value),
                                  self->value_destroy_func);
         }
-
-      g_ptr_array_unref (queued);
     }
 }
 
@@ -439,9 +802,11 @@ dzl_task_cache_cancel_in_idle (gpointer user_data)
   DzlTaskCache *self;
   CancelledData *data;
   GCancellable *cancellable;
+  g_autoptr(GCancellable) fetch_cancellable = NULL;
+  CacheShard *shard;
   GPtrArray *queued;
   GTask *task = user_data;
-  gboolean cancelled = FALSE;
+  gboolean found = FALSE;
 
   g_assert (G_IS_TASK (task));
 
@@ -454,7 +819,11 @@ dzl_task_cache_cancel_in_idle (gpointer user_data)
   g_assert (data != NULL);
   g_assert (data->cancellable == cancellable);
 
-  if ((queued = g_hash_table_lookup (self->queued, data->key)))
+  shard = cache_shard_get (self, data->key);
+
+  cache_shard_lock (self, shard);
+
+  if ((queued = g_hash_table_lookup (shard->queued, data->key)))
     {
       for (guint i = 0; i < queued->len; i++)
         {
@@ -466,8 +835,9 @@ dzl_task_cache_cancel_in_idle (gpointer user_data)
 
           if (queued_task == task && queued_cancellable == cancellable)
             {
-              cancelled = g_task_return_error_if_cancelled (task);
+              /* The idle source holds a reference to @task */
               g_ptr_array_remove_index_fast (queued, i);
+              found = TRUE;
               break;
             }
         }
@@ -476,14 +846,19 @@ dzl_task_cache_cancel_in_idle (gpointer user_data)
         {
           GTask *fetch_task;
 
-          if ((fetch_task = g_hash_table_lookup (self->in_flight, data->key)))
-            {
-              GCancellable *fetch_cancellable;
-
-              fetch_cancellable = g_task_get_cancellable (fetch_task);
-              g_cancellable_cancel (fetch_cancellable);
-            }
+          if ((fetch_task = g_hash_table_lookup (shard->in_flight, data->key)))
+            fetch_cancellable = g_object_ref (g_task_get_cancellable (fetch_task));
         }
+    }
+
+  cache_shard_unlock (self, shard);
+
+  if (found)
+    {
+      gboolean cancelled = g_task_return_error_if_cancelled (task);
+
+      if (fetch_cancellable != NULL)
+        g_cancellable_cancel (fetch_cancellable);
 
       g_return_val_if_fail (cancelled, G_SOURCE_REMOVE);
     }
@@ -515,7 +890,7 @@ dzl_task_cache_cancelled_cb (GCancellable *cancellable,
   g_source_set_callback (source, dzl_task_cache_cancel_in_idle, g_object_ref (task), g_object_unref);
   g_source_set_name (source, "[dzl] dzl_task_cache_cancel_in_idle");
 
-  context = g_main_context_get_thread_default ();
+  context = g_task_get_context (task);
   g_source_attach (source, context);
 }
 
@@ -528,31 +903,110 @@ dzl_task_cache_fetch_cb (GObject      *object,
   GTask *task = (GTask *)result;
   GError *error = NULL;
   gpointer key = user_data;
+  g_autoptr(GPtrArray) stolen = NULL;
+  CacheShard *shard;
+  CacheItem *item = NULL;
+  GPtrArray *queued;
   gpointer ret;
 
   g_assert (DZL_IS_TASK_CACHE (self));
   g_assert (G_IS_TASK (task));
 
-  g_hash_table_remove (self->in_flight, key);
-
   ret = g_task_propagate_pointer (task, &error);
 
+  /* The cost function may be slow, so create the item before locking */
+  if (ret != NULL)
+    item = cache_item_new (self, key, ret, NULL);
+  else if (self->error_time_to_live_usec > 0 &&
+           !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    item = cache_item_new (self, key, NULL, error);
+
+  if (item != NULL)
+    stolen = g_ptr_array_new_with_free_func (cache_item_free);
+
+  shard = cache_shard_get (self, key);
+
+  cache_shard_lock (self, shard);
+
+  /* Our caller still holds @task, so this cannot finalize it */
+  g_hash_table_remove (shard->in_flight, key);
+
+  if (item != NULL)
+    {
+      CacheItem *old_item = g_hash_table_lookup (shard->cache, key);
+
+      /*
+       * Keep serving a (possibly stale) value rather than the error, but
+       * do not refresh it again until the error would have expired so a
+       * failing populate is not retried on every request.
+       */
+      if (item->error != NULL && old_item != NULL && old_item->error == NULL)
+        {
+          if (old_item->stale_at != 0)
+            {
+              old_item->stale_at = item->evict_at;
+
+              if (old_item->evict_at != 0 && old_item->stale_at >= old_item->evict_at)
+                old_item->stale_at = 0;
+            }
+
+          g_ptr_array_add (stolen, item);
+        }
+      else
+        dzl_task_cache_populate (self, shard, item, stolen);
+    }
+
+  queued = cache_shard_steal_queued (shard, key);
+
+  cache_shard_unlock (self, shard);
+
   if (ret != NULL)
     {
-      dzl_task_cache_populate (self, key, ret);
-      dzl_task_cache_propagate_pointer (self, key, ret);
+      dzl_task_cache_propagate_pointer (self, queued, ret);
       self->value_destroy_func (ret);
     }
   else
     {
-      dzl_task_cache_propagate_error (self, key, error);
+      dzl_task_cache_propagate_error (self, queued, error);
       g_clear_error (&error);
     }
 
+  if (item != NULL && self->evict_source != NULL)
+    evict_source_rearm (self->evict_source);
+
+  g_clear_pointer (&stolen, g_ptr_array_unref);
+  g_clear_pointer (&queued, g_ptr_array_unref);
+
   self->key_destroy_func (key);
   g_object_unref (task);
 }
 
+/*
+ * Creates the task used to populate @key and marks @key as in flight. The
+ * shard must be locked, and the populate callback called once unlocked.
+ */
+static GTask *
+cache_shard_begin_fetch (DzlTaskCache  *self,
+                         CacheShard    *shard,
+                         gconstpointer  key)
+{
+  g_autoptr(GCancellable) fetch_cancellable = NULL;
+  GTask *fetch_task;
+
+  g_assert (!g_hash_table_contains (shard->in_flight, key));
+
+  fetch_cancellable = g_cancellable_new ();
+  fetch_task = g_task_new (self,
+                           fetch_cancellable,
+                           dzl_task_cache_fetch_cb,
+                           self->key_copy_func ((gpointer)key));
+  g_hash_table_insert (shard->in_flight,
+                       self->key_copy_func ((gpointer)key),
+                       g_object_ref (fetch_task));
+
+  return fetch_task;
+}
+
 void
 dzl_task_cache_get_async (DzlTaskCache        *self,
                           gconstpointer        key,
@@ -564,35 +1018,89 @@ dzl_task_cache_get_async (DzlTaskCache        *self,
   g_autoptr(GTask) fetch_task = NULL;
   g_autoptr(GTask) task = NULL;
   CancelledData *data;
+  CacheShard *shard;
   GPtrArray *queued;
-  gpointer ret;
   gulong cancelled_id = 0;
 
   g_return_if_fail (DZL_IS_TASK_CACHE (self));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
+  dzl_task_cache_ensure_counters (self);
+
   task = g_task_new (self, cancellable, callback, user_data);
   g_task_set_return_on_cancel (task, FALSE);
 
+  shard = cache_shard_get (self, key);
+
   /*
-   * If we have the answer, return it now.
+   * If we have the answer, return it now. That includes a cached error,
+   * and a stale value which is then refreshed in the background.
    */
-  if (!force_update && (ret = dzl_task_cache_peek (self, key)))
+  if (!force_update)
     {
-      g_task_return_pointer (task,
-                             self->value_copy_func (ret),
-                             self->value_destroy_func);
-      return;
+      GError *error = NULL;
+      gpointer ret = NULL;
+      gboolean found = FALSE;
+      CacheItem *item;
+
+      cache_shard_lock (self, shard);
+
+      if ((item = g_hash_table_lookup (shard->cache, key)))
+        {
+          found = TRUE;
+          cache_shard_touch (shard, item);
+
+          if (item->error != NULL)
+            error = g_error_copy (item->error);
+          else
+            ret = self->value_copy_func (item->value);
+
+          if (item->stale_at != 0 &&
+              item->stale_at <= g_get_monotonic_time () &&
+              !g_hash_table_contains (shard->in_flight, key))
+            fetch_task = cache_shard_begin_fetch (self, shard, key);
+        }
+
+      cache_shard_unlock (self, shard);
+
+      if (found)
+        {
+          dzl_task_cache_count (self, STAT_HITS, 1);
+
+          if (error != NULL)
+            g_task_return_error (task, error);
+          else
+            g_task_return_pointer (task, ret, self->value_destroy_func);
+
+          if (fetch_task != NULL)
+            self->populate_callback (self,
+                                     key,
+                                     g_object_ref (fetch_task),
+                                     self->populate_callback_data);
+
+          return;
+        }
+
+      dzl_task_cache_count (self, STAT_MISSES, 1);
     }
 
+  /*
+   * The task data must be set before the task is visible to other
+   * threads through the queued table.
+   */
+  data = cancelled_data_new (self, cancellable, key, 0);
+  g_task_set_task_data (task, data, cancelled_data_free);
+
+  cache_shard_lock (self, shard);
+
   /*
    * Always queue the request. If we need to dispatch the worker to
    * fetch the result, that will happen with another task.
    */
-  if (!(queued = g_hash_table_lookup (self->queued, key)))
+  if (!(queued = g_hash_table_lookup (shard->queued, key)))
     {
       queued = g_ptr_array_new_with_free_func (g_object_unref);
-      g_hash_table_insert (self->queued,
+      g_hash_table_insert (shard->queued,
                            self->key_copy_func ((gpointer)key),
                            queued);
     }
@@ -601,33 +1109,27 @@ dzl_task_cache_get_async (DzlTaskCache        *self,
 
   /*
    * The in_flight hashtable will have a bit set if we have queued
-   * an operation for this key.
+   * an operation for this key. Checking it while holding the lock
+   * ensures concurrent requests for a key share a single fetch.
    */
-  if (!g_hash_table_contains (self->in_flight, key))
-    {
-      g_autoptr(GCancellable) fetch_cancellable = NULL;
-
-      fetch_cancellable = g_cancellable_new ();
-      fetch_task = g_task_new (self,
-                               fetch_cancellable,
-                               dzl_task_cache_fetch_cb,
-                               self->key_copy_func ((gpointer)key));
-      g_hash_table_insert (self->in_flight,
-                           self->key_copy_func ((gpointer)key),
-                           g_object_ref (fetch_task));
-    }
+  if (!g_hash_table_contains (shard->in_flight, key))
+    fetch_task = cache_shard_begin_fetch (self, shard, key);
 
+  cache_shard_unlock (self, shard);
+
+  /*
+   * Connecting may call dzl_task_cache_cancelled_cb() immediately, which
+   * only schedules an idle, so it must happen without the lock held.
+   */
   if (cancellable != NULL)
     {
       cancelled_id = g_cancellable_connect (cancellable,
                                             G_CALLBACK (dzl_task_cache_cancelled_cb),
                                             task,
                                             NULL);
+      data->cancelled_id = cancelled_id;
     }
 
-  data = cancelled_data_new (self, cancellable, key, cancelled_id);
-  g_task_set_task_data (task, data, cancelled_data_free);
-
   if (fetch_task != NULL)
     {
       self->populate_callback (self,
@@ -662,24 +1164,37 @@ static gboolean
 dzl_task_cache_do_eviction (gpointer user_data)
 {
   DzlTaskCache *self = user_data;
+  g_autoptr(GPtrArray) evicted = g_ptr_array_new_with_free_func (cache_item_free);
   gint64 now = g_get_monotonic_time ();
 
-  while (self->evict_heap->len > 0)
+  for (guint i = 0; i < self->n_shards; i++)
     {
-      CacheItem *item;
+      CacheShard *shard = &self->shards [i];
 
-      item = dzl_heap_peek (self->evict_heap, gpointer);
+      cache_shard_lock (self, shard);
 
-      if (item->evict_at <= now)
+      while (shard->evict_heap->len > 0)
         {
-          dzl_heap_extract (self->evict_heap, NULL);
-          dzl_task_cache_evict_full (self, item->key, FALSE);
-          continue;
+          CacheItem *item;
+
+          item = dzl_heap_peek (shard->evict_heap, gpointer);
+
+          if (item->evict_at <= now)
+            {
+              g_ptr_array_add (evicted, cache_shard_steal (shard, item->key));
+              dzl_task_cache_count (self, STAT_EXPIRATIONS, 1);
+              continue;
+            }
+
+          break;
         }
 
-      break;
+      cache_shard_unlock (self, shard);
     }
 
+  if (evicted->len > 0)
+    g_debug ("Evicted %u items from %s", evicted->len, self->name ?: "unnamed cache");
+
   return G_SOURCE_CONTINUE;
 }
 
@@ -699,7 +1214,7 @@ dzl_task_cache_install_evict_source (DzlTaskCache *self)
   g_source_set_ready_time (source, -1);
 
   evict_source = (EvictSource *)source;
-  evict_source->heap = dzl_heap_ref (self->evict_heap);
+  evict_source->self = self;
 
   self->evict_source = source;
   self->evict_source_id = g_source_attach (source, main_context);
@@ -732,35 +1247,54 @@ dzl_task_cache_constructed (GObject *object)
   if (self->value_destroy_func == NULL)
     self->value_destroy_func = dzl_task_cache_dummy_destroy_func;
 
-  /*
-   * This is where the cached result objects live.
-   */
-  self->cache = g_hash_table_new_full (self->key_hash_func,
-                                       self->key_equal_func,
-                                       NULL,
-                                       cache_item_free);
+  if (self->value_cost_func == NULL)
+    self->value_cost_func = dzl_task_cache_dummy_cost_func;
 
-  /*
-   * This is where we store a bit to know if we have an inflight
-   * request for this cache key.
-   */
-  self->in_flight = g_hash_table_new_full (self->key_hash_func,
-                                           self->key_equal_func,
-                                           self->key_destroy_func,
-                                           g_object_unref);
+  self->n_shards = self->thread_safe ? N_THREAD_SAFE_SHARDS : 1;
+  self->shards = g_new0 (CacheShard, self->n_shards);
+  self->shard_max_cost = MAX (1, self->max_cost / self->n_shards);
 
-  /*
-   * This is where tasks queue waiting for an in_flight callback.
-   */
-  self->queued = g_hash_table_new_full (self->key_hash_func,
-                                        self->key_equal_func,
-                                        self->key_destroy_func,
-                                        (GDestroyNotify)g_ptr_array_unref);
+  for (guint i = 0; i < self->n_shards; i++)
+    {
+      CacheShard *shard = &self->shards [i];
+
+      g_mutex_init (&shard->mutex);
+      shard->next_evict_at = -1;
+
+      /*
+       * This is where the cached result objects live. Items are freed
+       * by hand so that it can happen outside of the shard lock.
+       */
+      shard->cache = g_hash_table_new (self->key_hash_func, self->key_equal_func);
+
+      /*
+       * This is where we store a bit to know if we have an inflight
+       * request for this cache key.
+       */
+      shard->in_flight = g_hash_table_new_full (self->key_hash_func,
+                                                self->key_equal_func,
+                                                self->key_destroy_func,
+                                                g_object_unref);
+
+      /*
+       * This is where tasks queue waiting for an in_flight callback.
+       */
+      shard->queued = g_hash_table_new_full (self->key_hash_func,
+                                             self->key_equal_func,
+                                             self->key_destroy_func,
+                                             (GDestroyNotify)g_ptr_array_unref);
+
+      shard->evict_heap = dzl_heap_new_indexed (sizeof (gpointer),
+                                                cache_item_compare_evict_at,
+                                                cache_item_set_heap_index);
+
+      g_queue_init (&shard->lru);
+    }
 
   /*
    * Register our eviction source if we have a time_to_live.
    */
-  if (self->time_to_live_usec > 0)
+  if (self->time_to_live_usec > 0 || self->error_time_to_live_usec > 0)
     dzl_task_cache_install_evict_source (self);
 }
 
@@ -776,25 +1310,30 @@ dzl_task_cache_dispose (GObject *object)
       self->evict_source = NULL;
     }
 
-  g_clear_pointer (&self->evict_heap, dzl_heap_unref);
-
-  if (self->cache != NULL)
+  if (self->shards != NULL)
     {
-      gint64 count;
+      gint64 count = 0;
+
+      for (guint i = 0; i < self->n_shards; i++)
+        {
+          CacheShard *shard = &self->shards [i];
+
+          count += g_hash_table_size (shard->cache);
 
-      count = g_hash_table_size (self->cache);
-      g_clear_pointer (&self->cache, g_hash_table_unref);
+          g_hash_table_foreach (shard->cache, cache_item_free_foreach, NULL);
+          g_clear_pointer (&shard->cache, g_hash_table_unref);
+          g_clear_pointer (&shard->queued, g_hash_table_unref);
+          g_clear_pointer (&shard->in_flight, g_hash_table_unref);
+          g_clear_pointer (&shard->evict_heap, dzl_heap_unref);
+          g_mutex_clear (&shard->mutex);
+        }
+
+      g_clear_pointer (&self->shards, g_free);
 
       g_debug ("Evicted cache of %"G_GINT64_FORMAT" items from %s",
                count, self->name ?: "unnamed cache");
     }
 
-  if (self->queued != NULL)
-    g_clear_pointer (&self->queued, g_hash_table_unref);
-
-  if (self->in_flight != NULL)
-    g_clear_pointer (&self->in_flight, g_hash_table_unref);
-
   if (self->populate_callback_data)
     {
       if (self->populate_callback_data_destroy)
@@ -809,6 +1348,19 @@ dzl_task_cache_finalize (GObject *object)
 {
   DzlTaskCache *self = (DzlTaskCache *)object;
 
+#ifndef G_OS_WIN32
+  if (self->counters != NULL)
+    {
+      for (guint i = 0; i < N_STATS; i++)
+        {
+          dzl_counter_arena_unregister (dzl_counter_arena_get_default (), &self->counters [i]);
+          g_free ((gchar *)self->counters [i].name);
+        }
+
+      g_clear_pointer (&self->counters, g_free);
+    }
+#endif
+
   g_clear_pointer (&self->name, g_free);
 
   G_OBJECT_CLASS (dzl_task_cache_parent_class)->finalize (object);
@@ -824,6 +1376,10 @@ dzl_task_cache_set_property (GObject      *object,
 
   switch (prop_id)
     {
+    case PROP_ERROR_TIME_TO_LIVE:
+      self->error_time_to_live_usec = (g_value_get_int64 (value) * 1000L);
+      break;
+
     case PROP_KEY_COPY_FUNC:
       self->key_copy_func = g_value_get_pointer (value);
       break;
@@ -840,6 +1396,10 @@ dzl_task_cache_set_property (GObject      *object,
       self->key_hash_func = g_value_get_pointer (value);
       break;
 
+    case PROP_MAX_COST:
+      self->max_cost = g_value_get_uint64 (value);
+      break;
+
     case PROP_POPULATE_CALLBACK:
       self->populate_callback = g_value_get_pointer (value);
       break;
@@ -852,6 +1412,14 @@ dzl_task_cache_set_property (GObject      *object,
       self->populate_callback_data_destroy = g_value_get_pointer (value);
       break;
 
+    case PROP_STALE_WHILE_REVALIDATE:
+      self->stale_while_revalidate_usec = (g_value_get_int64 (value) * 1000L);
+      break;
+
+    case PROP_THREAD_SAFE:
+      self->thread_safe = g_value_get_boolean (value);
+      break;
+
     case PROP_TIME_TO_LIVE:
       self->time_to_live_usec = (g_value_get_int64 (value) * 1000L);
       break;
@@ -860,6 +1428,10 @@ dzl_task_cache_set_property (GObject      *object,
       self->value_copy_func = g_value_get_pointer (value);
       break;
 
+    case PROP_VALUE_COST_FUNC:
+      self->value_cost_func = g_value_get_pointer (value);
+      break;
+
     case PROP_VALUE_DESTROY_FUNC:
       self->value_destroy_func = g_value_get_pointer (value);
       break;
@@ -879,6 +1451,28 @@ dzl_task_cache_class_init (DzlTaskCacheClass *klass)
   object_class->finalize = dzl_task_cache_finalize;
   object_class->set_property = dzl_task_cache_set_property;
 
+  /**
+   * DzlTaskCache:error-time-to-live:
+   *
+   * This is the number of milliseconds for which an error from the
+   * populate callback is cached. While cached, dzl_task_cache_get_async()
+   * completes with a copy of the error instead of populating again, which
+   * avoids hammering a failing backend. Cancellation is never cached, and
+   * an error does not replace a value that is still in the cache.
+   *
+   * A value of zero indicates errors are not cached.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_ERROR_TIME_TO_LIVE] =
+    g_param_spec_int64 ("error-time-to-live",
+                        "Error Time to Live",
+                        "The time to cache errors in milliseconds.",
+                        0,
+                        G_MAXINT64 / 1000,
+                        0,
+                        (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
   properties [PROP_KEY_HASH_FUNC] =
     g_param_spec_pointer ("key-hash-func",
                          "Key Hash Func",
@@ -903,6 +1497,30 @@ dzl_task_cache_class_init (DzlTaskCacheClass *klass)
                          "Key Destroy Func",
                          (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * DzlTaskCache:max-cost:
+   *
+   * The maximum total cost of the items in the cache, as computed by
+   * #DzlTaskCache:value-cost-func. When inserting an item pushes the cache
+   * over this limit, the least recently used items are evicted. Looking
+   * an item up with dzl_task_cache_peek(), dzl_task_cache_lookup() or
+   * dzl_task_cache_get_async() marks it as recently used.
+   *
+   * Thread-safe caches split the limit evenly between their shards.
+   *
+   * A value of zero indicates no limit.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_MAX_COST] =
+    g_param_spec_uint64 ("max-cost",
+                         "Max Cost",
+                         "The maximum total cost of the cached items",
+                         0,
+                         G_MAXUINT64,
+                         0,
+                         (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
   properties [PROP_POPULATE_CALLBACK] =
     g_param_spec_pointer ("populate-callback",
                          "Populate Callback",
@@ -921,6 +1539,53 @@ dzl_task_cache_class_init (DzlTaskCacheClass *klass)
                          "Populate Callback Data Destroy",
                          (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * DzlTaskCache:stale-while-revalidate:
+   *
+   * This is the number of milliseconds after #DzlTaskCache:time-to-live
+   * during which an expired value is still returned by
+   * dzl_task_cache_get_async(). The first such request starts a single
+   * background call to the populate callback to refresh the value, so
+   * that callers never wait on an expired item. The item is evicted once
+   * this period is over as well.
+   *
+   * If the refresh fails, the expired value is still returned and, when
+   * #DzlTaskCache:error-time-to-live is set, it is not refreshed again
+   * until that much time has passed.
+   *
+   * A value of zero indicates expired items are evicted immediately.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_STALE_WHILE_REVALIDATE] =
+    g_param_spec_int64 ("stale-while-revalidate",
+                        "Stale While Revalidate",
+                        "The time to serve expired items while refreshing them in milliseconds.",
+                        0,
+                        G_MAXINT64 / 1000,
+                        0,
+                        (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * DzlTaskCache:thread-safe:
+   *
+   * If the cache may be used from multiple threads. The keys are then
+   * split across a number of shards, each protected by its own lock, so
+   * that dzl_task_cache_lookup(), dzl_task_cache_get_async() and eviction
+   * may be used concurrently. Concurrent requests for the same key still
+   * share a single call to the populate callback.
+   *
+   * The populate callback is called from the thread requesting the key.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_THREAD_SAFE] =
+    g_param_spec_boolean ("thread-safe",
+                          "Thread Safe",
+                          "If the cache may be used from multiple threads",
+                          FALSE,
+                          (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
   /**
    * DzlTaskCache:time-to-live:
    *
@@ -944,6 +1609,21 @@ dzl_task_cache_class_init (DzlTaskCacheClass *klass)
                          "Value Copy Func",
                          (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * DzlTaskCache:value-cost-func:
+   *
+   * A #DzlTaskCacheCostFunc used to compute the cost of each value, such
+   * as its size in bytes. If unset, every value costs 1 and
+   * #DzlTaskCache:max-cost limits the number of items.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_VALUE_COST_FUNC] =
+    g_param_spec_pointer ("value-cost-func",
+                         "Value Cost Func",
+                         "Value Cost Func",
+                         (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
   properties [PROP_VALUE_DESTROY_FUNC] =
     g_param_spec_pointer ("value-destroy-func",
                          "Value Destroy Func",
@@ -956,7 +1636,6 @@ dzl_task_cache_class_init (DzlTaskCacheClass *klass)
 void
 dzl_task_cache_init (DzlTaskCache *self)
 {
-  self->evict_heap = dzl_heap_new (sizeof (gpointer), cache_item_compare_evict_at);
 }
 
 /**
@@ -1012,18 +1691,39 @@ dzl_task_cache_get_values (DzlTaskCache *self)
 
   ar = g_ptr_array_new_with_free_func (self->value_destroy_func);
 
-  g_hash_table_iter_init (&iter, self->cache);
-
-  while (g_hash_table_iter_next (&iter, NULL, &value))
+  for (guint i = 0; i < self->n_shards; i++)
     {
-      CacheItem *item = value;
+      CacheShard *shard = &self->shards [i];
+
+      cache_shard_lock (self, shard);
+
+      g_hash_table_iter_init (&iter, shard->cache);
+
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          CacheItem *item = value;
 
-      g_ptr_array_add (ar, self->value_copy_func (item->value));
+          if (item->error == NULL)
+            g_ptr_array_add (ar, self->value_copy_func (item->value));
+        }
+
+      cache_shard_unlock (self, shard);
     }
 
   return ar;
 }
 
+/**
+ * dzl_task_cache_set_name:
+ * @self: a #DzlTaskCache
+ * @name: (nullable): a name for the cache, used for debugging
+ *
+ * Sets the name of the cache. A cache with a name also keeps counters of
+ * its hits, misses, evictions, expirations and cost in the default
+ * #DzlCounterArena, such as "TaskCache" "@name Hits", for as long as the
+ * cache is alive. They are registered the first time the cache is used,
+ * so the name should be set before that.
+ */
 void
 dzl_task_cache_set_name (DzlTaskCache *self,
                          const gchar  *name)
@@ -52,6 +52,20 @@ typedef void (*DzlTaskCacheCallback) (DzlTaskCache  *self,
                                       GTask         *task,
                                       gpointer       user_data);
 
+/**
+ * DzlTaskCacheCostFunc:
+ * @value: the cached value
+ *
+ * #DzlTaskCacheCostFunc is the prototype for a function computing the
+ * cost of keeping @value in the cache, such as its size in bytes. See
+ * #DzlTaskCache:max-cost.
+ *
+ * Returns: the cost of @value
+ *
+ * Since: 3.46
+ */
+typedef gsize (*DzlTaskCacheCostFunc) (gconstpointer value);
+
 DZL_AVAILABLE_IN_ALL
 DzlTaskCache *dzl_task_cache_new        (GHashFunc              key_hash_func,
                                          GEqualFunc             key_equal_func,
@@ -85,6 +99,9 @@ void          dzl_task_cache_evict_all  (DzlTaskCache          *self);
 DZL_AVAILABLE_IN_ALL
 gpointer      dzl_task_cache_peek       (DzlTaskCache          *self,
                                          gconstpointer          key);
+DZL_AVAILABLE_IN_3_46
+gpointer      dzl_task_cache_lookup     (DzlTaskCache          *self,
+                                         gconstpointer          key);
 DZL_AVAILABLE_IN_ALL
 GPtrArray    *dzl_task_cache_get_values (DzlTaskCache          *self);
 
@@ -96,6 +96,7 @@ G_BEGIN_DECLS
 #include "search/dzl-fuzzy-index-cursor.h"
 #include "search/dzl-fuzzy-index-match.h"
 #include "search/dzl-fuzzy-mutable-index.h"
+#include "search/dzl-fuzzy-segmented-index.h"
 #include "search/dzl-levenshtein.h"
 #include "search/dzl-pattern-spec.h"
 #include "search/dzl-trie.h"
@@ -135,6 +136,8 @@ G_BEGIN_DECLS
 #include "util/dzl-cancellable.h"
 #ifndef G_OS_WIN32
 # include "util/dzl-counter.h"
+# include "util/dzl-counter-log.h"
+# include "util/dzl-counter-sampler.h"
 #endif
 #include "util/dzl-date-time.h"
 #include "util/dzl-dnd.h"
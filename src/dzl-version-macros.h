@@ -47,6 +47,7 @@
 #define DZL_VERSION_3_34 (G_ENCODE_VERSION (3, 34))
 #define DZL_VERSION_3_36 (G_ENCODE_VERSION (3, 36))
 #define DZL_VERSION_3_38 (G_ENCODE_VERSION (3, 38))
+#define DZL_VERSION_3_46 (G_ENCODE_VERSION (3, 46))
 
 #if (DZL_MINOR_VERSION == 99)
 # define DZL_VERSION_CUR_STABLE (G_ENCODE_VERSION (DZL_MAJOR_VERSION + 1, 0))
@@ -187,4 +188,10 @@
 # define DZL_AVAILABLE_IN_3_38                 _DZL_EXTERN
 #endif
 
+#if DZL_VERSION_MAX_ALLOWED < DZL_VERSION_3_46
+# define DZL_AVAILABLE_IN_3_46                 DZL_UNAVAILABLE(3, 46)
+#else
+# define DZL_AVAILABLE_IN_3_46                 _DZL_EXTERN
+#endif
+
 #endif /* DZL_VERSION_MACROS_H */
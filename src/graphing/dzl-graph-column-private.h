@@ -31,6 +31,9 @@ void  _dzl_graph_view_column_get_value  (DzlGraphColumn *self,
 void  _dzl_graph_view_column_set_value  (DzlGraphColumn *self,
                                          guint           index,
                                          const GValue   *value);
+void  _dzl_graph_view_column_set_double (DzlGraphColumn *self,
+                                         guint           index,
+                                         gdouble         value);
 void  _dzl_graph_view_column_collect    (DzlGraphColumn *self,
                                          guint           index,
                                          va_list        *args);
@@ -46,6 +49,10 @@ void  _dzl_graph_view_column_set        (DzlGraphColumn *column,
 guint _dzl_graph_view_column_push       (DzlGraphColumn *column);
 void  _dzl_graph_view_column_set_n_rows (DzlGraphColumn *column,
                                          guint           n_rows);
+guint _dzl_graph_view_column_get_last_index (DzlGraphColumn *column);
+
+const gdouble *_dzl_graph_view_column_get_doubles (DzlGraphColumn *column);
+const gint64  *_dzl_graph_view_column_get_int64s  (DzlGraphColumn *column);
 
 G_END_DECLS
 
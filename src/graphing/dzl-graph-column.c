@@ -34,8 +34,23 @@ struct _DzlGraphColumn
   gchar   *name;
   DzlRing *values;
   GType    value_type;
+
+  /*
+   * The values converted to gdouble, and to gint64 for G_TYPE_INT64
+   * columns, at the same indexes. These let renderers walk contiguous
+   * arrays instead of boxing each value in a GValue.
+   */
+  DzlRing *doubles;
+  DzlRing *int64s;
 };
 
+typedef struct
+{
+  DzlRing *values;
+  DzlRing *doubles;
+  DzlRing *int64s;
+} CopyState;
+
 G_DEFINE_TYPE (DzlGraphColumn, dzl_graph_view_column, G_TYPE_OBJECT)
 
 enum {
@@ -79,13 +94,59 @@ dzl_graph_view_column_set_name (DzlGraphColumn *self,
     }
 }
 
+static gdouble
+dzl_graph_view_column_value_to_double (const GValue *value)
+{
+  switch (G_VALUE_TYPE (value))
+    {
+    case G_TYPE_DOUBLE:
+      return g_value_get_double (value);
+
+    case G_TYPE_UINT:
+      return g_value_get_uint (value);
+
+    case G_TYPE_UINT64:
+      return g_value_get_uint64 (value);
+
+    case G_TYPE_INT:
+      return g_value_get_int (value);
+
+    case G_TYPE_INT64:
+      return g_value_get_int64 (value);
+
+    default:
+      return 0.0;
+    }
+}
+
+static void
+dzl_graph_view_column_update_numbers (DzlGraphColumn *self,
+                                      guint           index)
+{
+  const GValue *value;
+
+  g_assert (DZL_IS_GRAPH_COLUMN (self));
+  g_assert (index < self->values->len);
+
+  value = &((GValue *)(gpointer)self->values->data)[index];
+
+  ((gdouble *)(gpointer)self->doubles->data)[index] =
+    dzl_graph_view_column_value_to_double (value);
+
+  if (self->int64s != NULL)
+    ((gint64 *)(gpointer)self->int64s->data)[index] =
+      G_VALUE_TYPE (value) == G_TYPE_INT64 ? g_value_get_int64 (value) : 0;
+}
+
 static void
 dzl_graph_view_column_copy_value (gpointer data,
                                   gpointer user_data)
 {
   const GValue *src_value = data;
-  DzlRing *ring = user_data;
+  CopyState *state = user_data;
   GValue copy = G_VALUE_INIT;
+  gdouble d;
+  gint64 i64;
 
   if (G_IS_VALUE (src_value))
     {
@@ -93,28 +154,50 @@ dzl_graph_view_column_copy_value (gpointer data,
       g_value_copy (src_value, &copy);
     }
 
-  dzl_ring_append_val (ring, copy);
+  /* Append to each ring so that the values keep the same indexes */
+  dzl_ring_append_val (state->values, copy);
+
+  d = dzl_graph_view_column_value_to_double (&copy);
+  dzl_ring_append_val (state->doubles, d);
+
+  if (state->int64s != NULL)
+    {
+      i64 = G_VALUE_TYPE (&copy) == G_TYPE_INT64 ? g_value_get_int64 (&copy) : 0;
+      dzl_ring_append_val (state->int64s, i64);
+    }
 }
 
 void
 _dzl_graph_view_column_set_n_rows (DzlGraphColumn *self,
                                    guint           n_rows)
 {
-  DzlRing *ring;
+  CopyState state = { 0 };
 
   g_return_if_fail (DZL_IS_GRAPH_COLUMN (self));
   g_return_if_fail (n_rows > 0);
 
-  ring = dzl_ring_sized_new (sizeof (GValue), n_rows, NULL);
-  dzl_ring_foreach (self->values, dzl_graph_view_column_copy_value, ring);
+  state.values = dzl_ring_sized_new (sizeof (GValue), n_rows, NULL);
+  state.doubles = dzl_ring_sized_new (sizeof (gdouble), n_rows, NULL);
+  if (self->int64s != NULL)
+    state.int64s = dzl_ring_sized_new (sizeof (gint64), n_rows, NULL);
+
+  dzl_ring_foreach (self->values, dzl_graph_view_column_copy_value, &state);
+
   g_clear_pointer (&self->values, dzl_ring_unref);
-  self->values = ring;
+  g_clear_pointer (&self->doubles, dzl_ring_unref);
+  g_clear_pointer (&self->int64s, dzl_ring_unref);
+
+  self->values = state.values;
+  self->doubles = state.doubles;
+  self->int64s = state.int64s;
 }
 
 guint
 _dzl_graph_view_column_push (DzlGraphColumn *self)
 {
   GValue value = G_VALUE_INIT;
+  gdouble d = 0.0;
+  gint64 i64 = 0;
   guint ret;
 
   g_return_val_if_fail (DZL_IS_GRAPH_COLUMN (self), 0);
@@ -122,9 +205,112 @@ _dzl_graph_view_column_push (DzlGraphColumn *self)
   g_value_init (&value, self->value_type);
   ret = dzl_ring_append_val (self->values, value);
 
+  dzl_ring_append_val (self->doubles, d);
+  if (self->int64s != NULL)
+    dzl_ring_append_val (self->int64s, i64);
+
   return ret;
 }
 
+/**
+ * _dzl_graph_view_column_set_double:
+ * @self: a #DzlGraphColumn
+ * @index: the index of the row
+ * @value: the value to set
+ *
+ * Sets the value of @index from a gdouble, converted to the type of the
+ * column, which must hold numbers.
+ */
+void
+_dzl_graph_view_column_set_double (DzlGraphColumn *self,
+                                   guint           index,
+                                   gdouble         value)
+{
+  GValue *dst_value;
+
+  g_return_if_fail (DZL_IS_GRAPH_COLUMN (self));
+  g_return_if_fail (index < self->values->len);
+
+  dst_value = &((GValue *)(gpointer)self->values->data)[index];
+
+  if (!G_IS_VALUE (dst_value))
+    g_value_init (dst_value, self->value_type);
+
+  switch (self->value_type)
+    {
+    case G_TYPE_DOUBLE:
+      g_value_set_double (dst_value, value);
+      break;
+
+    case G_TYPE_UINT:
+      g_value_set_uint (dst_value, value);
+      break;
+
+    case G_TYPE_UINT64:
+      g_value_set_uint64 (dst_value, value);
+      break;
+
+    case G_TYPE_INT:
+      g_value_set_int (dst_value, value);
+      break;
+
+    case G_TYPE_INT64:
+      g_value_set_int64 (dst_value, value);
+      break;
+
+    default:
+      g_critical ("Column %s does not contain numbers", self->name);
+      return;
+    }
+
+  dzl_graph_view_column_update_numbers (self, index);
+}
+
+/**
+ * _dzl_graph_view_column_get_doubles:
+ * @self: a #DzlGraphColumn
+ *
+ * Gets the values of the column converted to gdouble, indexed like the
+ * values of the column. Values which are not numbers are 0.
+ *
+ * Returns: (transfer none): an array of the number of rows of @self
+ */
+const gdouble *
+_dzl_graph_view_column_get_doubles (DzlGraphColumn *self)
+{
+  g_return_val_if_fail (DZL_IS_GRAPH_COLUMN (self), NULL);
+
+  return (const gdouble *)(gpointer)self->doubles->data;
+}
+
+/**
+ * _dzl_graph_view_column_get_int64s:
+ * @self: a #DzlGraphColumn
+ *
+ * Like _dzl_graph_view_column_get_doubles(), for G_TYPE_INT64 columns.
+ *
+ * Returns: (transfer none) (nullable): an array of the number of rows of
+ *   @self, or %NULL if @self does not contain G_TYPE_INT64 values.
+ */
+const gint64 *
+_dzl_graph_view_column_get_int64s (DzlGraphColumn *self)
+{
+  g_return_val_if_fail (DZL_IS_GRAPH_COLUMN (self), NULL);
+
+  if (self->int64s == NULL)
+    return NULL;
+
+  return (const gint64 *)(gpointer)self->int64s->data;
+}
+
+guint
+_dzl_graph_view_column_get_last_index (DzlGraphColumn *self)
+{
+  g_return_val_if_fail (DZL_IS_GRAPH_COLUMN (self), 0);
+
+  return (self->values->pos + self->values->len - 1) % self->values->len;
+}
+
 void
 _dzl_graph_view_column_get_value (DzlGraphColumn *self,
                                   guint           index,
@@ -162,6 +348,8 @@ _dzl_graph_view_column_set_value (DzlGraphColumn *self,
 
   g_value_init (dst_value, G_VALUE_TYPE (value));
   g_value_copy (value, dst_value);
+
+  dzl_graph_view_column_update_numbers (self, index);
 }
 
 void
@@ -184,6 +372,8 @@ _dzl_graph_view_column_collect (DzlGraphColumn *self,
       g_critical ("%s", errmsg);
       g_free (errmsg);
     }
+
+  dzl_graph_view_column_update_numbers (self, index);
 }
 
 void
@@ -249,10 +439,25 @@ dzl_graph_view_column_finalize (GObject *object)
 
   g_clear_pointer (&self->name, g_free);
   g_clear_pointer (&self->values, dzl_ring_unref);
+  g_clear_pointer (&self->doubles, dzl_ring_unref);
+  g_clear_pointer (&self->int64s, dzl_ring_unref);
 
   G_OBJECT_CLASS (dzl_graph_view_column_parent_class)->finalize (object);
 }
 
+static void
+dzl_graph_view_column_constructed (GObject *object)
+{
+  DzlGraphColumn *self = (DzlGraphColumn *)object;
+
+  self->doubles = dzl_ring_sized_new (sizeof (gdouble), self->values->len, NULL);
+
+  if (self->value_type == G_TYPE_INT64)
+    self->int64s = dzl_ring_sized_new (sizeof (gint64), self->values->len, NULL);
+
+  G_OBJECT_CLASS (dzl_graph_view_column_parent_class)->constructed (object);
+}
+
 static void
 dzl_graph_view_column_get_property (GObject    *object,
                                     guint       prop_id,
@@ -304,6 +509,7 @@ dzl_graph_view_column_class_init (DzlGraphColumnClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->constructed = dzl_graph_view_column_constructed;
   object_class->finalize = dzl_graph_view_column_finalize;
   object_class->get_property = dzl_graph_view_column_get_property;
   object_class->set_property = dzl_graph_view_column_set_property;
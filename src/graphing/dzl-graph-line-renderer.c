@@ -24,13 +24,19 @@
 
 #include "dzl-graph-line-renderer.h"
 
+#define DECIMATE_THRESHOLD 2
+
 struct _DzlGraphLineRenderer
 {
   GObject parent_instance;
 
-  GdkRGBA stroke_color;
-  gdouble line_width;
-  guint   column;
+  GdkRGBA  stroke_color;
+  gdouble  line_width;
+  guint    column;
+
+  /* Coordinates of the samples, reused between renders */
+  gdouble *points;
+  guint    n_points;
 };
 
 static void dzl_graph_view_line_renderer_init_renderer (DzlGraphRendererInterface *iface);
@@ -56,65 +62,28 @@ dzl_graph_view_line_renderer_new (void)
   return g_object_new (DZL_TYPE_GRAPH_LINE_RENDERER, NULL);
 }
 
-static gdouble
-calc_x (DzlGraphModelIter *iter,
-        gint64       begin,
-        gint64       end,
-        guint        width)
-{
-  gint64 timestamp;
-
-  timestamp = dzl_graph_view_model_iter_get_timestamp (iter);
-
-  g_assert_cmpint (timestamp, !=, 0);
-
-  return ((timestamp - begin) / (gdouble)(end - begin) * width);
-}
-
-static gdouble
-calc_y (DzlGraphModelIter *iter,
-        gdouble      range_begin,
-        gdouble      range_end,
-        guint        height,
-        guint        column)
+/*
+ * Converts the samples of @span to coordinates within the area. This is
+ * kept free of branches and calls so that the compiler can vectorize it.
+ */
+static void
+calc_points (const DzlGraphModelSpan *span,
+             gdouble                 *xs,
+             gdouble                 *ys,
+             gint64                   begin,
+             gdouble                  x_scale,
+             gdouble                  range_begin,
+             gdouble                  y_scale,
+             gdouble                  height)
 {
-  GValue value = G_VALUE_INIT;
-  gdouble y;
+  const gint64 *timestamps = span->timestamps;
+  const gdouble *values = span->values;
 
-  dzl_graph_view_model_iter_get_value (iter, column, &value);
-
-  switch (G_VALUE_TYPE (&value))
+  for (guint i = 0; i < span->n_values; i++)
     {
-    case G_TYPE_DOUBLE:
-      y = g_value_get_double (&value);
-      break;
-
-    case G_TYPE_UINT:
-      y = g_value_get_uint (&value);
-      break;
-
-    case G_TYPE_UINT64:
-      y = g_value_get_uint64 (&value);
-      break;
-
-    case G_TYPE_INT:
-      y = g_value_get_int (&value);
-      break;
-
-    case G_TYPE_INT64:
-      y = g_value_get_int64 (&value);
-      break;
-
-    default:
-      y = 0.0;
-      break;
+      xs[i] = (timestamps[i] - begin) * x_scale;
+      ys[i] = height - ((values[i] - range_begin) * y_scale);
     }
-
-  y -= range_begin;
-  y /= (range_end - range_begin);
-  y = height - (y * height);
-
-  return y;
 }
 
 static void
@@ -128,46 +97,85 @@ dzl_graph_view_line_renderer_render (DzlGraphRenderer                  *renderer
                          const cairo_rectangle_int_t *area)
 {
   DzlGraphLineRenderer *self = (DzlGraphLineRenderer *)renderer;
-  DzlGraphModelIter iter;
+  DzlGraphModelSpan spans[2];
+  guint n_spans;
 
   g_assert (DZL_IS_GRAPH_LINE_RENDERER (self));
 
   cairo_save (cr);
 
-  if (dzl_graph_view_model_get_iter_first (table, &iter))
+  if (self->column < dzl_graph_view_model_get_n_columns (table) &&
+      (n_spans = dzl_graph_view_model_get_spans (table, self->column, spans)) > 0)
     {
       guint max_samples;
+      guint n_points = 0;
+      gboolean decimated = FALSE;
       gdouble chunk;
-      gdouble last_x;
-      gdouble last_y;
+      gdouble x_scale;
+      gdouble y_scale;
+      gdouble *xs;
+      gdouble *ys;
 
       max_samples = dzl_graph_view_model_get_max_samples (table);
 
       chunk = area->width / (gdouble)(max_samples - 1) / 2.0;
+      x_scale = area->width / (gdouble)(x_end - x_begin);
+      y_scale = area->height / (y_end - y_begin);
+
+      for (guint i = 0; i < n_spans; i++)
+        n_points += spans[i].n_values;
+
+      /*
+       * With more samples than pixels, most curves would be drawn within a
+       * single pixel. Draw the lowest and highest samples of each pixel
+       * instead, which looks the same and bounds the cost to the width.
+       */
+      if (n_points > (guint)MAX (area->width, 1) * DECIMATE_THRESHOLD)
+        {
+          const gint64 *timestamps;
+          const gdouble *values;
+
+          n_points = dzl_graph_view_model_get_decimated (table, self->column,
+                                                         x_begin, x_end,
+                                                         MAX (area->width, 1),
+                                                         &timestamps, &values);
+          spans[0].timestamps = timestamps;
+          spans[0].values = values;
+          spans[0].n_values = n_points;
+          n_spans = 1;
+          decimated = TRUE;
+        }
+
+      if (self->n_points < n_points)
+        {
+          self->points = g_renew (gdouble, self->points, n_points * 2);
+          self->n_points = n_points;
+        }
 
-      last_x = calc_x (&iter, x_begin, x_end, area->width);
-      last_y = calc_y (&iter, y_begin, y_end, area->height, self->column);
+      xs = self->points;
+      ys = self->points + n_points;
 
-      cairo_move_to (cr, last_x, last_y);
+      for (guint i = 0, offset = 0; i < n_spans; offset += spans[i].n_values, i++)
+        calc_points (&spans[i], &xs[offset], &ys[offset],
+                     x_begin, x_scale, y_begin, y_scale, area->height);
 
-      while (dzl_graph_view_model_iter_next (&iter))
+      cairo_move_to (cr, xs[0], ys[0]);
+
+      if (decimated)
+        {
+          for (guint i = 1; i < n_points; i++)
+            cairo_line_to (cr, xs[i], ys[i]);
+        }
+      else
         {
-          gdouble x;
-          gdouble y;
-
-          x = calc_x (&iter, x_begin, x_end, area->width);
-          y = calc_y (&iter, y_begin, y_end, area->height, self->column);
-
-          cairo_curve_to (cr,
-                          last_x + chunk,
-                          last_y,
-                          last_x + chunk,
-                          y,
-                          x,
-                          y);
-
-          last_x = x;
-          last_y = y;
+          for (guint i = 1; i < n_points; i++)
+            cairo_curve_to (cr,
+                            xs[i - 1] + chunk,
+                            ys[i - 1],
+                            xs[i - 1] + chunk,
+                            ys[i],
+                            xs[i],
+                            ys[i]);
         }
     }
 
@@ -240,11 +248,22 @@ dzl_graph_view_line_renderer_set_property (GObject      *object,
     }
 }
 
+static void
+dzl_graph_view_line_renderer_finalize (GObject *object)
+{
+  DzlGraphLineRenderer *self = (DzlGraphLineRenderer *)object;
+
+  g_clear_pointer (&self->points, g_free);
+
+  G_OBJECT_CLASS (dzl_graph_view_line_renderer_parent_class)->finalize (object);
+}
+
 static void
 dzl_graph_view_line_renderer_class_init (DzlGraphLineRendererClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->finalize = dzl_graph_view_line_renderer_finalize;
   object_class->get_property = dzl_graph_view_line_renderer_get_property;
   object_class->set_property = dzl_graph_view_line_renderer_set_property;
 
@@ -21,22 +21,90 @@
 #define G_LOG_DOMAIN "dzl-graph-model"
 
 #include <glib/gi18n.h>
+#include <string.h>
 
 #include "graphing/dzl-graph-column-private.h"
 #include "graphing/dzl-graph-model.h"
 #include "util/dzl-macros.h"
+#include "util/dzl-ring.h"
+
+#define MAX_BUCKET_GAP 4
+#define PENDING_SIZE   1024
+
+/*
+ * A value queued by dzl_graph_view_model_push_concurrent(). The values of
+ * a sample are queued together, the first one starting the sample.
+ */
+typedef struct
+{
+  gint64  timestamp;
+  gdouble value;
+  guint   column;
+  guint   first : 1;
+} PendingValue;
+
+typedef struct
+{
+  guint64 sample;
+  gint64  timestamp;
+  gdouble value;
+} Point;
+
+/* The first, lowest, highest and last samples within a bucket */
+typedef struct
+{
+  Point first;
+  Point min;
+  Point max;
+  Point last;
+} Bucket;
+
+/*
+ * The samples of a column reduced to buckets of a fixed duration. Buckets
+ * are aligned to multiples of the duration, so they stay valid as the
+ * visible range moves with new samples. Every sample but the newest, which
+ * may still be set, is added to the buckets once.
+ */
+typedef struct
+{
+  GArray  *buckets;
+  gint64   base;
+  gint64   width;
+  guint    n_buckets;
+  guint    generation;
+  guint64  next_sample;
+  GArray  *timestamps;
+  GArray  *values;
+} Decimation;
 
 typedef struct
 {
   GPtrArray       *columns;
   DzlGraphColumn  *timestamps;
 
+  /* Decimation of each column, created as needed */
+  GPtrArray       *decimations;
+
   guint            last_index;
 
+  /* Number of samples ever pushed */
+  guint64          n_pushed;
+  /* Changed when samples other than the last one are modified */
+  guint            generation;
+
   guint            max_samples;
   GTimeSpan        timespan;
   gdouble          value_max;
   gdouble          value_min;
+
+  /*
+   * Values pushed from other threads, created on first use. They are
+   * drained into the model from main_context, the context the model
+   * was created in.
+   */
+  DzlRing         *pending;
+  GMainContext    *main_context;
+  volatile gint    drain_queued;
 } DzlGraphModelPrivate;
 
 typedef struct
@@ -186,6 +254,8 @@ dzl_graph_view_model_set_max_samples (DzlGraphModel *self,
   _dzl_graph_view_column_set_n_rows (priv->timestamps, max_samples);
 
   priv->max_samples = max_samples;
+  priv->last_index = _dzl_graph_view_column_get_last_index (priv->timestamps);
+  priv->generation++;
 
   g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_MAX_SAMPLES]);
 }
@@ -226,10 +296,115 @@ dzl_graph_view_model_push (DzlGraphModel     *self,
   impl->index = pos;
 
   priv->last_index = pos;
+  priv->n_pushed++;
 
   g_signal_emit (self, signals [CHANGED], 0);
 }
 
+static gboolean
+dzl_graph_view_model_drain_cb (gpointer data)
+{
+  DzlGraphModel *self = data;
+  DzlGraphModelPrivate *priv = dzl_graph_view_model_get_instance_private (self);
+  guint n;
+
+  g_assert (DZL_IS_GRAPH_MODEL (self));
+
+  /* Values pushed from now on queue another drain */
+  g_atomic_int_set (&priv->drain_queued, FALSE);
+
+  /* The drained values are the last n of the ring */
+  while ((n = dzl_ring_drain (priv->pending)) > 0)
+    {
+      for (guint i = 0; i < n; i++)
+        {
+          const PendingValue *pv = &dzl_ring_get_index (priv->pending, PendingValue, (gint)i - (gint)n);
+
+          if (pv->first)
+            {
+              DzlGraphModelIter iter;
+
+              dzl_graph_view_model_push (self, &iter, pv->timestamp);
+            }
+
+          if (pv->column < priv->columns->len)
+            _dzl_graph_view_column_set_double (g_ptr_array_index (priv->columns, pv->column),
+                                               priv->last_index,
+                                               pv->value);
+        }
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * dzl_graph_view_model_push_concurrent:
+ * @self: a #DzlGraphModel
+ * @timestamp: the time of the new sample
+ * @values: (array length=n_values) (nullable): the values of the first
+ *   @n_values columns
+ * @n_values: the number of values
+ *
+ * Queues a new sample, like dzl_graph_view_model_push() followed by
+ * setting the first @n_values columns, which must contain numbers.
+ *
+ * Unlike those, this may be called from any thread without locking, such
+ * as a thread collecting the samples. The caller must own a reference to
+ * @self. The samples are added from the main context that was the thread
+ * default when @self was created, in the order they were queued, so they
+ * should not be mixed with dzl_graph_view_model_push().
+ *
+ * Up to about a thousand values may be waiting to be added. If the main
+ * context falls behind, the sample is dropped and %FALSE is returned.
+ *
+ * Returns: %TRUE if the sample was queued.
+ *
+ * Since: 3.46
+ */
+gboolean
+dzl_graph_view_model_push_concurrent (DzlGraphModel *self,
+                                      gint64         timestamp,
+                                      const gdouble *values,
+                                      guint          n_values)
+{
+  DzlGraphModelPrivate *priv = dzl_graph_view_model_get_instance_private (self);
+  PendingValue *pending;
+  guint n;
+
+  g_return_val_if_fail (DZL_IS_GRAPH_MODEL (self), FALSE);
+  g_return_val_if_fail (timestamp > 0, FALSE);
+  g_return_val_if_fail (values != NULL || n_values == 0, FALSE);
+  g_return_val_if_fail (n_values <= PENDING_SIZE, FALSE);
+
+  if (g_once_init_enter (&priv->pending))
+    g_once_init_leave (&priv->pending,
+                       dzl_ring_sized_new_concurrent (sizeof (PendingValue), PENDING_SIZE, PENDING_SIZE, NULL));
+
+  /* A sample without values still takes a slot to be pushed */
+  n = MAX (1, n_values);
+  pending = g_newa (PendingValue, n);
+
+  for (guint i = 0; i < n; i++)
+    {
+      pending[i].timestamp = timestamp;
+      pending[i].value = i < n_values ? values[i] : 0.0;
+      pending[i].column = i < n_values ? i : G_MAXUINT;
+      pending[i].first = (i == 0);
+    }
+
+  if (!dzl_ring_push_vals (priv->pending, pending, n))
+    return FALSE;
+
+  if (g_atomic_int_compare_and_exchange (&priv->drain_queued, FALSE, TRUE))
+    g_main_context_invoke_full (priv->main_context,
+                                G_PRIORITY_DEFAULT,
+                                dzl_graph_view_model_drain_cb,
+                                g_object_ref (self),
+                                g_object_unref);
+
+  return TRUE;
+}
+
 gboolean
 dzl_graph_view_model_get_iter_last (DzlGraphModel     *self,
                                     DzlGraphModelIter *iter)
@@ -293,6 +468,385 @@ dzl_graph_view_model_get_iter_first (DzlGraphModel     *self,
   return (impl->timestamp != 0);
 }
 
+/**
+ * dzl_graph_view_model_get_spans:
+ * @self: a #DzlGraphModel
+ * @column: the column to get values from
+ * @spans: (out caller-allocates) (array fixed-size=2): location for the spans
+ *
+ * Gets the samples of @self as arrays of timestamps and of the values of
+ * @column, converted to gdouble. Since samples are stored in a ring, they
+ * may be split in two spans, which are in chronological order.
+ *
+ * This avoids copying each value into a #GValue, and is meant for
+ * renderers which need to visit every sample. The arrays are only valid
+ * until the model is changed.
+ *
+ * Returns: the number of spans set, from 0 to 2
+ *
+ * Since: 3.46
+ */
+guint
+dzl_graph_view_model_get_spans (DzlGraphModel     *self,
+                                guint              column,
+                                DzlGraphModelSpan *spans)
+{
+  DzlGraphModelPrivate *priv = dzl_graph_view_model_get_instance_private (self);
+  const gint64 *timestamps;
+  const gdouble *values;
+  guint first;
+  guint last;
+
+  g_return_val_if_fail (DZL_IS_GRAPH_MODEL (self), 0);
+  g_return_val_if_fail (column < priv->columns->len, 0);
+  g_return_val_if_fail (spans != NULL, 0);
+
+  timestamps = _dzl_graph_view_column_get_int64s (priv->timestamps);
+  values = _dzl_graph_view_column_get_doubles (g_ptr_array_index (priv->columns, column));
+  last = priv->last_index;
+
+  if (timestamps[last] == 0)
+    return 0;
+
+  /* Like dzl_graph_view_model_get_iter_first(), we may not have wrapped */
+  first = (last + 1) % priv->max_samples;
+  if (timestamps[first] == 0)
+    first = 0;
+
+  spans[0].timestamps = &timestamps[first];
+  spans[0].values = &values[first];
+
+  if (first <= last)
+    {
+      spans[0].n_values = last - first + 1;
+      return 1;
+    }
+
+  spans[0].n_values = priv->max_samples - first;
+
+  spans[1].timestamps = timestamps;
+  spans[1].values = values;
+  spans[1].n_values = last + 1;
+
+  return 2;
+}
+
+static Decimation *
+decimation_new (void)
+{
+  Decimation *dec;
+
+  dec = g_slice_new0 (Decimation);
+  dec->buckets = g_array_new (FALSE, TRUE, sizeof (Bucket));
+  dec->timestamps = g_array_new (FALSE, FALSE, sizeof (gint64));
+  dec->values = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  return dec;
+}
+
+static void
+decimation_free (gpointer data)
+{
+  Decimation *dec = data;
+
+  if (dec != NULL)
+    {
+      g_clear_pointer (&dec->buckets, g_array_unref);
+      g_clear_pointer (&dec->timestamps, g_array_unref);
+      g_clear_pointer (&dec->values, g_array_unref);
+      g_slice_free (Decimation, dec);
+    }
+}
+
+static void
+bucket_add (Bucket      *bucket,
+            const Point *point)
+{
+  /* Timestamps are positive, so this is an empty bucket */
+  if (bucket->first.timestamp == 0)
+    {
+      bucket->first = bucket->min = bucket->max = bucket->last = *point;
+      return;
+    }
+
+  if (point->value < bucket->min.value)
+    bucket->min = *point;
+
+  if (point->value > bucket->max.value)
+    bucket->max = *point;
+
+  bucket->last = *point;
+}
+
+static void
+decimation_add (Decimation  *dec,
+                const Point *point)
+{
+  gint64 index = point->timestamp / dec->width;
+  gint64 last = dec->base + (gint64)dec->buckets->len - 1;
+
+  if (dec->buckets->len == 0 || index - last > (gint64)dec->n_buckets * MAX_BUCKET_GAP)
+    {
+      /* Nothing before this would be visible with it */
+      g_array_set_size (dec->buckets, 0);
+      dec->base = last = index;
+    }
+  else if (index < last)
+    {
+      /* Timestamps should not go backwards, keep the order of samples */
+      index = last;
+    }
+
+  if (index - dec->base >= (gint64)dec->buckets->len)
+    g_array_set_size (dec->buckets, index - dec->base + 1);
+
+  bucket_add (&g_array_index (dec->buckets, Bucket, index - dec->base), point);
+}
+
+static void
+decimation_emit (Decimation  *dec,
+                 const Point *point,
+                 guint64     *last_sample)
+{
+  if (dec->timestamps->len > 0 && point->sample == *last_sample)
+    return;
+
+  g_array_append_val (dec->timestamps, point->timestamp);
+  g_array_append_val (dec->values, point->value);
+  *last_sample = point->sample;
+}
+
+static void
+decimation_emit_bucket (Decimation   *dec,
+                        const Bucket *bucket,
+                        guint64      *last_sample)
+{
+  if (bucket->first.timestamp == 0)
+    return;
+
+  decimation_emit (dec, &bucket->first, last_sample);
+
+  if (bucket->min.sample < bucket->max.sample)
+    {
+      decimation_emit (dec, &bucket->min, last_sample);
+      decimation_emit (dec, &bucket->max, last_sample);
+    }
+  else
+    {
+      decimation_emit (dec, &bucket->max, last_sample);
+      decimation_emit (dec, &bucket->min, last_sample);
+    }
+
+  decimation_emit (dec, &bucket->last, last_sample);
+}
+
+/*
+ * Calls @func for the samples from @first_sample to @end_sample, which
+ * must be within @spans. @oldest is the number of the first sample of
+ * @spans. Stops early if @func returns %FALSE.
+ */
+static void
+spans_foreach (const DzlGraphModelSpan *spans,
+               guint                    n_spans,
+               guint64                  oldest,
+               guint64                  first_sample,
+               guint64                  end_sample,
+               gboolean               (*func) (Decimation *, const Point *),
+               Decimation              *dec)
+{
+  guint64 sample = oldest;
+
+  for (guint i = 0; i < n_spans; i++)
+    {
+      for (guint j = 0; j < spans[i].n_values; j++, sample++)
+        {
+          Point point;
+
+          if (sample < first_sample)
+            continue;
+
+          if (sample >= end_sample)
+            return;
+
+          point.sample = sample;
+          point.timestamp = spans[i].timestamps[j];
+          point.value = spans[i].values[j];
+
+          if (!func (dec, &point))
+            return;
+        }
+    }
+}
+
+static gboolean
+decimation_add_cb (Decimation  *dec,
+                   const Point *point)
+{
+  decimation_add (dec, point);
+  return TRUE;
+}
+
+static gboolean
+decimation_add_to_base_cb (Decimation  *dec,
+                           const Point *point)
+{
+  gint64 index = point->timestamp / dec->width;
+
+  if (index > dec->base)
+    return FALSE;
+
+  if (index == dec->base)
+    bucket_add (&g_array_index (dec->buckets, Bucket, 0), point);
+
+  return TRUE;
+}
+
+/**
+ * dzl_graph_view_model_get_decimated:
+ * @self: a #DzlGraphModel
+ * @column: the column to get values from
+ * @begin: the beginning of the visible range
+ * @end: the end of the visible range
+ * @n_buckets: the number of buckets, such as the width in pixels
+ * @timestamps: (out) (transfer none) (array length=return): location for
+ *   the timestamps of the samples
+ * @values: (out) (transfer none) (array length=return): location for the
+ *   values of the samples
+ *
+ * Gets a reduced set of the samples of @column, which draws like all of
+ * the samples when each bucket is no larger than a pixel.
+ *
+ * The range from @begin to @end is split into @n_buckets buckets of time,
+ * and only the first, lowest, highest and last samples of each bucket are
+ * kept (the M4 algorithm). A sample before @begin is kept so that a line
+ * can enter the range.
+ *
+ * The buckets are kept between calls and only the samples pushed since
+ * are added to them, so repeatedly getting the samples of a moving range
+ * costs about @n_buckets rather than the number of samples.
+ *
+ * The arrays are only valid until the next call or until the model is
+ * changed.
+ *
+ * Returns: the number of samples, at most about four times @n_buckets
+ *
+ * Since: 3.46
+ */
+guint
+dzl_graph_view_model_get_decimated (DzlGraphModel  *self,
+                                    guint           column,
+                                    gint64          begin,
+                                    gint64          end,
+                                    guint           n_buckets,
+                                    const gint64  **timestamps,
+                                    const gdouble **values)
+{
+  DzlGraphModelPrivate *priv = dzl_graph_view_model_get_instance_private (self);
+  DzlGraphModelSpan spans[2];
+  Decimation *dec;
+  Point newest;
+  guint64 oldest;
+  guint64 last_sample = 0;
+  gint64 first_index;
+  gint64 width;
+  guint n_spans;
+  guint n_samples = 0;
+
+  g_return_val_if_fail (DZL_IS_GRAPH_MODEL (self), 0);
+  g_return_val_if_fail (column < priv->columns->len, 0);
+  g_return_val_if_fail (begin < end, 0);
+  g_return_val_if_fail (n_buckets > 0, 0);
+  g_return_val_if_fail (timestamps != NULL, 0);
+  g_return_val_if_fail (values != NULL, 0);
+
+  if (!(n_spans = dzl_graph_view_model_get_spans (self, column, spans)))
+    return 0;
+
+  for (guint i = 0; i < n_spans; i++)
+    n_samples += spans[i].n_values;
+
+  oldest = priv->n_pushed - n_samples;
+  width = MAX (1, (end - begin + n_buckets - 1) / n_buckets);
+
+  if (priv->decimations->len <= column)
+    g_ptr_array_set_size (priv->decimations, priv->columns->len);
+
+  if (!(dec = g_ptr_array_index (priv->decimations, column)))
+    g_ptr_array_index (priv->decimations, column) = dec = decimation_new ();
+
+  /* Start over if the buckets changed or samples were missed */
+  if (dec->width != width ||
+      dec->n_buckets != n_buckets ||
+      dec->generation != priv->generation ||
+      dec->next_sample < oldest)
+    {
+      g_array_set_size (dec->buckets, 0);
+      dec->width = width;
+      dec->n_buckets = n_buckets;
+      dec->generation = priv->generation;
+      dec->next_sample = oldest;
+    }
+
+  /* Add the samples pushed since, except the newest which may change */
+  spans_foreach (spans, n_spans, oldest, dec->next_sample, priv->n_pushed - 1,
+                 decimation_add_cb, dec);
+  dec->next_sample = priv->n_pushed - 1;
+
+  /* Drop the buckets before the range, keeping one to enter it */
+  first_index = MAX (begin / width - 1, spans[0].timestamps[0] / width);
+
+  if (dec->buckets->len > 0 && first_index > dec->base)
+    {
+      guint n_drop = MIN (first_index - dec->base, dec->buckets->len);
+
+      g_array_remove_range (dec->buckets, 0, n_drop);
+      dec->base += n_drop;
+    }
+
+  /* The first bucket may still contain samples dropped from the ring */
+  if (dec->buckets->len > 0 &&
+      g_array_index (dec->buckets, Bucket, 0).first.timestamp != 0 &&
+      g_array_index (dec->buckets, Bucket, 0).first.sample < oldest)
+    {
+      memset (&g_array_index (dec->buckets, Bucket, 0), 0, sizeof (Bucket));
+      spans_foreach (spans, n_spans, oldest, oldest, dec->next_sample,
+                     decimation_add_to_base_cb, dec);
+    }
+
+  newest.sample = priv->n_pushed - 1;
+  newest.timestamp = spans[n_spans - 1].timestamps[spans[n_spans - 1].n_values - 1];
+  newest.value = spans[n_spans - 1].values[spans[n_spans - 1].n_values - 1];
+
+  g_array_set_size (dec->timestamps, 0);
+  g_array_set_size (dec->values, 0);
+
+  for (guint i = 0; i < dec->buckets->len; i++)
+    {
+      const Bucket *bucket = &g_array_index (dec->buckets, Bucket, i);
+
+      /* Add the newest sample to a copy of the last bucket */
+      if (i == dec->buckets->len - 1 &&
+          newest.timestamp / width <= dec->base + i)
+        {
+          Bucket copy = *bucket;
+
+          bucket_add (&copy, &newest);
+          decimation_emit_bucket (dec, &copy, &last_sample);
+          goto finish;
+        }
+
+      decimation_emit_bucket (dec, bucket, &last_sample);
+    }
+
+  decimation_emit (dec, &newest, &last_sample);
+
+finish:
+  *timestamps = (const gint64 *)(gpointer)dec->timestamps->data;
+  *values = (const gdouble *)(gpointer)dec->values->data;
+
+  return dec->timestamps->len;
+}
+
 gboolean
 dzl_graph_view_model_iter_next (DzlGraphModelIter *iter)
 {
@@ -354,6 +908,10 @@ dzl_graph_view_model_iter_set (DzlGraphModelIter *iter,
 
   priv = dzl_graph_view_model_get_instance_private (impl->table);
 
+  /* Decimations assume that only the last sample changes */
+  if (impl->index != priv->last_index)
+    priv->generation++;
+
   va_start (args, first_column);
 
   while (column_id >= 0)
@@ -470,6 +1028,9 @@ dzl_graph_view_model_iter_set_value (DzlGraphModelIter *iter,
 
   g_assert (col != NULL);
 
+  if (impl->index != priv->last_index)
+    priv->generation++;
+
   _dzl_graph_view_column_set_value (col, impl->index, value);
 }
 
@@ -480,6 +1041,9 @@ dzl_graph_view_model_finalize (GObject *object)
   DzlGraphModelPrivate *priv = dzl_graph_view_model_get_instance_private (self);
 
   g_clear_pointer (&priv->columns, g_ptr_array_unref);
+  g_clear_pointer (&priv->decimations, g_ptr_array_unref);
+  g_clear_pointer (&priv->pending, dzl_ring_unref);
+  g_clear_pointer (&priv->main_context, g_main_context_unref);
   g_clear_object (&priv->timestamps);
 
   G_OBJECT_CLASS (dzl_graph_view_model_parent_class)->finalize (object);
@@ -613,7 +1177,10 @@ dzl_graph_view_model_init (DzlGraphModel *self)
   priv->value_max = 100.0;
 
   priv->columns = g_ptr_array_new_with_free_func (g_object_unref);
+  priv->decimations = g_ptr_array_new_with_free_func (decimation_free);
 
   priv->timestamps = dzl_graph_view_column_new (NULL, G_TYPE_INT64);
   _dzl_graph_view_column_set_n_rows (priv->timestamps, priv->max_samples);
+
+  priv->main_context = g_main_context_ref_thread_default ();
 }
@@ -42,6 +42,23 @@ typedef struct
   gpointer data[8];
 } DzlGraphModelIter;
 
+/**
+ * DzlGraphModelSpan:
+ * @timestamps: the timestamps of the samples
+ * @values: the values of a column for the samples
+ * @n_values: the number of samples
+ *
+ * A run of contiguous samples, see dzl_graph_view_model_get_spans().
+ *
+ * Since: 3.46
+ */
+typedef struct
+{
+  const gint64  *timestamps;
+  const gdouble *values;
+  guint          n_values;
+} DzlGraphModelSpan;
+
 DZL_AVAILABLE_IN_ALL
 DzlGraphModel *dzl_graph_view_model_new                (void);
 DZL_AVAILABLE_IN_ALL
@@ -65,6 +82,11 @@ DZL_AVAILABLE_IN_ALL
 void           dzl_graph_view_model_push               (DzlGraphModel     *self,
                                                         DzlGraphModelIter *iter,
                                                         gint64             timestamp);
+DZL_AVAILABLE_IN_3_46
+gboolean       dzl_graph_view_model_push_concurrent    (DzlGraphModel     *self,
+                                                        gint64             timestamp,
+                                                        const gdouble     *values,
+                                                        guint              n_values);
 DZL_AVAILABLE_IN_ALL
 gboolean       dzl_graph_view_model_get_iter_first     (DzlGraphModel     *self,
                                                         DzlGraphModelIter *iter);
@@ -73,6 +95,18 @@ gboolean       dzl_graph_view_model_get_iter_last      (DzlGraphModel     *self,
                                                         DzlGraphModelIter *iter);
 DZL_AVAILABLE_IN_ALL
 gboolean       dzl_graph_view_model_iter_next          (DzlGraphModelIter *iter);
+DZL_AVAILABLE_IN_3_46
+guint          dzl_graph_view_model_get_spans          (DzlGraphModel     *self,
+                                                        guint              column,
+                                                        DzlGraphModelSpan *spans);
+DZL_AVAILABLE_IN_3_46
+guint          dzl_graph_view_model_get_decimated      (DzlGraphModel     *self,
+                                                        guint              column,
+                                                        gint64             begin,
+                                                        gint64             end,
+                                                        guint              n_buckets,
+                                                        const gint64     **timestamps,
+                                                        const gdouble    **values);
 DZL_AVAILABLE_IN_ALL
 void           dzl_graph_view_model_iter_get           (DzlGraphModelIter *iter,
                                                         gint               first_column,
@@ -16,8 +16,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#define G_LOG_DOMAIN    "dzl-fuzzy-index-builder"
-#define MAX_KEY_ENTRIES (0x00FFFFFF)
+#define G_LOG_DOMAIN          "dzl-fuzzy-index-builder"
+#define MAX_KEY_ENTRIES       (0x00FFFFFF)
+#define ALIGN_UP(n,a)         (((n) + (a) - 1) & ~((guint64)(a) - 1))
+#define MIN_RUN_ITEMS         (4096)
+#define MIN_MERGE_ITEMS       (256)
+#define MAX_MERGE_FAN_IN      (16)
+#define MAX_SPILL_WRITE_ITEMS (1024)
+#define WRITE_BUFFER_SIZE     (64 * 1024)
 
 #include "config.h"
 
@@ -25,6 +31,8 @@
 #include <string.h>
 
 #include "search/dzl-fuzzy-index-builder.h"
+#include "search/dzl-fuzzy-index-private.h"
+#include "util/dzl-heap.h"
 #include "util/dzl-macros.h"
 #include "util/dzl-variant.h"
 
@@ -34,6 +42,26 @@ struct _DzlFuzzyIndexBuilder
 
   guint         case_sensitive : 1;
 
+  /*
+   * The on-disk format to write. Version 1 is a single GVariant while
+   * version 2 places the tables in aligned arrays after a directory so
+   * that they may be used directly from the mapped file.
+   */
+  guint         format_version;
+
+  /*
+   * If set, version 2 tables are delta encoded in blocks rather than
+   * stored as raw (position, lookaside_id) pairs.
+   */
+  guint         compress_tables : 1;
+
+  /*
+   * If non-zero, the number of bytes the version 2 tables may use while
+   * building. Sorted runs are spilled to temporary files and merged when
+   * writing instead of building every table in memory.
+   */
+  guint64       memory_budget;
+
   /*
    * This hash table contains a mapping of GVariants so that we
    * deduplicate insertions of the same document. This helps when
@@ -120,6 +148,9 @@ G_DEFINE_TYPE (DzlFuzzyIndexBuilder, dzl_fuzzy_index_builder, G_TYPE_OBJECT)
 enum {
   PROP_0,
   PROP_CASE_SENSITIVE,
+  PROP_COMPRESS_TABLES,
+  PROP_FORMAT_VERSION,
+  PROP_MEMORY_BUDGET,
   N_PROPS
 };
 
@@ -161,6 +192,18 @@ dzl_fuzzy_index_builder_get_property (GObject    *object,
       g_value_set_boolean (value, dzl_fuzzy_index_builder_get_case_sensitive (self));
       break;
 
+    case PROP_COMPRESS_TABLES:
+      g_value_set_boolean (value, dzl_fuzzy_index_builder_get_compress_tables (self));
+      break;
+
+    case PROP_FORMAT_VERSION:
+      g_value_set_uint (value, dzl_fuzzy_index_builder_get_format_version (self));
+      break;
+
+    case PROP_MEMORY_BUDGET:
+      g_value_set_uint64 (value, dzl_fuzzy_index_builder_get_memory_budget (self));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -180,6 +223,18 @@ dzl_fuzzy_index_builder_set_property (GObject      *object,
       dzl_fuzzy_index_builder_set_case_sensitive (self, g_value_get_boolean (value));
       break;
 
+    case PROP_COMPRESS_TABLES:
+      dzl_fuzzy_index_builder_set_compress_tables (self, g_value_get_boolean (value));
+      break;
+
+    case PROP_FORMAT_VERSION:
+      dzl_fuzzy_index_builder_set_format_version (self, g_value_get_uint (value));
+      break;
+
+    case PROP_MEMORY_BUDGET:
+      dzl_fuzzy_index_builder_set_memory_budget (self, g_value_get_uint64 (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -201,6 +256,68 @@ dzl_fuzzy_index_builder_class_init (DzlFuzzyIndexBuilderClass *klass)
                           FALSE,
                           (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * DzlFuzzyIndexBuilder:compress-tables:
+   *
+   * If set, the per-character tables are compressed, which usually makes
+   * the index several times smaller at a small cost when querying. This
+   * is only supported by #DzlFuzzyIndexBuilder:format-version 2 and is
+   * ignored for version 1.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_COMPRESS_TABLES] =
+    g_param_spec_boolean ("compress-tables",
+                          "Compress Tables",
+                          "If the character tables should be compressed",
+                          FALSE,
+                          (G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * DzlFuzzyIndexBuilder:format-version:
+   *
+   * The version of the file format to write. Version 2 indexes can be
+   * searched without copying the tables out of the mapped file but
+   * cannot be loaded by older versions of the library.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_FORMAT_VERSION] =
+    g_param_spec_uint ("format-version",
+                       "Format Version",
+                       "The version of the file format to write",
+                       1, 2, 1,
+                       (G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * DzlFuzzyIndexBuilder:memory-budget:
+   *
+   * The approximate number of bytes that may be used for the character
+   * tables while writing a #DzlFuzzyIndexBuilder:format-version 2 index.
+   *
+   * When set, the tables are sorted in parallel in runs that are spilled
+   * to temporary files and merged into the index as it is written. Runs
+   * are merged a few at a time, so only a bounded number of temporary
+   * files is open at once. This keeps peak memory usage bounded for very
+   * large indexes. The keys and documents are still held in memory.
+   *
+   * Very small budgets are honored but produce many temporary files.
+   *
+   * If zero, the default, the tables are built in memory.
+   *
+   * Version 1 indexes store the tables inside a single GVariant, which has
+   * to be built in memory. Writing a version 1 index with a memory budget
+   * fails with %G_IO_ERROR_NOT_SUPPORTED.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_MEMORY_BUDGET] =
+    g_param_spec_uint64 ("memory-budget",
+                         "Memory Budget",
+                         "The number of bytes to use for tables while writing",
+                         0, G_MAXUINT64, 0,
+                         (G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
@@ -213,6 +330,7 @@ dzl_fuzzy_index_builder_init (DzlFuzzyIndexBuilder *self)
   self->strings = g_string_chunk_new (4096);
   self->key_ids = g_hash_table_new (NULL, NULL);
   self->keys = g_ptr_array_new ();
+  self->format_version = 1;
 }
 
 DzlFuzzyIndexBuilder *
@@ -317,14 +435,22 @@ pos_doc_pair_compare (gconstpointer a,
 {
   const IndexItem *paira = a;
   const IndexItem *pairb = b;
-  gint ret;
-
-  ret = paira->lookaside_id - pairb->lookaside_id;
 
-  if (ret == 0)
-    ret = paira->position - pairb->position;
-
-  return ret;
+  /*
+   * The priority lives in the high bits of the lookaside_id, so we can't
+   * subtract to compare without overflowing. Readers rely on the tables
+   * being sorted as unsigned integers.
+   */
+  if (paira->lookaside_id < pairb->lookaside_id)
+    return -1;
+  else if (paira->lookaside_id > pairb->lookaside_id)
+    return 1;
+  else if (paira->position < pairb->position)
+    return -1;
+  else if (paira->position > pairb->position)
+    return 1;
+
+  return 0;
 }
 
 static GVariant *
@@ -347,13 +473,19 @@ dzl_fuzzy_index_builder_build_lookaside (DzlFuzzyIndexBuilder *self)
                                     sizeof (KVPair));
 }
 
-static GVariant *
-dzl_fuzzy_index_builder_build_index (DzlFuzzyIndexBuilder *self)
+static void
+sort_row (gpointer data,
+          gpointer user_data)
 {
-  g_autoptr(GHashTable) rows = NULL;
-  GVariantDict dict;
+  g_array_sort (data, pos_doc_pair_compare);
+}
+
+static GHashTable *
+dzl_fuzzy_index_builder_build_rows (DzlFuzzyIndexBuilder *self)
+{
+  GHashTable *rows;
+  GThreadPool *pool;
   GHashTableIter iter;
-  gpointer keyptr;
   GArray *row;
   guint i;
 
@@ -399,6 +531,30 @@ dzl_fuzzy_index_builder_build_index (DzlFuzzyIndexBuilder *self)
         }
     }
 
+  /* Sort the rows in parallel, waiting for them to complete */
+  pool = g_thread_pool_new (sort_row, NULL, g_get_num_processors (), FALSE, NULL);
+
+  g_hash_table_iter_init (&iter, rows);
+
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&row))
+    g_thread_pool_push (pool, row, NULL);
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  return rows;
+}
+
+static GVariant *
+dzl_fuzzy_index_builder_build_index (DzlFuzzyIndexBuilder *self,
+                                     GHashTable           *rows)
+{
+  GVariantDict dict;
+  GHashTableIter iter;
+  gpointer keyptr;
+  GArray *row;
+
+  g_assert (DZL_IS_FUZZY_INDEX_BUILDER (self));
+
   g_variant_dict_init (&dict, NULL);
 
   g_hash_table_iter_init (&iter, rows);
@@ -411,8 +567,6 @@ dzl_fuzzy_index_builder_build_index (DzlFuzzyIndexBuilder *self)
 
       key [g_unichar_to_utf8 (ch, key)] = 0;
 
-      g_array_sort (row, pos_doc_pair_compare);
-
       variant = g_variant_new_fixed_array ((const GVariantType *)"(uu)",
                                            row->data,
                                            row->len,
@@ -448,211 +602,1299 @@ dzl_fuzzy_index_builder_build_metadata (DzlFuzzyIndexBuilder *self)
   return g_variant_dict_end (&dict);
 }
 
-static void
-dzl_fuzzy_index_builder_write_worker (GTask        *task,
-                                      gpointer      source_object,
-                                      gpointer      task_data,
-                                      GCancellable *cancellable)
+typedef struct
 {
-  DzlFuzzyIndexBuilder *self = source_object;
-  g_autoptr(GVariant) variant = NULL;
-  g_autoptr(GVariant) documents = NULL;
-  g_autoptr(GError) error = NULL;
-  GVariantDict dict;
-  GFile *file = task_data;
+  guint32 codepoint;
+  guint32 lookaside_id;
+  guint32 position;
+} TableItem;
+
+/*
+ * Yields the items of every table in (codepoint, lookaside_id, position)
+ * order. Returns %FALSE when there are no more items or @error is set.
+ */
+typedef gboolean (*TableItemFunc) (gpointer    user_data,
+                                   TableItem  *item,
+                                   GError    **error);
 
-  g_assert (G_IS_TASK (task));
-  g_assert (DZL_IS_FUZZY_INDEX_BUILDER (self));
-  g_assert (G_IS_FILE (file));
-  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+typedef struct
+{
+  GOutputStream *stream;
+  GByteArray    *buffer;
+  guint64        pos;
+} IndexWriter;
 
-  g_variant_dict_init (&dict, NULL);
+typedef struct
+{
+  IndexWriter             *writer;
+  DzlFuzzyIndexTableEntry *entry;
+  GArray                  *blocks;
+  GByteArray              *scratch;
+  guint64                  data_offset;
+  guint64                  n_written;
+  TableItem                last;
+} TableWriter;
 
-  /* Set our version number for the document */
-  g_variant_dict_insert (&dict, "version", "i", 1);
+typedef struct
+{
+  GHashTable   *rows;
+  const GArray *directory;
+  const GArray *row;
+  guint         index;
+  guint         pos;
+} RowsIter;
 
-  /* Build our dicitionary of metadata */
-  g_variant_dict_insert_value (&dict,
-                               "metadata",
-                               dzl_fuzzy_index_builder_build_metadata (self));
+typedef struct
+{
+  /* The temporary file, or %NULL for a slice of the spill buffer */
+  GFile        *file;
+  guint64       n_items;
+
+  /* The read buffer while merging */
+  GInputStream *stream;
+  TableItem    *buffer;
+  gsize         buffer_size;
+  gsize         len;
+  gsize         pos;
+  guint64       n_read;
+} SortedRun;
 
-  /* Keys is an array of string keys where the index is the "key_id" */
-  g_variant_dict_insert_value (&dict,
-                               "keys",
-                               dzl_fuzzy_index_builder_build_keys (self));
+typedef struct
+{
+  DzlHeap      *heap;
+  GCancellable *cancellable;
+} RunMerger;
 
-  /* The lookaside is a mapping of kvpair to the repsective keys and
-   * documents. This allows the tables to use the kvpair id as the value
-   * in the index so we can have both document deduplication as well as
-   * the ability to disambiguate the keys which point to the same
-   * document. The contents are "a{uu}".
-   */
-  g_variant_dict_insert_value (&dict,
-                               "lookaside",
-                               dzl_fuzzy_index_builder_build_lookaside (self));
+static gint
+table_item_compare (gconstpointer a,
+                    gconstpointer b)
+{
+  const TableItem *itema = a;
+  const TableItem *itemb = b;
 
-  /* Build our dicitionary of character → [(pos,lookaside_id),..] tuples.
-   * The position is the utf8 character position within the string.
-   * The lookaside_id is the index within the lookaside buffer to locate
-   * the document_id or key_id.
-   */
-  g_variant_dict_insert_value (&dict,
-                               "tables",
-                               dzl_fuzzy_index_builder_build_index (self));
+  if (itema->codepoint != itemb->codepoint)
+    return itema->codepoint < itemb->codepoint ? -1 : 1;
+  else if (itema->lookaside_id != itemb->lookaside_id)
+    return itema->lookaside_id < itemb->lookaside_id ? -1 : 1;
+  else if (itema->position != itemb->position)
+    return itema->position < itemb->position ? -1 : 1;
 
-  /*
-   * The documents are stored as an array where the document identifier is
-   * their index position. We then use a lookaside buffer to map the insertion
-   * id to the document id. Otherwise, we can't disambiguate between two
-   * keys that insert the same document (as we deduplicate documents inserted
-   * into the index).
-   */
-  documents = g_variant_new_array (NULL,
-                                   (GVariant * const *)self->documents->pdata,
-                                   self->documents->len);
-  g_variant_dict_insert_value (&dict, "documents", g_variant_ref_sink (documents));
+  return 0;
+}
 
-  /* Now write the variant to disk */
-  variant = g_variant_ref_sink (g_variant_dict_end (&dict));
-  if (!g_file_replace_contents (file,
-                                g_variant_get_data (variant),
-                                g_variant_get_size (variant),
-                                NULL,
-                                FALSE,
-                                G_FILE_CREATE_NONE,
-                                NULL,
-                                cancellable,
-                                &error))
-    g_task_return_error (task, g_steal_pointer (&error));
-  else
-    g_task_return_boolean (task, TRUE);
+static gint
+directory_entry_compare (gconstpointer a,
+                         gconstpointer b)
+{
+  const DzlFuzzyIndexTableEntry *entrya = a;
+  const DzlFuzzyIndexTableEntry *entryb = b;
+
+  return entrya->codepoint < entryb->codepoint ? -1 : entrya->codepoint > entryb->codepoint ? 1 : 0;
 }
 
-/**
- * dzl_fuzzy_index_builder_write_async:
- * @self: A #DzlFuzzyIndexBuilder
- * @file: A #GFile to write the index to
- * @io_priority: The priority for IO operations
- * @cancellable: (nullable): An optional #GCancellable or %NULL
- * @callback: A callback for completion or %NULL
- * @user_data: User data for @callback
- *
- * Builds and writes the index to @file. The file format is a
- * GVariant on disk and can be loaded and searched using
- * #FuzzyIndex.
+/*
+ * Creates the table directory, sorted by codepoint, from a hashtable of
+ * codepoint to number of items. The offsets are filled in while writing.
  */
-void
-dzl_fuzzy_index_builder_write_async (DzlFuzzyIndexBuilder *self,
-                                     GFile                *file,
-                                     gint                  io_priority,
-                                     GCancellable         *cancellable,
-                                     GAsyncReadyCallback   callback,
-                                     gpointer              user_data)
+static GArray *
+directory_new (GHashTable *counts)
 {
-  g_autoptr(GTask) task = NULL;
+  GArray *directory;
+  GHashTableIter iter;
+  gpointer key, value;
 
-  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
-  g_return_if_fail (G_IS_FILE (file));
-  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+  directory = g_array_sized_new (FALSE, TRUE, sizeof (DzlFuzzyIndexTableEntry),
+                                 g_hash_table_size (counts));
 
-  task = g_task_new (self, cancellable, callback, user_data);
-  g_task_set_source_tag (task, dzl_fuzzy_index_builder_write_async);
-  g_task_set_priority (task, io_priority);
-  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
-  g_task_run_in_thread (task, dzl_fuzzy_index_builder_write_worker);
+  g_hash_table_iter_init (&iter, counts);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      DzlFuzzyIndexTableEntry entry = { 0 };
+
+      entry.codepoint = GPOINTER_TO_UINT (key);
+      entry.n_elements = GPOINTER_TO_UINT (value);
+
+      g_array_append_val (directory, entry);
+    }
+
+  g_array_sort (directory, directory_entry_compare);
+
+  return directory;
 }
 
-gboolean
-dzl_fuzzy_index_builder_write_finish (DzlFuzzyIndexBuilder  *self,
-                                      GAsyncResult          *result,
-                                      GError               **error)
+static gboolean
+index_writer_flush (IndexWriter   *writer,
+                    GCancellable  *cancellable,
+                    GError       **error)
 {
-  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), FALSE);
-  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+  if (writer->buffer->len > 0 &&
+      !g_output_stream_write_all (writer->stream,
+                                  writer->buffer->data,
+                                  writer->buffer->len,
+                                  NULL, cancellable, error))
+    return FALSE;
 
-  return g_task_propagate_boolean (G_TASK (result), error);
+  g_byte_array_set_size (writer->buffer, 0);
+
+  return TRUE;
 }
 
-gboolean
-dzl_fuzzy_index_builder_write (DzlFuzzyIndexBuilder  *self,
-                               GFile                 *file,
-                               gint                   io_priority,
-                               GCancellable          *cancellable,
-                               GError               **error)
+static gboolean
+index_writer_write (IndexWriter   *writer,
+                    gconstpointer  data,
+                    gsize          len,
+                    GCancellable  *cancellable,
+                    GError       **error)
 {
-  g_autoptr(GTask) task = NULL;
+  g_byte_array_append (writer->buffer, data, len);
+  writer->pos += len;
 
-  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), FALSE);
-  g_return_val_if_fail (G_IS_FILE (file), FALSE);
-  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+  if (writer->buffer->len >= WRITE_BUFFER_SIZE)
+    return index_writer_flush (writer, cancellable, error);
 
-  task = g_task_new (self, cancellable, NULL, NULL);
-  g_task_set_source_tag (task, dzl_fuzzy_index_builder_write);
-  g_task_set_priority (task, io_priority);
-  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+  return TRUE;
+}
 
-  dzl_fuzzy_index_builder_write_worker (task, self, file, cancellable);
+static gboolean
+index_writer_pad (IndexWriter   *writer,
+                  guint64        offset,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+  static const guint8 zeroes [DZL_FUZZY_INDEX_ALIGNMENT];
 
-  return g_task_propagate_boolean (task, error);
+  g_assert (writer->pos <= offset);
+
+  while (writer->pos < offset)
+    {
+      gsize len = MIN (sizeof zeroes, offset - writer->pos);
+
+      if (!index_writer_write (writer, zeroes, len, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
 }
 
-/**
- * dzl_fuzzy_index_builder_get_document:
- *
- * Returns the document that was inserted in a previous call to
- * dzl_fuzzy_index_builder_insert().
- *
- * Returns: (transfer none): A #GVariant
+/*
+ * Overwrites space reserved earlier in the file without changing the
+ * position of @writer.
  */
-const GVariant *
-dzl_fuzzy_index_builder_get_document (DzlFuzzyIndexBuilder *self,
-                                      guint64               document_id)
+static gboolean
+index_writer_write_at (IndexWriter   *writer,
+                       guint64        offset,
+                       gconstpointer  data,
+                       gsize          len,
+                       GCancellable  *cancellable,
+                       GError       **error)
 {
-  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), NULL);
-  g_return_val_if_fail ((guint)document_id < self->documents->len, NULL);
+  g_assert (offset + len <= writer->pos);
 
-  return g_ptr_array_index (self->documents, (guint)document_id);
+  return index_writer_flush (writer, cancellable, error) &&
+         g_seekable_seek (G_SEEKABLE (writer->stream), offset, G_SEEK_SET, cancellable, error) &&
+         g_output_stream_write_all (writer->stream, data, len, NULL, cancellable, error) &&
+         g_seekable_seek (G_SEEKABLE (writer->stream), writer->pos, G_SEEK_SET, cancellable, error);
 }
 
-void
-dzl_fuzzy_index_builder_set_metadata (DzlFuzzyIndexBuilder *self,
-                                      const gchar          *key,
-                                      GVariant             *value)
+static void
+append_varint (GByteArray *bytes,
+               guint       value)
 {
-  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
-  g_return_if_fail (key != NULL);
+  guint8 buf[5];
+  guint len = 0;
 
-  if (self->metadata == NULL)
-    self->metadata = g_hash_table_new_full (g_str_hash,
-                                            g_str_equal,
-                                            g_free,
-                                            (GDestroyNotify)g_variant_unref);
+  do
+    {
+      buf [len] = value & 0x7F;
+      value >>= 7;
+      if (value != 0)
+        buf [len] |= 0x80;
+      len++;
+    }
+  while (value != 0);
 
-  if (value != NULL)
-    g_hash_table_insert (self->metadata,
-                         g_strdup (key),
-                         g_variant_ref_sink (value));
-  else
-    g_hash_table_remove (self->metadata, key);
+  g_byte_array_append (bytes, buf, len);
 }
 
-void
-dzl_fuzzy_index_builder_set_metadata_string (DzlFuzzyIndexBuilder *self,
-                                             const gchar          *key,
-                                             const gchar          *value)
+static gboolean
+table_writer_begin (TableWriter              *tw,
+                    DzlFuzzyIndexTableEntry  *entry,
+                    gboolean                  compress,
+                    GCancellable             *cancellable,
+                    GError                  **error)
 {
-  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
-  g_return_if_fail (key != NULL);
-  g_return_if_fail (value != NULL);
+  if (!index_writer_pad (tw->writer, ALIGN_UP (tw->writer->pos, DZL_FUZZY_INDEX_ALIGNMENT), cancellable, error))
+    return FALSE;
 
-  dzl_fuzzy_index_builder_set_metadata (self, key, g_variant_new_string (value));
-}
+  tw->entry = entry;
+  tw->n_written = 0;
 
-void
-dzl_fuzzy_index_builder_set_metadata_uint32 (DzlFuzzyIndexBuilder *self,
-                                             const gchar          *key,
-                                             guint32               value)
-{
+  entry->offset = tw->writer->pos;
+  entry->flags = compress ? DZL_FUZZY_INDEX_TABLE_COMPRESSED : 0;
+
+  g_array_set_size (tw->blocks, 0);
+
+  if (compress)
+    {
+      guint64 n_blocks = (entry->n_elements + DZL_FUZZY_INDEX_BLOCK_SIZE - 1) / DZL_FUZZY_INDEX_BLOCK_SIZE;
+
+      /* Reserve room for the blocks, which are written once we know them */
+      if (!index_writer_pad (tw->writer,
+                             entry->offset + (n_blocks + 1) * sizeof (DzlFuzzyIndexBlock),
+                             cancellable, error))
+        return FALSE;
+
+      tw->data_offset = tw->writer->pos;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Compressed tables are encoded as described for
+ * DZL_FUZZY_INDEX_TABLE_COMPRESSED. Since tables are sorted by
+ * lookaside_id, the deltas are tiny and most items fit in two or
+ * three bytes instead of eight.
+ */
+static gboolean
+table_writer_add (TableWriter      *tw,
+                  const TableItem  *item,
+                  GCancellable     *cancellable,
+                  GError          **error)
+{
+  gboolean ret;
+
+  g_assert (tw->entry != NULL);
+  g_assert (tw->entry->codepoint == item->codepoint);
+
+  if (tw->entry->flags & DZL_FUZZY_INDEX_TABLE_COMPRESSED)
+    {
+      gboolean first = (tw->n_written % DZL_FUZZY_INDEX_BLOCK_SIZE) == 0;
+      guint delta = first ? 0 : item->lookaside_id - tw->last.lookaside_id;
+
+      if (first)
+        {
+          DzlFuzzyIndexBlock block;
+
+          block.first_lookaside_id = item->lookaside_id;
+          block.offset = tw->writer->pos - tw->data_offset;
+
+          g_array_append_val (tw->blocks, block);
+        }
+
+      g_byte_array_set_size (tw->scratch, 0);
+      append_varint (tw->scratch, delta);
+
+      if (!first && delta == 0)
+        append_varint (tw->scratch, item->position - tw->last.position);
+      else
+        append_varint (tw->scratch, item->position);
+
+      ret = index_writer_write (tw->writer, tw->scratch->data, tw->scratch->len, cancellable, error);
+    }
+  else
+    {
+      IndexItem raw = { item->position, item->lookaside_id };
+
+      ret = index_writer_write (tw->writer, &raw, sizeof raw, cancellable, error);
+    }
+
+  tw->last = *item;
+  tw->n_written++;
+
+  return ret;
+}
+
+static gboolean
+table_writer_finish (TableWriter   *tw,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+  DzlFuzzyIndexBlock sentinel;
+
+  g_assert (tw->entry != NULL);
+  g_assert (tw->n_written == tw->entry->n_elements);
+
+  if (!(tw->entry->flags & DZL_FUZZY_INDEX_TABLE_COMPRESSED))
+    return TRUE;
+
+  sentinel.first_lookaside_id = G_MAXUINT32;
+  sentinel.offset = tw->writer->pos - tw->data_offset;
+  g_array_append_val (tw->blocks, sentinel);
+
+  return index_writer_write_at (tw->writer,
+                                tw->entry->offset,
+                                tw->blocks->data,
+                                tw->blocks->len * sizeof (DzlFuzzyIndexBlock),
+                                cancellable,
+                                error);
+}
+
+/*
+ * Writes the version 2 format. The file starts with a DzlFuzzyIndexHeader
+ * followed by the table directory sorted by codepoint. Each table is
+ * placed at a DZL_FUZZY_INDEX_ALIGNMENT boundary so that the index can
+ * use it straight from the mapped file. The remaining data is stored as
+ * a GVariant at the end of the file.
+ *
+ * The tables are streamed from @next, so the header and directory are
+ * written last once the table offsets are known. @stream must be
+ * seekable.
+ */
+static gboolean
+dzl_fuzzy_index_builder_write_v2_stream (DzlFuzzyIndexBuilder  *self,
+                                         GOutputStream         *stream,
+                                         GArray                *directory,
+                                         TableItemFunc          next,
+                                         gpointer               next_data,
+                                         GVariant              *variant,
+                                         GCancellable          *cancellable,
+                                         GError               **error)
+{
+  g_autoptr(GByteArray) buffer = NULL;
+  g_autoptr(GByteArray) scratch = NULL;
+  g_autoptr(GArray) blocks = NULL;
+  DzlFuzzyIndexHeader header = {{ 0 }};
+  IndexWriter writer = { 0 };
+  TableWriter tw = { 0 };
+  GError *local_error = NULL;
+  TableItem item;
+  guint n_tables = 0;
+
+  g_assert (DZL_IS_FUZZY_INDEX_BUILDER (self));
+  g_assert (G_IS_OUTPUT_STREAM (stream));
+  g_assert (g_seekable_can_seek (G_SEEKABLE (stream)));
+  g_assert (directory != NULL);
+  g_assert (next != NULL);
+  g_assert (variant != NULL);
+
+  buffer = g_byte_array_sized_new (WRITE_BUFFER_SIZE);
+  scratch = g_byte_array_new ();
+  blocks = g_array_new (FALSE, FALSE, sizeof (DzlFuzzyIndexBlock));
+
+  writer.stream = stream;
+  writer.buffer = buffer;
+
+  tw.writer = &writer;
+  tw.blocks = blocks;
+  tw.scratch = scratch;
+
+  header.directory_offset = sizeof header;
+  header.n_directory = directory->len;
+
+  if (!index_writer_pad (&writer,
+                         header.directory_offset + directory->len * sizeof (DzlFuzzyIndexTableEntry),
+                         cancellable, error))
+    return FALSE;
+
+  while (next (next_data, &item, &local_error))
+    {
+      if (tw.entry == NULL || tw.entry->codepoint != item.codepoint)
+        {
+          if (tw.entry != NULL && !table_writer_finish (&tw, cancellable, error))
+            return FALSE;
+
+          g_assert (n_tables < directory->len);
+
+          if (!table_writer_begin (&tw,
+                                   &g_array_index (directory, DzlFuzzyIndexTableEntry, n_tables++),
+                                   self->compress_tables,
+                                   cancellable, error))
+            return FALSE;
+        }
+
+      if (!table_writer_add (&tw, &item, cancellable, error))
+        return FALSE;
+    }
+
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+
+  if (tw.entry != NULL && !table_writer_finish (&tw, cancellable, error))
+    return FALSE;
+
+  g_assert (n_tables == directory->len);
+
+  memcpy (header.magic, DZL_FUZZY_INDEX_MAGIC, sizeof header.magic);
+  header.version = 2;
+  header.byte_order = G_BYTE_ORDER;
+  header.variant_offset = ALIGN_UP (writer.pos, 8);
+  header.variant_size = g_variant_get_size (variant);
+
+  return index_writer_pad (&writer, header.variant_offset, cancellable, error) &&
+         index_writer_write (&writer,
+                             g_variant_get_data (variant),
+                             g_variant_get_size (variant),
+                             cancellable, error) &&
+         index_writer_write_at (&writer, 0, &header, sizeof header, cancellable, error) &&
+         index_writer_write_at (&writer,
+                                header.directory_offset,
+                                directory->data,
+                                directory->len * sizeof (DzlFuzzyIndexTableEntry),
+                                cancellable, error) &&
+         index_writer_flush (&writer, cancellable, error);
+}
+
+static gboolean
+dzl_fuzzy_index_builder_write_v2 (DzlFuzzyIndexBuilder  *self,
+                                  GFile                 *file,
+                                  GArray                *directory,
+                                  TableItemFunc          next,
+                                  gpointer               next_data,
+                                  GVariant              *variant,
+                                  GCancellable          *cancellable,
+                                  GError               **error)
+{
+  g_autoptr(GFileOutputStream) stream = NULL;
+  g_autoptr(GOutputStream) memory = NULL;
+  g_autoptr(GCancellable) abandon = NULL;
+  GOutputStream *target;
+  gboolean existed;
+
+  g_assert (DZL_IS_FUZZY_INDEX_BUILDER (self));
+  g_assert (G_IS_FILE (file));
+
+  existed = g_file_query_exists (file, NULL);
+  stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, cancellable, error);
+
+  if (stream == NULL)
+    return FALSE;
+
+  /*
+   * The header, directory and compressed table blocks are written once the
+   * data following them is known, which requires seeking back. Some GVfs
+   * backends cannot seek, so build the file in memory for those and copy
+   * it out at the end.
+   */
+  target = G_OUTPUT_STREAM (stream);
+
+  if (!g_seekable_can_seek (G_SEEKABLE (stream)))
+    target = memory = g_memory_output_stream_new_resizable ();
+
+  if (dzl_fuzzy_index_builder_write_v2_stream (self, target,
+                                               directory, next, next_data, variant,
+                                               cancellable, error) &&
+      (memory == NULL ||
+       (g_output_stream_close (memory, cancellable, error) &&
+        g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+                                   g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (memory)),
+                                   g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (memory)),
+                                   NULL, cancellable, error))) &&
+      g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable, error))
+    return TRUE;
+
+  /*
+   * Closing the stream is what replaces @file, and disposing it would
+   * close it for us. Close it with a cancelled cancellable instead, which
+   * abandons the replacement and leaves the previous index in place.
+   */
+  abandon = g_cancellable_new ();
+  g_cancellable_cancel (abandon);
+  g_output_stream_close (G_OUTPUT_STREAM (stream), abandon, NULL);
+
+  /* Without a previous index, the data was written to @file directly */
+  if (!existed)
+    g_file_delete (file, NULL, NULL);
+
+  return FALSE;
+}
+
+static gboolean
+rows_iter_next (gpointer    user_data,
+                TableItem  *item,
+                GError    **error)
+{
+  RowsIter *iter = user_data;
+
+  while (iter->index < iter->directory->len)
+    {
+      const DzlFuzzyIndexTableEntry *entry;
+
+      entry = &g_array_index (iter->directory, DzlFuzzyIndexTableEntry, iter->index);
+
+      if (iter->row == NULL)
+        iter->row = g_hash_table_lookup (iter->rows, GUINT_TO_POINTER (entry->codepoint));
+
+      if (iter->pos < iter->row->len)
+        {
+          const IndexItem *row_item = &g_array_index (iter->row, IndexItem, iter->pos++);
+
+          item->codepoint = entry->codepoint;
+          item->lookaside_id = row_item->lookaside_id;
+          item->position = row_item->position;
+
+          return TRUE;
+        }
+
+      iter->index++;
+      iter->row = NULL;
+      iter->pos = 0;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+dzl_fuzzy_index_builder_write_rows (DzlFuzzyIndexBuilder  *self,
+                                    GFile                 *file,
+                                    GHashTable            *rows,
+                                    GVariant              *variant,
+                                    GCancellable          *cancellable,
+                                    GError               **error)
+{
+  g_autoptr(GHashTable) counts = NULL;
+  g_autoptr(GArray) directory = NULL;
+  RowsIter iter = { 0 };
+  GHashTableIter hiter;
+  gpointer key;
+  GArray *row;
+
+  counts = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_iter_init (&hiter, rows);
+
+  while (g_hash_table_iter_next (&hiter, &key, (gpointer *)&row))
+    g_hash_table_insert (counts, key, GUINT_TO_POINTER (row->len));
+
+  directory = directory_new (counts);
+
+  iter.rows = rows;
+  iter.directory = directory;
+
+  return dzl_fuzzy_index_builder_write_v2 (self, file, directory,
+                                           rows_iter_next, &iter,
+                                           variant, cancellable, error);
+}
+
+static void
+sorted_run_free (SortedRun *run)
+{
+  if (run == NULL)
+    return;
+
+  g_clear_object (&run->stream);
+
+  if (run->file != NULL)
+    g_file_delete (run->file, NULL, NULL);
+
+  g_clear_object (&run->file);
+  g_free (run->buffer);
+  g_free (run);
+}
+
+static gboolean
+sorted_run_fill (SortedRun     *run,
+                 GCancellable  *cancellable,
+                 GError       **error)
+{
+  gsize n_items = MIN (run->buffer_size, run->n_items - run->n_read);
+  gsize n_read = 0;
+
+  run->pos = 0;
+  run->len = 0;
+
+  if (n_items == 0)
+    return TRUE;
+
+  if (!g_input_stream_read_all (run->stream, run->buffer, n_items * sizeof (TableItem), &n_read, cancellable, error))
+    return FALSE;
+
+  if (n_read != n_items * sizeof (TableItem))
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_PARTIAL_INPUT,
+                   "Temporary index file was truncated");
+      return FALSE;
+    }
+
+  run->len = n_items;
+  run->n_read += n_items;
+
+  return TRUE;
+}
+
+/*
+ * Opens the temporary file of @run for reading with a buffer of
+ * @buffer_size items. The file is only kept open while it is merged so
+ * that the number of open descriptors is bounded by the merge fan-in.
+ */
+static gboolean
+sorted_run_open (SortedRun     *run,
+                 gsize          buffer_size,
+                 GCancellable  *cancellable,
+                 GError       **error)
+{
+  g_assert (run->file != NULL);
+  g_assert (run->stream == NULL);
+
+  if (!(run->stream = G_INPUT_STREAM (g_file_read (run->file, cancellable, error))))
+    return FALSE;
+
+  run->buffer_size = buffer_size;
+  run->buffer = g_new (TableItem, buffer_size);
+  run->n_read = 0;
+
+  return sorted_run_fill (run, cancellable, error);
+}
+
+static gint
+sorted_run_compare (gconstpointer a,
+                    gconstpointer b)
+{
+  const SortedRun *runa = *(SortedRun * const *)a;
+  const SortedRun *runb = *(SortedRun * const *)b;
+
+  /* DzlHeap keeps the largest at the head, we want the smallest */
+  return table_item_compare (&runb->buffer [runb->pos], &runa->buffer [runa->pos]);
+}
+
+static void
+run_merger_init (RunMerger    *merger,
+                 GCancellable *cancellable)
+{
+  merger->heap = dzl_heap_new (sizeof (SortedRun *), sorted_run_compare);
+  merger->cancellable = cancellable;
+}
+
+static void
+run_merger_add (RunMerger *merger,
+                SortedRun *run)
+{
+  if (run->pos < run->len)
+    dzl_heap_insert_val (merger->heap, run);
+}
+
+static void
+run_merger_clear (RunMerger *merger)
+{
+  g_clear_pointer (&merger->heap, dzl_heap_unref);
+}
+
+static gboolean
+run_merger_next (gpointer    user_data,
+                 TableItem  *item,
+                 GError    **error)
+{
+  RunMerger *merger = user_data;
+  SortedRun *run;
+
+  if (merger->heap->len == 0)
+    return FALSE;
+
+  dzl_heap_extract (merger->heap, &run);
+
+  *item = run->buffer [run->pos++];
+
+  if (run->pos == run->len && !sorted_run_fill (run, merger->cancellable, error))
+    return FALSE;
+
+  if (run->pos < run->len)
+    dzl_heap_insert_val (merger->heap, run);
+
+  return TRUE;
+}
+
+/*
+ * Drains @merger into a new sorted run in a temporary file, using an
+ * output buffer of @out_items items. The file is closed once written.
+ */
+static SortedRun *
+sorted_run_new_from_merger (RunMerger     *merger,
+                            gsize          out_items,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  g_autoptr(GFileIOStream) iostream = NULL;
+  g_autofree TableItem *out = NULL;
+  GOutputStream *stream;
+  GError *local_error = NULL;
+  SortedRun *run;
+  TableItem item;
+  gsize len = 0;
+
+  run = g_new0 (SortedRun, 1);
+
+  if (!(run->file = g_file_new_tmp ("dzl-fuzzy-index-XXXXXX.run", &iostream, error)))
+    goto failure;
+
+  stream = g_io_stream_get_output_stream (G_IO_STREAM (iostream));
+  out = g_new (TableItem, out_items);
+
+  while (run_merger_next (merger, &item, &local_error))
+    {
+      out [len++] = item;
+      run->n_items++;
+
+      if (len == out_items)
+        {
+          if (!g_output_stream_write_all (stream, out, len * sizeof (TableItem), NULL, cancellable, error))
+            goto failure;
+          len = 0;
+        }
+    }
+
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, local_error);
+      goto failure;
+    }
+
+  if ((len > 0 && !g_output_stream_write_all (stream, out, len * sizeof (TableItem), NULL, cancellable, error)) ||
+      !g_io_stream_close (G_IO_STREAM (iostream), cancellable, error))
+    goto failure;
+
+  return run;
+
+failure:
+  sorted_run_free (run);
+
+  return NULL;
+}
+
+/* Called from the thread pool to sort a slice of the spill buffer */
+static void
+sorted_run_sort (gpointer data,
+                 gpointer user_data)
+{
+  SortedRun *slice = data;
+
+  qsort (slice->buffer, slice->len, sizeof (TableItem), table_item_compare);
+}
+
+/*
+ * Sorts @buffer by splitting it into slices that are sorted in parallel
+ * and merged into a single run in a temporary file, so that every spill
+ * adds exactly one run no matter how many processors there are.
+ */
+static gboolean
+spill_sorted_runs (GArray        *buffer,
+                   GPtrArray     *runs,
+                   gsize          out_items,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  g_autofree SortedRun *slices = NULL;
+  RunMerger merger = { 0 };
+  SortedRun *run;
+  gsize per_slice;
+  guint n_slices;
+
+  if (buffer->len == 0)
+    return TRUE;
+
+  n_slices = CLAMP (buffer->len / MIN_RUN_ITEMS, 1, MIN (g_get_num_processors (), MAX_MERGE_FAN_IN));
+  per_slice = (buffer->len + n_slices - 1) / n_slices;
+  slices = g_new0 (SortedRun, n_slices);
+
+  /* The slices read straight from @buffer, they have nothing to fill */
+  for (guint i = 0; i < n_slices; i++)
+    {
+      gsize begin = MIN (buffer->len, i * per_slice);
+
+      slices[i].buffer = &g_array_index (buffer, TableItem, begin);
+      slices[i].len = MIN (per_slice, buffer->len - begin);
+      slices[i].n_items = slices[i].len;
+      slices[i].n_read = slices[i].len;
+    }
+
+  if (n_slices == 1)
+    {
+      sorted_run_sort (&slices[0], NULL);
+    }
+  else
+    {
+      GThreadPool *pool = g_thread_pool_new (sorted_run_sort, NULL, n_slices, FALSE, NULL);
+
+      for (guint i = 0; i < n_slices; i++)
+        g_thread_pool_push (pool, &slices[i], NULL);
+
+      /* Wait for all of the slices to be sorted */
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+
+  run_merger_init (&merger, cancellable);
+
+  for (guint i = 0; i < n_slices; i++)
+    run_merger_add (&merger, &slices[i]);
+
+  run = sorted_run_new_from_merger (&merger, out_items, cancellable, error);
+
+  run_merger_clear (&merger);
+  g_array_set_size (buffer, 0);
+
+  if (run == NULL)
+    return FALSE;
+
+  g_ptr_array_add (runs, run);
+
+  return TRUE;
+}
+
+/*
+ * Returns the number of items of the output buffer used while spilling
+ * or merging into a temporary file, taken out of @budget_items.
+ */
+static gsize
+get_out_items (gsize budget_items,
+               guint fan_in)
+{
+  return CLAMP (budget_items / (fan_in + 1), 1, MAX_SPILL_WRITE_ITEMS);
+}
+
+/*
+ * Returns the number of runs that may be merged at once. Each of them
+ * needs a read buffer and an open file, so this is bounded both by
+ * MAX_MERGE_FAN_IN and by the budget.
+ */
+static guint
+get_fan_in (gsize budget_items)
+{
+  return CLAMP (budget_items / MIN_MERGE_ITEMS, 2, MAX_MERGE_FAN_IN);
+}
+
+/*
+ * Returns the number of items that the budget allows, which is at least
+ * enough to merge two runs one item at a time.
+ */
+static gsize
+get_budget_items (DzlFuzzyIndexBuilder *self)
+{
+  return MAX (3, self->memory_budget / sizeof (TableItem));
+}
+
+/*
+ * Generates the table items for every key, spilling sorted runs to
+ * temporary files whenever the memory budget is reached.
+ */
+static gboolean
+dzl_fuzzy_index_builder_build_runs (DzlFuzzyIndexBuilder  *self,
+                                    GHashTable            *counts,
+                                    GPtrArray             *runs,
+                                    GCancellable          *cancellable,
+                                    GError               **error)
+{
+  g_autoptr(GArray) buffer = NULL;
+  gsize budget_items;
+  gsize out_items;
+  gsize max_items;
+
+  g_assert (DZL_IS_FUZZY_INDEX_BUILDER (self));
+
+  /* The spill buffer and the output buffer share the budget */
+  budget_items = get_budget_items (self);
+  out_items = get_out_items (budget_items, get_fan_in (budget_items));
+  max_items = budget_items - out_items;
+
+  buffer = g_array_sized_new (FALSE, FALSE, sizeof (TableItem), max_items);
+
+  for (guint i = 0; i < self->kv_pairs->len; i++)
+    {
+      g_autofree gchar *lower = NULL;
+      const KVPair *kvpair = &g_array_index (self->kv_pairs, KVPair, i);
+      const gchar *key;
+      TableItem item;
+
+      key = g_ptr_array_index (self->keys, mask_priority (kvpair->key_id));
+      item.lookaside_id = i | (kvpair->key_id & 0xFF000000);
+      item.position = 0;
+
+      if (!self->case_sensitive)
+        key = lower = g_utf8_casefold (key, -1);
+
+      for (const gchar *tmp = key; *tmp; tmp = g_utf8_next_char (tmp))
+        {
+          gpointer ch = GUINT_TO_POINTER (g_utf8_get_char (tmp));
+          guint count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, ch));
+
+          g_hash_table_insert (counts, ch, GUINT_TO_POINTER (count + 1));
+
+          item.codepoint = GPOINTER_TO_UINT (ch);
+          g_array_append_val (buffer, item);
+          item.position++;
+
+          /* Spill before the array would need to grow */
+          if (buffer->len == max_items && !spill_sorted_runs (buffer, runs, out_items, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return spill_sorted_runs (buffer, runs, out_items, cancellable, error);
+}
+
+/*
+ * Opens up to @n_runs runs starting at @first, sharing @buffer_items
+ * between their read buffers, and adds them to @merger.
+ */
+static gboolean
+open_runs (GPtrArray     *runs,
+           guint          first,
+           guint          n_runs,
+           gsize          buffer_items,
+           RunMerger     *merger,
+           GCancellable  *cancellable,
+           GError       **error)
+{
+  gsize buffer_size = MAX (1, buffer_items / n_runs);
+
+  for (guint i = first; i < first + n_runs; i++)
+    {
+      SortedRun *run = g_ptr_array_index (runs, i);
+
+      if (!sorted_run_open (run, buffer_size, cancellable, error))
+        return FALSE;
+
+      run_merger_add (merger, run);
+    }
+
+  return TRUE;
+}
+
+/*
+ * Merges groups of at most @fan_in runs into longer runs until no more
+ * than @fan_in remain, so that the final merge fits in the budget.
+ */
+static gboolean
+merge_runs (GPtrArray     **runs,
+            gsize           budget_items,
+            guint           fan_in,
+            GCancellable   *cancellable,
+            GError        **error)
+{
+  gsize out_items = get_out_items (budget_items, fan_in);
+
+  while ((*runs)->len > fan_in)
+    {
+      g_autoptr(GPtrArray) merged = NULL;
+
+      merged = g_ptr_array_new_with_free_func ((GDestroyNotify)sorted_run_free);
+
+      for (guint i = 0; i < (*runs)->len; i += fan_in)
+        {
+          guint n_runs = MIN (fan_in, (*runs)->len - i);
+          RunMerger merger = { 0 };
+          SortedRun *run;
+
+          if (n_runs == 1)
+            {
+              /* Nothing to merge it with, carry it over to the next pass */
+              g_ptr_array_add (merged, g_ptr_array_index (*runs, i));
+              g_ptr_array_index (*runs, i) = NULL;
+              continue;
+            }
+
+          run_merger_init (&merger, cancellable);
+
+          if (open_runs (*runs, i, n_runs, budget_items - out_items, &merger, cancellable, error))
+            run = sorted_run_new_from_merger (&merger, out_items, cancellable, error);
+          else
+            run = NULL;
+
+          run_merger_clear (&merger);
+
+          if (run == NULL)
+            return FALSE;
+
+          g_ptr_array_add (merged, run);
+
+          /* Release the merged files right away */
+          for (guint j = i; j < i + n_runs; j++)
+            {
+              sorted_run_free (g_ptr_array_index (*runs, j));
+              g_ptr_array_index (*runs, j) = NULL;
+            }
+        }
+
+      g_ptr_array_unref (*runs);
+      *runs = g_steal_pointer (&merged);
+    }
+
+  return TRUE;
+}
+
+/*
+ * Like dzl_fuzzy_index_builder_write_rows() but the tables never live
+ * in memory all at once. Sorted runs are spilled to temporary files and
+ * merged while writing the index.
+ */
+static gboolean
+dzl_fuzzy_index_builder_write_runs (DzlFuzzyIndexBuilder  *self,
+                                    GFile                 *file,
+                                    GVariant              *variant,
+                                    GCancellable          *cancellable,
+                                    GError               **error)
+{
+  g_autoptr(GHashTable) counts = NULL;
+  g_autoptr(GPtrArray) runs = NULL;
+  g_autoptr(GArray) directory = NULL;
+  RunMerger merger = { 0 };
+  gsize budget_items;
+  guint fan_in;
+  gboolean ret = FALSE;
+
+  g_assert (DZL_IS_FUZZY_INDEX_BUILDER (self));
+  g_assert (self->memory_budget > 0);
+
+  budget_items = get_budget_items (self);
+  fan_in = get_fan_in (budget_items);
+
+  counts = g_hash_table_new (NULL, NULL);
+  runs = g_ptr_array_new_with_free_func ((GDestroyNotify)sorted_run_free);
+
+  if (!dzl_fuzzy_index_builder_build_runs (self, counts, runs, cancellable, error) ||
+      !merge_runs (&runs, budget_items, fan_in, cancellable, error))
+    return FALSE;
+
+  directory = directory_new (counts);
+
+  /* The last pass streams into the index, so the budget is all for reading */
+  run_merger_init (&merger, cancellable);
+
+  if (runs->len == 0 ||
+      open_runs (runs, 0, runs->len, budget_items, &merger, cancellable, error))
+    ret = dzl_fuzzy_index_builder_write_v2 (self, file, directory,
+                                            run_merger_next, &merger,
+                                            variant, cancellable, error);
+
+  run_merger_clear (&merger);
+
+  return ret;
+}
+
+static void
+dzl_fuzzy_index_builder_write_worker (GTask        *task,
+                                      gpointer      source_object,
+                                      gpointer      task_data,
+                                      GCancellable *cancellable)
+{
+  DzlFuzzyIndexBuilder *self = source_object;
+  g_autoptr(GHashTable) rows = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariant) documents = NULL;
+  g_autoptr(GError) error = NULL;
+  GVariantDict dict;
+  GFile *file = task_data;
+  gboolean ret;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (DZL_IS_FUZZY_INDEX_BUILDER (self));
+  g_assert (G_IS_FILE (file));
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  if (self->format_version == 1 && self->memory_budget > 0)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_NOT_SUPPORTED,
+                               "A memory budget requires format version 2");
+      return;
+    }
+
+  if (self->memory_budget == 0)
+    rows = dzl_fuzzy_index_builder_build_rows (self);
+
+  g_variant_dict_init (&dict, NULL);
+
+  /* Set our version number for the document */
+  g_variant_dict_insert (&dict, "version", "i", (gint)self->format_version);
+
+  /* Build our dicitionary of metadata */
+  g_variant_dict_insert_value (&dict,
+                               "metadata",
+                               dzl_fuzzy_index_builder_build_metadata (self));
+
+  /* Keys is an array of string keys where the index is the "key_id" */
+  g_variant_dict_insert_value (&dict,
+                               "keys",
+                               dzl_fuzzy_index_builder_build_keys (self));
+
+  /* The lookaside is a mapping of kvpair to the repsective keys and
+   * documents. This allows the tables to use the kvpair id as the value
+   * in the index so we can have both document deduplication as well as
+   * the ability to disambiguate the keys which point to the same
+   * document. The contents are "a{uu}".
+   */
+  g_variant_dict_insert_value (&dict,
+                               "lookaside",
+                               dzl_fuzzy_index_builder_build_lookaside (self));
+
+  /* Build our dicitionary of character → [(pos,lookaside_id),..] tuples.
+   * The position is the utf8 character position within the string.
+   * The lookaside_id is the index within the lookaside buffer to locate
+   * the document_id or key_id.
+   *
+   * Version 2 stores the tables outside of the GVariant instead.
+   */
+  if (self->format_version == 1)
+    g_variant_dict_insert_value (&dict,
+                                 "tables",
+                                 dzl_fuzzy_index_builder_build_index (self, rows));
+
+  /*
+   * The documents are stored as an array where the document identifier is
+   * their index position. We then use a lookaside buffer to map the insertion
+   * id to the document id. Otherwise, we can't disambiguate between two
+   * keys that insert the same document (as we deduplicate documents inserted
+   * into the index).
+   */
+  documents = g_variant_new_array (NULL,
+                                   (GVariant * const *)self->documents->pdata,
+                                   self->documents->len);
+  g_variant_dict_insert_value (&dict, "documents", g_variant_ref_sink (documents));
+
+  /* Now write the variant to disk */
+  variant = g_variant_ref_sink (g_variant_dict_end (&dict));
+
+  if (self->format_version == 1)
+    ret = g_file_replace_contents (file,
+                                   g_variant_get_data (variant),
+                                   g_variant_get_size (variant),
+                                   NULL,
+                                   FALSE,
+                                   G_FILE_CREATE_NONE,
+                                   NULL,
+                                   cancellable,
+                                   &error);
+  else if (rows != NULL)
+    ret = dzl_fuzzy_index_builder_write_rows (self, file, rows, variant, cancellable, &error);
+  else
+    ret = dzl_fuzzy_index_builder_write_runs (self, file, variant, cancellable, &error);
+
+  if (!ret)
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * dzl_fuzzy_index_builder_write_async:
+ * @self: A #DzlFuzzyIndexBuilder
+ * @file: A #GFile to write the index to
+ * @io_priority: The priority for IO operations
+ * @cancellable: (nullable): An optional #GCancellable or %NULL
+ * @callback: A callback for completion or %NULL
+ * @user_data: User data for @callback
+ *
+ * Builds and writes the index to @file. The file format is a
+ * GVariant on disk and can be loaded and searched using
+ * #FuzzyIndex.
+ */
+void
+dzl_fuzzy_index_builder_write_async (DzlFuzzyIndexBuilder *self,
+                                     GFile                *file,
+                                     gint                  io_priority,
+                                     GCancellable         *cancellable,
+                                     GAsyncReadyCallback   callback,
+                                     gpointer              user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, dzl_fuzzy_index_builder_write_async);
+  g_task_set_priority (task, io_priority);
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+  g_task_run_in_thread (task, dzl_fuzzy_index_builder_write_worker);
+}
+
+gboolean
+dzl_fuzzy_index_builder_write_finish (DzlFuzzyIndexBuilder  *self,
+                                      GAsyncResult          *result,
+                                      GError               **error)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+gboolean
+dzl_fuzzy_index_builder_write (DzlFuzzyIndexBuilder  *self,
+                               GFile                 *file,
+                               gint                   io_priority,
+                               GCancellable          *cancellable,
+                               GError               **error)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), FALSE);
+  g_return_val_if_fail (G_IS_FILE (file), FALSE);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+
+  task = g_task_new (self, cancellable, NULL, NULL);
+  g_task_set_source_tag (task, dzl_fuzzy_index_builder_write);
+  g_task_set_priority (task, io_priority);
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+
+  dzl_fuzzy_index_builder_write_worker (task, self, file, cancellable);
+
+  return g_task_propagate_boolean (task, error);
+}
+
+/**
+ * dzl_fuzzy_index_builder_get_document:
+ *
+ * Returns the document that was inserted in a previous call to
+ * dzl_fuzzy_index_builder_insert().
+ *
+ * Returns: (transfer none): A #GVariant
+ */
+const GVariant *
+dzl_fuzzy_index_builder_get_document (DzlFuzzyIndexBuilder *self,
+                                      guint64               document_id)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), NULL);
+  g_return_val_if_fail ((guint)document_id < self->documents->len, NULL);
+
+  return g_ptr_array_index (self->documents, (guint)document_id);
+}
+
+void
+dzl_fuzzy_index_builder_set_metadata (DzlFuzzyIndexBuilder *self,
+                                      const gchar          *key,
+                                      GVariant             *value)
+{
+  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
+  g_return_if_fail (key != NULL);
+
+  if (self->metadata == NULL)
+    self->metadata = g_hash_table_new_full (g_str_hash,
+                                            g_str_equal,
+                                            g_free,
+                                            (GDestroyNotify)g_variant_unref);
+
+  if (value != NULL)
+    g_hash_table_insert (self->metadata,
+                         g_strdup (key),
+                         g_variant_ref_sink (value));
+  else
+    g_hash_table_remove (self->metadata, key);
+}
+
+void
+dzl_fuzzy_index_builder_set_metadata_string (DzlFuzzyIndexBuilder *self,
+                                             const gchar          *key,
+                                             const gchar          *value)
+{
+  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (value != NULL);
+
+  dzl_fuzzy_index_builder_set_metadata (self, key, g_variant_new_string (value));
+}
+
+void
+dzl_fuzzy_index_builder_set_metadata_uint32 (DzlFuzzyIndexBuilder *self,
+                                             const gchar          *key,
+                                             guint32               value)
+{
   g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
   g_return_if_fail (key != NULL);
 
@@ -692,3 +1934,127 @@ dzl_fuzzy_index_builder_set_case_sensitive (DzlFuzzyIndexBuilder *self,
       g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_CASE_SENSITIVE]);
     }
 }
+
+/**
+ * dzl_fuzzy_index_builder_get_format_version:
+ * @self: a #DzlFuzzyIndexBuilder
+ *
+ * Gets the #DzlFuzzyIndexBuilder:format-version property.
+ *
+ * Returns: the version of the file format that will be written
+ *
+ * Since: 3.46
+ */
+guint
+dzl_fuzzy_index_builder_get_format_version (DzlFuzzyIndexBuilder *self)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), 0);
+
+  return self->format_version;
+}
+
+/**
+ * dzl_fuzzy_index_builder_set_format_version:
+ * @self: a #DzlFuzzyIndexBuilder
+ * @format_version: the file format version, 1 or 2
+ *
+ * Sets the version of the file format written by
+ * dzl_fuzzy_index_builder_write_async().
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_index_builder_set_format_version (DzlFuzzyIndexBuilder *self,
+                                            guint                 format_version)
+{
+  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
+  g_return_if_fail (format_version >= 1 && format_version <= 2);
+
+  if (self->format_version != format_version)
+    {
+      self->format_version = format_version;
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_FORMAT_VERSION]);
+    }
+}
+
+/**
+ * dzl_fuzzy_index_builder_get_compress_tables:
+ * @self: a #DzlFuzzyIndexBuilder
+ *
+ * Gets the #DzlFuzzyIndexBuilder:compress-tables property.
+ *
+ * Returns: %TRUE if tables will be compressed
+ *
+ * Since: 3.46
+ */
+gboolean
+dzl_fuzzy_index_builder_get_compress_tables (DzlFuzzyIndexBuilder *self)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), FALSE);
+
+  return self->compress_tables;
+}
+
+/**
+ * dzl_fuzzy_index_builder_set_compress_tables:
+ * @self: a #DzlFuzzyIndexBuilder
+ * @compress_tables: if the tables should be compressed
+ *
+ * Sets the #DzlFuzzyIndexBuilder:compress-tables property.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_index_builder_set_compress_tables (DzlFuzzyIndexBuilder *self,
+                                             gboolean              compress_tables)
+{
+  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
+
+  compress_tables = !!compress_tables;
+
+  if (self->compress_tables != compress_tables)
+    {
+      self->compress_tables = compress_tables;
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_COMPRESS_TABLES]);
+    }
+}
+
+/**
+ * dzl_fuzzy_index_builder_get_memory_budget:
+ * @self: a #DzlFuzzyIndexBuilder
+ *
+ * Gets the #DzlFuzzyIndexBuilder:memory-budget property.
+ *
+ * Returns: the memory budget in bytes, or 0 if unbounded
+ *
+ * Since: 3.46
+ */
+guint64
+dzl_fuzzy_index_builder_get_memory_budget (DzlFuzzyIndexBuilder *self)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self), 0);
+
+  return self->memory_budget;
+}
+
+/**
+ * dzl_fuzzy_index_builder_set_memory_budget:
+ * @self: a #DzlFuzzyIndexBuilder
+ * @memory_budget: the memory budget in bytes, or 0
+ *
+ * Sets the #DzlFuzzyIndexBuilder:memory-budget property.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_index_builder_set_memory_budget (DzlFuzzyIndexBuilder *self,
+                                           guint64               memory_budget)
+{
+  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (self));
+
+  if (self->memory_budget != memory_budget)
+    {
+      self->memory_budget = memory_budget;
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_MEMORY_BUDGET]);
+    }
+}
@@ -37,6 +37,21 @@ gboolean              dzl_fuzzy_index_builder_get_case_sensitive  (DzlFuzzyIndex
 DZL_AVAILABLE_IN_ALL
 void                  dzl_fuzzy_index_builder_set_case_sensitive  (DzlFuzzyIndexBuilder  *self,
                                                                    gboolean               case_sensitive);
+DZL_AVAILABLE_IN_3_46
+gboolean              dzl_fuzzy_index_builder_get_compress_tables (DzlFuzzyIndexBuilder  *self);
+DZL_AVAILABLE_IN_3_46
+void                  dzl_fuzzy_index_builder_set_compress_tables (DzlFuzzyIndexBuilder  *self,
+                                                                   gboolean               compress_tables);
+DZL_AVAILABLE_IN_3_46
+guint                 dzl_fuzzy_index_builder_get_format_version  (DzlFuzzyIndexBuilder  *self);
+DZL_AVAILABLE_IN_3_46
+void                  dzl_fuzzy_index_builder_set_format_version  (DzlFuzzyIndexBuilder  *self,
+                                                                   guint                  format_version);
+DZL_AVAILABLE_IN_3_46
+guint64               dzl_fuzzy_index_builder_get_memory_budget   (DzlFuzzyIndexBuilder  *self);
+DZL_AVAILABLE_IN_3_46
+void                  dzl_fuzzy_index_builder_set_memory_budget   (DzlFuzzyIndexBuilder  *self,
+                                                                   guint64                memory_budget);
 DZL_AVAILABLE_IN_ALL
 guint64               dzl_fuzzy_index_builder_insert              (DzlFuzzyIndexBuilder  *self,
                                                                    const gchar           *key,
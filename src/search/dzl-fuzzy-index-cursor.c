@@ -25,26 +25,38 @@
 #include "search/dzl-fuzzy-index-cursor.h"
 #include "search/dzl-fuzzy-index-match.h"
 #include "search/dzl-fuzzy-index-private.h"
+#include "util/dzl-heap.h"
 #include "util/dzl-macros.h"
 #include "util/dzl-int-pair.h"
 
 struct _DzlFuzzyIndexCursor
 {
-  GObject          object;
+  GObject              object;
 
-  DzlFuzzyIndex   *index;
-  gchar           *query;
-  GVariantDict    *tables;
-  GArray          *matches;
-  guint            max_matches;
-  guint            case_sensitive : 1;
-};
+  DzlFuzzyIndex       *index;
+  gchar               *query;
+  GVariantDict        *tables;
+  GArray              *matches;
 
-typedef struct
-{
-  guint position;
-  guint lookaside_id;
-} DzlFuzzyIndexItem;
+  /*
+   * The sorted lookaside ids that matched @needle, before deduplication
+   * and truncation to @max_matches. A cursor refining this one for a
+   * longer needle only needs to look at these. Only kept if @refinable
+   * is set, and never changed once @populated is set.
+   */
+  GArray              *candidates;
+  gchar               *needle;
+
+  /* Only set until the query has been executed */
+  DzlFuzzyIndexCursor *parent;
+
+  guint                max_matches;
+  guint                n_threads;
+  guint                case_sensitive : 1;
+  guint                refinable : 1;
+  /* Set on the calling thread once initialization has completed */
+  guint                populated : 1;
+};
 
 typedef struct
 {
@@ -59,20 +71,62 @@ typedef struct
   DzlFuzzyIndex                   *index;
   const DzlFuzzyIndexItem * const *tables;
   const gsize                     *tables_n_elements;
-  gint                            *tables_state;
+  gsize                           *tables_state;
+  guint64                         *masks;
   guint                            n_tables;
   guint                            max_matches;
   const gchar                     *needle;
   GHashTable                      *matches;
 } DzlFuzzyLookup;
 
+typedef struct
+{
+  /*
+   * When max_matches is set we only keep the best max_matches results
+   * while resolving candidates. The heap is ordered so that the worst
+   * of the kept matches is at the head, which lets us reject candidates
+   * that cannot beat it before paying for _dzl_fuzzy_index_resolve().
+   */
+  DzlHeap    *heap;
+  GHashTable *by_document;
+  guint       max_matches;
+} DzlFuzzyTopK;
+
+typedef struct
+{
+  GMutex mutex;
+  GCond  cond;
+  guint  active;
+} DzlFuzzyShardGroup;
+
+typedef struct
+{
+  /*
+   * A shard is a range of the first table in the query. Tables are sorted
+   * by lookaside_id and shards never split a lookaside_id, so each shard
+   * can walk the remaining tables with its own state and produce results
+   * that are independent of the other shards.
+   */
+  DzlFuzzyShardGroup *group;
+  DzlFuzzyLookup      lookup;
+  DzlFuzzyTopK        top_k;
+  GArray             *resolved;
+  GArray             *candidates;
+  const guint        *restrict_to;
+  gsize               begin;
+  gsize               end;
+} DzlFuzzyShard;
+
 enum {
   PROP_0,
   PROP_CASE_SENSITIVE,
   PROP_INDEX,
   PROP_TABLES,
   PROP_MAX_MATCHES,
+  PROP_N_THREADS,
+  PROP_PARENT_CURSOR,
   PROP_QUERY,
+  PROP_REFINABLE,
   N_PROPS
 };
 
@@ -125,8 +179,11 @@ dzl_fuzzy_index_cursor_finalize (GObject *object)
   DzlFuzzyIndexCursor *self = (DzlFuzzyIndexCursor *)object;
 
   g_clear_object (&self->index);
+  g_clear_object (&self->parent);
   g_clear_pointer (&self->query, g_free);
+  g_clear_pointer (&self->needle, g_free);
   g_clear_pointer (&self->matches, g_array_unref);
+  g_clear_pointer (&self->candidates, g_array_unref);
   g_clear_pointer (&self->tables, g_variant_dict_unref);
 
   G_OBJECT_CLASS (dzl_fuzzy_index_cursor_parent_class)->finalize (object);
@@ -154,10 +211,18 @@ dzl_fuzzy_index_cursor_get_property (GObject    *object,
       g_value_set_uint (value, self->max_matches);
       break;
 
+    case PROP_N_THREADS:
+      g_value_set_uint (value, self->n_threads);
+      break;
+
     case PROP_QUERY:
       g_value_set_string (value, self->query);
       break;
 
+    case PROP_REFINABLE:
+      g_value_set_boolean (value, self->refinable);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -189,10 +254,22 @@ dzl_fuzzy_index_cursor_set_property (GObject      *object,
       self->max_matches = g_value_get_uint (value);
       break;
 
+    case PROP_N_THREADS:
+      self->n_threads = g_value_get_uint (value);
+      break;
+
+    case PROP_PARENT_CURSOR:
+      self->parent = g_value_dup_object (value);
+      break;
+
     case PROP_QUERY:
       self->query = g_value_dup_string (value);
       break;
 
+    case PROP_REFINABLE:
+      self->refinable = g_value_get_boolean (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -224,9 +301,9 @@ dzl_fuzzy_index_cursor_class_init (DzlFuzzyIndexCursorClass *klass)
   properties [PROP_TABLES] =
     g_param_spec_boxed ("tables",
                         "Tables",
-                        "The dictionary of character indexes",
+                        "Unused, tables are located through the index",
                         G_TYPE_VARIANT_DICT,
-                        (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+                        (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_DEPRECATED | G_PARAM_STATIC_STRINGS));
 
   properties [PROP_QUERY] =
     g_param_spec_string ("query",
@@ -244,6 +321,58 @@ dzl_fuzzy_index_cursor_class_init (DzlFuzzyIndexCursorClass *klass)
                        0,
                        (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * DzlFuzzyIndexCursor:n-threads:
+   *
+   * The number of threads used to execute the query. When greater than
+   * one, the query is split into shards by lookaside identifier which are
+   * matched concurrently and then merged. Zero uses one thread per
+   * processor.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_N_THREADS] =
+    g_param_spec_uint ("n-threads",
+                       "N Threads",
+                       "The number of threads used to execute the query",
+                       0,
+                       G_MAXUINT,
+                       1,
+                       (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * DzlFuzzyIndexCursor:parent-cursor:
+   *
+   * A previously executed cursor on the same index. If its query is a
+   * prefix of this cursor's query, only the keys that matched the parent
+   * are searched. Otherwise a full query is performed.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_PARENT_CURSOR] =
+    g_param_spec_object ("parent-cursor",
+                         "Parent Cursor",
+                         "A previous cursor whose results may be refined",
+                         DZL_TYPE_FUZZY_INDEX_CURSOR,
+                         (G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * DzlFuzzyIndexCursor:refinable:
+   *
+   * If set, the cursor keeps the keys that matched its query so that
+   * dzl_fuzzy_index_cursor_refine_async() only needs to search those.
+   * Otherwise refining the cursor performs a full query. Cursors created
+   * by dzl_fuzzy_index_cursor_refine_async() are refinable.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_REFINABLE] =
+    g_param_spec_boolean ("refinable",
+                          "Refinable",
+                          "If the matching keys are kept for refining the cursor",
+                          FALSE,
+                          (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
@@ -251,6 +380,7 @@ static void
 dzl_fuzzy_index_cursor_init (DzlFuzzyIndexCursor *self)
 {
   self->matches = g_array_new (FALSE, FALSE, sizeof (DzlFuzzyMatch));
+  self->n_threads = 1;
 }
 
 static gint
@@ -268,63 +398,746 @@ fuzzy_match_compare (gconstpointer a,
   return strcmp (ma->key, mb->key);
 }
 
-static gboolean
-fuzzy_do_match (const DzlFuzzyLookup    *lookup,
-                const DzlFuzzyIndexItem *item,
-                guint                    table_index,
-                gint                     score)
+static void
+fuzzy_top_k_init (DzlFuzzyTopK *top_k,
+                  guint         max_matches)
+{
+  g_assert (top_k != NULL);
+  g_assert (max_matches > 0);
+
+  top_k->heap = dzl_heap_new (sizeof (DzlFuzzyMatch), fuzzy_match_compare);
+  top_k->by_document = g_hash_table_new (NULL, NULL);
+  top_k->max_matches = max_matches;
+}
+
+static void
+fuzzy_top_k_clear (DzlFuzzyTopK *top_k)
+{
+  g_assert (top_k != NULL);
+
+  g_clear_pointer (&top_k->heap, dzl_heap_unref);
+  g_clear_pointer (&top_k->by_document, g_hash_table_unref);
+}
+
+static void
+fuzzy_top_k_add_match (DzlFuzzyTopK        *top_k,
+                       const DzlFuzzyMatch *match)
+{
+  gpointer other_score;
+  gboolean full;
+
+  g_assert (top_k != NULL);
+  g_assert (top_k->heap != NULL);
+  g_assert (match != NULL);
+
+  full = top_k->heap->len >= top_k->max_matches;
+
+  if (full && fuzzy_match_compare (match, &dzl_heap_peek (top_k->heap, DzlFuzzyMatch)) >= 0)
+    return;
+
+  if (g_hash_table_lookup_extended (top_k->by_document,
+                                    GUINT_TO_POINTER (match->document_id),
+                                    NULL,
+                                    &other_score))
+    {
+      if (match->score <= pointer_to_float (other_score))
+        return;
+
+      /*
+       * Drop the previous match for the document if we are still holding
+       * it. The heap is at most max_matches long, so a scan is fine.
+       */
+      for (gsize i = 0; i < top_k->heap->len; i++)
+        {
+          if (dzl_heap_index (top_k->heap, DzlFuzzyMatch, i).document_id == match->document_id)
+            {
+              dzl_heap_extract_index (top_k->heap, i, NULL);
+              full = FALSE;
+              break;
+            }
+        }
+    }
+
+  g_hash_table_insert (top_k->by_document,
+                       GUINT_TO_POINTER (match->document_id),
+                       float_to_pointer (match->score));
+
+  if (full)
+    dzl_heap_extract (top_k->heap, NULL);
+
+  dzl_heap_insert_vals (top_k->heap, match, 1);
+}
+
+static void
+fuzzy_top_k_add (DzlFuzzyTopK  *top_k,
+                 DzlFuzzyIndex *index,
+                 guint          lookaside_id,
+                 guint          in_score,
+                 guint          last_offset)
+{
+  DzlFuzzyMatch match;
+
+  g_assert (top_k != NULL);
+  g_assert (top_k->heap != NULL);
+
+  /*
+   * The score is known before resolving the key, so if it cannot beat the
+   * worst match we are holding there is no reason to look anything up.
+   * Equal scores still need the key to break the tie.
+   */
+  if (top_k->heap->len >= top_k->max_matches &&
+      _dzl_fuzzy_index_score (lookaside_id, in_score, last_offset) <
+      dzl_heap_peek (top_k->heap, DzlFuzzyMatch).score)
+    return;
+
+  if G_UNLIKELY (!_dzl_fuzzy_index_resolve (index,
+                                            lookaside_id,
+                                            &match.document_id,
+                                            &match.key,
+                                            &match.priority,
+                                            in_score,
+                                            last_offset,
+                                            &match.score))
+    return;
+
+  fuzzy_top_k_add_match (top_k, &match);
+}
+
+static void
+fuzzy_top_k_finish (DzlFuzzyTopK *top_k,
+                    GArray       *matches)
 {
-  const DzlFuzzyIndexItem *table;
-  const DzlFuzzyIndexItem *iter;
-  gssize n_elements;
-  gint *state;
-  gint iter_score;
+  g_assert (top_k != NULL);
+  g_assert (matches != NULL);
 
-  g_assert (lookup != NULL);
-  g_assert (item != NULL);
-  g_assert (score >= 0);
+  if (top_k->heap->len > 0)
+    g_array_append_vals (matches, top_k->heap->data, top_k->heap->len);
+}
 
-  table = lookup->tables [table_index];
-  n_elements = (gssize)lookup->tables_n_elements [table_index];
-  state = &lookup->tables_state [table_index];
+static gsize
+fuzzy_table_lower_bound (const DzlFuzzyIndexItem *table,
+                         gsize                    n_elements,
+                         guint                    lookaside_id)
+{
+  gsize lo = 0;
+  gsize hi = n_elements;
 
-  for (; state [0] < n_elements; state [0]++)
+  while (lo < hi)
     {
-      DzlIntPair *lookup_pair;
-      gboolean contains_document;
+      gsize mid = lo + (hi - lo) / 2;
 
-      iter = &table [state [0]];
+      if (table [mid].lookaside_id < lookaside_id)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
 
-      if ((iter->lookaside_id < item->lookaside_id) ||
-          ((iter->lookaside_id == item->lookaside_id) &&
-           (iter->position <= item->position)))
-        continue;
-      else if (iter->lookaside_id > item->lookaside_id)
-        break;
+  return lo;
+}
 
-      iter_score = score + (iter->position - item->position);
+/*
+ * Like fuzzy_table_lower_bound() but starting from @from, doubling the
+ * step until we pass @lookaside_id. This is cheaper than a full binary
+ * search when the target is expected to be close to @from.
+ */
+static gsize
+fuzzy_table_gallop (const DzlFuzzyIndexItem *table,
+                    gsize                    n_elements,
+                    gsize                    from,
+                    guint                    lookaside_id)
+{
+  gsize lo = from;
+  gsize hi = from;
+  gsize step = 1;
+
+  while (hi < n_elements && table [hi].lookaside_id < lookaside_id)
+    {
+      lo = hi + 1;
+      hi += step;
+      step *= 2;
+    }
+
+  hi = MIN (hi, n_elements);
+
+  return lo + fuzzy_table_lower_bound (&table [lo], hi - lo, lookaside_id);
+}
+
+static inline gboolean
+fuzzy_item_after (const DzlFuzzyIndexItem *item,
+                  guint                    lookaside_id,
+                  guint                    position)
+{
+  return item->lookaside_id > lookaside_id ||
+         (item->lookaside_id == lookaside_id && item->position > position);
+}
+
+/*
+ * Finds the first item at or after @from that sorts after the item
+ * (@lookaside_id, @position), galloping forward like fuzzy_table_gallop().
+ */
+static gsize
+fuzzy_table_gallop_after (const DzlFuzzyIndexItem *table,
+                          gsize                    n_elements,
+                          gsize                    from,
+                          guint                    lookaside_id,
+                          guint                    position)
+{
+  gsize lo = from;
+  gsize hi = from;
+  gsize step = 1;
+
+  while (hi < n_elements && !fuzzy_item_after (&table [hi], lookaside_id, position))
+    {
+      lo = hi + 1;
+      hi += step;
+      step *= 2;
+    }
 
-      if (table_index + 1 < lookup->n_tables)
+  hi = MIN (hi, n_elements);
+
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+
+      if (fuzzy_item_after (&table [mid], lookaside_id, position))
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return lo;
+}
+
+static inline guint
+fuzzy_mask_first (guint64 mask)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll (mask);
+#else
+  guint ret = 0;
+
+  for (; (mask & 1) == 0; mask >>= 1)
+    ret++;
+
+  return ret;
+#endif
+}
+
+static void
+fuzzy_match_record (const DzlFuzzyLookup *lookup,
+                    guint                 lookaside_id,
+                    gint                  score,
+                    guint                 last_position)
+{
+  DzlIntPair *lookup_pair;
+
+  if (!g_hash_table_lookup_extended (lookup->matches,
+                                     GUINT_TO_POINTER (lookaside_id),
+                                     NULL,
+                                     (gpointer *)&lookup_pair) ||
+      score < dzl_int_pair_first (lookup_pair))
+    g_hash_table_insert (lookup->matches,
+                         GUINT_TO_POINTER (lookaside_id),
+                         dzl_int_pair_new (score, last_position));
+}
+
+/*
+ * Matches every occurrence of the first character of the needle within a
+ * single key, using a bitmask of the positions of each other character in
+ * the key. This only works for keys of up to 64 characters and returns
+ * %FALSE if the key is too long.
+ */
+static gboolean
+fuzzy_match_key_masks (const DzlFuzzyLookup    *lookup,
+                       const DzlFuzzyIndexItem *roots,
+                       gsize                    n_roots)
+{
+  guint lookaside_id = roots [0].lookaside_id;
+
+  /* Roots are sorted by position, so check the last one */
+  if (roots [n_roots - 1].position >= 64)
+    return FALSE;
+
+  for (guint i = 1; i < lookup->n_tables; i++)
+    {
+      const DzlFuzzyIndexItem *table = lookup->tables [i];
+      gsize n_elements = lookup->tables_n_elements [i];
+      guint64 mask = 0;
+
+      for (gsize j = lookup->tables_state [i];
+           j < n_elements && table [j].lookaside_id == lookaside_id;
+           j++)
+        {
+          if (table [j].position >= 64)
+            return FALSE;
+          mask |= G_GUINT64_CONSTANT (1) << table [j].position;
+        }
+
+      lookup->masks [i] = mask;
+    }
+
+  for (gsize i = 0; i < n_roots; i++)
+    {
+      guint position = roots [i].position;
+
+      for (guint j = 1; j < lookup->n_tables; j++)
         {
-          if (fuzzy_do_match (lookup, iter, table_index + 1, iter_score))
+          /* The next occurrence after position, if any */
+          guint64 mask = lookup->masks [j] & ~((G_GUINT64_CONSTANT (2) << position) - 1);
+
+          /* Later roots start further along, so they cannot match either */
+          if (mask == 0)
             return TRUE;
+
+          position = fuzzy_mask_first (mask);
+        }
+
+      fuzzy_match_record (lookup,
+                          lookaside_id,
+                          MIN (16, roots [i].position * 2) + (position - roots [i].position),
+                          position);
+    }
+
+  return TRUE;
+}
+
+/*
+ * Matches the needle against a single key, starting from each occurrence
+ * of the first character in @roots. For a given start, taking the earliest
+ * occurrence of each following character gives the tightest match, so no
+ * backtracking is needed and the table state only ever moves forward.
+ */
+static void
+fuzzy_match_key (const DzlFuzzyLookup    *lookup,
+                 const DzlFuzzyIndexItem *roots,
+                 gsize                    n_roots)
+{
+  guint lookaside_id = roots [0].lookaside_id;
+
+  if (n_roots > 1 && fuzzy_match_key_masks (lookup, roots, n_roots))
+    return;
+
+  for (gsize i = 0; i < n_roots; i++)
+    {
+      guint position = roots [i].position;
+
+      for (guint j = 1; j < lookup->n_tables; j++)
+        {
+          const DzlFuzzyIndexItem *table = lookup->tables [j];
+          gsize n_elements = lookup->tables_n_elements [j];
+          gsize *state = &lookup->tables_state [j];
+
+          *state = fuzzy_table_gallop_after (table, n_elements, *state, lookaside_id, position);
+
+          /* Later roots start further along, so they cannot match either */
+          if (*state >= n_elements || table [*state].lookaside_id != lookaside_id)
+            return;
+
+          position = table [*state].position;
+        }
+
+      fuzzy_match_record (lookup,
+                          lookaside_id,
+                          MIN (16, roots [i].position * 2) + (position - roots [i].position),
+                          position);
+    }
+}
+
+/*
+ * Matches the items of the first table in [@begin, @end). A key can only
+ * match if it is in every table, so we leapfrog between the tables,
+ * galloping each one forward to the largest lookaside_id seen so far
+ * until they all agree on one.
+ */
+static void
+fuzzy_match_range (const DzlFuzzyLookup *lookup,
+                   gsize                 begin,
+                   gsize                 end)
+{
+  const DzlFuzzyIndexItem *first = lookup->tables [0];
+  gsize i = begin;
+
+  while (i < end)
+    {
+      guint lookaside_id = first [i].lookaside_id;
+      guint next_id = lookaside_id;
+      gsize run_end;
+
+      for (guint j = 1; j < lookup->n_tables; j++)
+        {
+          const DzlFuzzyIndexItem *table = lookup->tables [j];
+          gsize n_elements = lookup->tables_n_elements [j];
+          gsize *state = &lookup->tables_state [j];
+
+          *state = fuzzy_table_gallop (table, n_elements, *state, lookaside_id);
+
+          if (*state >= n_elements)
+            return;
+
+          if (table [*state].lookaside_id != lookaside_id)
+            {
+              next_id = table [*state].lookaside_id;
+              break;
+            }
+        }
+
+      if (next_id != lookaside_id)
+        {
+          i = fuzzy_table_gallop (first, end, i, next_id);
           continue;
         }
 
-      contains_document = g_hash_table_lookup_extended (lookup->matches,
-                                                        GUINT_TO_POINTER (item->lookaside_id),
-                                                        NULL,
-                                                        (gpointer *)&lookup_pair);
+      if (lookaside_id == G_MAXUINT)
+        run_end = end;
+      else
+        run_end = fuzzy_table_gallop (first, end, i, lookaside_id + 1);
 
-      if (!contains_document || iter_score < dzl_int_pair_first (lookup_pair))
-        g_hash_table_insert (lookup->matches,
-                             GUINT_TO_POINTER (item->lookaside_id),
-                             dzl_int_pair_new (iter_score, iter->position));
+      fuzzy_match_key (lookup, &first [i], run_end - i);
 
-      return TRUE;
+      i = run_end;
     }
+}
 
-  return FALSE;
+static void
+fuzzy_shard_match_range (DzlFuzzyShard *shard,
+                         gsize          begin,
+                         gsize          end)
+{
+  DzlFuzzyLookup *lookup = &shard->lookup;
+  const DzlFuzzyIndexItem *first = lookup->tables [0];
+
+  if G_LIKELY (lookup->n_tables > 1)
+    {
+      fuzzy_match_range (lookup, begin, end);
+    }
+  else
+    {
+      guint last_id = G_MAXUINT;
+
+      for (gsize i = begin; i < end; i++)
+        {
+          const DzlFuzzyIndexItem *item = &first [i];
+          DzlFuzzyMatch match;
+
+          if (item->lookaside_id != last_id)
+            {
+              last_id = item->lookaside_id;
+
+              if (shard->candidates != NULL)
+                g_array_append_val (shard->candidates, last_id);
+
+              if (shard->top_k.heap != NULL)
+                {
+                  fuzzy_top_k_add (&shard->top_k,
+                                   lookup->index,
+                                   item->lookaside_id,
+                                   item->position,
+                                   item->position);
+                  continue;
+                }
+
+              if G_UNLIKELY (!_dzl_fuzzy_index_resolve (lookup->index,
+                                                        item->lookaside_id,
+                                                        &match.document_id,
+                                                        &match.key,
+                                                        &match.priority,
+                                                        item->position,
+                                                        item->position,
+                                                        &match.score))
+                continue;
+
+              g_array_append_val (shard->resolved, match);
+            }
+        }
+    }
+}
+
+static gint
+uint_compare (gconstpointer a,
+              gconstpointer b)
+{
+  guint ua = *(const guint *)a;
+  guint ub = *(const guint *)b;
+
+  return ua < ub ? -1 : ua > ub ? 1 : 0;
+}
+
+static void
+fuzzy_shard_run (DzlFuzzyShard *shard)
+{
+  DzlFuzzyLookup *lookup = &shard->lookup;
+  const DzlFuzzyIndexItem *first;
+  gsize n_first;
+
+  g_assert (shard != NULL);
+  g_assert (lookup->n_tables > 0);
+
+  if (shard->begin >= shard->end)
+    return;
+
+  first = lookup->tables [0];
+  n_first = lookup->tables_n_elements [0];
+
+  if (shard->restrict_to == NULL)
+    {
+      guint lookaside_id = first [shard->begin].lookaside_id;
+
+      /* Skip the entries of the other tables that belong to earlier shards */
+      for (guint i = 1; i < lookup->n_tables; i++)
+        lookup->tables_state [i] = fuzzy_table_lower_bound (lookup->tables [i],
+                                                            lookup->tables_n_elements [i],
+                                                            lookaside_id);
+
+      fuzzy_shard_match_range (shard, shard->begin, shard->end);
+    }
+  else
+    {
+      gsize pos = 0;
+
+      /*
+       * Only look at the lookaside ids that matched the parent query. Both
+       * the candidates and the tables are sorted, so we can gallop forward
+       * through every table instead of walking the entries in between.
+       */
+      for (gsize i = shard->begin; i < shard->end && pos < n_first; i++)
+        {
+          guint lookaside_id = shard->restrict_to [i];
+          gsize end;
+
+          pos = fuzzy_table_gallop (first, n_first, pos, lookaside_id);
+
+          for (end = pos; end < n_first && first [end].lookaside_id == lookaside_id; end++)
+            { /* Do Nothing */ }
+
+          if (end == pos)
+            continue;
+
+          for (guint j = 1; j < lookup->n_tables; j++)
+            lookup->tables_state [j] = fuzzy_table_gallop (lookup->tables [j],
+                                                           lookup->tables_n_elements [j],
+                                                           lookup->tables_state [j],
+                                                           lookaside_id);
+
+          fuzzy_shard_match_range (shard, pos, end);
+
+          pos = end;
+        }
+    }
+
+  if G_LIKELY (lookup->n_tables > 1)
+    {
+      GHashTableIter iter;
+      gpointer key, value;
+
+      g_hash_table_iter_init (&iter, lookup->matches);
+
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          guint lookaside_id = GPOINTER_TO_UINT (key);
+
+          if (shard->candidates != NULL)
+            g_array_append_val (shard->candidates, lookaside_id);
+
+          if (shard->top_k.heap != NULL)
+            fuzzy_top_k_add (&shard->top_k,
+                             lookup->index,
+                             lookaside_id,
+                             dzl_int_pair_first (value),
+                             dzl_int_pair_second (value));
+        }
+
+      if (shard->candidates != NULL)
+        g_array_sort (shard->candidates, uint_compare);
+    }
+}
+
+static void
+fuzzy_shard_worker (gpointer data,
+                    gpointer user_data)
+{
+  DzlFuzzyShard *shard = data;
+  DzlFuzzyShardGroup *group = shard->group;
+
+  fuzzy_shard_run (shard);
+
+  g_mutex_lock (&group->mutex);
+  if (--group->active == 0)
+    g_cond_signal (&group->cond);
+  g_mutex_unlock (&group->mutex);
+}
+
+static GThreadPool *
+fuzzy_shard_get_pool (void)
+{
+  static gsize initialized;
+  static GThreadPool *pool;
+
+  if (g_once_init_enter (&initialized))
+    {
+      pool = g_thread_pool_new (fuzzy_shard_worker,
+                                NULL,
+                                g_get_num_processors (),
+                                FALSE,
+                                NULL);
+      g_once_init_leave (&initialized, TRUE);
+    }
+
+  return pool;
+}
+
+static void
+fuzzy_shard_clear (DzlFuzzyShard *shard)
+{
+  g_assert (shard != NULL);
+
+  fuzzy_top_k_clear (&shard->top_k);
+  g_clear_pointer (&shard->lookup.matches, g_hash_table_unref);
+  g_clear_pointer (&shard->lookup.tables_state, g_free);
+  g_clear_pointer (&shard->lookup.masks, g_free);
+  g_clear_pointer (&shard->resolved, g_array_unref);
+  g_clear_pointer (&shard->candidates, g_array_unref);
+}
+
+static guint
+fuzzy_shard_split (const DzlFuzzyLookup *lookup,
+                   const GArray         *restrict_to,
+                   guint                 n_shards,
+                   DzlFuzzyShard        *shards)
+{
+  const DzlFuzzyIndexItem *first = lookup->tables [0];
+  gsize n_elements = restrict_to ? restrict_to->len : lookup->tables_n_elements [0];
+  gsize begin = 0;
+  guint n = 0;
+
+  /*
+   * Split the first table (or the candidates when refining) into ranges
+   * of roughly equal size, moving each boundary forward so that all
+   * entries for a lookaside_id stay within the same shard.
+   */
+  for (guint i = 0; i < n_shards && begin < n_elements; i++)
+    {
+      gsize end = (i + 1 == n_shards) ? n_elements : (n_elements * (i + 1)) / n_shards;
+
+      if (end <= begin)
+        continue;
+
+      while (restrict_to == NULL &&
+             end < n_elements &&
+             first [end].lookaside_id == first [end - 1].lookaside_id)
+        end++;
+
+      shards [n].begin = begin;
+      shards [n].end = end;
+      n++;
+
+      begin = end;
+    }
+
+  return n;
+}
+
+/*
+ * Fills @tables and @n_elements with usable items for each of @raw_tables,
+ * decoding compressed tables as necessary. The returned array owns the
+ * decoded items.
+ *
+ * Every matching lookaside_id must be in all of the tables (and in
+ * @restrict_to, when refining). So we decode the smallest table first and
+ * use its lookaside_ids to skip the blocks of the other tables that
+ * cannot contain a match.
+ */
+static GPtrArray *
+fuzzy_tables_decode (const GArray *raw_tables,
+                     const GArray *restrict_to,
+                     GPtrArray    *tables,
+                     GArray       *n_elements)
+{
+  g_autoptr(GArray) filter = NULL;
+  g_autofree guint *order = NULL;
+  GPtrArray *decoded;
+  gboolean compressed = FALSE;
+  guint smallest = 0;
+
+  g_assert (raw_tables != NULL);
+  g_assert (raw_tables->len > 0);
+
+  decoded = g_ptr_array_new_with_free_func ((GDestroyNotify)g_array_unref);
+
+  g_ptr_array_set_size (tables, raw_tables->len);
+  g_array_set_size (n_elements, raw_tables->len);
+
+  for (guint i = 0; i < raw_tables->len; i++)
+    {
+      const DzlFuzzyIndexTable *table = &g_array_index (raw_tables, DzlFuzzyIndexTable, i);
+
+      g_ptr_array_index (tables, i) = (gpointer)table->data;
+      g_array_index (n_elements, gsize, i) = table->n_elements;
+
+      if (table->flags & DZL_FUZZY_INDEX_TABLE_COMPRESSED)
+        compressed = TRUE;
+
+      if (table->n_elements < g_array_index (raw_tables, DzlFuzzyIndexTable, smallest).n_elements)
+        smallest = i;
+    }
+
+  if (!compressed)
+    return decoded;
+
+  /* Decode the smallest table first so it can filter the others */
+  order = g_new (guint, raw_tables->len);
+  order [0] = smallest;
+  for (guint i = 0, j = 1; i < raw_tables->len; i++)
+    {
+      if (i != smallest)
+        order [j++] = i;
+    }
+
+  for (guint o = 0; o < raw_tables->len; o++)
+    {
+      const DzlFuzzyIndexTable *table = &g_array_index (raw_tables, DzlFuzzyIndexTable, order [o]);
+      const DzlFuzzyIndexItem *items = table->data;
+      gsize n_items = table->n_elements;
+
+      if (table->flags & DZL_FUZZY_INDEX_TABLE_COMPRESSED)
+        {
+          GArray *ar = g_array_new (FALSE, FALSE, sizeof (DzlFuzzyIndexItem));
+
+          if (restrict_to != NULL)
+            _dzl_fuzzy_index_table_decode (table,
+                                           (const guint *)(gpointer)restrict_to->data,
+                                           restrict_to->len,
+                                           ar);
+          else if (filter != NULL)
+            _dzl_fuzzy_index_table_decode (table,
+                                           (const guint *)(gpointer)filter->data,
+                                           filter->len,
+                                           ar);
+          else
+            _dzl_fuzzy_index_table_decode (table, NULL, 0, ar);
+
+          g_ptr_array_add (decoded, ar);
+
+          items = (const DzlFuzzyIndexItem *)(gpointer)ar->data;
+          n_items = ar->len;
+
+          g_ptr_array_index (tables, order [o]) = (gpointer)items;
+          g_array_index (n_elements, gsize, order [o]) = n_items;
+        }
+
+      if (o == 0 && restrict_to == NULL && raw_tables->len > 1)
+        {
+          filter = g_array_new (FALSE, FALSE, sizeof (guint));
+
+          for (gsize i = 0; i < n_items; i++)
+            {
+              if (filter->len == 0 ||
+                  g_array_index (filter, guint, filter->len - 1) != items [i].lookaside_id)
+                g_array_append_val (filter, items [i].lookaside_id);
+            }
+        }
+    }
+
+  return decoded;
 }
 
 static void
@@ -334,17 +1147,25 @@ dzl_fuzzy_index_cursor_worker (GTask        *task,
                                GCancellable *cancellable)
 {
   DzlFuzzyIndexCursor *self = source_object;
-  g_autoptr(GHashTable) matches = NULL;
   g_autoptr(GHashTable) by_document = NULL;
   g_autoptr(GPtrArray) tables = NULL;
+  g_autoptr(GPtrArray) decoded = NULL;
   g_autoptr(GArray) tables_n_elements = NULL;
-  g_autofree gint *tables_state = NULL;
+  g_autoptr(GArray) raw_tables = NULL;
+  g_autofree DzlFuzzyShard *shards = NULL;
   g_autofree gchar *freeme = NULL;
+  g_autoptr(GString) needle = NULL;
+  const GArray *restrict_to = NULL;
+  DzlFuzzyShardGroup group;
   const gchar *query;
   DzlFuzzyLookup lookup = { 0 };
+  DzlFuzzyTopK top_k = { 0 };
+  GHashTable *matches;
   GHashTableIter iter;
   const gchar *str;
   gpointer key, value;
+  guint n_threads;
+  guint n_shards = 0;
   guint i;
 
   g_assert (DZL_IS_FUZZY_INDEX_CURSOR (self));
@@ -362,93 +1183,182 @@ dzl_fuzzy_index_cursor_worker (GTask        *task,
   if (!self->case_sensitive)
     query = freeme = g_utf8_casefold (query, -1);
 
-  tables = g_ptr_array_new ();
-  tables_n_elements = g_array_new (FALSE, FALSE, sizeof (gsize));
-  matches = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)dzl_int_pair_free);
+  /* Whitespace is ignored, so strip it to get the characters to match */
+  needle = g_string_new (NULL);
 
   for (str = query; *str; str = g_utf8_next_char (str))
     {
       gunichar ch = g_utf8_get_char (str);
-      g_autoptr(GVariant) table = NULL;
-      gconstpointer fixed;
-      gsize n_elements;
-      gchar char_key[8];
 
-      if (g_unichar_isspace (ch))
-        continue;
+      if (!g_unichar_isspace (ch))
+        g_string_append_unichar (needle, ch);
+    }
 
-      char_key [g_unichar_to_utf8 (ch, char_key)] = '\0';
-      table = g_variant_dict_lookup_value (self->tables,
-                                           char_key,
-                                           (const GVariantType *)"a(uu)");
+  /*
+   * If the parent cursor matched a prefix of our needle, every key that
+   * can match our needle is among the parent's candidates. The parent
+   * was populated before we were created, so they no longer change.
+   */
+  if (self->parent != NULL &&
+      self->parent->index == self->index &&
+      self->parent->case_sensitive == self->case_sensitive &&
+      self->parent->candidates != NULL &&
+      self->parent->needle != NULL &&
+      self->parent->needle [0] != '\0' &&
+      g_str_has_prefix (needle->str, self->parent->needle))
+    restrict_to = self->parent->candidates;
+
+  raw_tables = g_array_new (FALSE, FALSE, sizeof (DzlFuzzyIndexTable));
+
+  for (str = needle->str; *str; str = g_utf8_next_char (str))
+    {
+      gunichar ch = g_utf8_get_char (str);
+      DzlFuzzyIndexTable table;
 
       /* No possible matches, missing table for character */
-      if (table == NULL)
+      if (!_dzl_fuzzy_index_lookup_table (self->index, ch, &table))
         goto cleanup;
 
-      fixed = g_variant_get_fixed_array (table, &n_elements, sizeof (DzlFuzzyIndexItem));
-      g_array_append_val (tables_n_elements, n_elements);
-      g_ptr_array_add (tables, (gpointer)fixed);
+      g_array_append_val (raw_tables, table);
     }
 
-  if (tables->len == 0)
+  if (raw_tables->len == 0)
     goto cleanup;
 
+  tables = g_ptr_array_sized_new (raw_tables->len);
+  tables_n_elements = g_array_sized_new (FALSE, FALSE, sizeof (gsize), raw_tables->len);
+  decoded = fuzzy_tables_decode (raw_tables, restrict_to, tables, tables_n_elements);
+
   g_assert (tables->len > 0);
   g_assert (tables->len == tables_n_elements->len);
 
-  tables_state = g_new0 (gint, tables->len);
-
   lookup.index = self->index;
-  lookup.matches = matches;
   lookup.tables = (const DzlFuzzyIndexItem * const *)tables->pdata;
   lookup.tables_n_elements = (const gsize *)(gpointer)tables_n_elements->data;
-  lookup.tables_state = tables_state;
   lookup.n_tables = tables->len;
   lookup.needle = query;
   lookup.max_matches = self->max_matches;
 
-  if G_LIKELY (lookup.n_tables > 1)
+  n_threads = self->n_threads ? self->n_threads : g_get_num_processors ();
+  n_threads = CLAMP (n_threads, 1, MAX (1, restrict_to ? restrict_to->len : lookup.tables_n_elements [0]));
+
+  shards = g_new0 (DzlFuzzyShard, n_threads);
+  n_shards = fuzzy_shard_split (&lookup, restrict_to, n_threads, shards);
+
+  for (i = 0; i < n_shards; i++)
     {
-      for (i = 0; i < lookup.tables_n_elements[0]; i++)
-        {
-          const DzlFuzzyIndexItem *item = &lookup.tables[0][i];
+      DzlFuzzyShard *shard = &shards [i];
 
-          fuzzy_do_match (&lookup, item, 1, MIN (16, item->position * 2));
-        }
+      shard->group = &group;
+      shard->lookup = lookup;
+      shard->lookup.tables_state = g_new0 (gsize, lookup.n_tables);
+      shard->lookup.masks = g_new0 (guint64, lookup.n_tables);
+      shard->lookup.matches = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)dzl_int_pair_free);
+      shard->resolved = g_array_new (FALSE, FALSE, sizeof (DzlFuzzyMatch));
+
+      if (self->refinable)
+        shard->candidates = g_array_new (FALSE, FALSE, sizeof (guint));
+
+      if (restrict_to != NULL)
+        shard->restrict_to = (const guint *)(gpointer)restrict_to->data;
+
+      if (self->max_matches > 0)
+        fuzzy_top_k_init (&shard->top_k, self->max_matches);
     }
-  else
+
+  if (n_shards > 1)
     {
-      guint last_id = G_MAXUINT;
+      GThreadPool *pool = fuzzy_shard_get_pool ();
+
+      g_mutex_init (&group.mutex);
+      g_cond_init (&group.cond);
+      group.active = n_shards - 1;
+
+      /* Run the first shard on this thread while the pool handles the rest */
+      for (i = 1; i < n_shards; i++)
+        g_thread_pool_push (pool, &shards [i], NULL);
+
+      fuzzy_shard_run (&shards [0]);
+
+      g_mutex_lock (&group.mutex);
+      while (group.active > 0)
+        g_cond_wait (&group.cond, &group.mutex);
+      g_mutex_unlock (&group.mutex);
+
+      g_mutex_clear (&group.mutex);
+      g_cond_clear (&group.cond);
+    }
+  else if (n_shards == 1)
+    {
+      fuzzy_shard_run (&shards [0]);
+    }
+
+  if (g_task_return_error_if_cancelled (task))
+    goto cancelled;
+
+  /* Shards are ordered by lookaside_id, so the candidates stay sorted */
+  if (self->refinable)
+    {
+      self->candidates = g_array_new (FALSE, FALSE, sizeof (guint));
+
+      for (i = 0; i < n_shards; i++)
+        g_array_append_vals (self->candidates, shards [i].candidates->data, shards [i].candidates->len);
+    }
+
+  if (n_shards == 0)
+    goto cleanup;
 
-      for (i = 0; i < lookup.tables_n_elements[0]; i++)
+  /*
+   * With max_matches set, every shard already holds its own best results.
+   * Any document in the overall best max_matches must also be in the best
+   * max_matches of the shard holding its best match, so merging them is
+   * enough.
+   */
+  if (self->max_matches > 0)
+    {
+      if (n_shards == 1)
         {
-          const DzlFuzzyIndexItem *item = &lookup.tables[0][i];
-          DzlFuzzyMatch match;
+          top_k = shards [0].top_k;
+          memset (&shards [0].top_k, 0, sizeof shards [0].top_k);
+        }
+      else
+        {
+          fuzzy_top_k_init (&top_k, self->max_matches);
 
-          if (item->lookaside_id != last_id)
+          for (i = 0; i < n_shards; i++)
             {
-              last_id = item->lookaside_id;
+              DzlHeap *heap = shards [i].top_k.heap;
 
-              if G_UNLIKELY (!_dzl_fuzzy_index_resolve (self->index,
-                                                        item->lookaside_id,
-                                                        &match.document_id,
-                                                        &match.key,
-                                                        &match.priority,
-                                                        item->position,
-                                                        item->position,
-                                                        &match.score))
-                continue;
-
-              g_array_append_val (self->matches, match);
+              for (gsize j = 0; j < heap->len; j++)
+                fuzzy_top_k_add_match (&top_k, &dzl_heap_index (heap, DzlFuzzyMatch, j));
             }
         }
 
       goto cleanup;
     }
 
-  if (g_task_return_error_if_cancelled (task))
-    return;
+  /* Single character queries resolve directly while walking the table */
+  if (lookup.n_tables == 1)
+    {
+      for (i = 0; i < n_shards; i++)
+        g_array_append_vals (self->matches, shards [i].resolved->data, shards [i].resolved->len);
+
+      goto cleanup;
+    }
+
+  /* Shards cover disjoint lookaside ranges, so their matches never collide */
+  matches = shards [0].lookup.matches;
+
+  for (i = 1; i < n_shards; i++)
+    {
+      g_hash_table_iter_init (&iter, shards [i].lookup.matches);
+
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          g_hash_table_iter_steal (&iter);
+          g_hash_table_insert (matches, key, value);
+        }
+    }
 
   by_document = g_hash_table_new (NULL, NULL);
 
@@ -517,17 +1427,36 @@ dzl_fuzzy_index_cursor_worker (GTask        *task,
     }
 
   if (g_task_return_error_if_cancelled (task))
-    return;
+    goto cancelled;
 
 cleanup:
+  if (top_k.heap != NULL)
+    fuzzy_top_k_finish (&top_k, self->matches);
+
   if (self->matches != NULL)
     {
       g_array_sort (self->matches, fuzzy_match_compare);
-      if (lookup.max_matches > 0 && lookup.max_matches < self->matches->len)
-        g_array_set_size (self->matches, lookup.max_matches);
+      if (self->max_matches > 0 && self->max_matches < self->matches->len)
+        g_array_set_size (self->matches, self->max_matches);
+    }
+
+  /* Without a table for one of the characters, nothing can match a refinement either */
+  if (needle != NULL && self->refinable)
+    {
+      if (self->candidates == NULL)
+        self->candidates = g_array_new (FALSE, FALSE, sizeof (guint));
+      self->needle = g_string_free (g_steal_pointer (&needle), FALSE);
     }
 
   g_task_return_boolean (task, TRUE);
+
+cancelled:
+  g_clear_object (&self->parent);
+
+  fuzzy_top_k_clear (&top_k);
+
+  for (i = 0; i < n_shards; i++)
+    fuzzy_shard_clear (&shards [i]);
 }
 
 static void
@@ -555,10 +1484,17 @@ dzl_fuzzy_index_cursor_init_finish (GAsyncInitable  *initiable,
                                     GAsyncResult    *result,
                                     GError         **error)
 {
-  g_assert (DZL_IS_FUZZY_INDEX_CURSOR (initiable));
+  DzlFuzzyIndexCursor *self = (DzlFuzzyIndexCursor *)initiable;
+
+  g_assert (DZL_IS_FUZZY_INDEX_CURSOR (self));
   g_assert (G_IS_TASK (result));
 
-  return g_task_propagate_boolean (G_TASK (result), error);
+  if (!g_task_propagate_boolean (G_TASK (result), error))
+    return FALSE;
+
+  self->populated = TRUE;
+
+  return TRUE;
 }
 
 static void
@@ -630,3 +1566,112 @@ dzl_fuzzy_index_cursor_get_index (DzlFuzzyIndexCursor *self)
 
   return self->index;
 }
+
+static void
+dzl_fuzzy_index_cursor_refine_cb (GObject      *object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
+{
+  DzlFuzzyIndexCursor *cursor = (DzlFuzzyIndexCursor *)object;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (DZL_IS_FUZZY_INDEX_CURSOR (cursor));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (G_IS_TASK (task));
+
+  if (!g_async_initable_init_finish (G_ASYNC_INITABLE (cursor), result, &error))
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_pointer (task, g_object_ref (cursor), g_object_unref);
+}
+
+/**
+ * dzl_fuzzy_index_cursor_refine_async:
+ * @self: A #DzlFuzzyIndexCursor
+ * @query: the new query
+ * @max_matches: the max number of matches, or 0 for all
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: a callback to execute upon completion
+ * @user_data: closure data for @callback
+ *
+ * Queries the index of @self with @query, reusing the results of @self
+ * where possible. This is useful as the user types, since a query that
+ * extends the query of @self can only match keys that @self matched.
+ *
+ * If the query of @self is not a prefix of @query, or @self is not
+ * #DzlFuzzyIndexCursor:refinable, a full query of the index is performed.
+ *
+ * @self must have been populated, which is the case once the query that
+ * created it has completed. Otherwise %G_IO_ERROR_PENDING is returned.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_index_cursor_refine_async (DzlFuzzyIndexCursor *self,
+                                     const gchar         *query,
+                                     guint                max_matches,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(DzlFuzzyIndexCursor) cursor = NULL;
+
+  g_return_if_fail (DZL_IS_FUZZY_INDEX_CURSOR (self));
+  g_return_if_fail (query != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_priority (task, G_PRIORITY_LOW);
+  g_task_set_source_tag (task, dzl_fuzzy_index_cursor_refine_async);
+
+  if (!self->populated)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_PENDING,
+                               "The cursor is still being populated");
+      return;
+    }
+
+  cursor = g_object_new (DZL_TYPE_FUZZY_INDEX_CURSOR,
+                         "case-sensitive", self->case_sensitive,
+                         "index", self->index,
+                         "query", query,
+                         "max-matches", max_matches,
+                         "n-threads", self->n_threads,
+                         "parent-cursor", self,
+                         "refinable", TRUE,
+                         NULL);
+
+  g_async_initable_init_async (G_ASYNC_INITABLE (cursor),
+                               G_PRIORITY_LOW,
+                               cancellable,
+                               dzl_fuzzy_index_cursor_refine_cb,
+                               g_steal_pointer (&task));
+}
+
+/**
+ * dzl_fuzzy_index_cursor_refine_finish:
+ * @self: A #DzlFuzzyIndexCursor
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Completes an asynchronous request to dzl_fuzzy_index_cursor_refine_async().
+ *
+ * Returns: (transfer full): A #GListModel of results, which is itself
+ *   a #DzlFuzzyIndexCursor that may be refined further.
+ *
+ * Since: 3.46
+ */
+GListModel *
+dzl_fuzzy_index_cursor_refine_finish (DzlFuzzyIndexCursor  *self,
+                                      GAsyncResult         *result,
+                                      GError              **error)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_INDEX_CURSOR (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
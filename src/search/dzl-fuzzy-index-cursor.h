@@ -33,7 +33,18 @@ DZL_AVAILABLE_IN_ALL
 G_DECLARE_FINAL_TYPE (DzlFuzzyIndexCursor, dzl_fuzzy_index_cursor, DZL, FUZZY_INDEX_CURSOR, GObject)
 
 DZL_AVAILABLE_IN_ALL
-DzlFuzzyIndex *dzl_fuzzy_index_cursor_get_index (DzlFuzzyIndexCursor *self);
+DzlFuzzyIndex *dzl_fuzzy_index_cursor_get_index     (DzlFuzzyIndexCursor  *self);
+DZL_AVAILABLE_IN_3_46
+void           dzl_fuzzy_index_cursor_refine_async  (DzlFuzzyIndexCursor  *self,
+                                                     const gchar          *query,
+                                                     guint                 max_matches,
+                                                     GCancellable         *cancellable,
+                                                     GAsyncReadyCallback   callback,
+                                                     gpointer              user_data);
+DZL_AVAILABLE_IN_3_46
+GListModel    *dzl_fuzzy_index_cursor_refine_finish (DzlFuzzyIndexCursor  *self,
+                                                     GAsyncResult         *result,
+                                                     GError              **error);
 
 G_END_DECLS
 
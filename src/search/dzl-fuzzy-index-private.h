@@ -23,16 +23,115 @@
 
 G_BEGIN_DECLS
 
-GVariant    *_dzl_fuzzy_index_lookup_document (DzlFuzzyIndex  *self,
-                                               guint           document_id);
-gboolean     _dzl_fuzzy_index_resolve         (DzlFuzzyIndex  *self,
-                                               guint           lookaside_id,
-                                               guint          *document_id,
-                                               const gchar   **key,
-                                               guint          *priority,
-                                               guint           in_score,
-                                               guint           last_offset,
-                                               gfloat         *out_score);
+/*
+ * Version 2 of the index format is a small header followed by a directory
+ * of per-character tables, the tables themselves and finally the GVariant
+ * containing everything else (as found in version 1, minus "tables").
+ *
+ * The directory is sorted by codepoint so it can be binary searched in
+ * place, and each table starts on a 64-byte boundary so that it can be
+ * used directly from the mapped file. Everything is in host byte order,
+ * like the GVariant data of version 1.
+ */
+#define DZL_FUZZY_INDEX_MAGIC     "DzlFzIdx"
+#define DZL_FUZZY_INDEX_ALIGNMENT 64
+
+/*
+ * A compressed table starts with one DzlFuzzyIndexBlock per
+ * DZL_FUZZY_INDEX_BLOCK_SIZE items plus a sentinel block whose offset is
+ * the length of the encoded data that follows. Within a block, each item
+ * is a varint of the lookaside_id delta followed by a varint of the
+ * position (or the position delta when the lookaside_id is unchanged).
+ * The blocks act as skip pointers so a reader only needs to decode the
+ * blocks that may contain the lookaside_ids it is interested in.
+ */
+#define DZL_FUZZY_INDEX_TABLE_COMPRESSED (1 << 0)
+#define DZL_FUZZY_INDEX_BLOCK_SIZE       128
+
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint64 directory_offset;
+  guint64 n_directory;
+  guint64 variant_offset;
+  guint64 variant_size;
+  guint64 reserved[2];
+} DzlFuzzyIndexHeader;
+
+typedef struct
+{
+  guint32 codepoint;
+  guint32 flags;
+  guint64 offset;
+  guint64 n_elements;
+} DzlFuzzyIndexTableEntry;
+
+typedef struct
+{
+  guint32 first_lookaside_id;
+  guint32 offset;
+} DzlFuzzyIndexBlock;
+
+typedef struct
+{
+  guint position;
+  guint lookaside_id;
+} DzlFuzzyIndexItem;
+
+typedef struct
+{
+  gconstpointer data;
+  gsize         n_elements;
+  guint         flags;
+} DzlFuzzyIndexTable;
+
+G_STATIC_ASSERT (sizeof (DzlFuzzyIndexHeader) == 64);
+G_STATIC_ASSERT (sizeof (DzlFuzzyIndexTableEntry) == 24);
+G_STATIC_ASSERT (sizeof (DzlFuzzyIndexBlock) == 8);
+
+typedef void (*DzlFuzzyIndexForeach) (const gchar *key,
+                                      GVariant    *document,
+                                      guint        priority,
+                                      gpointer     user_data);
+
+gboolean     _dzl_fuzzy_index_get_case_sensitive (DzlFuzzyIndex *self);
+void         _dzl_fuzzy_index_foreach         (DzlFuzzyIndex             *self,
+                                               DzlFuzzyIndexForeach       func,
+                                               gpointer                   user_data);
+GVariant    *_dzl_fuzzy_index_lookup_document (DzlFuzzyIndex             *self,
+                                               guint                      document_id);
+gboolean     _dzl_fuzzy_index_lookup_table    (DzlFuzzyIndex             *self,
+                                               gunichar                   ch,
+                                               DzlFuzzyIndexTable        *table);
+void         _dzl_fuzzy_index_table_decode    (const DzlFuzzyIndexTable  *table,
+                                               const guint               *filter,
+                                               gsize                      n_filter,
+                                               GArray                    *items);
+gboolean     _dzl_fuzzy_index_resolve         (DzlFuzzyIndex             *self,
+                                               guint                      lookaside_id,
+                                               guint                     *document_id,
+                                               const gchar              **key,
+                                               guint                     *priority,
+                                               guint                      in_score,
+                                               guint                      last_offset,
+                                               gfloat                    *out_score);
+
+/*
+ * The score only depends on the priority bits stashed in the high byte of
+ * the lookaside_id and the match offsets, so cursors can compute it before
+ * paying for _dzl_fuzzy_index_resolve() and discard hopeless candidates.
+ */
+static inline gfloat
+_dzl_fuzzy_index_score (guint lookaside_id,
+                        guint in_score,
+                        guint last_offset)
+{
+  guint priority = (lookaside_id & 0xFF000000) >> 24;
+
+  return ((1.0 / 256.0) / (1 + last_offset + in_score)) + ((255.0 - priority) / 256.0);
+}
 
 G_END_DECLS
 
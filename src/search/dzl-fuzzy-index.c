@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "search/dzl-fuzzy-index.h"
@@ -39,6 +40,13 @@ struct _DzlFuzzyIndex
 
   guint         loaded : 1;
   guint         case_sensitive : 1;
+  guint         resort_tables : 1;
+
+  /*
+   * The number of threads cursors should use when executing queries.
+   * Zero means one thread per processor.
+   */
+  guint         n_threads;
 
   GMappedFile  *mapped_file;
 
@@ -90,6 +98,25 @@ struct _DzlFuzzyIndex
    */
   GVariantDict *tables;
 
+  /*
+   * Version 1 builders before 3.46 sorted the tables by subtracting
+   * lookaside_ids, which does not match unsigned order once a key has a
+   * priority of 128 or more. For such indexes, @resort_tables is set and
+   * tables that are out of order are sorted again when first looked up.
+   * This maps a codepoint to its sorted #GArray, or to %NULL if the table
+   * in the index was already in order. Cursors look up tables from worker
+   * threads, so this is protected by @sorted_tables_mutex.
+   */
+  GMutex        sorted_tables_mutex;
+  GHashTable   *sorted_tables;
+
+  /*
+   * Version 2 indexes do not have @tables. Instead they have a directory
+   * sorted by codepoint pointing at the tables within @mapped_file.
+   */
+  const DzlFuzzyIndexTableEntry *directory;
+  gsize n_directory;
+
   /*
    * The metadata located within the search index. This contains
    * metadata set with dzl_fuzzy_index_builder_set_metadata() or one
@@ -112,6 +139,9 @@ dzl_fuzzy_index_finalize (GObject *object)
   g_clear_pointer (&self->tables, g_variant_dict_unref);
   g_clear_pointer (&self->lookaside, g_variant_unref);
   g_clear_pointer (&self->metadata, g_variant_dict_unref);
+  g_clear_pointer (&self->sorted_tables, g_hash_table_unref);
+
+  g_mutex_clear (&self->sorted_tables_mutex);
 
   G_OBJECT_CLASS (dzl_fuzzy_index_parent_class)->finalize (object);
 }
@@ -127,6 +157,9 @@ dzl_fuzzy_index_class_init (DzlFuzzyIndexClass *klass)
 static void
 dzl_fuzzy_index_init (DzlFuzzyIndex *self)
 {
+  self->n_threads = 1;
+
+  g_mutex_init (&self->sorted_tables_mutex);
 }
 
 DzlFuzzyIndex *
@@ -135,6 +168,78 @@ dzl_fuzzy_index_new (void)
   return g_object_new (DZL_TYPE_FUZZY_INDEX, NULL);
 }
 
+static void
+sorted_table_free (gpointer data)
+{
+  if (data != NULL)
+    g_array_unref (data);
+}
+
+static gint
+table_item_compare (gconstpointer a,
+                    gconstpointer b)
+{
+  const DzlFuzzyIndexItem *itema = a;
+  const DzlFuzzyIndexItem *itemb = b;
+
+  if (itema->lookaside_id != itemb->lookaside_id)
+    return itema->lookaside_id < itemb->lookaside_id ? -1 : 1;
+  else if (itema->position != itemb->position)
+    return itema->position < itemb->position ? -1 : 1;
+
+  return 0;
+}
+
+/*
+ * Returns a copy of @items sorted as unsigned integers, or %NULL if
+ * @items is already in that order.
+ */
+static GArray *
+sort_legacy_table (const DzlFuzzyIndexItem *items,
+                   gsize                    n_items)
+{
+  GArray *sorted;
+  gsize i;
+
+  for (i = 1; i < n_items; i++)
+    {
+      if (table_item_compare (&items[i - 1], &items[i]) > 0)
+        break;
+    }
+
+  if (i >= n_items)
+    return NULL;
+
+  sorted = g_array_sized_new (FALSE, FALSE, sizeof (DzlFuzzyIndexItem), n_items);
+  g_array_append_vals (sorted, items, n_items);
+  g_array_sort (sorted, table_item_compare);
+
+  return sorted;
+}
+
+static gboolean
+table_blocks_valid (const gchar *data,
+                    gsize        length,
+                    guint64      n_elements)
+{
+  const DzlFuzzyIndexBlock *blocks = (const DzlFuzzyIndexBlock *)(gconstpointer)data;
+  guint64 n_blocks = (n_elements + DZL_FUZZY_INDEX_BLOCK_SIZE - 1) / DZL_FUZZY_INDEX_BLOCK_SIZE;
+
+  if (n_blocks >= length / sizeof (DzlFuzzyIndexBlock))
+    return FALSE;
+
+  length -= (n_blocks + 1) * sizeof (DzlFuzzyIndexBlock);
+
+  for (guint64 i = 0; i < n_blocks; i++)
+    {
+      if (blocks [i].offset > blocks [i + 1].offset ||
+          (i > 0 && blocks [i - 1].first_lookaside_id > blocks [i].first_lookaside_id))
+        return FALSE;
+    }
+
+  return blocks [n_blocks].offset <= length;
+}
+
 static void
 dzl_fuzzy_index_load_file_worker (GTask        *task,
                                   gpointer      source_object,
@@ -152,8 +257,13 @@ dzl_fuzzy_index_load_file_worker (GTask        *task,
   g_autoptr(GError) error = NULL;
   DzlFuzzyIndex *self = source_object;
   GFile *file = task_data;
+  const DzlFuzzyIndexTableEntry *directory = NULL;
+  DzlFuzzyIndexHeader header;
+  const gchar *contents;
   GVariantDict dict;
+  gsize length;
   gint version = 0;
+  gint expected_version = 1;
   gboolean case_sensitive = FALSE;
 
   g_assert (DZL_IS_FUZZY_INDEX (self));
@@ -186,10 +296,68 @@ dzl_fuzzy_index_load_file_worker (GTask        *task,
       return;
     }
 
-  variant = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT,
-                                     g_mapped_file_get_contents (mapped_file),
-                                     g_mapped_file_get_length (mapped_file),
-                                     FALSE, NULL, NULL);
+  contents = g_mapped_file_get_contents (mapped_file);
+  length = g_mapped_file_get_length (mapped_file);
+
+  /*
+   * Version 2 indexes start with a header describing where the tables and
+   * the GVariant live within the file. Version 1 is just the GVariant.
+   */
+  if (length >= sizeof header && memcmp (contents, DZL_FUZZY_INDEX_MAGIC, sizeof header.magic) == 0)
+    {
+      memcpy (&header, contents, sizeof header);
+
+      if (header.version != 2 ||
+          header.byte_order != G_BYTE_ORDER ||
+          header.directory_offset > length ||
+          header.n_directory > (length - header.directory_offset) / sizeof (DzlFuzzyIndexTableEntry) ||
+          header.directory_offset % 8 != 0 ||
+          header.variant_offset > length ||
+          header.variant_size > length - header.variant_offset ||
+          header.variant_offset % 8 != 0)
+        {
+          g_task_return_new_error (task,
+                                   G_IO_ERROR,
+                                   G_IO_ERROR_INVAL,
+                                   "Invalid index header");
+          return;
+        }
+
+      directory = (const DzlFuzzyIndexTableEntry *)(gpointer)(contents + header.directory_offset);
+
+      for (gsize i = 0; i < header.n_directory; i++)
+        {
+          const DzlFuzzyIndexTableEntry *entry = &directory [i];
+
+          if ((i > 0 && directory [i - 1].codepoint >= entry->codepoint) ||
+              entry->offset % DZL_FUZZY_INDEX_ALIGNMENT != 0 ||
+              entry->offset > length ||
+              (entry->flags & ~DZL_FUZZY_INDEX_TABLE_COMPRESSED) != 0 ||
+              ((entry->flags & DZL_FUZZY_INDEX_TABLE_COMPRESSED)
+                 ? !table_blocks_valid (contents + entry->offset, length - entry->offset, entry->n_elements)
+                 : entry->n_elements > (length - entry->offset) / sizeof (DzlFuzzyIndexItem)))
+            {
+              g_task_return_new_error (task,
+                                       G_IO_ERROR,
+                                       G_IO_ERROR_INVAL,
+                                       "Invalid table directory in index");
+              return;
+            }
+        }
+
+      expected_version = 2;
+      variant = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT,
+                                         contents + header.variant_offset,
+                                         header.variant_size,
+                                         FALSE, NULL, NULL);
+    }
+  else
+    {
+      variant = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT,
+                                         contents,
+                                         length,
+                                         FALSE, NULL, NULL);
+    }
 
   if (variant == NULL)
     {
@@ -204,14 +372,14 @@ dzl_fuzzy_index_load_file_worker (GTask        *task,
 
   g_variant_dict_init (&dict, variant);
 
-  if (!g_variant_dict_lookup (&dict, "version", "i", &version) || version != 1)
+  if (!g_variant_dict_lookup (&dict, "version", "i", &version) || version != expected_version)
     {
       g_variant_dict_clear (&dict);
       g_task_return_new_error (task,
                                G_IO_ERROR,
                                G_IO_ERROR_INVAL,
-                               "Version mismatch in gvariant. Got %d, expected 1",
-                               version);
+                               "Version mismatch in gvariant. Got %d, expected %d",
+                               version, expected_version);
       return;
     }
 
@@ -222,7 +390,8 @@ dzl_fuzzy_index_load_file_worker (GTask        *task,
   metadata = g_variant_dict_lookup_value (&dict, "metadata", G_VARIANT_TYPE_VARDICT);
   g_variant_dict_clear (&dict);
 
-  if (keys == NULL || documents == NULL || tables == NULL || metadata == NULL)
+  if (keys == NULL || documents == NULL || metadata == NULL ||
+      (directory == NULL && tables == NULL))
     {
       g_task_return_new_error (task,
                                G_IO_ERROR,
@@ -236,13 +405,35 @@ dzl_fuzzy_index_load_file_worker (GTask        *task,
   self->documents = g_steal_pointer (&documents);
   self->lookaside = g_steal_pointer (&lookaside);
   self->keys = g_steal_pointer (&keys);
-  self->tables = g_variant_dict_new (tables);
   self->metadata = g_variant_dict_new (metadata);
 
+  if (directory != NULL)
+    {
+      self->directory = directory;
+      self->n_directory = header.n_directory;
+    }
+  else
+    {
+      self->tables = g_variant_dict_new (tables);
+    }
+
   self->lookaside_raw = g_variant_get_fixed_array (self->lookaside,
                                                    &self->lookaside_len,
                                                    sizeof (LookasideEntry));
 
+  if (self->tables != NULL)
+    {
+      for (gsize i = 0; i < self->lookaside_len; i++)
+        {
+          if ((self->lookaside_raw[i].key_id & 0x80000000) != 0)
+            {
+              self->resort_tables = TRUE;
+              self->sorted_tables = g_hash_table_new_full (NULL, NULL, NULL, sorted_table_free);
+              break;
+            }
+        }
+    }
+
   if (g_variant_dict_lookup (self->metadata, "case-sensitive", "b", &case_sensitive))
     self->case_sensitive = !!case_sensitive;
 
@@ -345,7 +536,7 @@ dzl_fuzzy_index_query_async (DzlFuzzyIndex       *self,
                          "index", self,
                          "query", query,
                          "max-matches", max_matches,
-                         "tables", self->tables,
+                         "n-threads", self->n_threads,
                          NULL);
 
   g_async_initable_init_async (G_ASYNC_INITABLE (cursor),
@@ -440,6 +631,265 @@ dzl_fuzzy_index_get_metadata_string (DzlFuzzyIndex *self,
   return NULL;
 }
 
+/**
+ * dzl_fuzzy_index_get_n_threads:
+ * @self: a #DzlFuzzyIndex
+ *
+ * Gets the number of threads used to execute queries.
+ *
+ * Returns: the number of threads, or 0 for one per processor
+ *
+ * Since: 3.46
+ */
+guint
+dzl_fuzzy_index_get_n_threads (DzlFuzzyIndex *self)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_INDEX (self), 0);
+
+  return self->n_threads;
+}
+
+/**
+ * dzl_fuzzy_index_set_n_threads:
+ * @self: a #DzlFuzzyIndex
+ * @n_threads: the number of threads, or 0 for one per processor
+ *
+ * Sets the number of threads used by queries started with
+ * dzl_fuzzy_index_query_async(). When greater than one, each query is
+ * split into shards of the index which are searched concurrently and
+ * then merged, which can reduce latency on large indexes.
+ *
+ * The default is 1.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_index_set_n_threads (DzlFuzzyIndex *self,
+                               guint          n_threads)
+{
+  g_return_if_fail (DZL_IS_FUZZY_INDEX (self));
+
+  self->n_threads = n_threads;
+}
+
+static gint
+table_entry_compare (gconstpointer keyptr,
+                     gconstpointer element)
+{
+  gunichar ch = *(const gunichar *)keyptr;
+  const DzlFuzzyIndexTableEntry *entry = element;
+
+  return ch < entry->codepoint ? -1 : ch > entry->codepoint ? 1 : 0;
+}
+
+/**
+ * _dzl_fuzzy_index_lookup_table:
+ * @self: A #DzlFuzzyIndex
+ * @ch: the character to locate
+ * @table: (out): a location for the table
+ *
+ * Locates the table of (position, lookaside_id) pairs for @ch. The table
+ * points into the mapped index, or into a sorted copy for version 1
+ * indexes written in the legacy order, and is valid for the lifetime of
+ * @self.
+ *
+ * If @table has %DZL_FUZZY_INDEX_TABLE_COMPRESSED set in its flags, the
+ * items must be decoded with _dzl_fuzzy_index_table_decode() before use.
+ *
+ * Returns: %TRUE if the index contains @ch; otherwise %FALSE.
+ */
+gboolean
+_dzl_fuzzy_index_lookup_table (DzlFuzzyIndex      *self,
+                               gunichar            ch,
+                               DzlFuzzyIndexTable *table)
+{
+  g_assert (DZL_IS_FUZZY_INDEX (self));
+  g_assert (table != NULL);
+
+  if (self->directory != NULL)
+    {
+      const DzlFuzzyIndexTableEntry *entry;
+
+      entry = bsearch (&ch,
+                       self->directory,
+                       self->n_directory,
+                       sizeof (DzlFuzzyIndexTableEntry),
+                       table_entry_compare);
+
+      if (entry == NULL)
+        return FALSE;
+
+      table->data = g_mapped_file_get_contents (self->mapped_file) + entry->offset;
+      table->n_elements = entry->n_elements;
+      table->flags = entry->flags;
+
+      return TRUE;
+    }
+
+  if (self->tables != NULL)
+    {
+      g_autoptr(GVariant) variant = NULL;
+      gchar char_key[8];
+
+      char_key [g_unichar_to_utf8 (ch, char_key)] = '\0';
+      variant = g_variant_dict_lookup_value (self->tables,
+                                             char_key,
+                                             (const GVariantType *)"a(uu)");
+
+      if (variant == NULL)
+        return FALSE;
+
+      /* The data is owned by the mapped file, so it outlives @variant */
+      table->data = g_variant_get_fixed_array (variant, &table->n_elements, sizeof (DzlFuzzyIndexItem));
+      table->flags = 0;
+
+      if (self->resort_tables)
+        {
+          gpointer key = GUINT_TO_POINTER (ch);
+          gpointer sorted = NULL;
+
+          g_mutex_lock (&self->sorted_tables_mutex);
+
+          if (!g_hash_table_lookup_extended (self->sorted_tables, key, NULL, &sorted))
+            {
+              sorted = sort_legacy_table (table->data, table->n_elements);
+              g_hash_table_insert (self->sorted_tables, key, sorted);
+            }
+
+          g_mutex_unlock (&self->sorted_tables_mutex);
+
+          /* The sorted copy lives until @self is finalized */
+          if (sorted != NULL)
+            table->data = ((GArray *)sorted)->data;
+        }
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static inline gboolean
+read_varint (const guint8 **ptr,
+             const guint8  *end,
+             guint         *value)
+{
+  const guint8 *p = *ptr;
+  guint ret = 0;
+
+  for (guint shift = 0; p < end && shift < 32; shift += 7)
+    {
+      guint8 b = *p++;
+
+      ret |= (guint)(b & 0x7F) << shift;
+
+      if ((b & 0x80) == 0)
+        {
+          *ptr = p;
+          *value = ret;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static void
+decode_block (const guint8 *data,
+              const guint8 *end,
+              guint         lookaside_id,
+              guint         n_items,
+              GArray       *items)
+{
+  DzlFuzzyIndexItem item = { 0, lookaside_id };
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      guint delta;
+      guint position;
+
+      if (!read_varint (&data, end, &delta) || !read_varint (&data, end, &position))
+        {
+          g_warning ("Corrupted table block in fuzzy index");
+          return;
+        }
+
+      if (i > 0 && delta == 0)
+        position += item.position;
+
+      item.lookaside_id += delta;
+      item.position = position;
+
+      g_array_append_val (items, item);
+    }
+}
+
+/**
+ * _dzl_fuzzy_index_table_decode:
+ * @table: a table from _dzl_fuzzy_index_lookup_table()
+ * @filter: (nullable): sorted lookaside_ids of interest
+ * @n_filter: the number of elements in @filter
+ * @items: a #GArray of #DzlFuzzyIndexItem
+ *
+ * Appends the items of @table to @items, in order.
+ *
+ * If @filter is set, blocks of a compressed table that cannot contain
+ * any of the lookaside_ids in @filter are skipped without being decoded.
+ * Items outside of @filter may still be appended.
+ */
+void
+_dzl_fuzzy_index_table_decode (const DzlFuzzyIndexTable *table,
+                               const guint              *filter,
+                               gsize                     n_filter,
+                               GArray                   *items)
+{
+  const DzlFuzzyIndexBlock *blocks;
+  const guint8 *data;
+  gsize n_blocks;
+  gsize j = 0;
+
+  g_assert (table != NULL);
+  g_assert (items != NULL);
+  g_assert (g_array_get_element_size (items) == sizeof (DzlFuzzyIndexItem));
+
+  if ((table->flags & DZL_FUZZY_INDEX_TABLE_COMPRESSED) == 0)
+    {
+      g_array_append_vals (items, table->data, table->n_elements);
+      return;
+    }
+
+  blocks = table->data;
+  n_blocks = (table->n_elements + DZL_FUZZY_INDEX_BLOCK_SIZE - 1) / DZL_FUZZY_INDEX_BLOCK_SIZE;
+  data = (const guint8 *)&blocks [n_blocks + 1];
+
+  for (gsize i = 0; i < n_blocks; i++)
+    {
+      guint n_items = MIN (DZL_FUZZY_INDEX_BLOCK_SIZE, table->n_elements - i * DZL_FUZZY_INDEX_BLOCK_SIZE);
+
+      /*
+       * A lookaside_id may straddle two blocks, so the last lookaside_id
+       * of this block may be the first of the next.
+       */
+      if (filter != NULL)
+        {
+          while (j < n_filter && filter [j] < blocks [i].first_lookaside_id)
+            j++;
+
+          if (j == n_filter)
+            break;
+
+          if (i + 1 < n_blocks && filter [j] > blocks [i + 1].first_lookaside_id)
+            continue;
+        }
+
+      decode_block (data + blocks [i].offset,
+                    data + blocks [i + 1].offset,
+                    blocks [i].first_lookaside_id,
+                    n_items,
+                    items);
+    }
+}
+
 /**
  * _dzl_fuzzy_index_lookup_document:
  * @self: A #DzlFuzzyIndex
@@ -462,6 +912,57 @@ _dzl_fuzzy_index_lookup_document (DzlFuzzyIndex *self,
   return g_variant_get_child_value (self->documents, document_id);
 }
 
+gboolean
+_dzl_fuzzy_index_get_case_sensitive (DzlFuzzyIndex *self)
+{
+  g_assert (DZL_IS_FUZZY_INDEX (self));
+
+  return self->case_sensitive;
+}
+
+/**
+ * _dzl_fuzzy_index_foreach:
+ * @self: A #DzlFuzzyIndex
+ * @func: a function to call for each entry
+ * @user_data: closure data for @func
+ *
+ * Calls @func for every (key, document, priority) that was inserted into
+ * the builder that created @self. This is used to rebuild indexes.
+ */
+void
+_dzl_fuzzy_index_foreach (DzlFuzzyIndex        *self,
+                          DzlFuzzyIndexForeach  func,
+                          gpointer              user_data)
+{
+  gsize n_keys;
+  gsize n_documents;
+
+  g_assert (DZL_IS_FUZZY_INDEX (self));
+  g_assert (func != NULL);
+
+  if (self->keys == NULL || self->documents == NULL || self->lookaside_raw == NULL)
+    return;
+
+  n_keys = g_variant_n_children (self->keys);
+  n_documents = g_variant_n_children (self->documents);
+
+  for (gsize i = 0; i < self->lookaside_len; i++)
+    {
+      const LookasideEntry *entry = &self->lookaside_raw [i];
+      g_autoptr(GVariant) document = NULL;
+      const gchar *key = NULL;
+      guint key_id = entry->key_id & 0x00FFFFFF;
+
+      if G_UNLIKELY (key_id >= n_keys || entry->document_id >= n_documents)
+        continue;
+
+      g_variant_get_child (self->keys, key_id, "&s", &key);
+      document = g_variant_get_child_value (self->documents, entry->document_id);
+
+      func (key, document, (entry->key_id & 0xFF000000) >> 24, user_data);
+    }
+}
+
 gboolean
 _dzl_fuzzy_index_resolve (DzlFuzzyIndex  *self,
                           guint           lookaside_id,
@@ -506,7 +1007,7 @@ _dzl_fuzzy_index_resolve (DzlFuzzyIndex  *self,
     *document_id = entry->document_id;
 
   *priority = (entry->key_id & 0xFF000000) >> 24;
-  *out_score = ((1.0 / 256.0) / (1 + last_offset + in_score)) + ((255.0 - *priority) / 256.0);
+  *out_score = _dzl_fuzzy_index_score (entry->key_id, in_score, last_offset);
 
   return TRUE;
 }
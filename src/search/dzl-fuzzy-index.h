@@ -70,6 +70,11 @@ guint64         dzl_fuzzy_index_get_metadata_uint64 (DzlFuzzyIndex        *self,
 DZL_AVAILABLE_IN_ALL
 const gchar    *dzl_fuzzy_index_get_metadata_string (DzlFuzzyIndex        *self,
                                                      const gchar          *key);
+DZL_AVAILABLE_IN_3_46
+guint           dzl_fuzzy_index_get_n_threads       (DzlFuzzyIndex        *self);
+DZL_AVAILABLE_IN_3_46
+void            dzl_fuzzy_index_set_n_threads       (DzlFuzzyIndex        *self,
+                                                     guint                 n_threads);
 
 G_END_DECLS
 
@@ -78,7 +78,8 @@ typedef struct
 {
    DzlFuzzyMutableIndex        *fuzzy;
    GArray      **tables;
-   gint         *state;
+   guint        *state;
+   guint64      *masks;
    guint         n_tables;
    gsize         max_matches;
    const gchar  *needle;
@@ -337,90 +338,201 @@ dzl_fuzzy_mutable_index_unref (DzlFuzzyMutableIndex *fuzzy)
     }
 }
 
-static void
-rollback_state_to_pos (GArray *table,
-                       gint   *state,
-                       guint   id,
-                       guint   pos)
+/*
+ * Finds the first item at or after @from that is not ordered before the
+ * item (@id, @pos). We gallop forward from @from since the state of each
+ * table only ever moves forward during a match.
+ */
+static guint
+dzl_fuzzy_mutable_index_gallop (GArray *table,
+                                guint   from,
+                                guint   id,
+                                guint   pos)
 {
-  g_assert (table != NULL);
-  g_assert (state != NULL);
-  g_assert (pos > 0);
+  const DzlFuzzyMutableIndexItem *items = (const DzlFuzzyMutableIndexItem *)(gpointer)table->data;
+  guint lo = from;
+  guint hi = from;
+  guint step = 1;
+
+#define ITEM_BEFORE(i) (items[i].id < id || (items[i].id == id && items[i].pos < pos))
 
-  while (*state > 0 && *state <= table->len)
+  while (hi < table->len && ITEM_BEFORE (hi))
     {
-      DzlFuzzyMutableIndexItem *iter;
+      lo = hi + 1;
+      hi = (table->len - hi > step) ? hi + step : table->len;
+      step *= 2;
+    }
 
-      (*state)--;
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
 
-      iter = &g_array_index (table, DzlFuzzyMutableIndexItem, *state);
+      if (ITEM_BEFORE (mid))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
 
-      if (iter->id > id || (iter->id == id && *state >= pos))
-        continue;
+#undef ITEM_BEFORE
 
-      break;
-    }
+  return lo;
 }
 
+/*
+ * Like dzl_fuzzy_mutable_index_match_key() but using a bitmask of the
+ * positions of each character within the key. This only works for keys
+ * of up to 64 bytes and returns %FALSE if the key is too long.
+ */
 static gboolean
-dzl_fuzzy_mutable_index_do_match (DzlFuzzyMutableIndexLookup *lookup,
-                                  DzlFuzzyMutableIndexItem   *item,
-                                  guint                       table_index,
-                                  gint                        score)
+dzl_fuzzy_mutable_index_match_key_masks (DzlFuzzyMutableIndexLookup     *lookup,
+                                         const DzlFuzzyMutableIndexItem *roots,
+                                         guint                           n_roots,
+                                         gint                           *score)
 {
-  gboolean ret = FALSE;
-  GArray *table;
-  gint *state;
+  guint id = roots[0].id;
 
-  table = lookup->tables [table_index];
-  state = &lookup->state [table_index];
+  /* Roots are sorted by position, so check the last one */
+  if (roots[n_roots - 1].pos >= 64)
+    return FALSE;
 
-  for (; state [0] < (gint)table->len; state [0]++)
+  for (guint i = 1; i < lookup->n_tables; i++)
     {
-      DzlFuzzyMutableIndexItem *iter;
-      gpointer key;
-      gint iter_score;
+      GArray *table = lookup->tables[i];
+      guint64 mask = 0;
 
-      iter = &g_array_index (table, DzlFuzzyMutableIndexItem, state[0]);
+      for (guint j = lookup->state[i];
+           j < table->len && g_array_index (table, DzlFuzzyMutableIndexItem, j).id == id;
+           j++)
+        {
+          guint pos = g_array_index (table, DzlFuzzyMutableIndexItem, j).pos;
 
-      if ((iter->id < item->id) || ((iter->id == item->id) && (iter->pos <= item->pos)))
-        continue;
-      else if (iter->id > item->id)
-        break;
+          if (pos >= 64)
+            return FALSE;
+          mask |= G_GUINT64_CONSTANT (1) << pos;
+        }
+
+      lookup->masks[i] = mask;
+    }
+
+  for (guint i = 0; i < n_roots; i++)
+    {
+      guint pos = roots[i].pos;
 
-      iter_score = score + (iter->pos - item->pos - 1);
+      for (guint j = 1; j < lookup->n_tables; j++)
+        {
+          /* The next occurrence after pos, if any */
+          guint64 mask = lookup->masks[j] & ~((G_GUINT64_CONSTANT (2) << pos) - 1);
+
+          if (mask == 0)
+            return TRUE;
+
+#ifdef __GNUC__
+          pos = __builtin_ctzll (mask);
+#else
+          for (pos = 0; (mask & 1) == 0; mask >>= 1)
+            pos++;
+#endif
+        }
+
+      *score = MIN (*score, (gint)(pos - roots[i].pos) - (gint)(lookup->n_tables - 1));
+    }
+
+  return TRUE;
+}
+
+/*
+ * Finds the best match of the needle within a single key, given each
+ * occurrence of the first character of the needle in @roots. The score
+ * is the number of characters skipped between the first and last matched
+ * character. For a given start, taking the earliest occurrence of each
+ * following character gives the lowest score, so no backtracking is
+ * needed and the state of each table only moves forward.
+ */
+static void
+dzl_fuzzy_mutable_index_match_key (DzlFuzzyMutableIndexLookup     *lookup,
+                                   const DzlFuzzyMutableIndexItem *roots,
+                                   guint                           n_roots)
+{
+  guint id = roots[0].id;
+  gint score = G_MAXINT;
+
+  if (n_roots > 1 && dzl_fuzzy_mutable_index_match_key_masks (lookup, roots, n_roots, &score))
+    goto finish;
+
+  for (guint i = 0; i < n_roots; i++)
+    {
+      guint pos = roots[i].pos;
 
-      if ((table_index + 1) < lookup->n_tables)
+      for (guint j = 1; j < lookup->n_tables; j++)
         {
-          if (dzl_fuzzy_mutable_index_do_match (lookup, iter, table_index + 1, iter_score))
+          GArray *table = lookup->tables[j];
+          guint *state = &lookup->state[j];
+
+          *state = dzl_fuzzy_mutable_index_gallop (table, *state, id, pos + 1);
+
+          /* Later roots start further along, so they cannot match either */
+          if (*state >= table->len || g_array_index (table, DzlFuzzyMutableIndexItem, *state).id != id)
+            goto finish;
+
+          pos = g_array_index (table, DzlFuzzyMutableIndexItem, *state).pos;
+        }
+
+      score = MIN (score, (gint)(pos - roots[i].pos) - (gint)(lookup->n_tables - 1));
+    }
+
+finish:
+  if (score != G_MAXINT)
+    g_hash_table_insert (lookup->matches, GINT_TO_POINTER (id), GINT_TO_POINTER (score));
+}
+
+/*
+ * A key can only match if it is in every table, so we leapfrog between
+ * the tables, galloping each one forward to the largest id seen so far
+ * until they all agree on one.
+ */
+static void
+dzl_fuzzy_mutable_index_do_match (DzlFuzzyMutableIndexLookup *lookup)
+{
+  GArray *root = lookup->tables[0];
+  guint i = 0;
+
+  while (i < root->len)
+    {
+      guint id = g_array_index (root, DzlFuzzyMutableIndexItem, i).id;
+      guint next_id = id;
+      guint run_end;
+
+      for (guint j = 1; j < lookup->n_tables; j++)
+        {
+          GArray *table = lookup->tables[j];
+          guint *state = &lookup->state[j];
+
+          *state = dzl_fuzzy_mutable_index_gallop (table, *state, id, 0);
+
+          if (*state >= table->len)
+            return;
+
+          if (g_array_index (table, DzlFuzzyMutableIndexItem, *state).id != id)
             {
-              ret = TRUE;
-
-              /* We already found a match, but we could have a better match
-               * further in the word. We need to rollback all of our additional
-               * table state to the current position so that we can possibly
-               * advance again.
-               */
-              if ((state[0] + 1) < table->len &&
-                  g_array_index (table, DzlFuzzyMutableIndexItem, state[0] + 1).id == item->id)
-                {
-                  for (guint i = table_index + 1; i < lookup->n_tables; i++)
-                    rollback_state_to_pos (lookup->tables[i], &lookup->state[i], iter->id, iter->pos + 1);
-                }
+              next_id = g_array_index (table, DzlFuzzyMutableIndexItem, *state).id;
+              break;
             }
+        }
+
+      if (next_id != id)
+        {
+          i = dzl_fuzzy_mutable_index_gallop (root, i, next_id, 0);
           continue;
         }
 
-      key = GINT_TO_POINTER (iter->id);
+      run_end = dzl_fuzzy_mutable_index_gallop (root, i, id + 1, 0);
 
-      if (!g_hash_table_contains (lookup->matches, key) ||
-          (iter_score < GPOINTER_TO_INT (g_hash_table_lookup (lookup->matches, key))))
-        g_hash_table_insert (lookup->matches, key, GINT_TO_POINTER (iter_score));
+      dzl_fuzzy_mutable_index_match_key (lookup,
+                                         &g_array_index (root, DzlFuzzyMutableIndexItem, i),
+                                         run_end - i);
 
-      ret = TRUE;
+      i = run_end;
     }
-
-  return ret;
 }
 
 static inline const gchar *
@@ -482,7 +594,8 @@ dzl_fuzzy_mutable_index_match (DzlFuzzyMutableIndex *fuzzy,
 
   lookup.fuzzy = fuzzy;
   lookup.n_tables = g_utf8_strlen (needle, -1);
-  lookup.state = g_new0 (gint, lookup.n_tables);
+  lookup.state = g_new0 (guint, lookup.n_tables);
+  lookup.masks = g_new0 (guint64, lookup.n_tables);
   lookup.tables = g_new0 (GArray*, lookup.n_tables);
   lookup.needle = needle;
   lookup.max_matches = max_matches;
@@ -509,23 +622,7 @@ dzl_fuzzy_mutable_index_match (DzlFuzzyMutableIndex *fuzzy,
 
   if (G_LIKELY (lookup.n_tables > 1))
     {
-      for (i = 0; i < root->len; i++)
-        {
-          item = &g_array_index (root, DzlFuzzyMutableIndexItem, i);
-
-          if (dzl_fuzzy_mutable_index_do_match (&lookup, item, 1, 0) &&
-              i + 1 < root->len &&
-              (item + 1)->id == item->id)
-            {
-              /* We found a match, but we might find another one with a higher
-               * score later on for the same item of the corpus.  We need to
-               * roll state back to the position we're starting at so that we
-               * can match all the same characters again.
-               */
-              for (guint j = 1; j < lookup.n_tables; j++)
-                rollback_state_to_pos (lookup.tables[j], &lookup.state[j], item->id, item->pos + 1);
-            }
-        }
+      dzl_fuzzy_mutable_index_do_match (&lookup);
     }
   else
     {
@@ -588,6 +685,7 @@ dzl_fuzzy_mutable_index_match (DzlFuzzyMutableIndex *fuzzy,
 cleanup:
   g_free (downcase);
   g_free (lookup.state);
+  g_free (lookup.masks);
   g_free (lookup.tables);
   g_clear_pointer (&lookup.matches, g_hash_table_unref);
 
@@ -0,0 +1,973 @@
+/* dzl-fuzzy-segmented-index.c
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "dzl-fuzzy-segmented-index"
+
+#include "config.h"
+
+#include <string.h>
+
+#include "search/dzl-fuzzy-index-match.h"
+#include "search/dzl-fuzzy-index-private.h"
+#include "search/dzl-fuzzy-segmented-index.h"
+#include "util/dzl-macros.h"
+#include "util/dzl-variant.h"
+
+/**
+ * SECTION:dzl-fuzzy-segmented-index
+ * @title: DzlFuzzySegmentedIndex
+ * @short_description: Combine immutable fuzzy indexes with incremental changes
+ *
+ * #DzlFuzzySegmentedIndex queries a series of #DzlFuzzyIndex segments as
+ * if they were a single index. This allows keeping a large base index on
+ * disk while writing small indexes containing just what has changed.
+ *
+ * Segments are ordered from oldest to newest. A segment replaces the
+ * documents it contains, so when it is added, every key pointing at one
+ * of those documents is hidden in older segments. Other documents sharing
+ * a key with them are left alone. Keys and documents may also be removed,
+ * which hides them from every segment added before the removal.
+ *
+ * Use dzl_fuzzy_segmented_index_compact_async() to merge all of the
+ * segments into a new base index once there are too many of them.
+ *
+ * Since: 3.46
+ */
+
+typedef struct
+{
+  volatile gint  ref_count;
+
+  /*
+   * Maps a key (or document) to the generation before which it is hidden.
+   * Removing a key hides it from all current segments while adding a
+   * segment hides its documents in the older segments.
+   */
+  GHashTable    *keys;
+  GHashTable    *documents;
+
+  /*
+   * The sorted generations of every key and document, so that queries can
+   * count the tombstones that may hide results of a given segment. Built
+   * before the tombstones are shared, dropped when they change.
+   */
+  GArray        *generations;
+} Tombstones;
+
+struct _DzlFuzzySegmentedIndex
+{
+  GObject     object;
+
+  /*
+   * The segments, oldest first. Each segment has a generation in
+   * @generations which increases with every segment added.
+   */
+  GPtrArray  *segments;
+  GArray     *generations;
+  guint       next_generation;
+
+  /*
+   * What is hidden, shared with running queries and compactions. It is
+   * copied before being changed if anything else holds a reference.
+   */
+  Tombstones *tombstones;
+
+  guint       compacting : 1;
+};
+
+typedef struct
+{
+  gchar      *query;
+  guint       max_matches;
+  guint       n_active;
+  GPtrArray  *segments;
+  GArray     *generations;
+  Tombstones *tombstones;
+  GPtrArray  *matches;
+  gboolean   *requeried;
+  GError     *error;
+} Query;
+
+typedef struct
+{
+  DzlFuzzyIndexBuilder *builder;
+  GFile                *file;
+  GPtrArray            *segments;
+  GArray               *generations;
+  Tombstones           *tombstones;
+  guint                 generation;
+  guint                 current;
+} Compact;
+
+G_DEFINE_TYPE (DzlFuzzySegmentedIndex, dzl_fuzzy_segmented_index, G_TYPE_OBJECT)
+
+static GHashTable *
+hidden_keys_new (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static GHashTable *
+hidden_documents_new (void)
+{
+  return g_hash_table_new_full (dzl_g_variant_hash,
+                                g_variant_equal,
+                                (GDestroyNotify)g_variant_unref,
+                                NULL);
+}
+
+static GHashTable *
+hidden_copy (GHashTable *hidden,
+             gboolean    documents)
+{
+  GHashTable *copy = documents ? hidden_documents_new () : hidden_keys_new ();
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, hidden);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (documents)
+        g_hash_table_insert (copy, g_variant_ref (key), value);
+      else
+        g_hash_table_insert (copy, g_strdup (key), value);
+    }
+
+  return copy;
+}
+
+static Tombstones *
+tombstones_new (GHashTable *keys,
+                GHashTable *documents)
+{
+  Tombstones *t = g_slice_new0 (Tombstones);
+
+  t->ref_count = 1;
+  t->keys = keys;
+  t->documents = documents;
+
+  return t;
+}
+
+static Tombstones *
+tombstones_ref (Tombstones *t)
+{
+  g_assert (t != NULL);
+  g_assert (t->ref_count > 0);
+
+  g_atomic_int_inc (&t->ref_count);
+
+  return t;
+}
+
+static void
+tombstones_unref (Tombstones *t)
+{
+  g_assert (t != NULL);
+  g_assert (t->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&t->ref_count))
+    {
+      g_clear_pointer (&t->keys, g_hash_table_unref);
+      g_clear_pointer (&t->documents, g_hash_table_unref);
+      g_clear_pointer (&t->generations, g_array_unref);
+      g_slice_free (Tombstones, t);
+    }
+}
+
+static gint
+guint_compare (gconstpointer a,
+               gconstpointer b)
+{
+  guint ua = *(const guint *)a;
+  guint ub = *(const guint *)b;
+
+  return ua < ub ? -1 : ua > ub ? 1 : 0;
+}
+
+/*
+ * Gets a reference to the current tombstones, which must not be changed
+ * until every reference but ours is dropped.
+ */
+static Tombstones *
+dzl_fuzzy_segmented_index_get_tombstones (DzlFuzzySegmentedIndex *self)
+{
+  Tombstones *t = self->tombstones;
+
+  if (t->generations == NULL)
+    {
+      GHashTableIter iter;
+      gpointer value;
+
+      t->generations = g_array_sized_new (FALSE,
+                                          FALSE,
+                                          sizeof (guint),
+                                          g_hash_table_size (t->keys) + g_hash_table_size (t->documents));
+
+      g_hash_table_iter_init (&iter, t->keys);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          guint generation = GPOINTER_TO_UINT (value);
+          g_array_append_val (t->generations, generation);
+        }
+
+      g_hash_table_iter_init (&iter, t->documents);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          guint generation = GPOINTER_TO_UINT (value);
+          g_array_append_val (t->generations, generation);
+        }
+
+      g_array_sort (t->generations, guint_compare);
+    }
+
+  return tombstones_ref (t);
+}
+
+/*
+ * Gets tombstones that may be changed, copying them if they are shared
+ * with a query or compaction.
+ */
+static Tombstones *
+dzl_fuzzy_segmented_index_edit_tombstones (DzlFuzzySegmentedIndex *self)
+{
+  Tombstones *t = self->tombstones;
+
+  if (g_atomic_int_get (&t->ref_count) > 1)
+    {
+      self->tombstones = tombstones_new (hidden_copy (t->keys, FALSE),
+                                         hidden_copy (t->documents, TRUE));
+      tombstones_unref (t);
+      t = self->tombstones;
+    }
+
+  g_clear_pointer (&t->generations, g_array_unref);
+
+  return t;
+}
+
+/*
+ * Counts the tombstones that may hide results of a segment of @generation.
+ */
+static guint
+tombstones_count_hiding (const Tombstones *t,
+                         guint             generation)
+{
+  guint lo = 0;
+  guint hi;
+
+  g_assert (t != NULL);
+  g_assert (t->generations != NULL);
+
+  hi = t->generations->len;
+
+  /* Find the first tombstone newer than @generation */
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (g_array_index (t->generations, guint, mid) > generation)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return t->generations->len - lo;
+}
+
+static void
+hide (GHashTable     *hidden,
+      gpointer        key,
+      GDestroyNotify  key_destroy,
+      guint           generation)
+{
+  guint old = GPOINTER_TO_UINT (g_hash_table_lookup (hidden, key));
+
+  if (generation > old)
+    g_hash_table_insert (hidden, key, GUINT_TO_POINTER (generation));
+  else
+    key_destroy (key);
+}
+
+static gboolean
+is_hidden (const Tombstones *t,
+           const gchar      *key,
+           GVariant         *document,
+           guint             generation)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (t->keys, key)) > generation ||
+         (document != NULL &&
+          GPOINTER_TO_UINT (g_hash_table_lookup (t->documents, document)) > generation);
+}
+
+static void
+dzl_fuzzy_segmented_index_finalize (GObject *object)
+{
+  DzlFuzzySegmentedIndex *self = (DzlFuzzySegmentedIndex *)object;
+
+  g_clear_pointer (&self->segments, g_ptr_array_unref);
+  g_clear_pointer (&self->generations, g_array_unref);
+  g_clear_pointer (&self->tombstones, tombstones_unref);
+
+  G_OBJECT_CLASS (dzl_fuzzy_segmented_index_parent_class)->finalize (object);
+}
+
+static void
+dzl_fuzzy_segmented_index_class_init (DzlFuzzySegmentedIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = dzl_fuzzy_segmented_index_finalize;
+}
+
+static void
+dzl_fuzzy_segmented_index_init (DzlFuzzySegmentedIndex *self)
+{
+  self->segments = g_ptr_array_new_with_free_func (g_object_unref);
+  self->generations = g_array_new (FALSE, FALSE, sizeof (guint));
+  self->tombstones = tombstones_new (hidden_keys_new (), hidden_documents_new ());
+  self->next_generation = 1;
+}
+
+DzlFuzzySegmentedIndex *
+dzl_fuzzy_segmented_index_new (void)
+{
+  return g_object_new (DZL_TYPE_FUZZY_SEGMENTED_INDEX, NULL);
+}
+
+/**
+ * dzl_fuzzy_segmented_index_get_n_segments:
+ * @self: a #DzlFuzzySegmentedIndex
+ *
+ * Gets the number of segments that are queried.
+ *
+ * Returns: the number of segments
+ *
+ * Since: 3.46
+ */
+guint
+dzl_fuzzy_segmented_index_get_n_segments (DzlFuzzySegmentedIndex *self)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_SEGMENTED_INDEX (self), 0);
+
+  return self->segments->len;
+}
+
+static void
+add_segment_foreach_cb (const gchar *key,
+                        GVariant    *document,
+                        guint        priority,
+                        gpointer     user_data)
+{
+  DzlFuzzySegmentedIndex *self = user_data;
+  guint generation = g_array_index (self->generations, guint, self->generations->len - 1);
+
+  hide (self->tombstones->documents,
+        g_variant_ref (document),
+        (GDestroyNotify)g_variant_unref,
+        generation);
+}
+
+/**
+ * dzl_fuzzy_segmented_index_add_segment:
+ * @self: a #DzlFuzzySegmentedIndex
+ * @segment: a loaded #DzlFuzzyIndex
+ *
+ * Adds @segment as the newest segment of the index. Documents in @segment
+ * replace the same documents in the segments that were added before it,
+ * including any of their keys that @segment no longer contains. Keys of
+ * other documents are not affected.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_segmented_index_add_segment (DzlFuzzySegmentedIndex *self,
+                                       DzlFuzzyIndex          *segment)
+{
+  guint generation;
+
+  g_return_if_fail (DZL_IS_FUZZY_SEGMENTED_INDEX (self));
+  g_return_if_fail (DZL_IS_FUZZY_INDEX (segment));
+
+  for (guint i = 0; i < self->segments->len; i++)
+    g_return_if_fail (g_ptr_array_index (self->segments, i) != (gpointer)segment);
+
+  generation = self->next_generation++;
+
+  g_ptr_array_add (self->segments, g_object_ref (segment));
+  g_array_append_val (self->generations, generation);
+
+  /* Nothing to hide if this is the base segment */
+  if (self->segments->len > 1)
+    {
+      dzl_fuzzy_segmented_index_edit_tombstones (self);
+      _dzl_fuzzy_index_foreach (segment, add_segment_foreach_cb, self);
+    }
+}
+
+/**
+ * dzl_fuzzy_segmented_index_remove_key:
+ * @self: a #DzlFuzzySegmentedIndex
+ * @key: the key to remove
+ *
+ * Hides @key in all of the current segments. Segments added afterwards
+ * may contain @key again.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_segmented_index_remove_key (DzlFuzzySegmentedIndex *self,
+                                      const gchar            *key)
+{
+  g_return_if_fail (DZL_IS_FUZZY_SEGMENTED_INDEX (self));
+  g_return_if_fail (key != NULL);
+
+  hide (dzl_fuzzy_segmented_index_edit_tombstones (self)->keys,
+        g_strdup (key),
+        g_free,
+        self->next_generation);
+}
+
+/**
+ * dzl_fuzzy_segmented_index_remove_document:
+ * @self: a #DzlFuzzySegmentedIndex
+ * @document: the document to remove
+ *
+ * Hides every key pointing at @document in all of the current segments.
+ * Segments added afterwards may contain @document again.
+ *
+ * If @document is floating, it will be consumed.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_segmented_index_remove_document (DzlFuzzySegmentedIndex *self,
+                                           GVariant               *document)
+{
+  g_return_if_fail (DZL_IS_FUZZY_SEGMENTED_INDEX (self));
+  g_return_if_fail (document != NULL);
+
+  hide (dzl_fuzzy_segmented_index_edit_tombstones (self)->documents,
+        g_variant_ref_sink (document),
+        (GDestroyNotify)g_variant_unref,
+        self->next_generation);
+}
+
+static void
+query_free (gpointer data)
+{
+  Query *q = data;
+
+  g_clear_pointer (&q->query, g_free);
+  g_clear_pointer (&q->segments, g_ptr_array_unref);
+  g_clear_pointer (&q->generations, g_array_unref);
+  g_clear_pointer (&q->tombstones, tombstones_unref);
+  g_clear_pointer (&q->matches, g_ptr_array_unref);
+  g_clear_pointer (&q->requeried, g_free);
+  g_clear_error (&q->error);
+  g_slice_free (Query, q);
+}
+
+static gint
+match_compare (gconstpointer a,
+               gconstpointer b)
+{
+  DzlFuzzyIndexMatch *matcha = *(DzlFuzzyIndexMatch * const *)a;
+  DzlFuzzyIndexMatch *matchb = *(DzlFuzzyIndexMatch * const *)b;
+  gfloat scorea = dzl_fuzzy_index_match_get_score (matcha);
+  gfloat scoreb = dzl_fuzzy_index_match_get_score (matchb);
+
+  if (scorea > scoreb)
+    return -1;
+  else if (scorea < scoreb)
+    return 1;
+
+  return strcmp (dzl_fuzzy_index_match_get_key (matcha),
+                 dzl_fuzzy_index_match_get_key (matchb));
+}
+
+static void
+query_complete (GTask *task)
+{
+  Query *q = g_task_get_task_data (task);
+  g_autoptr(GHashTable) by_document = NULL;
+  g_autoptr(GPtrArray) unique = NULL;
+  GListStore *store;
+  guint n_items;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (q->n_active == 0);
+
+  if (q->error != NULL)
+    {
+      g_task_return_error (task, g_steal_pointer (&q->error));
+      return;
+    }
+
+  /*
+   * Like a single index, only the best match of each document is kept.
+   * The same document may be found in more than one segment.
+   */
+  by_document = g_hash_table_new (dzl_g_variant_hash, g_variant_equal);
+  unique = g_ptr_array_new ();
+
+  g_ptr_array_sort (q->matches, match_compare);
+
+  for (guint i = 0; i < q->matches->len; i++)
+    {
+      DzlFuzzyIndexMatch *match = g_ptr_array_index (q->matches, i);
+      GVariant *document = dzl_fuzzy_index_match_get_document (match);
+
+      if (document != NULL)
+        {
+          if (g_hash_table_contains (by_document, document))
+            continue;
+          g_hash_table_add (by_document, document);
+        }
+
+      g_ptr_array_add (unique, match);
+    }
+
+  n_items = unique->len;
+  if (q->max_matches > 0)
+    n_items = MIN (n_items, q->max_matches);
+
+  store = g_list_store_new (DZL_TYPE_FUZZY_INDEX_MATCH);
+
+  for (guint i = 0; i < n_items; i++)
+    g_list_store_append (store, g_ptr_array_index (unique, i));
+
+  g_task_return_pointer (task, store, g_object_unref);
+}
+
+static void
+dzl_fuzzy_segmented_index_query_cb (GObject      *object,
+                                    GAsyncResult *result,
+                                    gpointer      user_data)
+{
+  DzlFuzzyIndex *segment = (DzlFuzzyIndex *)object;
+  g_autoptr(GListModel) model = NULL;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GError) error = NULL;
+  Query *q = g_task_get_task_data (task);
+  guint generation = 0;
+  guint n_items;
+  guint n_visible = 0;
+  guint index = 0;
+
+  g_assert (DZL_IS_FUZZY_INDEX (segment));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (G_IS_TASK (task));
+
+  for (guint i = 0; i < q->segments->len; i++)
+    {
+      if (g_ptr_array_index (q->segments, i) == (gpointer)segment)
+        {
+          index = i;
+          generation = g_array_index (q->generations, guint, i);
+          break;
+        }
+    }
+
+  if (!(model = dzl_fuzzy_index_query_finish (segment, result, &error)))
+    {
+      if (q->error == NULL)
+        q->error = g_steal_pointer (&error);
+      goto finish;
+    }
+
+  n_items = g_list_model_get_n_items (model);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(DzlFuzzyIndexMatch) match = g_list_model_get_item (model, i);
+
+      if (!is_hidden (q->tombstones,
+                      dzl_fuzzy_index_match_get_key (match),
+                      dzl_fuzzy_index_match_get_document (match),
+                      generation))
+        n_visible++;
+    }
+
+  /*
+   * We asked for enough matches to cover the keys that could be hidden in
+   * this segment, but a key may map to many documents. If too many were
+   * hidden, and there could be more results, we have to ask again without
+   * a limit.
+   */
+  if (q->max_matches > 0 &&
+      n_visible < q->max_matches &&
+      n_items == q->max_matches + tombstones_count_hiding (q->tombstones, generation) &&
+      !q->requeried [index])
+    {
+      q->requeried [index] = TRUE;
+      dzl_fuzzy_index_query_async (segment,
+                                   q->query,
+                                   0,
+                                   g_task_get_cancellable (task),
+                                   dzl_fuzzy_segmented_index_query_cb,
+                                   g_steal_pointer (&task));
+      return;
+    }
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(DzlFuzzyIndexMatch) match = g_list_model_get_item (model, i);
+
+      if (!is_hidden (q->tombstones,
+                      dzl_fuzzy_index_match_get_key (match),
+                      dzl_fuzzy_index_match_get_document (match),
+                      generation))
+        g_ptr_array_add (q->matches, g_steal_pointer (&match));
+    }
+
+finish:
+  q->n_active--;
+
+  if (q->n_active == 0)
+    query_complete (task);
+}
+
+/**
+ * dzl_fuzzy_segmented_index_query_async:
+ * @self: a #DzlFuzzySegmentedIndex
+ * @query: the query to perform
+ * @max_matches: the maximum number of matches, or 0 for no limit
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: a callback to execute upon completion
+ * @user_data: user data for @callback
+ *
+ * Queries all of the segments, skipping results which have been hidden
+ * by newer segments or removed, and merges the results by score.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_segmented_index_query_async (DzlFuzzySegmentedIndex *self,
+                                       const gchar            *query,
+                                       guint                   max_matches,
+                                       GCancellable           *cancellable,
+                                       GAsyncReadyCallback     callback,
+                                       gpointer                user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  Query *q;
+
+  g_return_if_fail (DZL_IS_FUZZY_SEGMENTED_INDEX (self));
+  g_return_if_fail (query != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, dzl_fuzzy_segmented_index_query_async);
+
+  /*
+   * Snapshot our state so that changes made while the query is running,
+   * such as a compaction completing, do not affect the results.
+   */
+  q = g_slice_new0 (Query);
+  q->query = g_strdup (query);
+  q->max_matches = max_matches;
+  q->segments = g_ptr_array_new_with_free_func (g_object_unref);
+  q->generations = g_array_new (FALSE, FALSE, sizeof (guint));
+  q->tombstones = dzl_fuzzy_segmented_index_get_tombstones (self);
+  q->matches = g_ptr_array_new_with_free_func (g_object_unref);
+  q->requeried = g_new0 (gboolean, MAX (1, self->segments->len));
+  q->n_active = self->segments->len;
+  g_task_set_task_data (task, q, query_free);
+
+  for (guint i = 0; i < self->segments->len; i++)
+    {
+      g_ptr_array_add (q->segments, g_object_ref (g_ptr_array_index (self->segments, i)));
+      g_array_append_val (q->generations, g_array_index (self->generations, guint, i));
+    }
+
+  if (q->n_active == 0)
+    {
+      query_complete (task);
+      return;
+    }
+
+  /*
+   * Ask each segment for enough matches to fill max_matches even if the
+   * tombstones newer than the segment each hide one of them.
+   */
+  for (guint i = 0; i < q->segments->len; i++)
+    {
+      guint generation = g_array_index (q->generations, guint, i);
+
+      dzl_fuzzy_index_query_async (g_ptr_array_index (q->segments, i),
+                                   query,
+                                   max_matches ? max_matches + tombstones_count_hiding (q->tombstones, generation) : 0,
+                                   cancellable,
+                                   dzl_fuzzy_segmented_index_query_cb,
+                                   g_object_ref (task));
+    }
+}
+
+/**
+ * dzl_fuzzy_segmented_index_query_finish:
+ * @self: a #DzlFuzzySegmentedIndex
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Completes a request to dzl_fuzzy_segmented_index_query_async().
+ *
+ * Returns: (transfer full): a #GListModel of #DzlFuzzyIndexMatch
+ *
+ * Since: 3.46
+ */
+GListModel *
+dzl_fuzzy_segmented_index_query_finish (DzlFuzzySegmentedIndex  *self,
+                                        GAsyncResult            *result,
+                                        GError                 **error)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_SEGMENTED_INDEX (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+compact_free (gpointer data)
+{
+  Compact *c = data;
+
+  g_clear_object (&c->builder);
+  g_clear_object (&c->file);
+  g_clear_pointer (&c->segments, g_ptr_array_unref);
+  g_clear_pointer (&c->generations, g_array_unref);
+  g_clear_pointer (&c->tombstones, tombstones_unref);
+  g_slice_free (Compact, c);
+}
+
+static void
+compact_foreach_cb (const gchar *key,
+                    GVariant    *document,
+                    guint        priority,
+                    gpointer     user_data)
+{
+  Compact *c = user_data;
+
+  if (!is_hidden (c->tombstones, key, document, c->current))
+    dzl_fuzzy_index_builder_insert (c->builder, key, document, priority);
+}
+
+static void
+dzl_fuzzy_segmented_index_compact_worker (GTask        *task,
+                                          gpointer      source_object,
+                                          gpointer      task_data,
+                                          GCancellable *cancellable)
+{
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(GError) error = NULL;
+  Compact *c = task_data;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (DZL_IS_FUZZY_SEGMENTED_INDEX (source_object));
+  g_assert (c != NULL);
+
+  for (guint i = 0; i < c->segments->len; i++)
+    {
+      if (g_task_return_error_if_cancelled (task))
+        return;
+
+      c->current = g_array_index (c->generations, guint, i);
+      _dzl_fuzzy_index_foreach (g_ptr_array_index (c->segments, i), compact_foreach_cb, c);
+    }
+
+  index = dzl_fuzzy_index_new ();
+
+  if (!dzl_fuzzy_index_builder_write (c->builder, c->file, g_task_get_priority (task), cancellable, &error) ||
+      !dzl_fuzzy_index_load_file (index, c->file, cancellable, &error))
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_pointer (task, g_steal_pointer (&index), g_object_unref);
+}
+
+static void
+dzl_fuzzy_segmented_index_compact_cb (GObject      *object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data)
+{
+  DzlFuzzySegmentedIndex *self = (DzlFuzzySegmentedIndex *)object;
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GError) error = NULL;
+  Compact *c = g_task_get_task_data (G_TASK (result));
+  GHashTableIter iter;
+  Tombstones *t;
+  gpointer value;
+  guint n_compacted = 0;
+
+  g_assert (DZL_IS_FUZZY_SEGMENTED_INDEX (self));
+  g_assert (G_IS_TASK (result));
+  g_assert (G_IS_TASK (task));
+
+  self->compacting = FALSE;
+
+  if (!(index = g_task_propagate_pointer (G_TASK (result), &error)))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  /*
+   * Replace the segments we merged with the new base. It takes the
+   * generation of the newest merged segment so that everything added
+   * while compacting still applies to it.
+   */
+  while (n_compacted < self->generations->len &&
+         g_array_index (self->generations, guint, n_compacted) <= c->generation)
+    n_compacted++;
+
+  g_ptr_array_remove_range (self->segments, 0, n_compacted);
+  g_array_remove_range (self->generations, 0, n_compacted);
+
+  g_ptr_array_insert (self->segments, 0, g_steal_pointer (&index));
+  g_array_insert_val (self->generations, 0, c->generation);
+
+  /* Drop anything that only hid keys within the merged segments */
+  t = dzl_fuzzy_segmented_index_edit_tombstones (self);
+
+  g_hash_table_iter_init (&iter, t->keys);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      if (GPOINTER_TO_UINT (value) <= c->generation)
+        g_hash_table_iter_remove (&iter);
+    }
+
+  g_hash_table_iter_init (&iter, t->documents);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      if (GPOINTER_TO_UINT (value) <= c->generation)
+        g_hash_table_iter_remove (&iter);
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * dzl_fuzzy_segmented_index_compact_async:
+ * @self: a #DzlFuzzySegmentedIndex
+ * @builder: an empty #DzlFuzzyIndexBuilder
+ * @file: the file to write the new base index to
+ * @io_priority: the priority for IO operations
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: a callback to execute upon completion
+ * @user_data: user data for @callback
+ *
+ * Merges the visible contents of all of the segments into a new index
+ * written to @file, in a thread. When complete, the new index replaces
+ * the merged segments. Segments added and keys removed while compacting
+ * are preserved.
+ *
+ * @builder is used to write @file, so metadata and format options may be
+ * set on it beforehand. Case sensitivity is taken from the base segment.
+ *
+ * Since: 3.46
+ */
+void
+dzl_fuzzy_segmented_index_compact_async (DzlFuzzySegmentedIndex *self,
+                                         DzlFuzzyIndexBuilder   *builder,
+                                         GFile                  *file,
+                                         gint                    io_priority,
+                                         GCancellable           *cancellable,
+                                         GAsyncReadyCallback     callback,
+                                         gpointer                user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GTask) worker = NULL;
+  Compact *c;
+
+  g_return_if_fail (DZL_IS_FUZZY_SEGMENTED_INDEX (self));
+  g_return_if_fail (DZL_IS_FUZZY_INDEX_BUILDER (builder));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, dzl_fuzzy_segmented_index_compact_async);
+  g_task_set_priority (task, io_priority);
+
+  if (self->compacting)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_PENDING,
+                               "The index is already being compacted");
+      return;
+    }
+
+  if (self->segments->len == 0)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVAL,
+                               "There are no segments to compact");
+      return;
+    }
+
+  c = g_slice_new0 (Compact);
+  c->builder = g_object_ref (builder);
+  c->file = g_object_ref (file);
+  c->segments = g_ptr_array_new_with_free_func (g_object_unref);
+  c->generations = g_array_new (FALSE, FALSE, sizeof (guint));
+  c->tombstones = dzl_fuzzy_segmented_index_get_tombstones (self);
+  c->generation = g_array_index (self->generations, guint, self->generations->len - 1);
+
+  for (guint i = 0; i < self->segments->len; i++)
+    {
+      g_ptr_array_add (c->segments, g_object_ref (g_ptr_array_index (self->segments, i)));
+      g_array_append_val (c->generations, g_array_index (self->generations, guint, i));
+    }
+
+  dzl_fuzzy_index_builder_set_case_sensitive (builder,
+                                              _dzl_fuzzy_index_get_case_sensitive (g_ptr_array_index (self->segments, 0)));
+
+  self->compacting = TRUE;
+
+  worker = g_task_new (self, cancellable, dzl_fuzzy_segmented_index_compact_cb, g_steal_pointer (&task));
+  g_task_set_source_tag (worker, dzl_fuzzy_segmented_index_compact_worker);
+  g_task_set_priority (worker, io_priority);
+  g_task_set_task_data (worker, c, compact_free);
+  g_task_run_in_thread (worker, dzl_fuzzy_segmented_index_compact_worker);
+}
+
+/**
+ * dzl_fuzzy_segmented_index_compact_finish:
+ * @self: a #DzlFuzzySegmentedIndex
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Completes a request to dzl_fuzzy_segmented_index_compact_async().
+ *
+ * Returns: %TRUE if the segments were compacted; otherwise %FALSE
+ *   and @error is set.
+ *
+ * Since: 3.46
+ */
+gboolean
+dzl_fuzzy_segmented_index_compact_finish (DzlFuzzySegmentedIndex  *self,
+                                          GAsyncResult            *result,
+                                          GError                 **error)
+{
+  g_return_val_if_fail (DZL_IS_FUZZY_SEGMENTED_INDEX (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
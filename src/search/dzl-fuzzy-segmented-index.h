@@ -0,0 +1,75 @@
+/* dzl-fuzzy-segmented-index.h
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DZL_FUZZY_SEGMENTED_INDEX_H
+#define DZL_FUZZY_SEGMENTED_INDEX_H
+
+#include <gio/gio.h>
+
+#include "dzl-version-macros.h"
+
+#include "dzl-fuzzy-index.h"
+#include "dzl-fuzzy-index-builder.h"
+
+G_BEGIN_DECLS
+
+#define DZL_TYPE_FUZZY_SEGMENTED_INDEX (dzl_fuzzy_segmented_index_get_type())
+
+DZL_AVAILABLE_IN_3_46
+G_DECLARE_FINAL_TYPE (DzlFuzzySegmentedIndex, dzl_fuzzy_segmented_index, DZL, FUZZY_SEGMENTED_INDEX, GObject)
+
+DZL_AVAILABLE_IN_3_46
+DzlFuzzySegmentedIndex *dzl_fuzzy_segmented_index_new             (void);
+DZL_AVAILABLE_IN_3_46
+guint                   dzl_fuzzy_segmented_index_get_n_segments  (DzlFuzzySegmentedIndex  *self);
+DZL_AVAILABLE_IN_3_46
+void                    dzl_fuzzy_segmented_index_add_segment     (DzlFuzzySegmentedIndex  *self,
+                                                                   DzlFuzzyIndex           *segment);
+DZL_AVAILABLE_IN_3_46
+void                    dzl_fuzzy_segmented_index_remove_key      (DzlFuzzySegmentedIndex  *self,
+                                                                   const gchar             *key);
+DZL_AVAILABLE_IN_3_46
+void                    dzl_fuzzy_segmented_index_remove_document (DzlFuzzySegmentedIndex  *self,
+                                                                   GVariant                *document);
+DZL_AVAILABLE_IN_3_46
+void                    dzl_fuzzy_segmented_index_query_async     (DzlFuzzySegmentedIndex  *self,
+                                                                   const gchar             *query,
+                                                                   guint                    max_matches,
+                                                                   GCancellable            *cancellable,
+                                                                   GAsyncReadyCallback      callback,
+                                                                   gpointer                 user_data);
+DZL_AVAILABLE_IN_3_46
+GListModel             *dzl_fuzzy_segmented_index_query_finish    (DzlFuzzySegmentedIndex  *self,
+                                                                   GAsyncResult            *result,
+                                                                   GError                 **error);
+DZL_AVAILABLE_IN_3_46
+void                    dzl_fuzzy_segmented_index_compact_async   (DzlFuzzySegmentedIndex  *self,
+                                                                   DzlFuzzyIndexBuilder    *builder,
+                                                                   GFile                   *file,
+                                                                   gint                     io_priority,
+                                                                   GCancellable            *cancellable,
+                                                                   GAsyncReadyCallback      callback,
+                                                                   gpointer                 user_data);
+DZL_AVAILABLE_IN_3_46
+gboolean                dzl_fuzzy_segmented_index_compact_finish  (DzlFuzzySegmentedIndex  *self,
+                                                                   GAsyncResult            *result,
+                                                                   GError                 **error);
+
+G_END_DECLS
+
+#endif /* DZL_FUZZY_SEGMENTED_INDEX_H */
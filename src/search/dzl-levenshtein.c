@@ -23,87 +23,289 @@
 
 #include "dzl-levenshtein.h"
 
-gint
-dzl_levenshtein (const gchar *needle,
-                 const gchar *haystack)
+/*
+ * Strings up to this many bytes are decoded onto the stack.
+ */
+#define N_STACK_CHARS 128
+
+/*
+ * Myers' bit-vector algorithm keeps one bit per character of the shorter
+ * string, so it handles strings up to this many characters.
+ */
+#define MYERS_MAX_CHARS 64
+
+typedef struct
 {
-   const gchar *s;
-   const gchar *t;
-   gunichar sc;
-   gunichar tc;
-   gint *v0;
-   gint *v1;
-   gint haystack_char_len;
-   gint cost;
-   gint i;
-   gint j;
-   gint ret;
+   gunichar ch;
+   guint64  mask;
+} PeqEntry;
 
-   g_return_val_if_fail (needle, G_MAXINT);
-   g_return_val_if_fail (haystack, G_MAXINT);
+/*
+ * Decodes @str into codepoints, using @stack if it is large enough. ASCII
+ * strings are widened without going through the UTF-8 decoder.
+ */
+static gunichar *
+decode (const gchar *str,
+        gunichar    *stack,
+        guint       *len)
+{
+   const guint8 *p;
+   gunichar *ret;
+   gboolean ascii = TRUE;
+   gsize n_bytes = 0;
+   guint i;
 
-   /*
-    * Handle degenerate cases.
-    */
-   if (!g_strcmp0(needle, haystack)) {
-      return 0;
-   } else if (!*needle) {
-      return g_utf8_strlen(haystack, -1);
-   } else if (!*haystack) {
-      return g_utf8_strlen(needle, -1);
+   for (p = (const guint8 *)str; *p; p++) {
+      ascii &= (*p < 0x80);
+      n_bytes++;
    }
 
-   haystack_char_len = g_utf8_strlen (haystack, -1);
-
-   /*
-    * Create two vectors to hold our states.
-    */
-   v0 = g_new0(int, haystack_char_len + 1);
-   v1 = g_new0(int, haystack_char_len + 1);
-
-   /*
-    * initialize v0 (the previous row of distances).
-    * this row is A[0][i]: edit distance for an empty needle.
-    * the distance is just the number of characters to delete from haystack.
-    */
-   for (i = 0; i < haystack_char_len + 1; i++) {
-      v0[i] = i;
+   /* Never more codepoints than bytes */
+   ret = (n_bytes <= N_STACK_CHARS) ? stack : g_new (gunichar, n_bytes);
+
+   if (ascii) {
+      for (i = 0; i < n_bytes; i++)
+         ret[i] = ((const guint8 *)str)[i];
+      *len = n_bytes;
+   } else {
+      for (i = 0; *str; i++, str = g_utf8_next_char (str))
+         ret[i] = g_utf8_get_char (str);
+      *len = i;
    }
 
-   for (i = 0, s = needle; s && *s; i++, s = g_utf8_next_char(s)) {
-      /*
-       * Calculate v1 (current row distances) from the previous row v0.
-       */
+   return ret;
+}
 
-      sc = g_utf8_get_char(s);
+/*
+ * The pattern bitmasks for Myers' algorithm, stored in a small open
+ * addressed table. ASCII characters always land in their own slot.
+ */
+static inline guint
+peq_slot (const PeqEntry *peq,
+          gunichar        ch)
+{
+   guint slot = ch % (MYERS_MAX_CHARS * 2);
 
-      /*
-       * first element of v1 is A[i+1][0]
-       *
-       * edit distance is delete (i+1) chars from needle to match empty
-       * haystack.
-       */
-      v1[0] = i + 1;
+   while (peq[slot].mask != 0 && peq[slot].ch != ch)
+      slot = (slot + 1) % (MYERS_MAX_CHARS * 2);
+
+   return slot;
+}
+
+/*
+ * Computes the edit distance using Myers' bit-parallel algorithm, as
+ * described by Hyyrö for the global edit distance. @a is the shorter
+ * string, with at most MYERS_MAX_CHARS characters. Gives up once the
+ * distance is known to be greater than @max_distance.
+ */
+static gint
+levenshtein_myers (const gunichar *a,
+                   guint           m,
+                   const gunichar *b,
+                   guint           n,
+                   gint            max_distance)
+{
+   PeqEntry peq[MYERS_MAX_CHARS * 2] = {{ 0 }};
+   guint64 last = G_GUINT64_CONSTANT (1) << (m - 1);
+   guint64 pv = ~G_GUINT64_CONSTANT (0);
+   guint64 mv = 0;
+   gint score = m;
+   guint i;
+
+   g_assert (m > 0);
+   g_assert (m <= MYERS_MAX_CHARS);
+
+   for (i = 0; i < m; i++) {
+      guint slot = peq_slot (peq, a[i]);
+
+      peq[slot].ch = a[i];
+      peq[slot].mask |= G_GUINT64_CONSTANT (1) << i;
+   }
+
+   for (i = 0; i < n; i++) {
+      guint64 eq = peq[peq_slot (peq, b[i])].mask;
+      guint64 xv = eq | mv;
+      guint64 xh = (((eq & pv) + pv) ^ pv) | eq;
+      guint64 ph = mv | ~(xh | pv);
+      guint64 mh = pv & xh;
+
+      if (ph & last)
+         score++;
+      else if (mh & last)
+         score--;
 
       /*
-       * use formula to fill in the rest of the row.
+       * Each remaining character can lower the distance by at most one,
+       * so stop once we cannot get back within the bound.
        */
-      for (j = 0, t = haystack; t && *t; j++, t = g_utf8_next_char(t)) {
-         tc = g_utf8_get_char(t);
-         cost = (sc == tc) ? 0 : 1;
-         v1[j+1] = MIN(v1[j] + 1, MIN(v0[j+1] + 1, v0[j] + cost));
+      if (score - (gint)(n - i - 1) > max_distance)
+         return max_distance + 1;
+
+      ph = (ph << 1) | 1;
+      mh <<= 1;
+
+      pv = mh | ~(xv | ph);
+      mv = ph & xv;
+   }
+
+   return score;
+}
+
+/*
+ * Computes the edit distance using the classic dynamic programming
+ * approach, but only for the cells within @max_distance of the diagonal
+ * (Ukkonen's band). Anything outside the band is known to be greater than
+ * @max_distance and is clamped to max_distance + 1.
+ */
+static gint
+levenshtein_banded (const gunichar *a,
+                    guint           m,
+                    const gunichar *b,
+                    guint           n,
+                    gint            max_distance)
+{
+   gint stack[N_STACK_CHARS + 1];
+   gint *row;
+   gint over = max_distance + 1;
+   gint ret;
+   guint i;
+   guint j;
+
+   row = (n <= N_STACK_CHARS) ? stack : g_new (gint, n + 1);
+
+   /* Distances from the empty prefix of @a */
+   for (j = 0; j <= n; j++)
+      row[j] = MIN ((gint)j, over);
+
+   for (i = 1; i <= m; i++) {
+      guint lo = (i > (guint)max_distance) ? i - max_distance : 1;
+      guint hi = MIN (n, i + (guint)max_distance);
+      gint diag = row[lo - 1];
+      gint left = (lo == 1) ? MIN ((gint)i, over) : over;
+      gint row_min = left;
+
+      row[lo - 1] = left;
+
+      for (j = lo; j <= hi; j++) {
+         gint up = row[j];
+         gint val = MIN (MIN (up, left) + 1, diag + (a[i - 1] != b[j - 1]));
+
+         val = MIN (val, over);
+         diag = up;
+         row[j] = left = val;
+         row_min = MIN (row_min, val);
       }
 
-      /*
-       * copy v1 (current row) to v0 (previous row) for next iteration.
-       */
-      memcpy(v0, v1, sizeof(gint) * haystack_char_len);
+      /* Distances never decrease along a diagonal, so we can stop early */
+      if (row_min >= over) {
+         ret = over;
+         goto cleanup;
+      }
+   }
+
+   ret = row[n];
+
+cleanup:
+   if (row != stack)
+      g_free (row);
+
+   return ret;
+}
+
+static gint
+levenshtein (const gchar *needle,
+             const gchar *haystack,
+             gint         max_distance)
+{
+   gunichar needle_stack[N_STACK_CHARS];
+   gunichar haystack_stack[N_STACK_CHARS];
+   gunichar *a;
+   gunichar *b;
+   guint m;
+   guint n;
+   gint ret;
+
+   if (!g_strcmp0 (needle, haystack))
+      return 0;
+
+   a = decode (needle, needle_stack, &m);
+   b = decode (haystack, haystack_stack, &n);
+
+   /* The distance is symmetric, so keep the shorter string in @a */
+   if (m > n) {
+      gunichar *tmp_chars = a;
+      guint tmp_len = m;
+
+      a = b;
+      m = n;
+      b = tmp_chars;
+      n = tmp_len;
    }
 
-   ret = v1[haystack_char_len];
+   /* The distance can never exceed the length of the longer string */
+   max_distance = MIN ((guint)max_distance, n);
 
-   g_free(v0);
-   g_free(v1);
+   if (n - m > (guint)max_distance)
+      ret = max_distance + 1;
+   else if (m == 0)
+      ret = n;
+   else if (m <= MYERS_MAX_CHARS)
+      ret = levenshtein_myers (a, m, b, n, max_distance);
+   else
+      ret = levenshtein_banded (a, m, b, n, max_distance);
+
+   if (a != needle_stack && a != haystack_stack)
+      g_free (a);
+   if (b != needle_stack && b != haystack_stack)
+      g_free (b);
 
    return ret;
 }
+
+/**
+ * dzl_levenshtein:
+ * @needle: the string to compare
+ * @haystack: the string to compare against
+ *
+ * Computes the Levenshtein distance between @needle and @haystack, which
+ * is the number of codepoints that need to be inserted, deleted or
+ * substituted to turn one into the other.
+ *
+ * Returns: the edit distance between the strings
+ */
+gint
+dzl_levenshtein (const gchar *needle,
+                 const gchar *haystack)
+{
+   g_return_val_if_fail (needle, G_MAXINT);
+   g_return_val_if_fail (haystack, G_MAXINT);
+
+   return levenshtein (needle, haystack, G_MAXINT);
+}
+
+/**
+ * dzl_levenshtein_bounded:
+ * @needle: the string to compare
+ * @haystack: the string to compare against
+ * @max_distance: the largest distance of interest
+ *
+ * Like dzl_levenshtein(), but stops as soon as the distance is known to
+ * be greater than @max_distance. This is much faster when ranking many
+ * candidates where only close matches are of interest.
+ *
+ * Returns: the edit distance between the strings, or @max_distance + 1
+ *   if the distance is greater than @max_distance.
+ *
+ * Since: 3.46
+ */
+gint
+dzl_levenshtein_bounded (const gchar *needle,
+                         const gchar *haystack,
+                         gint         max_distance)
+{
+   g_return_val_if_fail (needle, G_MAXINT);
+   g_return_val_if_fail (haystack, G_MAXINT);
+   g_return_val_if_fail (max_distance >= 0, G_MAXINT);
+
+   return levenshtein (needle, haystack, max_distance);
+}
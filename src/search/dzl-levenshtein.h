@@ -26,8 +26,12 @@
 G_BEGIN_DECLS
 
 DZL_AVAILABLE_IN_ALL
-gint dzl_levenshtein (const gchar *needle,
-                      const gchar *haystack);
+gint dzl_levenshtein         (const gchar *needle,
+                              const gchar *haystack);
+DZL_AVAILABLE_IN_3_46
+gint dzl_levenshtein_bounded (const gchar *needle,
+                              const gchar *haystack,
+                              gint         max_distance);
 
 G_END_DECLS
 
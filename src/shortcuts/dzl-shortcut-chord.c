@@ -52,12 +52,24 @@ typedef struct
   gpointer data;
 } DzlShortcutChordTableEntry;
 
+/*
+ * The entries are kept sorted by chord, which makes the array a flattened
+ * prefix-trie: every chord sharing the first N keys lives in a contiguous
+ * range, and the children of that range are sorted by their N+1th key. A
+ * lookup therefore narrows the range with two binary searches per key
+ * rather than walking over every partial match.
+ *
+ * While frozen, entries are appended after @n_sorted and merged in when the
+ * table is thawed (or looked up), so bulk loading sorts only once.
+ */
 struct _DzlShortcutChordTable
 {
   DzlShortcutChordTableEntry *entries;
   GDestroyNotify              destroy;
   guint                       len;
   guint                       size;
+  guint                       n_sorted;
+  guint                       freeze_count;
 };
 
 static inline gboolean
@@ -85,6 +97,14 @@ dzl_shortcut_chord_compare (const DzlShortcutChord *a,
   return memcmp (a, b, sizeof *a);
 }
 
+static inline gint
+dzl_shortcut_key_compare (const DzlShortcutKey *a,
+                          const DzlShortcutKey *b)
+{
+  /* Must order keys the same way dzl_shortcut_chord_compare() orders chords */
+  return memcmp (a, b, sizeof *a);
+}
+
 static gboolean
 dzl_shortcut_chord_is_valid (const DzlShortcutChord *self)
 {
@@ -419,15 +439,133 @@ dzl_shortcut_chord_table_add (DzlShortcutChordTable  *self,
       self->entries = g_renew (DzlShortcutChordTableEntry, self->entries, self->size);
     }
 
-  self->entries[self->len].chord = *chord;
-  self->entries[self->len].data = data;
+  if (self->freeze_count > 0 || self->n_sorted < self->len)
+    {
+      self->entries[self->len].chord = *chord;
+      self->entries[self->len].data = data;
+      self->len++;
+    }
+  else
+    {
+      guint lo = 0;
+      guint hi = self->len;
+
+      /* Insert after any equal chords so that the first one added wins */
+      while (lo < hi)
+        {
+          guint mid = lo + (hi - lo) / 2;
+
+          if (dzl_shortcut_chord_compare (&self->entries[mid].chord, chord) <= 0)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+      if (lo < self->len)
+        memmove (&self->entries[lo + 1],
+                 &self->entries[lo],
+                 sizeof (DzlShortcutChordTableEntry) * (self->len - lo));
+
+      self->entries[lo].chord = *chord;
+      self->entries[lo].data = data;
+      self->len++;
+      self->n_sorted++;
+    }
+}
+
+static void
+dzl_shortcut_chord_table_ensure_sorted (DzlShortcutChordTable *self)
+{
+  DzlShortcutChordTableEntry *sorted;
+  DzlShortcutChordTableEntry *tail;
+  guint n_tail;
+  guint i = 0;
+  guint j = 0;
+  guint k = 0;
+
+  g_assert (self != NULL);
+
+  if (self->n_sorted == self->len)
+    return;
 
-  self->len++;
+  n_tail = self->len - self->n_sorted;
+  tail = &self->entries[self->n_sorted];
 
-  qsort (self->entries,
-         self->len,
+  qsort (tail,
+         n_tail,
          sizeof (DzlShortcutChordTableEntry),
          dzl_shortcut_chord_table_sort);
+
+  if (self->n_sorted == 0)
+    {
+      self->n_sorted = self->len;
+      return;
+    }
+
+  /*
+   * Merge the newly sorted tail into the already sorted head. The write
+   * position never passes the read position within the tail, so only the
+   * head needs to be copied aside.
+   */
+  sorted = g_new (DzlShortcutChordTableEntry, self->n_sorted);
+  memcpy (sorted, self->entries, sizeof (DzlShortcutChordTableEntry) * self->n_sorted);
+
+  while (i < self->n_sorted && j < n_tail)
+    {
+      if (dzl_shortcut_chord_compare (&sorted[i].chord, &tail[j].chord) <= 0)
+        self->entries[k++] = sorted[i++];
+      else
+        self->entries[k++] = tail[j++];
+    }
+
+  while (i < self->n_sorted)
+    self->entries[k++] = sorted[i++];
+
+  g_assert (k + (n_tail - j) == self->len);
+
+  self->n_sorted = self->len;
+
+  g_free (sorted);
+}
+
+/**
+ * dzl_shortcut_chord_table_freeze:
+ * @self: a #DzlShortcutChordTable
+ *
+ * Defers sorting of chords added to @self until
+ * dzl_shortcut_chord_table_thaw() is called. Use this when adding
+ * many chords at once, such as when loading a theme.
+ *
+ * Lookups remain valid while frozen, but each one will first merge
+ * the chords added since the previous lookup.
+ *
+ * Since: 3.46
+ */
+void
+dzl_shortcut_chord_table_freeze (DzlShortcutChordTable *self)
+{
+  g_return_if_fail (self != NULL);
+
+  self->freeze_count++;
+}
+
+/**
+ * dzl_shortcut_chord_table_thaw:
+ * @self: a #DzlShortcutChordTable
+ *
+ * Reverses a call to dzl_shortcut_chord_table_freeze(), sorting any
+ * chords added while the table was frozen.
+ *
+ * Since: 3.46
+ */
+void
+dzl_shortcut_chord_table_thaw (DzlShortcutChordTable *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->freeze_count > 0);
+
+  if (--self->freeze_count == 0)
+    dzl_shortcut_chord_table_ensure_sorted (self);
 }
 
 static void
@@ -448,6 +586,9 @@ dzl_shortcut_chord_table_remove_index (DzlShortcutChordTable *self,
              entry + 1,
              sizeof *entry * (self->len - position - 1));
 
+  if (position < self->n_sorted)
+    self->n_sorted--;
+
   self->len--;
 
   if (self->destroy != NULL)
@@ -515,29 +656,14 @@ dzl_shortcut_chord_table_lookup_data (DzlShortcutChordTable *self,
   return NULL;
 }
 
-static gint
-dzl_shortcut_chord_find_partial (gconstpointer a,
-                                 gconstpointer b)
-{
-  const DzlShortcutChord *key = a;
-  const DzlShortcutChordTableEntry *element = b;
-
-  /*
-   * We are only looking for a partial match here so that we can walk backwards
-   * after the bsearch to the first partial match.
-   */
-  if (dzl_shortcut_chord_match (key, &element->chord) != DZL_SHORTCUT_MATCH_NONE)
-    return 0;
-
-  return dzl_shortcut_chord_compare (key, &element->chord);
-}
-
 DzlShortcutMatch
 dzl_shortcut_chord_table_lookup (DzlShortcutChordTable  *self,
                                  const DzlShortcutChord *chord,
                                  gpointer               *data)
 {
-  const DzlShortcutChordTableEntry *match;
+  guint n_keys;
+  guint lo;
+  guint hi;
 
   if (data != NULL)
     *data = NULL;
@@ -551,54 +677,67 @@ dzl_shortcut_chord_table_lookup (DzlShortcutChordTable  *self,
   if (self->len == 0)
     return DZL_SHORTCUT_MATCH_NONE;
 
+  dzl_shortcut_chord_table_ensure_sorted (self);
+
   /*
-   * This function works by performing a binary search to locate ourself
-   * somewhere within a match zone of the array. Once we are there, we walk
-   * back to the first item that is a partial match.  After that, we walk
-   * through every potential match looking for an exact match until we reach a
-   * non-partial-match or the end of the array.
-   *
-   * Based on our findings, we return the appropriate DzlShortcutMatch.
+   * Descend the flattened trie one key at a time. At depth @i, the range
+   * [lo,hi) contains every entry prefixed by the first @i keys of @chord and
+   * is sorted by the key at @i, so we can narrow it to the entries matching
+   * the next key with a lower and upper bound search.
    */
 
-  match = bsearch (chord, self->entries, self->len, sizeof (DzlShortcutChordTableEntry),
-                   dzl_shortcut_chord_find_partial);
+  n_keys = dzl_shortcut_chord_count_keys (chord);
+  lo = 0;
+  hi = self->len;
 
-  if (match != NULL)
+  for (guint i = 0; i < n_keys && lo < hi; i++)
     {
-      const DzlShortcutChordTableEntry *begin = self->entries;
-      const DzlShortcutChordTableEntry *end = self->entries + self->len;
-      DzlShortcutMatch ret = DZL_SHORTCUT_MATCH_PARTIAL;
+      const DzlShortcutKey *key = &chord->keys[i];
+      guint l = lo;
+      guint h = hi;
 
-      /* Find the first patial match */
-      while ((match - 1) >= begin &&
-             dzl_shortcut_chord_match (chord, &(match - 1)->chord) != DZL_SHORTCUT_MATCH_NONE)
-        match--;
+      while (l < h)
+        {
+          guint mid = l + (h - l) / 2;
 
-      g_assert (match >= begin);
+          if (dzl_shortcut_key_compare (&self->entries[mid].chord.keys[i], key) < 0)
+            l = mid + 1;
+          else
+            h = mid;
+        }
+
+      lo = l;
+      h = hi;
 
-      /* Now walk forward to see if we have an exact match */
-      while (DZL_SHORTCUT_MATCH_NONE != (ret = dzl_shortcut_chord_match (chord, &match->chord)))
+      while (l < h)
         {
-          if (ret == DZL_SHORTCUT_MATCH_EQUAL)
-            {
-              if (data != NULL)
-                *data = match->data;
-              return DZL_SHORTCUT_MATCH_EQUAL;
-            }
+          guint mid = l + (h - l) / 2;
 
-          match++;
+          if (dzl_shortcut_key_compare (&self->entries[mid].chord.keys[i], key) <= 0)
+            l = mid + 1;
+          else
+            h = mid;
+        }
 
-          g_assert (match <= end);
+      hi = l;
+    }
 
-          if (ret == 0 || match == end)
-            break;
-        }
+  if (lo == hi)
+    return DZL_SHORTCUT_MATCH_NONE;
 
-      return DZL_SHORTCUT_MATCH_PARTIAL;
+  /*
+   * An exact match has no further keys, and since an empty key sorts before
+   * any other key, it must be the first entry in the range.
+   */
+  if (n_keys == G_N_ELEMENTS (chord->keys) ||
+      self->entries[lo].chord.keys[n_keys].keyval == 0)
+    {
+      if (data != NULL)
+        *data = self->entries[lo].data;
+      return DZL_SHORTCUT_MATCH_EQUAL;
     }
 
-  return DZL_SHORTCUT_MATCH_NONE;
+  return DZL_SHORTCUT_MATCH_PARTIAL;
 }
 
 void
@@ -90,6 +90,10 @@ DZL_AVAILABLE_IN_ALL
 void                    dzl_shortcut_chord_table_add           (DzlShortcutChordTable        *self,
                                                                 const DzlShortcutChord       *chord,
                                                                 gpointer                      data);
+DZL_AVAILABLE_IN_3_46
+void                    dzl_shortcut_chord_table_freeze        (DzlShortcutChordTable        *self);
+DZL_AVAILABLE_IN_3_46
+void                    dzl_shortcut_chord_table_thaw          (DzlShortcutChordTable        *self);
 DZL_AVAILABLE_IN_ALL
 gboolean                dzl_shortcut_chord_table_remove        (DzlShortcutChordTable        *self,
                                                                 const DzlShortcutChord       *chord);
@@ -95,10 +95,23 @@ typedef struct
    */
   GList descendants_link;
 
+  /*
+   * The root controller caches the controllers found walking from the focus
+   * widget to the toplevel, so that capture and bubble phases do not need to
+   * walk the widget hierarchy for every key press. The chain is rebuilt when
+   * the focus widget changes, when it is moved within the hierarchy (which
+   * emits GtkWidget::hierarchy-changed on it), or when @chain_generation
+   * no longer matches because a controller was created or destroyed.
+   */
+  GPtrArray *chain;
+  GtkWidget *chain_widget;
+  guint      chain_generation;
+
   /* Signal handlers to react to various changes in the system. */
   gulong hierarchy_changed_handler;
   gulong widget_destroy_handler;
   gulong manager_changed_handler;
+  gulong chain_hierarchy_changed_handler;
 
   /* If we have any global shortcuts registered */
   guint have_global : 1;
@@ -126,6 +139,7 @@ static GParamSpec *properties [N_PROPS];
 static guint       signals [N_SIGNALS];
 static GQuark      root_quark;
 static GQuark      controller_quark;
+static guint       chain_generation;
 
 static void dzl_shortcut_controller_connect    (DzlShortcutController *self);
 static void dzl_shortcut_controller_disconnect (DzlShortcutController *self);
@@ -249,6 +263,23 @@ dzl_shortcut_controller_on_manager_changed (DzlShortcutController *self,
   dzl_shortcut_controller_emit_reset (self);
 }
 
+static void
+dzl_shortcut_controller_clear_chain (DzlShortcutController *self)
+{
+  DzlShortcutControllerPrivate *priv = dzl_shortcut_controller_get_instance_private (self);
+
+  g_assert (DZL_IS_SHORTCUT_CONTROLLER (self));
+
+  if (priv->chain_widget != NULL)
+    {
+      g_signal_handler_disconnect (priv->chain_widget, priv->chain_hierarchy_changed_handler);
+      dzl_clear_weak_pointer (&priv->chain_widget);
+    }
+
+  priv->chain_hierarchy_changed_handler = 0;
+  g_clear_pointer (&priv->chain, g_ptr_array_unref);
+}
+
 static void
 dzl_shortcut_controller_widget_destroy (DzlShortcutController *self,
                                         GtkWidget             *widget)
@@ -258,6 +289,12 @@ dzl_shortcut_controller_widget_destroy (DzlShortcutController *self,
   g_assert (DZL_IS_SHORTCUT_CONTROLLER (self));
   g_assert (GTK_IS_WIDGET (widget));
 
+  /* Cached chains may contain this controller */
+  chain_generation++;
+
+  /* The chain may contain ourself, so break the cycle */
+  dzl_shortcut_controller_clear_chain (self);
+
   dzl_shortcut_controller_disconnect (self);
   dzl_clear_weak_pointer (&priv->widget);
 
@@ -440,6 +477,7 @@ dzl_shortcut_controller_finalize (GObject *object)
   DzlShortcutController *self = (DzlShortcutController *)object;
   DzlShortcutControllerPrivate *priv = dzl_shortcut_controller_get_instance_private (self);
 
+  dzl_shortcut_controller_clear_chain (self);
   dzl_clear_weak_pointer (&priv->widget);
   g_clear_pointer (&priv->commands, g_hash_table_unref);
   g_clear_pointer (&priv->commands_table, dzl_shortcut_chord_table_free);
@@ -612,6 +650,9 @@ dzl_shortcut_controller_new (GtkWidget *widget)
                            g_object_ref (ret),
                            g_object_unref);
 
+  /* Cached chains through @widget are missing this controller */
+  chain_generation++;
+
   return ret;
 }
 
@@ -1220,6 +1261,55 @@ _dzl_shortcut_controller_push (DzlShortcutController *self,
   return dzl_shortcut_chord_copy (priv->current_chord);
 }
 
+/**
+ * _dzl_shortcut_controller_get_chain:
+ * @self: the root #DzlShortcutController of a toplevel
+ * @widget: the focus widget within the toplevel
+ *
+ * Gets the controllers attached to @widget and its ancestors, ordered from
+ * @widget to the toplevel. The result is cached on @self until the focus
+ * widget, its ancestry, or the set of controllers change.
+ *
+ * Returns: (transfer full) (element-type DzlShortcutController): a #GPtrArray
+ *   that remains valid even if the chain is invalidated while in use.
+ */
+GPtrArray *
+_dzl_shortcut_controller_get_chain (DzlShortcutController *self,
+                                    GtkWidget             *widget)
+{
+  DzlShortcutControllerPrivate *priv = dzl_shortcut_controller_get_instance_private (self);
+
+  g_return_val_if_fail (DZL_IS_SHORTCUT_CONTROLLER (self), NULL);
+  g_return_val_if_fail (GTK_IS_WIDGET (widget), NULL);
+
+  if (priv->chain == NULL ||
+      priv->chain_widget != widget ||
+      priv->chain_generation != chain_generation)
+    {
+      dzl_shortcut_controller_clear_chain (self);
+
+      priv->chain = g_ptr_array_new_with_free_func (g_object_unref);
+      priv->chain_generation = chain_generation;
+
+      for (GtkWidget *ancestor = widget; ancestor != NULL; ancestor = gtk_widget_get_parent (ancestor))
+        {
+          DzlShortcutController *controller = g_object_get_qdata (G_OBJECT (ancestor), controller_quark);
+
+          if (controller != NULL)
+            g_ptr_array_add (priv->chain, g_object_ref (controller));
+        }
+
+      dzl_set_weak_pointer (&priv->chain_widget, widget);
+      priv->chain_hierarchy_changed_handler =
+        g_signal_connect_swapped (widget,
+                                  "hierarchy-changed",
+                                  G_CALLBACK (dzl_shortcut_controller_clear_chain),
+                                  self);
+    }
+
+  return g_ptr_array_ref (priv->chain);
+}
+
 void
 _dzl_shortcut_controller_clear (DzlShortcutController *self)
 {
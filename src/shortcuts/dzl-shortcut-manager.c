@@ -20,7 +20,9 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include "dzl-debug.h"
 
@@ -103,6 +105,15 @@ typedef struct
   guint reload_handler;
 } DzlShortcutManagerPrivate;
 
+/*
+ * Keythemes found in search path directories are compiled and cached in
+ * the user cache directory, one cache per directory. Each entry is keyed
+ * by file name and validated against the file's modification time and size.
+ */
+#define THEME_CACHE_VERSION      1
+#define THEME_CACHE_ENTRY_FORMAT "(xt" DZL_SHORTCUT_THEME_COMPILED_FORMAT ")"
+#define THEME_CACHE_FORMAT       "(ua{s" THEME_CACHE_ENTRY_FORMAT "})"
+
 enum {
   PROP_0,
   PROP_THEME,
@@ -466,13 +477,97 @@ dzl_shortcut_manager_init (DzlShortcutManager *self)
                                        NULL);
 }
 
+static gchar *
+dzl_shortcut_manager_get_cache_path (const gchar *directory)
+{
+  g_autofree gchar *checksum = NULL;
+  g_autofree gchar *name = NULL;
+
+  g_assert (directory != NULL);
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, directory, -1);
+  name = g_strdup_printf ("%s.keythemes", checksum);
+
+  return g_build_filename (g_get_user_cache_dir (), "libdazzle", "keythemes", name, NULL);
+}
+
+static GHashTable *
+dzl_shortcut_manager_load_cache (const gchar *cache_path)
+{
+  g_autoptr(GMappedFile) mapped_file = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariant) entries = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  GHashTable *ret;
+  GVariantIter iter;
+  const gchar *name;
+  GVariant *entry;
+  guint32 version = 0;
+
+  g_assert (cache_path != NULL);
+
+  if (NULL == (mapped_file = g_mapped_file_new (cache_path, FALSE, NULL)))
+    return NULL;
+
+  bytes = g_mapped_file_get_bytes (mapped_file);
+  variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (THEME_CACHE_FORMAT), bytes, FALSE));
+
+  g_variant_get (variant, "(u@a{s" THEME_CACHE_ENTRY_FORMAT "})", &version, &entries);
+
+  if (version != THEME_CACHE_VERSION)
+    return NULL;
+
+  ret = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+
+  g_variant_iter_init (&iter, entries);
+
+  while (g_variant_iter_next (&iter, "{&s@" THEME_CACHE_ENTRY_FORMAT "}", &name, &entry))
+    g_hash_table_insert (ret, g_strdup (name), entry);
+
+  return ret;
+}
+
+static void
+dzl_shortcut_manager_save_cache (const gchar *cache_path,
+                                 GVariant    *entries)
+{
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *cache_dir = NULL;
+
+  g_assert (cache_path != NULL);
+  g_assert (entries != NULL);
+
+  variant = g_variant_ref_sink (g_variant_new ("(u@a{s" THEME_CACHE_ENTRY_FORMAT "})",
+                                               THEME_CACHE_VERSION,
+                                               entries));
+
+  cache_dir = g_path_get_dirname (cache_path);
+
+  /* The cache is only an optimization, so failure is not fatal */
+  if (g_mkdir_with_parents (cache_dir, 0750) != 0 ||
+      !g_file_set_contents (cache_path,
+                            g_variant_get_data (variant),
+                            g_variant_get_size (variant),
+                            &error))
+    g_debug ("Failed to save keytheme cache “%s”: %s",
+             cache_path,
+             error ? error->message : g_strerror (errno));
+}
+
 static void
 dzl_shortcut_manager_load_directory (DzlShortcutManager  *self,
                                      const gchar         *directory,
                                      GCancellable        *cancellable)
 {
+  g_autoptr(GHashTable) cache = NULL;
   g_autoptr(GDir) dir = NULL;
+  g_autofree gchar *cache_path = NULL;
+  GVariantBuilder builder;
   const gchar *name;
+  gboolean cache_changed = FALSE;
+  gint64 now;
+  guint n_reused = 0;
 
   DZL_ENTRY;
 
@@ -488,15 +583,69 @@ dzl_shortcut_manager_load_directory (DzlShortcutManager  *self,
   if (NULL == (dir = g_dir_open (directory, 0, NULL)))
     DZL_EXIT;
 
+  cache_path = dzl_shortcut_manager_get_cache_path (directory);
+  cache = dzl_shortcut_manager_load_cache (cache_path);
+  now = g_get_real_time () / G_USEC_PER_SEC;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s" THEME_CACHE_ENTRY_FORMAT "}"));
+
   while (NULL != (name = g_dir_read_name (dir)))
     {
       g_autofree gchar *path = g_build_filename (directory, name, NULL);
       g_autoptr(DzlShortcutTheme) theme = NULL;
+      g_autoptr(GVariant) compiled = NULL;
       g_autoptr(GError) local_error = NULL;
+      GVariant *entry = NULL;
+      GStatBuf st;
+      gint64 mtime = -1;
+      guint64 size = 0;
+
+      if (g_stat (path, &st) == 0)
+        {
+          /*
+           * Changes within the same second as the cache is written would go
+           * unnoticed, so don't trust the cache for recently modified files.
+           */
+          if (st.st_mtime < now)
+            mtime = st.st_mtime;
+          size = st.st_size;
+        }
+
+      if (cache != NULL && mtime != -1 && NULL != (entry = g_hash_table_lookup (cache, name)))
+        {
+          gint64 cached_mtime;
+          guint64 cached_size;
+
+          g_variant_get (entry, "(xt@" DZL_SHORTCUT_THEME_COMPILED_FORMAT ")",
+                         &cached_mtime, &cached_size, &compiled);
+
+          if (cached_mtime == mtime && cached_size == size)
+            n_reused++;
+          else
+            g_clear_pointer (&compiled, g_variant_unref);
+        }
+
+      if (compiled == NULL)
+        {
+          g_autofree gchar *contents = NULL;
+          gsize len = 0;
+
+          if (!g_file_get_contents (path, &contents, &len, &local_error) ||
+              !(compiled = _dzl_shortcut_theme_compile (contents, len, &local_error)))
+            {
+              g_warning ("%s", local_error->message);
+              continue;
+            }
+
+          cache_changed = TRUE;
+        }
+
+      g_variant_builder_add (&builder, "{s(xt@" DZL_SHORTCUT_THEME_COMPILED_FORMAT ")}",
+                             name, mtime, size, compiled);
 
       theme = dzl_shortcut_theme_new (NULL);
 
-      if (dzl_shortcut_theme_load_from_path (theme, path, cancellable, &local_error))
+      if (_dzl_shortcut_theme_load_from_compiled (theme, compiled, &local_error))
         {
           _dzl_shortcut_theme_set_manager (theme, self);
           dzl_shortcut_manager_merge (self, theme);
@@ -505,6 +654,12 @@ dzl_shortcut_manager_load_directory (DzlShortcutManager  *self,
         g_warning ("%s", local_error->message);
     }
 
+  /* Also rewrite the cache when files were removed */
+  if (cache_changed || cache == NULL || n_reused != g_hash_table_size (cache))
+    dzl_shortcut_manager_save_cache (cache_path, g_variant_builder_end (&builder));
+  else
+    g_variant_builder_clear (&builder);
+
   DZL_EXIT;
 }
 
@@ -690,6 +845,7 @@ dzl_shortcut_manager_set_theme (DzlShortcutManager *self,
  * @event: the event in question
  * @chord: the current chord for the toplevel
  * @phase: the phase (capture, bubble)
+ * @root: the root controller for the toplevel
  * @widget: the widget the event was destined for
  * @focus: the current focus widget
  *
@@ -709,81 +865,70 @@ dzl_shortcut_manager_run_phase (DzlShortcutManager     *self,
                                 const GdkEventKey      *event,
                                 const DzlShortcutChord *chord,
                                 int                     phase,
+                                DzlShortcutController  *root,
                                 GtkWidget              *widget,
                                 GtkWidget              *focus)
 {
-  GtkWidget *ancestor = widget;
-  GQueue queue = G_QUEUE_INIT;
+  g_autoptr(GPtrArray) chain = NULL;
   DzlShortcutMatch ret = DZL_SHORTCUT_MATCH_NONE;
 
   g_assert (DZL_IS_SHORTCUT_MANAGER (self));
   g_assert (event != NULL);
   g_assert (chord != NULL);
   g_assert ((phase & DZL_SHORTCUT_PHASE_GLOBAL) == 0);
+  g_assert (DZL_IS_SHORTCUT_CONTROLLER (root));
   g_assert (GTK_IS_WIDGET (widget));
   g_assert (GTK_IS_WIDGET (focus));
 
   /*
-   * Collect all the widgets that might be needed for this phase and order them
-   * so that we can process from first-to-last. Capture phase is
-   * toplevel-to-widget, and bubble is widget-to-toplevel.  Dispatch only has
-   * the the widget itself.
+   * If we are in the dispatch phase, we will only see our target widget for
+   * the event delivery. Try to dispatch the event and if so we consider
+   * the event handled.
    */
-  do
+  if (phase == DZL_SHORTCUT_PHASE_DISPATCH)
     {
-      if (phase == DZL_SHORTCUT_PHASE_CAPTURE)
-        g_queue_push_head (&queue, g_object_ref (ancestor));
-      else
-        g_queue_push_tail (&queue, g_object_ref (ancestor));
-      ancestor = gtk_widget_get_parent (ancestor);
+      DzlShortcutController *controller;
+
+      g_object_ref (widget);
+
+      if ((controller = dzl_shortcut_controller_try_find (widget)))
+        ret = _dzl_shortcut_controller_handle (controller, event, chord, phase, focus);
+
+      if (ret == DZL_SHORTCUT_MATCH_NONE && gtk_widget_event (widget, (GdkEvent *)event))
+        ret = DZL_SHORTCUT_MATCH_EQUAL;
+
+      g_object_unref (widget);
+
+      DZL_RETURN (ret);
     }
-  while (phase != DZL_SHORTCUT_PHASE_DISPATCH && ancestor != NULL);
 
   /*
-   * Now look through our widget chain to find a match to activate.
+   * The root controller caches the controllers from the widget to the
+   * toplevel. Capture is processed toplevel-to-widget, and bubble is
+   * widget-to-toplevel. We hold a reference to the chain in case a
+   * handler causes it to be invalidated.
    */
-  for (const GList *iter = queue.head; iter; iter = iter->next)
-    {
-      GtkWidget *current = iter->data;
-      DzlShortcutController *controller;
-
-      controller = dzl_shortcut_controller_try_find (current);
+  chain = _dzl_shortcut_controller_get_chain (root, widget);
 
-      if (controller != NULL)
-        {
-          /*
-           * Now try to activate the event using the controller. If we get
-           * any result other than DZL_SHORTCUT_MATCH_NONE, we need to stop
-           * processing and swallow the event.
-           *
-           * Multiple controllers can have a partial match, but if any hits
-           * a partial match, it's undefined behavior to also have a shortcut
-           * which would activate.
-           */
-          ret = _dzl_shortcut_controller_handle (controller, event, chord, phase, focus);
-          if (ret)
-            DZL_GOTO (cleanup);
-        }
+  for (guint i = 0; i < chain->len; i++)
+    {
+      guint position = phase == DZL_SHORTCUT_PHASE_CAPTURE ? chain->len - i - 1 : i;
+      DzlShortcutController *controller = g_ptr_array_index (chain, position);
 
       /*
-       * If we are in the dispatch phase, we will only see our target widget for
-       * the event delivery. Try to dispatch the event and if so we consider
-       * the event handled.
+       * Now try to activate the event using the controller. If we get
+       * any result other than DZL_SHORTCUT_MATCH_NONE, we need to stop
+       * processing and swallow the event.
+       *
+       * Multiple controllers can have a partial match, but if any hits
+       * a partial match, it's undefined behavior to also have a shortcut
+       * which would activate.
        */
-      if (phase == DZL_SHORTCUT_PHASE_DISPATCH)
-        {
-          if (gtk_widget_event (current, (GdkEvent *)event))
-            {
-              ret = DZL_SHORTCUT_MATCH_EQUAL;
-              DZL_GOTO (cleanup);
-            }
-        }
+      ret = _dzl_shortcut_controller_handle (controller, event, chord, phase, focus);
+      if (ret)
+        break;
     }
 
-cleanup:
-  g_queue_foreach (&queue, (GFunc)g_object_unref, NULL);
-  g_queue_clear (&queue);
-
   DZL_RETURN (ret);
 }
 
@@ -1013,9 +1158,9 @@ dzl_shortcut_manager_handle_event (DzlShortcutManager *self,
    * on widgets. We can run through the phases to capture/dispatch/bubble.
    */
   if ((match = dzl_shortcut_manager_run_global (self, event, chord, DZL_SHORTCUT_PHASE_CAPTURE, root, widget)) ||
-      (match = dzl_shortcut_manager_run_phase (self, event, chord, DZL_SHORTCUT_PHASE_CAPTURE, widget, focus)) ||
-      (match = dzl_shortcut_manager_run_phase (self, event, chord, DZL_SHORTCUT_PHASE_DISPATCH, widget, focus)) ||
-      (match = dzl_shortcut_manager_run_phase (self, event, chord, DZL_SHORTCUT_PHASE_BUBBLE, widget, focus)) ||
+      (match = dzl_shortcut_manager_run_phase (self, event, chord, DZL_SHORTCUT_PHASE_CAPTURE, root, widget, focus)) ||
+      (match = dzl_shortcut_manager_run_phase (self, event, chord, DZL_SHORTCUT_PHASE_DISPATCH, root, widget, focus)) ||
+      (match = dzl_shortcut_manager_run_phase (self, event, chord, DZL_SHORTCUT_PHASE_BUBBLE, root, widget, focus)) ||
       (match = dzl_shortcut_manager_run_global (self, event, chord, DZL_SHORTCUT_PHASE_BUBBLE, root, widget)) ||
       (match = dzl_shortcut_manager_run_fallbacks (self, widget, toplevel, chord)))
     ret = GDK_EVENT_STOP;
@@ -30,6 +30,9 @@ G_BEGIN_DECLS
 #define DZL_SHORTCUT_CLOSURE_CHAIN_MAGIC 0x81236261
 #define DZL_SHORTCUT_NODE_DATA_MAGIC     0x81746332
 
+/* (op, element name or text, attribute names, attribute values) */
+#define DZL_SHORTCUT_THEME_COMPILED_FORMAT "a(ysasas)"
+
 typedef struct
 {
   DzlShortcutChordTable *table;
@@ -113,6 +116,10 @@ DzlShortcutMatch       _dzl_shortcut_controller_handle              (DzlShortcut
 DzlShortcutChord      *_dzl_shortcut_controller_push                (DzlShortcutController      *self,
                                                                      const GdkEventKey          *event);
 void                   _dzl_shortcut_controller_clear               (DzlShortcutController      *self);
+/* Exported for the tests */
+DZL_AVAILABLE_IN_3_46
+GPtrArray             *_dzl_shortcut_controller_get_chain           (DzlShortcutController      *self,
+                                                                     GtkWidget                  *widget);
 GNode                 *_dzl_shortcut_manager_get_root               (DzlShortcutManager         *self);
 DzlShortcutTheme      *_dzl_shortcut_manager_get_internal_theme     (DzlShortcutManager         *self);
 void                   _dzl_shortcut_simple_label_set_size_group    (DzlShortcutSimpleLabel     *self,
@@ -139,6 +146,15 @@ DzlShortcutMatch       _dzl_shortcut_theme_match                    (DzlShortcut
                                                                      DzlShortcutPhase            phase,
                                                                      const DzlShortcutChord     *chord,
                                                                      DzlShortcutClosureChain   **chain);
+/* Exported for the tests */
+DZL_AVAILABLE_IN_3_46
+GVariant              *_dzl_shortcut_theme_compile                  (const gchar                *data,
+                                                                     gssize                      len,
+                                                                     GError                    **error);
+DZL_AVAILABLE_IN_3_46
+gboolean               _dzl_shortcut_theme_load_from_compiled       (DzlShortcutTheme           *self,
+                                                                     GVariant                   *compiled,
+                                                                     GError                    **error);
 gboolean               _dzl_shortcut_context_contains               (DzlShortcutContext         *self,
                                                                      const DzlShortcutChord     *chord);
 DzlShortcutChordTable *_dzl_shortcut_context_get_table              (DzlShortcutContext         *self);
@@ -66,6 +66,26 @@ typedef struct
   guint             in_property : 1;
 } LoadState;
 
+/*
+ * A compiled theme is the sequence of parser callbacks recorded from the
+ * markup, so that loading it runs exactly the same code as parsing would
+ * without tokenizing, unescaping and validating the XML again.
+ */
+typedef enum
+{
+  COMPILED_START_ELEMENT = 's',
+  COMPILED_END_ELEMENT   = 'e',
+  COMPILED_TEXT          = 't',
+} CompiledOp;
+
+typedef struct
+{
+  GVariantBuilder builder;
+  guint           capture_text : 1;
+} CompileState;
+
+static const gchar *no_attributes[] = { NULL };
+
 static LoadStateFrame *
 load_state_frame_new (LoadStateType type)
 {
@@ -372,7 +392,6 @@ theme_start_element (GMarkupParseContext  *context,
 
   g_assert (state != NULL);
   g_assert (DZL_IS_SHORTCUT_THEME (state->self));
-  g_assert (context != NULL);
   g_assert (element_name != NULL);
 
   if (g_strcmp0 (element_name, "keytheme") == 0)
@@ -590,7 +609,6 @@ theme_end_element (GMarkupParseContext  *context,
 {
   LoadState *state = user_data;
 
-  g_assert (context != NULL);
   g_assert (element_name != NULL);
 
   if (g_strcmp0 (element_name, "keytheme") == 0)
@@ -674,7 +692,6 @@ theme_text (GMarkupParseContext  *context,
 {
   LoadState *state = user_data;
 
-  g_assert (context != NULL);
   g_assert (text != NULL);
   g_assert (state != NULL);
 
@@ -697,6 +714,201 @@ static const GMarkupParser theme_parser = {
   .text = theme_text,
 };
 
+static void
+load_state_clear (LoadState *state)
+{
+  while (state->stack != NULL)
+    {
+      LoadStateFrame *frm = state->stack;
+      state->stack = frm->next;
+      load_state_frame_free (frm);
+    }
+
+  if (state->text)
+    g_string_free (state->text, TRUE);
+}
+
+static void
+compile_start_element (GMarkupParseContext  *context,
+                       const gchar          *element_name,
+                       const gchar         **attr_names,
+                       const gchar         **attr_values,
+                       gpointer              user_data,
+                       GError              **error)
+{
+  CompileState *state = user_data;
+
+  g_assert (state != NULL);
+  g_assert (element_name != NULL);
+
+  g_variant_builder_add (&state->builder, "(ys^as^as)",
+                         COMPILED_START_ELEMENT, element_name, attr_names, attr_values);
+
+  /* Text is only used within these, so skip whitespace elsewhere */
+  state->capture_text = g_str_equal (element_name, "param") ||
+                        g_str_equal (element_name, "property");
+}
+
+static void
+compile_end_element (GMarkupParseContext  *context,
+                     const gchar          *element_name,
+                     gpointer              user_data,
+                     GError              **error)
+{
+  CompileState *state = user_data;
+
+  g_assert (state != NULL);
+  g_assert (element_name != NULL);
+
+  g_variant_builder_add (&state->builder, "(ys^as^as)",
+                         COMPILED_END_ELEMENT, element_name, no_attributes, no_attributes);
+
+  state->capture_text = FALSE;
+}
+
+static void
+compile_text (GMarkupParseContext  *context,
+              const gchar          *text,
+              gsize                 text_len,
+              gpointer              user_data,
+              GError              **error)
+{
+  CompileState *state = user_data;
+  g_autofree gchar *copy = NULL;
+
+  g_assert (state != NULL);
+  g_assert (text != NULL);
+
+  if (!state->capture_text)
+    return;
+
+  copy = g_strndup (text, text_len);
+
+  g_variant_builder_add (&state->builder, "(ys^as^as)",
+                         COMPILED_TEXT, copy, no_attributes, no_attributes);
+}
+
+static const GMarkupParser compile_parser = {
+  .start_element = compile_start_element,
+  .end_element = compile_end_element,
+  .text = compile_text,
+};
+
+/**
+ * _dzl_shortcut_theme_compile:
+ * @data: the keytheme markup
+ * @len: the length of @data, or -1 if it is %NULL terminated
+ * @error: a location for a #GError, or %NULL
+ *
+ * Parses @data into a #GVariant of type %DZL_SHORTCUT_THEME_COMPILED_FORMAT
+ * that can be loaded with _dzl_shortcut_theme_load_from_compiled(). Only
+ * errors in the markup itself are detected here, errors in the contents of
+ * the theme are reported when loading.
+ *
+ * Returns: (transfer full): a #GVariant or %NULL and @error is set
+ */
+GVariant *
+_dzl_shortcut_theme_compile (const gchar  *data,
+                             gssize        len,
+                             GError      **error)
+{
+  g_autoptr(GMarkupParseContext) context = NULL;
+  CompileState state = { 0 };
+
+  g_return_val_if_fail (data != NULL, NULL);
+
+  g_variant_builder_init (&state.builder, G_VARIANT_TYPE (DZL_SHORTCUT_THEME_COMPILED_FORMAT));
+
+  context = g_markup_parse_context_new (&compile_parser, 0, &state, NULL);
+
+  if (!g_markup_parse_context_parse (context, data, len, error))
+    {
+      g_variant_builder_clear (&state.builder);
+      return NULL;
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&state.builder));
+}
+
+/**
+ * _dzl_shortcut_theme_load_from_compiled:
+ * @self: a #DzlShortcutTheme
+ * @compiled: a #GVariant created with _dzl_shortcut_theme_compile()
+ * @error: a location for a #GError, or %NULL
+ *
+ * Loads a theme that was compiled with _dzl_shortcut_theme_compile(). This
+ * behaves just like dzl_shortcut_theme_load_from_data() with the original
+ * markup, including the errors that are reported.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set
+ */
+gboolean
+_dzl_shortcut_theme_load_from_compiled (DzlShortcutTheme  *self,
+                                        GVariant          *compiled,
+                                        GError           **error)
+{
+  g_autoptr(GError) local_error = NULL;
+  LoadState state = { 0 };
+  GVariantIter iter;
+  const gchar *name;
+  const gchar **attr_names;
+  const gchar **attr_values;
+  guint8 op;
+
+  g_return_val_if_fail (DZL_IS_SHORTCUT_THEME (self), FALSE);
+  g_return_val_if_fail (compiled != NULL, FALSE);
+  g_return_val_if_fail (g_variant_is_of_type (compiled, G_VARIANT_TYPE (DZL_SHORTCUT_THEME_COMPILED_FORMAT)), FALSE);
+
+  state.self = self;
+
+  g_variant_iter_init (&iter, compiled);
+
+  while (local_error == NULL &&
+         g_variant_iter_next (&iter, "(y&s^a&s^a&s)", &op, &name, &attr_names, &attr_values))
+    {
+      switch ((CompiledOp)op)
+        {
+        case COMPILED_START_ELEMENT:
+          if (g_strv_length ((gchar **)attr_names) == g_strv_length ((gchar **)attr_values))
+            theme_start_element (NULL, name, attr_names, attr_values, &state, &local_error);
+          else
+            g_set_error (&local_error,
+                         G_IO_ERROR,
+                         G_IO_ERROR_INVALID_DATA,
+                         "Corrupted compiled theme");
+          break;
+
+        case COMPILED_END_ELEMENT:
+          theme_end_element (NULL, name, &state, &local_error);
+          break;
+
+        case COMPILED_TEXT:
+          theme_text (NULL, name, strlen (name), &state, &local_error);
+          break;
+
+        default:
+          g_set_error (&local_error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_DATA,
+                       "Corrupted compiled theme");
+          break;
+        }
+
+      g_free (attr_names);
+      g_free (attr_values);
+    }
+
+  load_state_clear (&state);
+
+  if (local_error != NULL)
+    {
+      g_propagate_error (error, g_steal_pointer (&local_error));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 gboolean
 dzl_shortcut_theme_load_from_data (DzlShortcutTheme  *self,
                                    const gchar       *data,
@@ -715,15 +927,7 @@ dzl_shortcut_theme_load_from_data (DzlShortcutTheme  *self,
   context = g_markup_parse_context_new (&theme_parser, 0, &state, NULL);
   ret = g_markup_parse_context_parse (context, data, len, error);
 
-  while (state.stack != NULL)
-    {
-      LoadStateFrame *frm = state.stack;
-      state.stack = frm->next;
-      load_state_frame_free (frm);
-    }
-
-  if (state.text)
-    g_string_free (state.text, TRUE);
+  load_state_clear (&state);
 
   return ret;
 }
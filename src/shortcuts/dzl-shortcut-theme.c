@@ -874,8 +874,12 @@ _dzl_shortcut_theme_merge (DzlShortcutTheme *self,
    * need to be tricky about stealing data or what data we are safe to
    * copy/steal/ref/etc.
    */
+  dzl_shortcut_chord_table_freeze (priv->actions_table);
+  dzl_shortcut_chord_table_freeze (priv->commands_table);
   dzl_shortcut_chord_table_foreach (layer_priv->actions_table, copy_chord_to_table, priv->actions_table);
   dzl_shortcut_chord_table_foreach (layer_priv->commands_table, copy_chord_to_table, priv->commands_table);
+  dzl_shortcut_chord_table_thaw (priv->actions_table);
+  dzl_shortcut_chord_table_thaw (priv->commands_table);
 }
 
 void
@@ -45,6 +45,11 @@ struct _DzlTreeNode
 
   GdkRGBA            foreground_rgba;
 
+  /* Memoized result of the tree filter, valid while filter_generation
+   * matches the generation of the active filter.
+   */
+  guint              filter_generation;
+
   guint              children_possible : 1;
   guint              is_dummy : 1;
   guint              foreground_rgba_set : 1;
@@ -52,6 +57,7 @@ struct _DzlTreeNode
   guint              reset_on_collapse : 1;
   guint              use_dim_label : 1;
   guint              use_markup : 1;
+  guint              filter_visible : 1;
 };
 
 typedef struct
@@ -534,8 +540,18 @@ dzl_tree_node_set_item (DzlTreeNode *node,
   g_return_if_fail (DZL_IS_TREE_NODE (node));
   g_return_if_fail (!item || G_IS_OBJECT (item));
 
-  if (g_set_object (&node->item, item))
-    g_object_notify_by_pspec (G_OBJECT (node), properties [PROP_ITEM]);
+  if (node->item != item)
+    {
+      g_autoptr(GObject) old_item = g_steal_pointer (&node->item);
+
+      if (item != NULL)
+        node->item = g_object_ref (item);
+
+      if (node->tree != NULL)
+        _dzl_tree_index_item_changed (node->tree, node, old_item);
+
+      g_object_notify_by_pspec (G_OBJECT (node), properties [PROP_ITEM]);
+    }
 }
 
 void
@@ -1137,6 +1153,33 @@ _dzl_tree_node_set_needs_build_children (DzlTreeNode *self,
     self->is_dummy = FALSE;
 }
 
+gboolean
+_dzl_tree_node_get_filter_visible (DzlTreeNode *self,
+                                   guint        generation,
+                                   gboolean    *visible)
+{
+  g_assert (DZL_IS_TREE_NODE (self));
+  g_assert (visible != NULL);
+
+  if (generation == 0 || self->filter_generation != generation)
+    return FALSE;
+
+  *visible = self->filter_visible;
+
+  return TRUE;
+}
+
+void
+_dzl_tree_node_set_filter_visible (DzlTreeNode *self,
+                                   guint        generation,
+                                   gboolean     visible)
+{
+  g_assert (DZL_IS_TREE_NODE (self));
+
+  self->filter_generation = generation;
+  self->filter_visible = !!visible;
+}
+
 void
 _dzl_tree_node_add_dummy_child (DzlTreeNode *self)
 {
@@ -1176,6 +1219,8 @@ _dzl_tree_node_remove_dummy_child (DzlTreeNode *self)
   if (dzl_tree_node_get_iter (self, &iter) &&
       gtk_tree_model_iter_children (GTK_TREE_MODEL (model), &children, &iter))
     {
+      _dzl_tree_index_remove_children (self->tree, &iter);
+
       while (gtk_tree_store_remove (model, &children))
         { /* Do nothing */ }
     }
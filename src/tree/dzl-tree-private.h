@@ -56,6 +56,15 @@ gboolean      _dzl_tree_get_iter                        (DzlTree
                                                          DzlTreeNode            *node,
                                                          GtkTreeIter            *iter);
 GtkTreeStore *_dzl_tree_get_store                       (DzlTree                *self);
+void          _dzl_tree_index_add                       (DzlTree                *self,
+                                                         DzlTreeNode            *node);
+void          _dzl_tree_index_remove                    (DzlTree                *self,
+                                                         DzlTreeNode            *node);
+void          _dzl_tree_index_item_changed              (DzlTree                *self,
+                                                         DzlTreeNode            *node,
+                                                         GObject                *old_item);
+void          _dzl_tree_index_remove_children           (DzlTree                *self,
+                                                         GtkTreeIter            *iter);
 void          _dzl_tree_node_set_tree                   (DzlTreeNode            *node,
                                                          DzlTree                *tree);
 void          _dzl_tree_node_set_parent                 (DzlTreeNode            *node,
@@ -64,6 +73,12 @@ const gchar  *_dzl_tree_node_get_expanded_icon          (DzlTreeNode
 gboolean      _dzl_tree_node_get_needs_build_children   (DzlTreeNode            *node);
 void          _dzl_tree_node_set_needs_build_children   (DzlTreeNode            *node,
                                                          gboolean                needs_build_children);
+gboolean      _dzl_tree_node_get_filter_visible         (DzlTreeNode            *node,
+                                                         guint                   generation,
+                                                         gboolean               *visible);
+void          _dzl_tree_node_set_filter_visible         (DzlTreeNode            *node,
+                                                         guint                   generation,
+                                                         gboolean                visible);
 void          _dzl_tree_node_add_dummy_child            (DzlTreeNode            *node);
 void          _dzl_tree_node_remove_dummy_child         (DzlTreeNode            *node);
 gboolean      _dzl_tree_node_is_dummy                   (DzlTreeNode            *self);
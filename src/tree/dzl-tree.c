@@ -26,8 +26,41 @@
 #include "tree/dzl-tree-node.h"
 #include "tree/dzl-tree-private.h"
 #include "tree/dzl-tree-store.h"
+#include "util/dzl-macros.h"
 #include "util/dzl-util-private.h"
 
+/* How long the background builder may run per main loop iteration */
+#define FILTER_BUILD_BUDGET_USEC (5 * 1000)
+
+typedef struct
+{
+  GtkTreePath *path;
+  guint        n_changed;
+} FilterPending;
+
+typedef struct
+{
+  DzlTree           *self;
+  GtkTreeStore      *store;
+  DzlTreeFilterFunc  filter_func;
+  gpointer           filter_data;
+  GDestroyNotify     filter_data_destroy;
+
+  /*
+   * Stack of FilterPending, with the number of ancestors whose visibility
+   * flipped for each store emission in progress. It is pushed before
+   * GtkTreeModelFilter sees the change and popped by path once it has.
+   * If a handler stops an emission, its entry is flushed by the next pop
+   * below it or from flush_source.
+   */
+  GArray            *pending;
+  guint              flush_source;
+
+  gulong             handlers[6];
+  guint              generation;
+  guint              in_update : 1;
+} FilterFunc;
+
 typedef struct
 {
   /* Owned references */
@@ -36,12 +69,20 @@ typedef struct
   GtkTreeStore            *store;
   GMenuModel              *context_menu;
   GtkTreePath             *last_drop_path;
+  GHashTable              *index;
 
   /* Unowned references */
   DzlTreeNode             *selection;
   GtkTreeViewColumn       *column;
   GtkCellRenderer         *cell_pixbuf;
   GtkCellRenderer         *cell_text;
+  FilterFunc              *filter;
+  GEqualFunc               index_equal_func;
+  GType                    index_item_type;
+
+  /* Nodes waiting to have their children built for the filter */
+  GQueue                   filter_build_queue;
+  guint                    filter_build_source;
 
   GtkTreeViewDropPosition  last_drop_pos;
   GdkDragAction            drag_action;
@@ -50,6 +91,7 @@ typedef struct
 
   guint                    show_icons : 1;
   guint                    always_expand : 1;
+  guint                    filter_builds_children : 1;
 } DzlTreePrivate;
 
 typedef struct
@@ -59,14 +101,6 @@ typedef struct
   DzlTreeNode *result;
 } NodeLookup;
 
-typedef struct
-{
-  DzlTree           *self;
-  DzlTreeFilterFunc  filter_func;
-  gpointer           filter_data;
-  GDestroyNotify     filter_data_destroy;
-} FilterFunc;
-
 static void dzl_tree_buildable_init (GtkBuildableIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (DzlTree, dzl_tree, GTK_TYPE_TREE_VIEW,
@@ -77,6 +111,7 @@ enum {
   PROP_0,
   PROP_ALWAYS_EXPAND,
   PROP_CONTEXT_MENU,
+  PROP_FILTER_BUILDS_CHILDREN,
   PROP_ROOT,
   PROP_SELECTION,
   PROP_SHOW_ICONS,
@@ -89,9 +124,13 @@ enum {
   LAST_SIGNAL
 };
 
+static void dzl_tree_filter_start_build (DzlTree *self);
+static void dzl_tree_filter_stop_build  (DzlTree *self);
+
 static GtkBuildableIface *dzl_tree_parent_buildable_iface;
 static GParamSpec *properties [LAST_PROP];
 static guint signals [LAST_SIGNAL];
+static guint filter_generation;
 
 /**
  * dzl_tree_get_context_menu:
@@ -535,6 +574,7 @@ _dzl_tree_insert (DzlTree     *self,
       gtk_tree_store_insert_with_values (priv->store, &iter, &parent_iter, position,
                                          0, child,
                                          -1);
+      _dzl_tree_index_add (self, child);
 
       _dzl_tree_build_node (self, child);
 
@@ -586,6 +626,7 @@ dzl_tree_add (DzlTree     *self,
                                      prepend ? 0 : -1,
                                      0, child,
                                      -1);
+  _dzl_tree_index_add (self, child);
 
   _dzl_tree_build_node (self, child);
 
@@ -659,6 +700,7 @@ _dzl_tree_insert_sorted (DzlTree                *self,
   gtk_tree_store_set (priv->store, &children, 0, child, -1);
 
 inserted:
+  _dzl_tree_index_add (self, child);
   _dzl_tree_build_node (self, child);
 
   if (priv->always_expand || priv->root == child)
@@ -785,6 +827,8 @@ dzl_tree_row_collapsed (GtkTreeView *tree_view,
     {
       GtkTreeIter child;
 
+      _dzl_tree_index_remove_children (self, iter);
+
       if (gtk_tree_model_iter_children (model, &child, iter))
         {
           while (gtk_tree_store_remove (priv->store, &child))
@@ -1107,7 +1151,11 @@ dzl_tree_destroy (GtkWidget *widget)
 
   g_assert (DZL_IS_TREE (self));
 
+  dzl_tree_filter_stop_build (self);
   gtk_tree_view_set_model (GTK_TREE_VIEW (self), NULL);
+  priv->filter = NULL;
+
+  g_clear_pointer (&priv->index, g_hash_table_unref);
 
   if (priv->store != NULL)
     {
@@ -1142,6 +1190,10 @@ dzl_tree_get_property (GObject    *object,
       g_value_set_object (value, priv->context_menu);
       break;
 
+    case PROP_FILTER_BUILDS_CHILDREN:
+      g_value_set_boolean (value, priv->filter_builds_children);
+      break;
+
     case PROP_ROOT:
       g_value_set_object (value, priv->root);
       break;
@@ -1178,6 +1230,10 @@ dzl_tree_set_property (GObject      *object,
       dzl_tree_set_context_menu (self, g_value_get_object (value));
       break;
 
+    case PROP_FILTER_BUILDS_CHILDREN:
+      dzl_tree_set_filter_builds_children (self, g_value_get_boolean (value));
+      break;
+
     case PROP_ROOT:
       dzl_tree_set_root (self, g_value_get_object (value));
       break;
@@ -1243,6 +1299,24 @@ dzl_tree_class_init (DzlTreeClass *klass)
                          G_TYPE_MENU_MODEL,
                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * DzlTree:filter-builds-children:
+   *
+   * If %TRUE, nodes whose children have not been built yet are built in
+   * small batches from an idle callback while a filter is set, so that
+   * the filter can match nodes that have never been expanded.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_FILTER_BUILDS_CHILDREN] =
+    g_param_spec_boolean ("filter-builds-children",
+                          "Filter Builds Children",
+                          "If unbuilt children should be built in the background while filtering",
+                          FALSE,
+                          (G_PARAM_READWRITE |
+                           G_PARAM_EXPLICIT_NOTIFY |
+                           G_PARAM_STATIC_STRINGS));
+
   properties[PROP_ROOT] =
     g_param_spec_object ("root",
                          "Root",
@@ -1614,6 +1688,8 @@ dzl_tree_set_root (DzlTree     *self,
         {
           _dzl_tree_node_set_parent (priv->root, NULL);
           _dzl_tree_node_set_tree (priv->root, NULL);
+          if (priv->index != NULL)
+            g_hash_table_remove_all (priv->index);
           gtk_tree_store_clear (priv->store);
           g_clear_object (&priv->root);
         }
@@ -1630,6 +1706,8 @@ dzl_tree_set_root (DzlTree     *self,
           _dzl_tree_build_children (self, priv->root);
         }
 
+      dzl_tree_filter_start_build (self);
+
       g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_ROOT]);
     }
 }
@@ -1650,11 +1728,216 @@ dzl_tree_rebuild (DzlTree *self)
 
   if (priv->root != NULL)
     {
+      if (priv->index != NULL)
+        g_hash_table_remove_all (priv->index);
       gtk_tree_store_clear (priv->store);
       _dzl_tree_build_children (self, priv->root);
     }
 }
 
+static void
+index_list_free (gpointer data)
+{
+  g_slist_free_full (data, g_object_unref);
+}
+
+void
+_dzl_tree_index_add (DzlTree     *self,
+                     DzlTreeNode *node)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+  GObject *item;
+  GSList *list;
+
+  g_assert (DZL_IS_TREE (self));
+  g_assert (DZL_IS_TREE_NODE (node));
+
+  if (priv->index == NULL ||
+      !(item = dzl_tree_node_get_item (node)) ||
+      !G_TYPE_CHECK_INSTANCE_TYPE (item, priv->index_item_type))
+    return;
+
+  /*
+   * Items that compare equal share a list, kept in insertion order. The
+   * head of the list never changes when appending, so the table does not
+   * need to be updated unless this is the first node for @item.
+   */
+  if ((list = g_hash_table_lookup (priv->index, item)))
+    list = g_slist_append (list, g_object_ref (node));
+  else
+    g_hash_table_insert (priv->index,
+                         g_object_ref (item),
+                         g_slist_prepend (NULL, g_object_ref (node)));
+}
+
+static gboolean
+dzl_tree_index_remove_item (DzlTree     *self,
+                            DzlTreeNode *node,
+                            GObject     *item)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+  gpointer orig_key;
+  GSList *list;
+  GSList *link;
+
+  g_assert (DZL_IS_TREE (self));
+  g_assert (DZL_IS_TREE_NODE (node));
+  g_assert (!item || G_IS_OBJECT (item));
+
+  if (priv->index == NULL ||
+      item == NULL ||
+      !G_TYPE_CHECK_INSTANCE_TYPE (item, priv->index_item_type) ||
+      !g_hash_table_lookup_extended (priv->index, item, &orig_key, (gpointer *)&list) ||
+      !(link = g_slist_find (list, node)))
+    return FALSE;
+
+  /* Steal the entry so the list we are editing is not freed under us */
+  g_hash_table_steal (priv->index, item);
+
+  list = g_slist_delete_link (list, link);
+  g_object_unref (node);
+
+  if (list != NULL)
+    g_hash_table_insert (priv->index, orig_key, list);
+  else
+    g_object_unref (orig_key);
+
+  return TRUE;
+}
+
+void
+_dzl_tree_index_remove (DzlTree     *self,
+                        DzlTreeNode *node)
+{
+  g_assert (DZL_IS_TREE (self));
+  g_assert (DZL_IS_TREE_NODE (node));
+
+  dzl_tree_index_remove_item (self, node, dzl_tree_node_get_item (node));
+}
+
+void
+_dzl_tree_index_item_changed (DzlTree     *self,
+                              DzlTreeNode *node,
+                              GObject     *old_item)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+  GtkTreeIter iter;
+
+  g_assert (DZL_IS_TREE (self));
+  g_assert (DZL_IS_TREE_NODE (node));
+
+  if (priv->index == NULL)
+    return;
+
+  dzl_tree_index_remove_item (self, node, old_item);
+
+  /*
+   * The old item may not have been indexed (no item, or another type), so
+   * we have to check the store to know whether the node is in the tree
+   * rather than on its way in (or already removed), in which case the
+   * index is updated elsewhere.
+   */
+  if (_dzl_tree_get_iter (self, node, &iter))
+    _dzl_tree_index_add (self, node);
+}
+
+void
+_dzl_tree_index_remove_children (DzlTree     *self,
+                                 GtkTreeIter *iter)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+  GtkTreeModel *model = GTK_TREE_MODEL (priv->store);
+  GtkTreeIter child;
+
+  g_assert (DZL_IS_TREE (self));
+
+  if (priv->index == NULL || !gtk_tree_model_iter_children (model, &child, iter))
+    return;
+
+  do
+    {
+      g_autoptr(DzlTreeNode) node = NULL;
+
+      gtk_tree_model_get (model, &child, 0, &node, -1);
+
+      if (node != NULL)
+        _dzl_tree_index_remove (self, node);
+
+      _dzl_tree_index_remove_children (self, &child);
+    }
+  while (gtk_tree_model_iter_next (model, &child));
+}
+
+static gboolean
+dzl_tree_index_foreach_cb (GtkTreeModel *model,
+                           GtkTreePath  *path,
+                           GtkTreeIter  *iter,
+                           gpointer      user_data)
+{
+  g_autoptr(DzlTreeNode) node = NULL;
+  DzlTree *self = user_data;
+
+  g_assert (GTK_IS_TREE_MODEL (model));
+  g_assert (iter != NULL);
+  g_assert (DZL_IS_TREE (self));
+
+  gtk_tree_model_get (model, iter, 0, &node, -1);
+
+  if (node != NULL)
+    _dzl_tree_index_add (self, node);
+
+  return FALSE;
+}
+
+/**
+ * dzl_tree_set_index_funcs:
+ * @self: A #DzlTree
+ * @item_type: the #GType of the items to index
+ * @hash_func: (nullable): A #GHashFunc for node items, or %NULL
+ * @equal_func: (nullable): A #GEqualFunc for node items, or %NULL
+ *
+ * Maintains an index from the #DzlTreeNode:item of every node in the tree
+ * to the node, so that dzl_tree_find_item() runs in constant time instead
+ * of walking the whole tree.
+ *
+ * Use g_direct_hash() and g_direct_equal() to index items by identity, or
+ * functions such as g_file_hash() and g_file_equal() to index them by
+ * value. In the latter case, dzl_tree_find_custom() also uses the index
+ * when it is passed @equal_func, and @key must be an @item_type.
+ * The hash of an item must not change while it is in the tree.
+ *
+ * Only items that are an @item_type are passed to @hash_func and
+ * @equal_func, so trees mixing several kinds of items can index one of
+ * them, such as %G_TYPE_FILE with g_file_hash(). Lookups of other items
+ * walk the tree. Use %G_TYPE_OBJECT to index every item.
+ *
+ * Pass %NULL for @hash_func to drop the index.
+ *
+ * Since: 3.46
+ */
+void
+dzl_tree_set_index_funcs (DzlTree    *self,
+                          GType       item_type,
+                          GHashFunc   hash_func,
+                          GEqualFunc  equal_func)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+
+  g_return_if_fail (DZL_IS_TREE (self));
+  g_return_if_fail (G_TYPE_IS_OBJECT (item_type) || G_TYPE_IS_INTERFACE (item_type));
+  g_return_if_fail (hash_func == NULL || equal_func != NULL);
+
+  g_clear_pointer (&priv->index, g_hash_table_unref);
+  priv->index_equal_func = equal_func;
+  priv->index_item_type = item_type;
+
+  if (hash_func != NULL)
+    {
+      priv->index = g_hash_table_new_full (hash_func, equal_func, g_object_unref, index_list_free);
+      gtk_tree_model_foreach (GTK_TREE_MODEL (priv->store), dzl_tree_index_foreach_cb, self);
+    }
+}
+
 /**
  * dzl_tree_find_custom:
  * @self: A #DzlTree
@@ -1664,6 +1947,10 @@ dzl_tree_rebuild (DzlTree *self)
  * Walks the entire tree looking for the first item that matches given
  * @equal_func and @key.
  *
+ * If @equal_func is the one given to dzl_tree_set_index_funcs(), the
+ * index is used instead of walking the tree and any of the matching nodes
+ * may be returned.
+ *
  * The first parameter to @equal_func will always be @key.
  * The second parameter will be the nodes #DzlTreeNode:item property.
  *
@@ -1680,6 +1967,13 @@ dzl_tree_find_custom (DzlTree     *self,
   g_return_val_if_fail (DZL_IS_TREE (self), NULL);
   g_return_val_if_fail (equal_func != NULL, NULL);
 
+  if (priv->index != NULL && equal_func == priv->index_equal_func && key != NULL)
+    {
+      GSList *list = g_hash_table_lookup (priv->index, key);
+
+      return list ? list->data : NULL;
+    }
+
   lookup.key = key;
   lookup.equal_func = equal_func;
   lookup.result = NULL;
@@ -1698,6 +1992,10 @@ dzl_tree_find_custom (DzlTree     *self,
  *
  * Finds a #DzlTreeNode with an item property matching @item.
  *
+ * This is a constant time operation if an index of items such as @item
+ * has been enabled with dzl_tree_set_index_funcs(), otherwise the whole
+ * tree is walked.
+ *
  * Returns: (transfer none) (nullable): A #DzlTreeNode or %NULL.
  */
 DzlTreeNode *
@@ -1710,6 +2008,23 @@ dzl_tree_find_item (DzlTree  *self,
   g_return_val_if_fail (DZL_IS_TREE (self), NULL);
   g_return_val_if_fail (!item || G_IS_OBJECT (item), NULL);
 
+  /*
+   * Every node whose item equals @item is in the same list, so a node
+   * holding @item itself, if there is one, must be there too.
+   */
+  if (priv->index != NULL &&
+      item != NULL &&
+      G_TYPE_CHECK_INSTANCE_TYPE (item, priv->index_item_type))
+    {
+      for (const GSList *iter = g_hash_table_lookup (priv->index, item); iter; iter = iter->next)
+        {
+          if (dzl_tree_node_get_item (iter->data) == item)
+            return iter->data;
+        }
+
+      return NULL;
+    }
+
   lookup.key = item;
   lookup.equal_func = g_direct_equal;
   lookup.result = NULL;
@@ -1767,6 +2082,8 @@ _dzl_tree_invalidate (DzlTree     *self,
 
       if (gtk_tree_model_get_iter (model, &iter, path))
         {
+          _dzl_tree_index_remove_children (self, &iter);
+
           if (gtk_tree_model_iter_children (model, &child, &iter))
             {
               while (gtk_tree_store_remove (priv->store, &child))
@@ -1889,7 +2206,11 @@ _dzl_tree_remove (DzlTree     *self,
   path = dzl_tree_node_get_path (node);
 
   if (gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->store), &iter, path))
-    gtk_tree_store_remove (priv->store, &iter);
+    {
+      _dzl_tree_index_remove (self, node);
+      _dzl_tree_index_remove_children (self, &iter);
+      gtk_tree_store_remove (priv->store, &iter);
+    }
 
   gtk_tree_path_free (path);
 }
@@ -1918,48 +2239,330 @@ _dzl_tree_get_iter (DzlTree      *self,
   return ret;
 }
 
-static void
-filter_func_free (gpointer user_data)
+static guint
+next_filter_generation (void)
 {
-  FilterFunc *data = user_data;
-
-  if (data->filter_data_destroy)
-    data->filter_data_destroy (data->filter_data);
+  /* Zero is reserved to mark a node as invalidated */
+  if (G_UNLIKELY (++filter_generation == 0))
+    ++filter_generation;
 
-  g_free (data);
+  return filter_generation;
 }
 
+/*
+ * Returns %TRUE if @node, or any node below it that has been built, is
+ * matched by the filter. The result is memoized on the node until the
+ * filter generation changes or the node is invalidated, so the whole
+ * tree is only walked once per refilter no matter how many rows the
+ * GtkTreeModelFilter asks about.
+ */
 static gboolean
-dzl_tree_model_filter_recursive (GtkTreeModel *model,
-                                 GtkTreeIter  *parent,
-                                 FilterFunc   *filter)
+dzl_tree_filter_compute (FilterFunc  *filter,
+                         GtkTreeIter *iter,
+                         DzlTreeNode *node)
 {
+  GtkTreeModel *model = GTK_TREE_MODEL (filter->store);
   GtkTreeIter child;
+  gboolean ret;
 
-  if (gtk_tree_model_iter_children (model, &child, parent))
+  g_assert (filter != NULL);
+  g_assert (iter != NULL);
+  g_assert (DZL_IS_TREE_NODE (node));
+
+  if (_dzl_tree_node_get_filter_visible (node, filter->generation, &ret))
+    return ret;
+
+  ret = filter->filter_func (filter->self, node, filter->filter_data);
+
+  /* If any of our children match, we should match. */
+  if (!ret && gtk_tree_model_iter_children (model, &child, iter))
     {
       do
         {
-          g_autoptr(DzlTreeNode) node = NULL;
+          g_autoptr(DzlTreeNode) child_node = NULL;
 
-          gtk_tree_model_get (model, &child, 0, &node, -1);
+          gtk_tree_model_get (model, &child, 0, &child_node, -1);
 
-          if (node != NULL)
+          if (child_node != NULL && dzl_tree_filter_compute (filter, &child, child_node))
             {
-              if (filter->filter_func (filter->self, node, filter->filter_data))
-                return TRUE;
-
-              if (!_dzl_tree_node_get_needs_build_children (node))
-                {
-                  if (dzl_tree_model_filter_recursive (model, &child, filter))
-                    return TRUE;
-                }
+              ret = TRUE;
+              break;
             }
         }
       while (gtk_tree_model_iter_next (model, &child));
     }
 
-  return FALSE;
+  _dzl_tree_node_set_filter_visible (node, filter->generation, ret);
+
+  return ret;
+}
+
+/*
+ * Recomputes @iter and its ancestors after one of the children of @iter
+ * changed, stopping at the first row whose visibility is unchanged (or
+ * was never computed, in which case nothing above it can depend on it).
+ *
+ * Returns the number of rows, starting at @iter, whose visibility flipped.
+ */
+static guint
+dzl_tree_filter_update_ancestors (FilterFunc  *filter,
+                                  GtkTreeIter *iter)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (filter->store);
+  GtkTreeIter cur = *iter;
+  GtkTreeIter parent;
+  guint n_changed = 0;
+
+  for (;;)
+    {
+      g_autoptr(DzlTreeNode) node = NULL;
+      gboolean old_visible;
+
+      gtk_tree_model_get (model, &cur, 0, &node, -1);
+
+      if (node == NULL ||
+          !_dzl_tree_node_get_filter_visible (node, filter->generation, &old_visible))
+        break;
+
+      _dzl_tree_node_set_filter_visible (node, 0, FALSE);
+
+      if (dzl_tree_filter_compute (filter, &cur, node) == old_visible)
+        break;
+
+      n_changed++;
+
+      if (!gtk_tree_model_iter_parent (model, &parent, &cur))
+        break;
+
+      cur = parent;
+    }
+
+  return n_changed;
+}
+
+static void
+filter_pending_clear (gpointer data)
+{
+  FilterPending *pending = data;
+
+  g_clear_pointer (&pending->path, gtk_tree_path_free);
+}
+
+/*
+ * Emits row-changed for the @n_changed ancestors of @path whose visibility
+ * flipped, since GtkTreeModelFilter only re-evaluates the row that changed.
+ * Goes from the top down so that parents are visible before their children.
+ */
+static void
+dzl_tree_filter_emit_ancestors (FilterFunc  *filter,
+                                GtkTreePath *path,
+                                guint        n_changed)
+{
+  g_assert (filter != NULL);
+  g_assert (path != NULL);
+
+  if (n_changed == 0)
+    return;
+
+  filter->in_update = TRUE;
+
+  for (guint i = n_changed; i > 0; i--)
+    {
+      g_autoptr(GtkTreePath) ancestor = gtk_tree_path_copy (path);
+      GtkTreeIter iter;
+
+      for (guint j = 0; j < i; j++)
+        gtk_tree_path_up (ancestor);
+
+      if (gtk_tree_model_get_iter (GTK_TREE_MODEL (filter->store), &iter, ancestor))
+        gtk_tree_model_row_changed (GTK_TREE_MODEL (filter->store), ancestor, &iter);
+    }
+
+  filter->in_update = FALSE;
+}
+
+/*
+ * Pops the pending entries down to @depth, newest first.
+ */
+static void
+dzl_tree_filter_flush_pending (FilterFunc *filter,
+                               guint       depth)
+{
+  g_assert (filter != NULL);
+
+  while (filter->pending->len > depth)
+    {
+      FilterPending *top = &g_array_index (filter->pending, FilterPending, filter->pending->len - 1);
+      g_autoptr(GtkTreePath) path = g_steal_pointer (&top->path);
+      guint n_changed = top->n_changed;
+
+      g_array_set_size (filter->pending, filter->pending->len - 1);
+      dzl_tree_filter_emit_ancestors (filter, path, n_changed);
+    }
+}
+
+static gboolean
+dzl_tree_filter_flush_cb (gpointer user_data)
+{
+  FilterFunc *filter = user_data;
+
+  g_assert (filter != NULL);
+
+  filter->flush_source = 0;
+
+  /* No store emission is in progress, anything left was stopped */
+  dzl_tree_filter_flush_pending (filter, 0);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+dzl_tree_filter_push_pending (FilterFunc  *filter,
+                              GtkTreePath *path)
+{
+  g_autoptr(GtkTreePath) parent_path = NULL;
+  FilterPending pending;
+  GtkTreeIter parent;
+  guint n_changed = 0;
+
+  g_assert (filter != NULL);
+  g_assert (path != NULL);
+
+  parent_path = gtk_tree_path_copy (path);
+
+  if (gtk_tree_path_up (parent_path) &&
+      gtk_tree_path_get_depth (parent_path) > 0 &&
+      gtk_tree_model_get_iter (GTK_TREE_MODEL (filter->store), &parent, parent_path))
+    n_changed = dzl_tree_filter_update_ancestors (filter, &parent);
+
+  pending.path = gtk_tree_path_copy (path);
+  pending.n_changed = n_changed;
+  g_array_append_val (filter->pending, pending);
+
+  /*
+   * If a handler stops the emission, the matching pop never happens.
+   * Make sure such entries are flushed once the emissions are over.
+   */
+  if (filter->flush_source == 0)
+    filter->flush_source = g_idle_add (dzl_tree_filter_flush_cb, filter);
+}
+
+static void
+dzl_tree_filter_pop_pending (FilterFunc  *filter,
+                             GtkTreePath *path)
+{
+  g_assert (filter != NULL);
+  g_assert (path != NULL);
+
+  /*
+   * Find the innermost entry pushed for @path. Entries above it belong to
+   * nested emissions that were stopped before reaching our after handler,
+   * so they are flushed along with it.
+   */
+  for (guint i = filter->pending->len; i > 0; i--)
+    {
+      const FilterPending *pending = &g_array_index (filter->pending, FilterPending, i - 1);
+
+      if (gtk_tree_path_compare (pending->path, path) == 0)
+        {
+          dzl_tree_filter_flush_pending (filter, i - 1);
+          break;
+        }
+    }
+}
+
+static void
+dzl_tree_filter_row_changed (GtkTreeModel *model,
+                             GtkTreePath  *path,
+                             GtkTreeIter  *iter,
+                             FilterFunc   *filter)
+{
+  g_autoptr(DzlTreeNode) node = NULL;
+
+  g_assert (GTK_IS_TREE_MODEL (model));
+  g_assert (path != NULL);
+  g_assert (iter != NULL);
+  g_assert (filter != NULL);
+
+  if (filter->in_update)
+    return;
+
+  gtk_tree_model_get (model, iter, 0, &node, -1);
+
+  if (node != NULL)
+    _dzl_tree_node_set_filter_visible (node, 0, FALSE);
+
+  dzl_tree_filter_push_pending (filter, path);
+}
+
+static void
+dzl_tree_filter_row_deleted (GtkTreeModel *model,
+                             GtkTreePath  *path,
+                             FilterFunc   *filter)
+{
+  g_assert (GTK_IS_TREE_MODEL (model));
+  g_assert (path != NULL);
+  g_assert (filter != NULL);
+
+  if (!filter->in_update)
+    dzl_tree_filter_push_pending (filter, path);
+}
+
+static void
+dzl_tree_filter_row_changed_after (GtkTreeModel *model,
+                                   GtkTreePath  *path,
+                                   GtkTreeIter  *iter,
+                                   FilterFunc   *filter)
+{
+  g_assert (GTK_IS_TREE_MODEL (model));
+  g_assert (path != NULL);
+  g_assert (filter != NULL);
+
+  if (!filter->in_update)
+    dzl_tree_filter_pop_pending (filter, path);
+}
+
+static void
+dzl_tree_filter_row_deleted_after (GtkTreeModel *model,
+                                   GtkTreePath  *path,
+                                   FilterFunc   *filter)
+{
+  g_assert (GTK_IS_TREE_MODEL (model));
+  g_assert (path != NULL);
+  g_assert (filter != NULL);
+
+  if (!filter->in_update)
+    dzl_tree_filter_pop_pending (filter, path);
+}
+
+static void
+filter_func_free (gpointer user_data)
+{
+  FilterFunc *data = user_data;
+
+  for (guint i = 0; i < G_N_ELEMENTS (data->handlers); i++)
+    dzl_clear_signal_handler (data->store, &data->handlers[i]);
+
+  if (data->self != NULL)
+    {
+      DzlTreePrivate *priv = dzl_tree_get_instance_private (data->self);
+
+      if (priv->filter == data)
+        {
+          dzl_tree_filter_stop_build (data->self);
+          priv->filter = NULL;
+        }
+
+      dzl_clear_weak_pointer (&data->self);
+    }
+
+  if (data->filter_data_destroy)
+    data->filter_data_destroy (data->filter_data);
+
+  dzl_clear_source (&data->flush_source);
+  g_clear_pointer (&data->pending, g_array_unref);
+  g_clear_object (&data->store);
+  g_free (data);
 }
 
 static gboolean
@@ -1969,41 +2572,123 @@ dzl_tree_model_filter_visible_func (GtkTreeModel *model,
 {
   g_autoptr(DzlTreeNode) node = NULL;
   FilterFunc *filter = data;
-  gboolean ret;
 
   g_assert (filter != NULL);
-  g_assert (DZL_IS_TREE (filter->self));
   g_assert (filter->filter_func != NULL);
 
+  if (filter->self == NULL)
+    return FALSE;
+
+  gtk_tree_model_get (model, iter, 0, &node, -1);
+
+  /* Rows are inserted empty by _dzl_tree_insert_sorted() */
+  if (node == NULL)
+    return FALSE;
+
+  return dzl_tree_filter_compute (filter, iter, node);
+}
+
+static gboolean
+dzl_tree_filter_build_cb (gpointer user_data)
+{
+  DzlTree *self = user_data;
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+  GtkTreeModel *model = GTK_TREE_MODEL (priv->store);
+  gint64 deadline;
+
+  g_assert (DZL_IS_TREE (self));
+
+  deadline = g_get_monotonic_time () + FILTER_BUILD_BUDGET_USEC;
+
   /*
-   * This is a rather complex situation.
-   *
-   * We might not match, but one of our children nodes might match.
-   * Furthering the issue, the children might still need to be built.
-   * For some cases, this could be really expensive (think file tree)
-   * but for other things, it could be cheap. If you are going to use
-   * a filter func for your tree, you probably should avoid being
-   * too lazy and ensure the nodes are available.
-   *
-   * Therefore, we will only check available nodes, and ignore the
-   * case where the children nodes need to be built.   *
-   *
-   * TODO: Another option would be to iteratively build the items after
-   *       the initial filter.
+   * Walk the tree breadth-first, building the children of nodes that have
+   * not been expanded yet. Rows added by the builders reach the filter
+   * through the store signals like any other change, so matches deep in
+   * the tree show up as they are discovered.
    */
+  while (!g_queue_is_empty (&priv->filter_build_queue) &&
+         g_get_monotonic_time () < deadline)
+    {
+      g_autoptr(DzlTreeNode) node = g_queue_pop_head (&priv->filter_build_queue);
+      GtkTreeIter *parent = NULL;
+      GtkTreeIter iter;
+      GtkTreeIter child;
 
-  gtk_tree_model_get (model, iter, 0, &node, -1);
-  ret = filter->filter_func (filter->self, node, filter->filter_data);
+      /*
+       * The node may have been removed since it was queued. Building it
+       * then would append to a detached node and mark it as built, so it
+       * would not be built again if it is added back.
+       */
+      if (node != priv->root)
+        {
+          if (!dzl_tree_node_get_iter (node, &iter))
+            continue;
+          parent = &iter;
+        }
 
-  /* Short circuit if we already matched. */
-  if (ret)
-    return TRUE;
+      /* GtkTreeStore iters persist, so @iter is still valid afterwards */
+      if (_dzl_tree_node_get_needs_build_children (node) &&
+          dzl_tree_node_get_children_possible (node))
+        _dzl_tree_build_children (self, node);
 
-  /* If any of our children match, we should match. */
-  if (dzl_tree_model_filter_recursive (model, iter, filter))
-    return TRUE;
+      if (gtk_tree_model_iter_children (model, &child, parent))
+        {
+          do
+            {
+              g_autoptr(DzlTreeNode) child_node = NULL;
 
-  return FALSE;
+              gtk_tree_model_get (model, &child, 0, &child_node, -1);
+
+              if (child_node == NULL || _dzl_tree_node_is_dummy (child_node))
+                continue;
+
+              if ((_dzl_tree_node_get_needs_build_children (child_node) &&
+                   dzl_tree_node_get_children_possible (child_node)) ||
+                  gtk_tree_model_iter_has_child (model, &child))
+                g_queue_push_tail (&priv->filter_build_queue, g_steal_pointer (&child_node));
+            }
+          while (gtk_tree_model_iter_next (model, &child));
+        }
+    }
+
+  if (g_queue_is_empty (&priv->filter_build_queue))
+    {
+      priv->filter_build_source = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+dzl_tree_filter_stop_build (DzlTree *self)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+  DzlTreeNode *node;
+
+  g_assert (DZL_IS_TREE (self));
+
+  dzl_clear_source (&priv->filter_build_source);
+
+  while ((node = g_queue_pop_head (&priv->filter_build_queue)))
+    g_object_unref (node);
+}
+
+static void
+dzl_tree_filter_start_build (DzlTree *self)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+
+  g_assert (DZL_IS_TREE (self));
+
+  dzl_tree_filter_stop_build (self);
+
+  if (!priv->filter_builds_children || priv->filter == NULL || priv->root == NULL)
+    return;
+
+  g_queue_push_tail (&priv->filter_build_queue, g_object_ref (priv->root));
+  priv->filter_build_source =
+    g_idle_add_full (G_PRIORITY_LOW, dzl_tree_filter_build_cb, self, NULL);
 }
 
 /**
@@ -2014,6 +2699,11 @@ dzl_tree_model_filter_visible_func (GtkTreeModel *model,
  * @filter_data_destroy: Destroy notify for @filter_data.
  *
  * Sets the filter function to be used to determine visability of a tree node.
+ *
+ * A node is visible if @filter_func matches it or any of its built
+ * descendants. Results are cached per node, so if the outcome of
+ * @filter_func changes for reasons the tree cannot see, such as a new
+ * search string in @filter_data, call dzl_tree_refilter().
  */
 void
 dzl_tree_set_filter (DzlTree           *self,
@@ -2025,6 +2715,9 @@ dzl_tree_set_filter (DzlTree           *self,
 
   g_return_if_fail (DZL_IS_TREE (self));
 
+  /* The previous filter model may be kept alive by someone else */
+  priv->filter = NULL;
+
   if (filter_func == NULL)
     {
       gtk_tree_view_set_model (GTK_TREE_VIEW (self), GTK_TREE_MODEL (priv->store));
@@ -2035,10 +2728,38 @@ dzl_tree_set_filter (DzlTree           *self,
       GtkTreeModel *filter;
 
       data = g_new0 (FilterFunc, 1);
-      data->self = self;
+      dzl_set_weak_pointer (&data->self, self);
+      data->store = g_object_ref (priv->store);
       data->filter_func = filter_func;
       data->filter_data = filter_data;
       data->filter_data_destroy = filter_data_destroy;
+      data->pending = g_array_new (FALSE, FALSE, sizeof (FilterPending));
+      g_array_set_clear_func (data->pending, filter_pending_clear);
+      data->generation = next_filter_generation ();
+
+      /*
+       * These must be connected before the GtkTreeModelFilter connects to
+       * the store, so that the memoized results are up to date by the time
+       * it asks for the visibility of a changed row.
+       */
+      data->handlers[0] =
+        g_signal_connect (priv->store, "row-inserted",
+                          G_CALLBACK (dzl_tree_filter_row_changed), data);
+      data->handlers[1] =
+        g_signal_connect (priv->store, "row-changed",
+                          G_CALLBACK (dzl_tree_filter_row_changed), data);
+      data->handlers[2] =
+        g_signal_connect (priv->store, "row-deleted",
+                          G_CALLBACK (dzl_tree_filter_row_deleted), data);
+      data->handlers[3] =
+        g_signal_connect_after (priv->store, "row-inserted",
+                                G_CALLBACK (dzl_tree_filter_row_changed_after), data);
+      data->handlers[4] =
+        g_signal_connect_after (priv->store, "row-changed",
+                                G_CALLBACK (dzl_tree_filter_row_changed_after), data);
+      data->handlers[5] =
+        g_signal_connect_after (priv->store, "row-deleted",
+                                G_CALLBACK (dzl_tree_filter_row_deleted_after), data);
 
       filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (priv->store), NULL);
       gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (filter),
@@ -2047,6 +2768,89 @@ dzl_tree_set_filter (DzlTree           *self,
                                               filter_func_free);
       gtk_tree_view_set_model (GTK_TREE_VIEW (self), GTK_TREE_MODEL (filter));
       g_clear_object (&filter);
+
+      priv->filter = data;
+    }
+
+  dzl_tree_filter_start_build (self);
+}
+
+/**
+ * dzl_tree_refilter:
+ * @self: A #DzlTree
+ *
+ * Drops the cached filter results and re-evaluates the filter set with
+ * dzl_tree_set_filter() for every row. Use this instead of
+ * gtk_tree_model_filter_refilter() after the criteria of the filter
+ * changed.
+ *
+ * Since: 3.46
+ */
+void
+dzl_tree_refilter (DzlTree *self)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+  GtkTreeModel *model;
+
+  g_return_if_fail (DZL_IS_TREE (self));
+
+  if (priv->filter == NULL)
+    return;
+
+  priv->filter->generation = next_filter_generation ();
+
+  model = gtk_tree_view_get_model (GTK_TREE_VIEW (self));
+  if (GTK_IS_TREE_MODEL_FILTER (model))
+    gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (model));
+
+  dzl_tree_filter_start_build (self);
+}
+
+/**
+ * dzl_tree_get_filter_builds_children:
+ * @self: A #DzlTree
+ *
+ * Gets the #DzlTree:filter-builds-children property.
+ *
+ * Returns: %TRUE if unbuilt children are built in the background while
+ *   a filter is set.
+ *
+ * Since: 3.46
+ */
+gboolean
+dzl_tree_get_filter_builds_children (DzlTree *self)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+
+  g_return_val_if_fail (DZL_IS_TREE (self), FALSE);
+
+  return priv->filter_builds_children;
+}
+
+/**
+ * dzl_tree_set_filter_builds_children:
+ * @self: A #DzlTree
+ * @filter_builds_children: if unbuilt children should be built
+ *
+ * Sets the #DzlTree:filter-builds-children property.
+ *
+ * Since: 3.46
+ */
+void
+dzl_tree_set_filter_builds_children (DzlTree  *self,
+                                     gboolean  filter_builds_children)
+{
+  DzlTreePrivate *priv = dzl_tree_get_instance_private (self);
+
+  g_return_if_fail (DZL_IS_TREE (self));
+
+  filter_builds_children = !!filter_builds_children;
+
+  if (filter_builds_children != priv->filter_builds_children)
+    {
+      priv->filter_builds_children = filter_builds_children;
+      dzl_tree_filter_start_build (self);
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_FILTER_BUILDS_CHILDREN]);
     }
 }
 
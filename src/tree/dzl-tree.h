@@ -113,6 +113,18 @@ void          dzl_tree_set_filter       (DzlTree           *self,
                                          DzlTreeFilterFunc  filter_func,
                                          gpointer           filter_data,
                                          GDestroyNotify     filter_data_destroy);
+DZL_AVAILABLE_IN_3_46
+void          dzl_tree_refilter         (DzlTree           *self);
+DZL_AVAILABLE_IN_3_46
+void          dzl_tree_set_index_funcs  (DzlTree           *self,
+                                         GType              item_type,
+                                         GHashFunc          hash_func,
+                                         GEqualFunc         equal_func);
+DZL_AVAILABLE_IN_3_46
+gboolean      dzl_tree_get_filter_builds_children (DzlTree *self);
+DZL_AVAILABLE_IN_3_46
+void          dzl_tree_set_filter_builds_children (DzlTree  *self,
+                                                   gboolean  filter_builds_children);
 DZL_AVAILABLE_IN_ALL
 GMenuModel   *dzl_tree_get_context_menu (DzlTree           *self);
 DZL_AVAILABLE_IN_ALL
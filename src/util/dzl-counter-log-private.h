@@ -0,0 +1,152 @@
+/* dzl-counter-log-private.h
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DZL_COUNTER_LOG_PRIVATE_H
+#define DZL_COUNTER_LOG_PRIVATE_H
+
+#include <glib.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Counter Log Format
+ * ==================
+ *
+ * A counter log starts with the magic "DZLC" and a version byte, followed
+ * by records appended as the counters are sampled. Each record starts with
+ * a tag byte. Integers are LEB128 varints; signed integers are zigzag
+ * encoded first so that small negative deltas stay small.
+ *
+ *   'C'  A counter. Its category, name and description follow as strings,
+ *        each a varint length and that many bytes. Counters are numbered
+ *        in the order they appear in the log.
+ *
+ *   'S'  A sample. The wall-clock time in microseconds as a signed delta
+ *        from the previous sample (or from zero), the number of counters N
+ *        sampled, and the signed delta of the value of counters 0 to N-1
+ *        from the previous sample. N never decreases.
+ *
+ * A counter which was not part of the previous sample has a previous value
+ * of zero. Since the log is append-only, a truncated trailing record (say
+ * the recorder was killed mid-write) is ignored by the reader.
+ *
+ * Appending to an existing log starts a new session with another magic
+ * and version. Counters are numbered from zero again, and the first sample
+ * of a session is relative to zero rather than to the previous session.
+ * The reader merges the counters of a session with those of the same
+ * category and name in earlier sessions.
+ */
+
+#define COUNTER_LOG_MAGIC       "DZLC"
+#define COUNTER_LOG_MAGIC_LEN   4
+#define COUNTER_LOG_VERSION     1
+#define COUNTER_LOG_TAG_COUNTER 'C'
+#define COUNTER_LOG_TAG_SAMPLE  'S'
+#define COUNTER_LOG_TAG_SESSION 'D' /* The first byte of the magic */
+
+static inline void
+counter_log_put_uint (GByteArray *buf,
+                      guint64     value)
+{
+  do
+    {
+      guint8 b = value & 0x7F;
+
+      value >>= 7;
+      if (value != 0)
+        b |= 0x80;
+      g_byte_array_append (buf, &b, 1);
+    }
+  while (value != 0);
+}
+
+static inline void
+counter_log_put_int (GByteArray *buf,
+                     gint64      value)
+{
+  counter_log_put_uint (buf, ((guint64)value << 1) ^ (guint64)(value >> 63));
+}
+
+static inline void
+counter_log_put_string (GByteArray  *buf,
+                        const gchar *str)
+{
+  gsize len = str ? strlen (str) : 0;
+
+  counter_log_put_uint (buf, len);
+  g_byte_array_append (buf, (const guint8 *)str, len);
+}
+
+static inline gboolean
+counter_log_get_uint (const guint8 **pos,
+                      const guint8  *end,
+                      guint64       *value)
+{
+  guint64 v = 0;
+
+  for (guint shift = 0; *pos < end && shift < 64; shift += 7)
+    {
+      guint8 b = *(*pos)++;
+
+      v |= (guint64)(b & 0x7F) << shift;
+
+      if ((b & 0x80) == 0)
+        {
+          *value = v;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static inline gboolean
+counter_log_get_int (const guint8 **pos,
+                     const guint8  *end,
+                     gint64        *value)
+{
+  guint64 v;
+
+  if (!counter_log_get_uint (pos, end, &v))
+    return FALSE;
+
+  *value = (gint64)(v >> 1) ^ -(gint64)(v & 1);
+
+  return TRUE;
+}
+
+static inline gboolean
+counter_log_get_string (const guint8 **pos,
+                        const guint8  *end,
+                        gchar        **str)
+{
+  guint64 len;
+
+  if (!counter_log_get_uint (pos, end, &len) || len > (guint64)(end - *pos))
+    return FALSE;
+
+  *str = g_strndup ((const gchar *)*pos, len);
+  *pos += len;
+
+  return TRUE;
+}
+
+G_END_DECLS
+
+#endif /* DZL_COUNTER_LOG_PRIVATE_H */
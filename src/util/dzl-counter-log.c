@@ -0,0 +1,749 @@
+/* dzl-counter-log.c
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "dzl-counter-log"
+
+#include "config.h"
+
+#include <string.h>
+
+#include "util/dzl-counter-log.h"
+#include "util/dzl-counter-log-private.h"
+
+/**
+ * SECTION:dzl-counter-log
+ * @title: DzlCounterLog
+ * @short_description: Read counter samples recorded by #DzlCounterSampler
+ *
+ * #DzlCounterLog loads a log written by #DzlCounterSampler so that the
+ * values of counters, and the rate at which they changed, can be inspected
+ * after the fact.
+ *
+ * Counters are identified by their position in the log, which can be found
+ * with dzl_counter_log_lookup(). Samples are ordered by time, see
+ * dzl_counter_log_find_sample() to locate the samples around an event.
+ *
+ * Since: 3.46
+ */
+
+typedef struct
+{
+  gchar *category;
+  gchar *name;
+  gchar *description;
+} LogCounter;
+
+struct _DzlCounterLog
+{
+  volatile gint  ref_count;
+
+  /* LogCounter, in the order they were defined in the log */
+  GPtrArray     *counters;
+
+  /* Wall-clock time of each sample in microseconds */
+  GArray        *times;
+
+  /*
+   * The values of sample i are values[offsets[i]] to values[offsets[i+1]],
+   * so that samples taken before a counter was defined need no storage for
+   * it. There is one more offset than there are samples.
+   */
+  GArray        *offsets;
+  GArray        *values;
+};
+
+G_DEFINE_BOXED_TYPE (DzlCounterLog, dzl_counter_log, dzl_counter_log_ref, dzl_counter_log_unref)
+
+static void
+log_counter_free (gpointer data)
+{
+  LogCounter *counter = data;
+
+  g_free (counter->category);
+  g_free (counter->name);
+  g_free (counter->description);
+  g_slice_free (LogCounter, counter);
+}
+
+typedef struct
+{
+  /* The index in the log of each counter of the session */
+  GArray     *ids;
+
+  /* Counters of earlier sessions by category and name, not yet merged */
+  GHashTable *earlier;
+
+  /* The number of counters in the previous sample of the session */
+  guint       n_sampled;
+  guint       n_samples;
+} LogSession;
+
+static inline guint
+get_n_values (DzlCounterLog *self,
+              guint          sample)
+{
+  return g_array_index (self->offsets, guint, sample + 1) - g_array_index (self->offsets, guint, sample);
+}
+
+static gchar *
+log_counter_get_key (const LogCounter *counter)
+{
+  return g_strdup_printf ("%s\n%s", counter->category, counter->name);
+}
+
+static void
+log_session_init (LogSession *session)
+{
+  session->ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  session->earlier = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  session->n_sampled = 0;
+  session->n_samples = 0;
+}
+
+static void
+log_session_clear (LogSession *session)
+{
+  g_clear_pointer (&session->ids, g_array_unref);
+  g_clear_pointer (&session->earlier, g_hash_table_unref);
+}
+
+/*
+ * Starts a new session, after which counters are numbered from zero
+ * again and may be merged with the counters seen so far.
+ */
+static void
+log_session_reset (DzlCounterLog *self,
+                   LogSession    *session)
+{
+  g_array_set_size (session->ids, 0);
+  g_hash_table_remove_all (session->earlier);
+  session->n_sampled = 0;
+  session->n_samples = 0;
+
+  /* When a name is defined more than once, merge with the last one */
+  for (guint i = 0; i < self->counters->len; i++)
+    g_hash_table_insert (session->earlier,
+                         log_counter_get_key (g_ptr_array_index (self->counters, i)),
+                         GUINT_TO_POINTER (i));
+}
+
+static gboolean
+dzl_counter_log_parse_header (const guint8  **pos,
+                              const guint8   *end,
+                              GError        **error)
+{
+  if ((gsize)(end - *pos) < COUNTER_LOG_MAGIC_LEN + 1 ||
+      memcmp (*pos, COUNTER_LOG_MAGIC, COUNTER_LOG_MAGIC_LEN) != 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   "Not a counter log");
+      return FALSE;
+    }
+
+  *pos += COUNTER_LOG_MAGIC_LEN;
+
+  if (**pos != COUNTER_LOG_VERSION)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "Unsupported counter log version %u",
+                   **pos);
+      return FALSE;
+    }
+
+  (*pos)++;
+
+  return TRUE;
+}
+
+static gboolean
+dzl_counter_log_parse_counter (DzlCounterLog  *self,
+                               LogSession     *session,
+                               const guint8  **pos,
+                               const guint8   *end)
+{
+  LogCounter *counter = g_slice_new0 (LogCounter);
+  g_autofree gchar *key = NULL;
+  gpointer earlier;
+  guint id;
+
+  if (!counter_log_get_string (pos, end, &counter->category) ||
+      !counter_log_get_string (pos, end, &counter->name) ||
+      !counter_log_get_string (pos, end, &counter->description))
+    {
+      log_counter_free (counter);
+      return FALSE;
+    }
+
+  key = log_counter_get_key (counter);
+
+  if (g_hash_table_lookup_extended (session->earlier, key, NULL, &earlier))
+    {
+      /* The same counter in an earlier session, keep a single one */
+      id = GPOINTER_TO_UINT (earlier);
+      g_hash_table_remove (session->earlier, key);
+      log_counter_free (counter);
+    }
+  else
+    {
+      id = self->counters->len;
+      g_ptr_array_add (self->counters, counter);
+    }
+
+  g_array_append_val (session->ids, id);
+
+  return TRUE;
+}
+
+/*
+ * Returns FALSE if the record is truncated, in which case nothing is
+ * added. Sets @error if the record is invalid.
+ */
+static gboolean
+dzl_counter_log_parse_sample (DzlCounterLog  *self,
+                              LogSession     *session,
+                              const guint8  **pos,
+                              const guint8   *end,
+                              GError        **error)
+{
+  guint n_samples = self->times->len;
+  guint prev_n = 0;
+  guint prev_offset = 0;
+  guint offset = self->values->len;
+  gint64 prev_time = 0;
+  gint64 *row;
+  gint64 delta;
+  guint64 n;
+  guint width;
+
+  if (n_samples > 0)
+    {
+      prev_n = get_n_values (self, n_samples - 1);
+      prev_offset = g_array_index (self->offsets, guint, n_samples - 1);
+    }
+
+  /* The first sample of a session is relative to zero */
+  if (session->n_samples > 0)
+    prev_time = g_array_index (self->times, gint64, n_samples - 1);
+
+  if (!counter_log_get_int (pos, end, &delta) || !counter_log_get_uint (pos, end, &n))
+    return FALSE;
+
+  if (n < session->n_sampled || n > session->ids->len)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   "Sample %u has an invalid number of counters",
+                   n_samples);
+      return FALSE;
+    }
+
+  /* Counters of earlier sessions not sampled in this one are zero */
+  width = prev_n;
+  for (guint i = 0; i < n; i++)
+    width = MAX (width, g_array_index (session->ids, guint, i) + 1);
+
+  g_array_set_size (self->values, offset + width);
+  row = &g_array_index (self->values, gint64, offset);
+  memset (row, 0, width * sizeof (gint64));
+
+  for (guint i = 0; i < n; i++)
+    {
+      guint id = g_array_index (session->ids, guint, i);
+      gint64 value = i < session->n_sampled ? g_array_index (self->values, gint64, prev_offset + id) : 0;
+      gint64 value_delta;
+
+      if (!counter_log_get_int (pos, end, &value_delta))
+        {
+          g_array_set_size (self->values, offset);
+          return FALSE;
+        }
+
+      row[id] = value + value_delta;
+    }
+
+  prev_time += delta;
+  g_array_append_val (self->times, prev_time);
+  g_array_append_val (self->offsets, self->values->len);
+
+  session->n_sampled = n;
+  session->n_samples++;
+
+  return TRUE;
+}
+
+static gboolean
+dzl_counter_log_parse (DzlCounterLog  *self,
+                       const guint8   *data,
+                       gsize           len,
+                       GError        **error)
+{
+  const guint8 *pos = data;
+  const guint8 *end = data + len;
+  LogSession session;
+  gboolean ret = FALSE;
+
+  if (!dzl_counter_log_parse_header (&pos, end, error))
+    return FALSE;
+
+  log_session_init (&session);
+
+  while (pos < end)
+    {
+      const guint8 *record = pos;
+      gboolean complete;
+
+      switch (*pos++)
+        {
+        case COUNTER_LOG_TAG_COUNTER:
+          complete = dzl_counter_log_parse_counter (self, &session, &pos, end);
+          break;
+
+        case COUNTER_LOG_TAG_SAMPLE:
+          {
+            GError *local_error = NULL;
+
+            complete = dzl_counter_log_parse_sample (self, &session, &pos, end, &local_error);
+
+            if (local_error != NULL)
+              {
+                g_propagate_error (error, local_error);
+                goto cleanup;
+              }
+          }
+          break;
+
+        case COUNTER_LOG_TAG_SESSION:
+          /* The log was appended to, which starts with another header */
+          pos = record;
+
+          if ((gsize)(end - pos) < COUNTER_LOG_MAGIC_LEN + 1 &&
+              memcmp (pos, COUNTER_LOG_MAGIC, end - pos) == 0)
+            {
+              complete = FALSE;
+              break;
+            }
+
+          if (!dzl_counter_log_parse_header (&pos, end, error))
+            goto cleanup;
+
+          log_session_reset (self, &session);
+          complete = TRUE;
+          break;
+
+        default:
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_DATA,
+                       "Unknown record at offset %"G_GSIZE_FORMAT,
+                       (gsize)(record - data));
+          goto cleanup;
+        }
+
+      if (!complete)
+        {
+          g_debug ("Ignoring truncated record at end of counter log");
+          break;
+        }
+    }
+
+  ret = TRUE;
+
+cleanup:
+  log_session_clear (&session);
+
+  return ret;
+}
+
+/**
+ * dzl_counter_log_new_from_bytes:
+ * @bytes: the contents of a counter log
+ * @error: a location for a #GError, or %NULL
+ *
+ * Parses a counter log written by #DzlCounterSampler.
+ *
+ * Returns: (transfer full): a #DzlCounterLog or %NULL and @error is set.
+ *
+ * Since: 3.46
+ */
+DzlCounterLog *
+dzl_counter_log_new_from_bytes (GBytes  *bytes,
+                                GError **error)
+{
+  DzlCounterLog *self;
+  const guint8 *data;
+  gsize len;
+  guint zero = 0;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  self = g_slice_new0 (DzlCounterLog);
+  self->ref_count = 1;
+  self->counters = g_ptr_array_new_with_free_func (log_counter_free);
+  self->times = g_array_new (FALSE, FALSE, sizeof (gint64));
+  self->offsets = g_array_new (FALSE, FALSE, sizeof (guint));
+  self->values = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  g_array_append_val (self->offsets, zero);
+
+  data = g_bytes_get_data (bytes, &len);
+
+  if (!dzl_counter_log_parse (self, data, len, error))
+    {
+      dzl_counter_log_unref (self);
+      return NULL;
+    }
+
+  return self;
+}
+
+/**
+ * dzl_counter_log_new_for_file:
+ * @file: a #GFile containing a counter log
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @error: a location for a #GError, or %NULL
+ *
+ * Loads the counter log found in @file.
+ *
+ * Returns: (transfer full): a #DzlCounterLog or %NULL and @error is set.
+ *
+ * Since: 3.46
+ */
+DzlCounterLog *
+dzl_counter_log_new_for_file (GFile         *file,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  gchar *contents = NULL;
+  gsize len = 0;
+
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), NULL);
+
+  if (!g_file_load_contents (file, cancellable, &contents, &len, NULL, error))
+    return NULL;
+
+  bytes = g_bytes_new_take (contents, len);
+
+  return dzl_counter_log_new_from_bytes (bytes, error);
+}
+
+DzlCounterLog *
+dzl_counter_log_ref (DzlCounterLog *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+dzl_counter_log_unref (DzlCounterLog *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_clear_pointer (&self->counters, g_ptr_array_unref);
+      g_clear_pointer (&self->times, g_array_unref);
+      g_clear_pointer (&self->offsets, g_array_unref);
+      g_clear_pointer (&self->values, g_array_unref);
+      g_slice_free (DzlCounterLog, self);
+    }
+}
+
+/**
+ * dzl_counter_log_get_n_counters:
+ * @self: a #DzlCounterLog
+ *
+ * Gets the number of counters found in the log.
+ *
+ * Since: 3.46
+ */
+guint
+dzl_counter_log_get_n_counters (DzlCounterLog *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->counters->len;
+}
+
+/**
+ * dzl_counter_log_get_category:
+ * @self: a #DzlCounterLog
+ * @counter: the index of the counter
+ *
+ * Since: 3.46
+ */
+const gchar *
+dzl_counter_log_get_category (DzlCounterLog *self,
+                              guint          counter)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (counter < self->counters->len, NULL);
+
+  return ((LogCounter *)g_ptr_array_index (self->counters, counter))->category;
+}
+
+/**
+ * dzl_counter_log_get_name:
+ * @self: a #DzlCounterLog
+ * @counter: the index of the counter
+ *
+ * Since: 3.46
+ */
+const gchar *
+dzl_counter_log_get_name (DzlCounterLog *self,
+                          guint          counter)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (counter < self->counters->len, NULL);
+
+  return ((LogCounter *)g_ptr_array_index (self->counters, counter))->name;
+}
+
+/**
+ * dzl_counter_log_get_description:
+ * @self: a #DzlCounterLog
+ * @counter: the index of the counter
+ *
+ * Since: 3.46
+ */
+const gchar *
+dzl_counter_log_get_description (DzlCounterLog *self,
+                                 guint          counter)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (counter < self->counters->len, NULL);
+
+  return ((LogCounter *)g_ptr_array_index (self->counters, counter))->description;
+}
+
+/**
+ * dzl_counter_log_lookup:
+ * @self: a #DzlCounterLog
+ * @category: the category of the counter
+ * @name: the name of the counter
+ * @counter: (out): a location for the index of the counter
+ *
+ * Finds the first counter in the log matching @category and @name.
+ *
+ * Returns: %TRUE if the counter was found and @counter is set.
+ *
+ * Since: 3.46
+ */
+gboolean
+dzl_counter_log_lookup (DzlCounterLog *self,
+                        const gchar   *category,
+                        const gchar   *name,
+                        guint         *counter)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (category != NULL, FALSE);
+  g_return_val_if_fail (name != NULL, FALSE);
+  g_return_val_if_fail (counter != NULL, FALSE);
+
+  for (guint i = 0; i < self->counters->len; i++)
+    {
+      const LogCounter *lc = g_ptr_array_index (self->counters, i);
+
+      if (g_str_equal (lc->category, category) && g_str_equal (lc->name, name))
+        {
+          *counter = i;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/**
+ * dzl_counter_log_get_n_samples:
+ * @self: a #DzlCounterLog
+ *
+ * Gets the number of samples found in the log.
+ *
+ * Since: 3.46
+ */
+guint
+dzl_counter_log_get_n_samples (DzlCounterLog *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->times->len;
+}
+
+/**
+ * dzl_counter_log_get_sample_time:
+ * @self: a #DzlCounterLog
+ * @sample: the index of the sample
+ *
+ * Gets the time at which @sample was taken.
+ *
+ * Returns: the wall-clock time in microseconds, as from g_get_real_time()
+ *
+ * Since: 3.46
+ */
+gint64
+dzl_counter_log_get_sample_time (DzlCounterLog *self,
+                                 guint          sample)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (sample < self->times->len, 0);
+
+  return g_array_index (self->times, gint64, sample);
+}
+
+/**
+ * dzl_counter_log_find_sample:
+ * @self: a #DzlCounterLog
+ * @time: a wall-clock time in microseconds
+ *
+ * Finds the last sample taken at or before @time, or the first sample if
+ * they were all taken after @time.
+ *
+ * Returns: the index of the sample
+ *
+ * Since: 3.46
+ */
+guint
+dzl_counter_log_find_sample (DzlCounterLog *self,
+                             gint64         time)
+{
+  guint lo = 0;
+  guint hi;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (self->times->len > 0, 0);
+
+  hi = self->times->len;
+
+  /* Find the first sample after @time */
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (g_array_index (self->times, gint64, mid) <= time)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo > 0 ? lo - 1 : 0;
+}
+
+/**
+ * dzl_counter_log_get_value:
+ * @self: a #DzlCounterLog
+ * @sample: the index of the sample
+ * @counter: the index of the counter
+ *
+ * Gets the value of @counter when @sample was taken. Counters which were
+ * not registered yet have a value of zero.
+ *
+ * Since: 3.46
+ */
+gint64
+dzl_counter_log_get_value (DzlCounterLog *self,
+                           guint          sample,
+                           guint          counter)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (sample < self->times->len, 0);
+  g_return_val_if_fail (counter < self->counters->len, 0);
+
+  if (counter >= get_n_values (self, sample))
+    return 0;
+
+  return g_array_index (self->values,
+                        gint64,
+                        g_array_index (self->offsets, guint, sample) + counter);
+}
+
+/**
+ * dzl_counter_log_get_rate_between:
+ * @self: a #DzlCounterLog
+ * @begin_sample: the index of the first sample
+ * @end_sample: the index of the last sample
+ * @counter: the index of the counter
+ *
+ * Gets the average rate of change of @counter between two samples.
+ *
+ * Returns: the change of the value per second
+ *
+ * Since: 3.46
+ */
+gdouble
+dzl_counter_log_get_rate_between (DzlCounterLog *self,
+                                  guint          begin_sample,
+                                  guint          end_sample,
+                                  guint          counter)
+{
+  gint64 begin_time;
+  gint64 end_time;
+
+  g_return_val_if_fail (self != NULL, 0.0);
+  g_return_val_if_fail (begin_sample <= end_sample, 0.0);
+  g_return_val_if_fail (end_sample < self->times->len, 0.0);
+  g_return_val_if_fail (counter < self->counters->len, 0.0);
+
+  begin_time = g_array_index (self->times, gint64, begin_sample);
+  end_time = g_array_index (self->times, gint64, end_sample);
+
+  if (end_time <= begin_time)
+    return 0.0;
+
+  return (gdouble)(dzl_counter_log_get_value (self, end_sample, counter) -
+                   dzl_counter_log_get_value (self, begin_sample, counter)) /
+         ((gdouble)(end_time - begin_time) / (gdouble)G_USEC_PER_SEC);
+}
+
+/**
+ * dzl_counter_log_get_rate:
+ * @self: a #DzlCounterLog
+ * @sample: the index of the sample
+ * @counter: the index of the counter
+ *
+ * Gets the rate of change of @counter between the previous sample and
+ * @sample. The rate of the first sample is zero.
+ *
+ * Returns: the change of the value per second
+ *
+ * Since: 3.46
+ */
+gdouble
+dzl_counter_log_get_rate (DzlCounterLog *self,
+                          guint          sample,
+                          guint          counter)
+{
+  g_return_val_if_fail (self != NULL, 0.0);
+  g_return_val_if_fail (sample < self->times->len, 0.0);
+
+  if (sample == 0)
+    return 0.0;
+
+  return dzl_counter_log_get_rate_between (self, sample - 1, sample, counter);
+}
@@ -0,0 +1,87 @@
+/* dzl-counter-log.h
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DZL_COUNTER_LOG_H
+#define DZL_COUNTER_LOG_H
+
+#include <gio/gio.h>
+
+#include "dzl-version-macros.h"
+
+G_BEGIN_DECLS
+
+#define DZL_TYPE_COUNTER_LOG (dzl_counter_log_get_type())
+
+typedef struct _DzlCounterLog DzlCounterLog;
+
+DZL_AVAILABLE_IN_3_46
+GType          dzl_counter_log_get_type            (void);
+DZL_AVAILABLE_IN_3_46
+DzlCounterLog *dzl_counter_log_new_from_bytes      (GBytes         *bytes,
+                                                    GError        **error);
+DZL_AVAILABLE_IN_3_46
+DzlCounterLog *dzl_counter_log_new_for_file        (GFile          *file,
+                                                    GCancellable   *cancellable,
+                                                    GError        **error);
+DZL_AVAILABLE_IN_3_46
+DzlCounterLog *dzl_counter_log_ref                 (DzlCounterLog  *self);
+DZL_AVAILABLE_IN_3_46
+void           dzl_counter_log_unref               (DzlCounterLog  *self);
+DZL_AVAILABLE_IN_3_46
+guint          dzl_counter_log_get_n_counters      (DzlCounterLog  *self);
+DZL_AVAILABLE_IN_3_46
+const gchar   *dzl_counter_log_get_category        (DzlCounterLog  *self,
+                                                    guint           counter);
+DZL_AVAILABLE_IN_3_46
+const gchar   *dzl_counter_log_get_name            (DzlCounterLog  *self,
+                                                    guint           counter);
+DZL_AVAILABLE_IN_3_46
+const gchar   *dzl_counter_log_get_description     (DzlCounterLog  *self,
+                                                    guint           counter);
+DZL_AVAILABLE_IN_3_46
+gboolean       dzl_counter_log_lookup              (DzlCounterLog  *self,
+                                                    const gchar    *category,
+                                                    const gchar    *name,
+                                                    guint          *counter);
+DZL_AVAILABLE_IN_3_46
+guint          dzl_counter_log_get_n_samples       (DzlCounterLog  *self);
+DZL_AVAILABLE_IN_3_46
+gint64         dzl_counter_log_get_sample_time     (DzlCounterLog  *self,
+                                                    guint           sample);
+DZL_AVAILABLE_IN_3_46
+guint          dzl_counter_log_find_sample         (DzlCounterLog  *self,
+                                                    gint64          time);
+DZL_AVAILABLE_IN_3_46
+gint64         dzl_counter_log_get_value           (DzlCounterLog  *self,
+                                                    guint           sample,
+                                                    guint           counter);
+DZL_AVAILABLE_IN_3_46
+gdouble        dzl_counter_log_get_rate            (DzlCounterLog  *self,
+                                                    guint           sample,
+                                                    guint           counter);
+DZL_AVAILABLE_IN_3_46
+gdouble        dzl_counter_log_get_rate_between    (DzlCounterLog  *self,
+                                                    guint           begin_sample,
+                                                    guint           end_sample,
+                                                    guint           counter);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DzlCounterLog, dzl_counter_log_unref)
+
+G_END_DECLS
+
+#endif /* DZL_COUNTER_LOG_H */
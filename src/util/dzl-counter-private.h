@@ -0,0 +1,34 @@
+/* dzl-counter-private.h
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DZL_COUNTER_PRIVATE_H
+#define DZL_COUNTER_PRIVATE_H
+
+#include <glib.h>
+
+#include "dzl-version-macros.h"
+
+G_BEGIN_DECLS
+
+/* Exported for the tests, which cannot tell from the kernel alone */
+DZL_AVAILABLE_IN_3_46
+gboolean _dzl_counter_uses_rseq (void);
+
+G_END_DECLS
+
+#endif /* DZL_COUNTER_PRIVATE_H */
@@ -0,0 +1,476 @@
+/* dzl-counter-sampler.c
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "dzl-counter-sampler"
+
+#include "config.h"
+
+#include "util/dzl-counter-log-private.h"
+#include "util/dzl-counter-sampler.h"
+#include "util/dzl-macros.h"
+
+/**
+ * SECTION:dzl-counter-sampler
+ * @title: DzlCounterSampler
+ * @short_description: Record the counters of an arena over time
+ *
+ * #DzlCounterSampler snapshots every counter of a #DzlCounterArena at a
+ * regular interval and appends them to a #GOutputStream, such as a file
+ * opened with g_file_append_to(). Each sample only stores how much every
+ * counter changed since the previous one, which usually takes a byte per
+ * counter. The log can be read back with #DzlCounterLog. Every sampler
+ * starts a new session in the log, so recordings may be appended to the
+ * same file.
+ *
+ * The arena may belong to another process, see
+ * dzl_counter_arena_new_for_pid(). It is refreshed before every sample
+ * so that counters registered later, or in a slot of an unregistered
+ * counter, are recorded too. Writes are synchronous and flushed after
+ * every sample so that little is lost if the process is killed.
+ *
+ * Since: 3.46
+ */
+
+#define DEFAULT_INTERVAL_MSEC 1000
+
+struct _DzlCounterSampler
+{
+  GObject          parent_instance;
+
+  DzlCounterArena *arena;
+  GOutputStream   *stream;
+
+  /* DzlCounter to its index in the log, plus one */
+  GHashTable      *ids;
+
+  /* The value of each counter at the previous sample, by index */
+  GArray          *values;
+
+  /* Reused to build each record before writing it */
+  GByteArray      *buffer;
+
+  gint64           last_time;
+  guint            interval;
+  guint            source_id;
+
+  guint            wrote_header : 1;
+  guint            failed : 1;
+};
+
+G_DEFINE_TYPE (DzlCounterSampler, dzl_counter_sampler, G_TYPE_OBJECT)
+
+enum {
+  PROP_0,
+  PROP_ARENA,
+  PROP_INTERVAL,
+  PROP_STREAM,
+  N_PROPS
+};
+
+static GParamSpec *properties [N_PROPS];
+
+/**
+ * dzl_counter_sampler_new:
+ * @arena: the #DzlCounterArena to sample
+ * @stream: the #GOutputStream to write samples to
+ *
+ * Creates a new #DzlCounterSampler. No sample is taken until
+ * dzl_counter_sampler_start() or dzl_counter_sampler_sample() is called.
+ *
+ * Returns: (transfer full): a #DzlCounterSampler
+ *
+ * Since: 3.46
+ */
+DzlCounterSampler *
+dzl_counter_sampler_new (DzlCounterArena *arena,
+                         GOutputStream   *stream)
+{
+  g_return_val_if_fail (arena != NULL, NULL);
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), NULL);
+
+  return g_object_new (DZL_TYPE_COUNTER_SAMPLER,
+                       "arena", arena,
+                       "stream", stream,
+                       NULL);
+}
+
+static void
+collect_counters_cb (DzlCounter *counter,
+                     gpointer    user_data)
+{
+  g_ptr_array_add (user_data, counter);
+}
+
+/**
+ * dzl_counter_sampler_sample:
+ * @self: a #DzlCounterSampler
+ * @error: a location for a #GError, or %NULL
+ *
+ * Takes a sample of every counter in the arena now, and appends it to
+ * the stream. If writing fails, the log may be incomplete and further
+ * samples are refused.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ *
+ * Since: 3.46
+ */
+gboolean
+dzl_counter_sampler_sample (DzlCounterSampler  *self,
+                            GError            **error)
+{
+  g_autoptr(GPtrArray) counters = NULL;
+  g_autoptr(GArray) current = NULL;
+  gint64 now;
+
+  g_return_val_if_fail (DZL_IS_COUNTER_SAMPLER (self), FALSE);
+
+  if (self->failed)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_FAILED,
+                   "A previous sample could not be written");
+      return FALSE;
+    }
+
+  g_byte_array_set_size (self->buffer, 0);
+
+  if (!self->wrote_header)
+    {
+      static const guint8 version = COUNTER_LOG_VERSION;
+
+      g_byte_array_append (self->buffer, (const guint8 *)COUNTER_LOG_MAGIC, COUNTER_LOG_MAGIC_LEN);
+      g_byte_array_append (self->buffer, &version, 1);
+    }
+
+  /*
+   * Pick up counters the process registered since the last sample. A
+   * slot reused by another counter gets a new DzlCounter, and so a new
+   * index in the log.
+   */
+  dzl_counter_arena_refresh (self->arena);
+
+  counters = g_ptr_array_new ();
+  dzl_counter_arena_foreach (self->arena, collect_counters_cb, counters);
+
+  /* Counters which went missing keep their previous value */
+  current = g_array_sized_new (FALSE, FALSE, sizeof (gint64), self->values->len + counters->len);
+  g_array_append_vals (current, self->values->data, self->values->len);
+
+  for (guint i = 0; i < counters->len; i++)
+    {
+      DzlCounter *counter = g_ptr_array_index (counters, i);
+      guint id = GPOINTER_TO_UINT (g_hash_table_lookup (self->ids, counter));
+      gint64 value;
+
+      if (id == 0)
+        {
+          static const guint8 tag = COUNTER_LOG_TAG_COUNTER;
+
+          g_byte_array_append (self->buffer, &tag, 1);
+          counter_log_put_string (self->buffer, counter->category);
+          counter_log_put_string (self->buffer, counter->name);
+          counter_log_put_string (self->buffer, counter->description);
+
+          g_array_set_size (current, current->len + 1);
+          id = current->len;
+          g_hash_table_insert (self->ids, counter, GUINT_TO_POINTER (id));
+        }
+
+      value = dzl_counter_get (counter);
+      g_array_index (current, gint64, id - 1) = value;
+    }
+
+  now = g_get_real_time ();
+
+  {
+    static const guint8 tag = COUNTER_LOG_TAG_SAMPLE;
+
+    g_byte_array_append (self->buffer, &tag, 1);
+    counter_log_put_int (self->buffer, now - self->last_time);
+    counter_log_put_uint (self->buffer, current->len);
+
+    for (guint i = 0; i < current->len; i++)
+      {
+        gint64 prev = i < self->values->len ? g_array_index (self->values, gint64, i) : 0;
+
+        counter_log_put_int (self->buffer, g_array_index (current, gint64, i) - prev);
+      }
+  }
+
+  if (!g_output_stream_write_all (self->stream, self->buffer->data, self->buffer->len, NULL, NULL, error) ||
+      !g_output_stream_flush (self->stream, NULL, error))
+    {
+      /* Counters may have been assigned an index without being written */
+      self->failed = TRUE;
+      return FALSE;
+    }
+
+  g_array_set_size (self->values, 0);
+  g_array_append_vals (self->values, current->data, current->len);
+  self->last_time = now;
+  self->wrote_header = TRUE;
+
+  return TRUE;
+}
+
+static gboolean
+dzl_counter_sampler_timeout (gpointer data)
+{
+  DzlCounterSampler *self = data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (DZL_IS_COUNTER_SAMPLER (self));
+
+  if (!dzl_counter_sampler_sample (self, &error))
+    {
+      g_warning ("Stopped sampling counters: %s", error->message);
+      self->source_id = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * dzl_counter_sampler_start:
+ * @self: a #DzlCounterSampler
+ *
+ * Starts sampling the counters every #DzlCounterSampler:interval
+ * milliseconds from the thread-default main context.
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_sampler_start (DzlCounterSampler *self)
+{
+  GSource *source;
+
+  g_return_if_fail (DZL_IS_COUNTER_SAMPLER (self));
+
+  if (self->source_id != 0)
+    return;
+
+  source = g_timeout_source_new (self->interval);
+  g_source_set_name (source, "[dzl] DzlCounterSampler");
+  g_source_set_callback (source, dzl_counter_sampler_timeout, self, NULL);
+  self->source_id = g_source_attach (source, g_main_context_get_thread_default ());
+  g_source_unref (source);
+}
+
+/**
+ * dzl_counter_sampler_stop:
+ * @self: a #DzlCounterSampler
+ *
+ * Stops sampling the counters started with dzl_counter_sampler_start().
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_sampler_stop (DzlCounterSampler *self)
+{
+  g_return_if_fail (DZL_IS_COUNTER_SAMPLER (self));
+
+  dzl_clear_source (&self->source_id);
+}
+
+/**
+ * dzl_counter_sampler_get_arena:
+ * @self: a #DzlCounterSampler
+ *
+ * Returns: (transfer none): the #DzlCounterArena being sampled
+ *
+ * Since: 3.46
+ */
+DzlCounterArena *
+dzl_counter_sampler_get_arena (DzlCounterSampler *self)
+{
+  g_return_val_if_fail (DZL_IS_COUNTER_SAMPLER (self), NULL);
+
+  return self->arena;
+}
+
+/**
+ * dzl_counter_sampler_get_interval:
+ * @self: a #DzlCounterSampler
+ *
+ * Returns: the number of milliseconds between samples
+ *
+ * Since: 3.46
+ */
+guint
+dzl_counter_sampler_get_interval (DzlCounterSampler *self)
+{
+  g_return_val_if_fail (DZL_IS_COUNTER_SAMPLER (self), 0);
+
+  return self->interval;
+}
+
+/**
+ * dzl_counter_sampler_set_interval:
+ * @self: a #DzlCounterSampler
+ * @interval: the number of milliseconds between samples
+ *
+ * Sets the sampling interval, taking effect immediately if the sampler
+ * is running.
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_sampler_set_interval (DzlCounterSampler *self,
+                                  guint              interval)
+{
+  g_return_if_fail (DZL_IS_COUNTER_SAMPLER (self));
+  g_return_if_fail (interval > 0);
+
+  if (interval != self->interval)
+    {
+      self->interval = interval;
+
+      if (self->source_id != 0)
+        {
+          dzl_counter_sampler_stop (self);
+          dzl_counter_sampler_start (self);
+        }
+
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_INTERVAL]);
+    }
+}
+
+static void
+dzl_counter_sampler_dispose (GObject *object)
+{
+  DzlCounterSampler *self = (DzlCounterSampler *)object;
+
+  dzl_clear_source (&self->source_id);
+
+  G_OBJECT_CLASS (dzl_counter_sampler_parent_class)->dispose (object);
+}
+
+static void
+dzl_counter_sampler_finalize (GObject *object)
+{
+  DzlCounterSampler *self = (DzlCounterSampler *)object;
+
+  g_clear_pointer (&self->arena, dzl_counter_arena_unref);
+  g_clear_object (&self->stream);
+  g_clear_pointer (&self->ids, g_hash_table_unref);
+  g_clear_pointer (&self->values, g_array_unref);
+  g_clear_pointer (&self->buffer, g_byte_array_unref);
+
+  G_OBJECT_CLASS (dzl_counter_sampler_parent_class)->finalize (object);
+}
+
+static void
+dzl_counter_sampler_get_property (GObject    *object,
+                                  guint       prop_id,
+                                  GValue     *value,
+                                  GParamSpec *pspec)
+{
+  DzlCounterSampler *self = DZL_COUNTER_SAMPLER (object);
+
+  switch (prop_id)
+    {
+    case PROP_ARENA:
+      g_value_set_boxed (value, self->arena);
+      break;
+
+    case PROP_INTERVAL:
+      g_value_set_uint (value, self->interval);
+      break;
+
+    case PROP_STREAM:
+      g_value_set_object (value, self->stream);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+dzl_counter_sampler_set_property (GObject      *object,
+                                  guint         prop_id,
+                                  const GValue *value,
+                                  GParamSpec   *pspec)
+{
+  DzlCounterSampler *self = DZL_COUNTER_SAMPLER (object);
+
+  switch (prop_id)
+    {
+    case PROP_ARENA:
+      self->arena = g_value_dup_boxed (value);
+      break;
+
+    case PROP_INTERVAL:
+      dzl_counter_sampler_set_interval (self, g_value_get_uint (value));
+      break;
+
+    case PROP_STREAM:
+      self->stream = g_value_dup_object (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+dzl_counter_sampler_class_init (DzlCounterSamplerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = dzl_counter_sampler_dispose;
+  object_class->finalize = dzl_counter_sampler_finalize;
+  object_class->get_property = dzl_counter_sampler_get_property;
+  object_class->set_property = dzl_counter_sampler_set_property;
+
+  properties [PROP_ARENA] =
+    g_param_spec_boxed ("arena",
+                        "Arena",
+                        "The counter arena to sample",
+                        dzl_counter_arena_get_type (),
+                        (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  properties [PROP_INTERVAL] =
+    g_param_spec_uint ("interval",
+                       "Interval",
+                       "The number of milliseconds between samples",
+                       1,
+                       G_MAXUINT,
+                       DEFAULT_INTERVAL_MSEC,
+                       (G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
+  properties [PROP_STREAM] =
+    g_param_spec_object ("stream",
+                         "Stream",
+                         "The stream to write samples to",
+                         G_TYPE_OUTPUT_STREAM,
+                         (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+dzl_counter_sampler_init (DzlCounterSampler *self)
+{
+  self->interval = DEFAULT_INTERVAL_MSEC;
+  self->ids = g_hash_table_new (NULL, NULL);
+  self->values = g_array_new (FALSE, FALSE, sizeof (gint64));
+  self->buffer = g_byte_array_new ();
+}
@@ -0,0 +1,54 @@
+/* dzl-counter-sampler.h
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DZL_COUNTER_SAMPLER_H
+#define DZL_COUNTER_SAMPLER_H
+
+#include <gio/gio.h>
+
+#include "dzl-counter.h"
+#include "dzl-version-macros.h"
+
+G_BEGIN_DECLS
+
+#define DZL_TYPE_COUNTER_SAMPLER (dzl_counter_sampler_get_type())
+
+DZL_AVAILABLE_IN_3_46
+G_DECLARE_FINAL_TYPE (DzlCounterSampler, dzl_counter_sampler, DZL, COUNTER_SAMPLER, GObject)
+
+DZL_AVAILABLE_IN_3_46
+DzlCounterSampler *dzl_counter_sampler_new          (DzlCounterArena    *arena,
+                                                     GOutputStream      *stream);
+DZL_AVAILABLE_IN_3_46
+DzlCounterArena   *dzl_counter_sampler_get_arena    (DzlCounterSampler  *self);
+DZL_AVAILABLE_IN_3_46
+guint              dzl_counter_sampler_get_interval (DzlCounterSampler  *self);
+DZL_AVAILABLE_IN_3_46
+void               dzl_counter_sampler_set_interval (DzlCounterSampler  *self,
+                                                     guint               interval);
+DZL_AVAILABLE_IN_3_46
+gboolean           dzl_counter_sampler_sample       (DzlCounterSampler  *self,
+                                                     GError            **error);
+DZL_AVAILABLE_IN_3_46
+void               dzl_counter_sampler_start        (DzlCounterSampler  *self);
+DZL_AVAILABLE_IN_3_46
+void               dzl_counter_sampler_stop         (DzlCounterSampler  *self);
+
+G_END_DECLS
+
+#endif /* DZL_COUNTER_SAMPLER_H */
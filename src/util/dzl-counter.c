@@ -39,37 +39,73 @@
 #endif
 
 #include "util/dzl-counter.h"
+#include "util/dzl-counter-private.h"
 #include "util/dzl-macros.h"
 
+#if defined(DZL_COUNTER_HAVE_RSEQ) && defined(HAVE_LINUX_RSEQ_H)
+# define USE_RSEQ 1
+# include <sys/syscall.h>
+# ifdef HAVE_SYS_RSEQ_H
+#  include <sys/rseq.h>
+# else
+#  include <linux/rseq.h>
+# endif
+# ifndef RSEQ_SIG
+#  define RSEQ_SIG 0x53053053
+# endif
+#endif
+
 G_DEFINE_BOXED_TYPE (DzlCounterArena, dzl_counter_arena, dzl_counter_arena_ref, dzl_counter_arena_unref)
 
-#define MAX_COUNTERS       2000
-#define NAME_FORMAT        "/DzlCounters-%u"
-#define MAGIC              0x71167125
-#define COUNTER_MAX_SHM    (1024 * 1024 * 4)
-#define COUNTERS_PER_GROUP 8
-#define DATA_CELL_SIZE     64
-#define CELLS_PER_INFO     (sizeof(CounterInfo) / DATA_CELL_SIZE)
-#define CELLS_PER_HEADER   2
+#define MAX_COUNTERS        2000
+#define MAX_SEGMENTS        64
+#define ARENA_PAGES         64
+#define NAME_FORMAT         "/DzlCounters-%u"
+#define SEGMENT_NAME_FORMAT "/DzlCounters-%u-%u"
+/*
+ * Changed whenever ShmHeader or CounterInfo changes so that readers built
+ * against another layout reject the arena. 0x71167125 was the layout
+ * before histograms, chained segments and tombstones.
+ */
+#define MAGIC               0x71167126
+#define COUNTER_MAX_SHM     (1024 * 1024 * 4)
+#define COUNTERS_PER_GROUP  8
+#define DATA_CELL_SIZE      64
+#define CELLS_PER_INFO      (sizeof(CounterInfo) / DATA_CELL_SIZE)
+#define CELLS_PER_HEADER    2
 #define CELLS_PER_GROUP(ncpu)                             \
   (((sizeof (CounterInfo) * COUNTERS_PER_GROUP) +         \
     (sizeof(DzlCounterValue) * (ncpu))) / DATA_CELL_SIZE)
+#define CELLS_PER_HISTOGRAM_ROW                           \
+  ((sizeof (gint64) * DZL_COUNTER_HISTOGRAM_N_BUCKETS) / DATA_CELL_SIZE)
 #ifdef DZL_COUNTER_REQUIRES_ATOMIC
 #define DZL_MEMORY_BARRIER G_STMT_START { __sync_synchronize(); } G_STMT_END
 #else
 #define DZL_MEMORY_BARRIER G_STMT_START {} G_STMT_END
 #endif
+/* Orders the generation of a CounterInfo with its contents */
+#define SLOT_BARRIER G_STMT_START { __sync_synchronize(); } G_STMT_END
+
+enum {
+  COUNTER_KIND_COUNTER   = 0,
+  COUNTER_KIND_HISTOGRAM = 1,
+  COUNTER_KIND_TOMBSTONE = 2,
+};
 
 typedef struct
 {
-  guint cell : 29;       /* Counter groups starting cell */
-  guint position : 3;    /* Index within counter group */
-  gchar category[20];    /* Counter category name. */
-  gchar name[32];        /* Counter name. */
-  gchar description[72]; /* Counter description */
+  guint   cell : 29;       /* Counter groups starting cell */
+  guint   position : 3;    /* Index within counter group */
+  gchar   category[20];    /* Counter category name. */
+  gchar   name[32];        /* Counter name. */
+  gchar   description[64]; /* Counter description */
+  guint16 kind;            /* One of COUNTER_KIND_* */
+  guint16 generation;      /* Odd while the slot is being changed */
+  guint32 data_cell;       /* First cell of the histogram buckets */
 } CounterInfo __attribute__((aligned (DATA_CELL_SIZE)));
 
 G_STATIC_ASSERT (sizeof (CounterInfo) == 128);
+G_STATIC_ASSERT ((sizeof (gint64) * DZL_COUNTER_HISTOGRAM_N_BUCKETS) % DATA_CELL_SIZE == 0);
 G_STATIC_ASSERT (CELLS_PER_INFO == 2);
 G_STATIC_ASSERT (CELLS_PER_GROUP(1) == 17);
 G_STATIC_ASSERT (CELLS_PER_GROUP(2) == 18);
@@ -90,30 +126,74 @@ typedef struct
   guint32 size;          /* Size of underlying shm file */
   guint32 ncpu;          /* Number of CPUs registered with */
   guint32 first_offset;  /* Offset to first counter info in cells */
-  guint32 n_counters;    /* Number of CounterInfos */
-  gchar   padding [108];
+  guint32 n_counters;    /* Number of CounterInfos, including tombstones */
+  guint32 segment;       /* Index of this segment */
+  guint32 next_segment;  /* Index of the following segment, or 0 */
+  gchar   padding [100];
 } ShmHeader __attribute__((aligned (DATA_CELL_SIZE)));
 
 G_STATIC_ASSERT (sizeof(ShmHeader) == (DATA_CELL_SIZE * CELLS_PER_HEADER));
 
-struct _DzlCounterArena
+typedef struct
 {
-  gint      ref_count;
-  guint     arena_is_malloced : 1;
-  guint     data_is_mmapped : 1;
-  guint     is_local_arena : 1;
-  gsize     n_cells;
   DataCell *cells;
+  gsize     n_cells;
   gsize     data_length;
-  GPid      pid;
+  /* Cells from here to n_cells are used by histogram buckets */
+  gsize     histogram_cell;
   guint     n_counters;
-  GList    *counters;
+  guint     is_mmapped : 1;
+  /* RemoteSlot of each CounterInfo read so far, for remote arenas */
+  GArray   *remote_slots;
+} Segment;
+
+/* What was last read from a CounterInfo of a remote arena */
+typedef struct
+{
+  DzlCounter *counter;
+  guint16     generation;
+  guint       read : 1;
+} RemoteSlot;
+
+/* The CounterInfo of a registered counter in a local arena */
+typedef struct
+{
+  ShmHeader   *header;
+  CounterInfo *info;
+  guint        index;
+} Slot;
+
+struct _DzlCounterArena
+{
+  gint        ref_count;
+  guint       arena_is_malloced : 1;
+  guint       is_local_arena : 1;
+  guint       use_shm : 1;
+  GPid        pid;
+  /* Segment, the first one holds the ShmHeader found by other processes */
+  GArray     *segments;
+  GList      *counters;
+  /* Set of the DzlCounter embedded in each DzlCounterHistogram */
+  GHashTable *histograms;
+  /* DzlCounter to its Slot, for local arenas */
+  GHashTable *slots;
+  /* Slots of unregistered counters, which can be reused */
+  GQueue      free_counter_slots;
+  GQueue      free_histogram_slots;
+  /* Counters of remote arenas whose slot changed, kept alive until freed */
+  GList      *retired;
 };
 
 G_LOCK_DEFINE_STATIC (reglock);
 
 static void _dzl_counter_init_getcpu (void) __attribute__ ((constructor));
 static guint (*_dzl_counter_getcpu_helper) (void);
+static void _dzl_counter_add_getcpu (volatile gint64 *cells,
+                                     gsize            stride,
+                                     gint64           count);
+static void (*_dzl_counter_add_helper) (volatile gint64 *cells,
+                                        gsize            stride,
+                                        gint64           count) = _dzl_counter_add_getcpu;
 
 gint64
 dzl_counter_get (DzlCounter *counter)
@@ -134,6 +214,25 @@ dzl_counter_get (DzlCounter *counter)
   return value;
 }
 
+/**
+ * dzl_counter_add:
+ * @counter: a #DzlCounter
+ * @count: the amount to add
+ *
+ * Adds @count to the cell of @counter owned by the current CPU. This is
+ * what DZL_COUNTER_ADD() uses where restartable sequences may be available.
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_add (DzlCounter *counter,
+                 gint64      count)
+{
+  _dzl_counter_add_helper (&counter->values [0].value,
+                           sizeof (DzlCounterValue) / sizeof (gint64),
+                           count);
+}
+
 void
 dzl_counter_reset (DzlCounter *counter)
 {
@@ -150,7 +249,30 @@ dzl_counter_reset (DzlCounter *counter)
   DZL_MEMORY_BARRIER;
 }
 
+static void
+_dzl_counter_segment_name (gchar *name,
+                           gsize  len,
+                           guint  pid,
+                           guint  index)
+{
+  if (index == 0)
+    g_snprintf (name, len, NAME_FORMAT, pid);
+  else
+    g_snprintf (name, len, SEGMENT_NAME_FORMAT, pid, index);
+}
+
+static gsize
+_dzl_counter_get_page_size (void)
+{
+  glong page_size = sysconf (_SC_PAGE_SIZE);
+
+  /* Implausible, but squashes warnings. */
+  return page_size < 4096 ? 4096 : page_size;
+}
+
 #ifndef G_OS_WIN32
+static guint n_shm_segments;
+
 static void
 _dzl_counter_arena_atexit (void)
 {
@@ -158,176 +280,344 @@ _dzl_counter_arena_atexit (void)
   gint pid;
 
   pid = getpid ();
-  g_snprintf (name, sizeof name, NAME_FORMAT, pid);
-  shm_unlink (name);
+
+  for (guint i = 0; i < n_shm_segments; i++)
+    {
+      _dzl_counter_segment_name (name, sizeof name, pid, i);
+      shm_unlink (name);
+    }
 }
 #endif
 
-static void
-_dzl_counter_arena_init_local (DzlCounterArena *arena)
+/*
+ * Adds a segment of @size bytes to the local @arena, linking it from the
+ * previous segment so that other processes can find it. Must be called
+ * with reglock held, or before the arena is visible.
+ */
+static gboolean
+_dzl_counter_arena_add_segment (DzlCounterArena *arena,
+                                gsize            size)
 {
-  gsize size;
-  gint page_size;
+  Segment segment = { 0 };
   ShmHeader *header;
-  gboolean needs_warning = TRUE;
+  gpointer mem = NULL;
+  guint index;
+
+  g_assert (arena != NULL);
+  g_assert (arena->is_local_arena);
+  g_assert (size % _dzl_counter_get_page_size () == 0);
+
+  index = arena->segments->len;
+
+  if (index >= MAX_SEGMENTS)
+    return FALSE;
+
 #ifndef G_OS_WIN32
-  gpointer mem;
-  unsigned pid;
-  gint fd;
-  gchar name [32];
-#endif
+  if (arena->use_shm)
+    {
+      gchar name [32];
+      gint fd;
 
-  page_size = sysconf (_SC_PAGE_SIZE);
+      _dzl_counter_segment_name (name, sizeof name, getpid (), index);
 
-  /* Implausible, but squashes warnings. */
-  if (page_size < 4096)
+      if (-1 != (fd = shm_open (name, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR|S_IRGRP)))
+        {
+          /*
+           * ftruncate() will cause reads to be zero. Therefore, we don't need
+           * to do write() of zeroes to initialize the shared memory area.
+           * Pages of the shm file are only allocated once they are written to.
+           */
+          if (-1 != ftruncate (fd, size))
+            {
+              mem = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+              if (mem == MAP_FAILED)
+                mem = NULL;
+            }
+
+          close (fd);
+
+          if (mem == NULL)
+            shm_unlink (name);
+        }
+
+      if (mem != NULL)
+        {
+          if (n_shm_segments++ == 0)
+            atexit (_dzl_counter_arena_atexit);
+          segment.is_mmapped = TRUE;
+        }
+      else
+        {
+          g_warning ("Failed to allocate shared memory for counters. "
+                     "Counters will not be available to external processes.");
+          arena->use_shm = FALSE;
+        }
+    }
+#endif
+
+  if (mem == NULL)
     {
-      page_size = 4096;
-      size = page_size * 4;
-      goto use_malloc;
+#ifdef G_OS_WIN32
+      mem = _aligned_malloc (size, _dzl_counter_get_page_size ());
+#else
+      if (posix_memalign (&mem, _dzl_counter_get_page_size (), size) != 0)
+        {
+          perror ("posix_memalign()");
+          abort ();
+        }
+#endif
+
+      /* Unlike the shm file, this is not zeroed for us */
+      memset (mem, 0, size);
     }
 
-#ifndef G_OS_WIN32
+  segment.cells = mem;
+  segment.n_cells = size / DATA_CELL_SIZE;
+  segment.histogram_cell = segment.n_cells;
+  segment.data_length = size;
 
-  /*
-   * FIXME: https://bugzilla.gnome.org/show_bug.cgi?id=749280
-   *
-   * We have some very tricky work ahead of us to add unlimited numbers
-   * of counters at runtime. We basically need to avoid placing counters
-   * that could overlap a page.
-   */
-  size = page_size * 4;
+  header = mem;
+  header->magic = MAGIC;
+  header->ncpu = g_get_num_processors ();
+  header->first_offset = CELLS_PER_HEADER;
+  header->segment = index;
 
-  arena->ref_count = 1;
-  arena->is_local_arena = TRUE;
+  DZL_MEMORY_BARRIER;
+
+  header->size = (guint32)size;
 
-  if (getenv ("DZL_COUNTER_DISABLE_SHM"))
+  g_array_append_val (arena->segments, segment);
+
+  /* Only link the segment once it is ready to be read */
+  if (index > 0 && segment.is_mmapped)
     {
-      needs_warning = FALSE;
-      goto use_malloc;
+      ShmHeader *prev = (ShmHeader *)g_array_index (arena->segments, Segment, index - 1).cells;
+
+      SLOT_BARRIER;
+      prev->next_segment = index;
     }
 
-  pid = getpid ();
-  g_snprintf (name, sizeof name, NAME_FORMAT, pid);
+  return TRUE;
+}
 
-  if (-1 == (fd = shm_open (name, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR|S_IRGRP)))
-    goto use_malloc;
+static void
+_dzl_counter_arena_init_local (DzlCounterArena *arena)
+{
+  arena->ref_count = 1;
+  arena->is_local_arena = TRUE;
+  arena->segments = g_array_new (FALSE, FALSE, sizeof (Segment));
+  arena->slots = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  arena->use_shm = (getenv ("DZL_COUNTER_DISABLE_SHM") == NULL);
 
   /*
-   * ftruncate() will cause reads to be zero. Therefore, we don't need to
-   * do write() of zeroes to initialize the shared memory area.
+   * Start with enough room for most applications, including a few
+   * histograms. More segments are added as they are needed.
    */
-  if (-1 == ftruncate (fd, size))
-    goto failure;
+  _dzl_counter_arena_add_segment (arena, _dzl_counter_get_page_size () * ARENA_PAGES);
+}
 
-  /*
-   * Memory map the shared memory segement so that we can store our counters
-   * within it. We need to layout the counters into the segment so that other
-   * processes can traverse and read the values by loading the shared page.
-   */
-  mem = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-  if (mem == MAP_FAILED)
-    goto failure;
+/*
+ * Copies @info into @copy, unless it is being changed by the process
+ * owning it, in which case FALSE is returned.
+ */
+static gboolean
+_dzl_counter_info_read (const CounterInfo *info,
+                        CounterInfo       *copy)
+{
+  for (guint i = 0; i < 100; i++)
+    {
+      guint16 generation = ((volatile const CounterInfo *)info)->generation;
 
-  close (fd);
-  atexit (_dzl_counter_arena_atexit);
+      if ((generation & 1) == 0)
+        {
+          SLOT_BARRIER;
+          memcpy (copy, info, sizeof *copy);
+          SLOT_BARRIER;
 
-  arena->data_is_mmapped = TRUE;
-  arena->cells = mem;
-  arena->n_cells = (size / DATA_CELL_SIZE);
-  arena->data_length = size;
+          if (((volatile const CounterInfo *)info)->generation == generation)
+            return TRUE;
+        }
 
-  header = mem;
-  header->magic = MAGIC;
-  header->ncpu = g_get_num_processors ();
-  header->first_offset = CELLS_PER_HEADER;
+      g_thread_yield ();
+    }
 
-  DZL_MEMORY_BARRIER;
+  return FALSE;
+}
 
-  header->size = (guint32)arena->data_length;
+static DzlCounter *
+_dzl_counter_remote_new (DzlCounterArena   *arena,
+                         Segment           *segment,
+                         const CounterInfo *info,
+                         guint              ncpu)
+{
+  DzlCounter *counter;
 
-  return;
+  if ((gsize)info->cell + ncpu > segment->n_cells)
+    return NULL;
 
-failure:
-  shm_unlink (name);
-  close (fd);
-#endif
+  if (info->kind == COUNTER_KIND_HISTOGRAM)
+    {
+      DzlCounterHistogram *histogram;
 
-use_malloc:
-  if (needs_warning)
-    g_warning ("Failed to allocate shared memory for counters. "
-               "Counters will not be available to external processes.");
+      if ((gsize)info->data_cell + (CELLS_PER_HISTOGRAM_ROW * ncpu) > segment->n_cells)
+        return NULL;
 
-  /*
-   * Ask for double memory than required so that we can be certain
-   * that the memalign will keep us within valid memory ranges.
-   */
-  if (size < page_size)
-    size = page_size;
-  arena->data_is_mmapped = FALSE;
-  arena->n_cells = (size / DATA_CELL_SIZE);
-  arena->data_length = size;
-#ifdef G_OS_WIN32
-  arena->cells = _aligned_malloc (size, page_size);
-#else
-  arena->cells = g_malloc0 (size << 1);
-#endif
+      histogram = g_new0 (DzlCounterHistogram, 1);
+      histogram->buckets = (volatile gint64 *)&segment->cells [info->data_cell];
+      counter = &histogram->counter;
 
-#ifndef G_OS_WIN32
-  /*
-   * Make sure that we have a properly aligned allocation back from
-   * malloc. Since we are at least a page size, we should pretty much
-   * be guaranteed this, but better to check with posix_memalign().
-   */
-  if (posix_memalign ((gpointer)&arena->cells, page_size, size << 1) != 0)
+      if (arena->histograms == NULL)
+        arena->histograms = g_hash_table_new (NULL, NULL);
+      g_hash_table_add (arena->histograms, counter);
+    }
+  else
     {
-      perror ("posix_memalign()");
-      abort ();
+      counter = g_new0 (DzlCounter, 1);
     }
+
+  counter->category = g_strndup (info->category, sizeof info->category);
+  counter->name = g_strndup (info->name, sizeof info->name);
+  counter->description = g_strndup (info->description, sizeof info->description);
+  counter->values = (DzlCounterValue *)&segment->cells [info->cell].values[info->position];
+
+#if 0
+  g_print ("Counter discovered: cell=%u position=%u category=%s name=%s values=%p offset=%lu\n",
+           info->cell, info->position, info->category, info->name, counter->values,
+           (guint8*)counter->values - (guint8*)segment->cells);
 #endif
 
-  header = (void *)arena->cells;
-  header->magic = MAGIC;
-  header->ncpu = g_get_num_processors ();
-  header->first_offset = CELLS_PER_HEADER;
+  return counter;
+}
 
-  DZL_MEMORY_BARRIER;
+/*
+ * Hides @counter of a remote arena whose slot was unregistered or reused.
+ * It stays valid until the arena is freed since callers may still hold it.
+ */
+static void
+_dzl_counter_remote_retire (DzlCounterArena *arena,
+                            DzlCounter      *counter)
+{
+  arena->counters = g_list_remove (arena->counters, counter);
+  if (arena->histograms != NULL)
+    g_hash_table_remove (arena->histograms, counter);
+  arena->retired = g_list_prepend (arena->retired, counter);
+}
+
+/*
+ * Reads the CounterInfo of @segment that changed since the last call,
+ * replacing the counters of slots that were unregistered or reused and
+ * adding new ones. Returns 1 if the counters changed, 0 if not, or -1
+ * if the segment is corrupt.
+ */
+static gint
+_dzl_counter_arena_refresh_segment (DzlCounterArena *arena,
+                                    Segment         *segment)
+{
+  const volatile ShmHeader *header = (const volatile ShmHeader *)segment->cells;
+  GList *added = NULL;
+  guint n_counters;
+  guint ncpu;
+  gint ret = 0;
+
+  ncpu = g_get_num_processors ();
+  n_counters = header->n_counters;
+
+  if (n_counters > MAX_COUNTERS)
+    return -1;
+
+  if (segment->remote_slots->len < n_counters)
+    g_array_set_size (segment->remote_slots, n_counters);
+
+  for (guint i = 0; i < n_counters; i++)
+    {
+      RemoteSlot *rslot = &g_array_index (segment->remote_slots, RemoteSlot, i);
+      const CounterInfo *slot_info;
+      CounterInfo info;
+      DzlCounter *counter;
+      guint group_start_cell;
+      guint group;
+      guint position;
+
+      group = i / COUNTERS_PER_GROUP;
+      position = i % COUNTERS_PER_GROUP;
+      group_start_cell = header->first_offset + (CELLS_PER_GROUP (ncpu) * group);
+
+      if (group_start_cell + CELLS_PER_GROUP (ncpu) >= segment->n_cells)
+        {
+          ret = -1;
+          break;
+        }
+
+      slot_info = &((CounterInfo *)&segment->cells[group_start_cell])[position];
+
+      if (rslot->read && ((volatile const CounterInfo *)slot_info)->generation == rslot->generation)
+        continue;
+
+      /* Skip counters that are being replaced, we'll see them next time */
+      if (!_dzl_counter_info_read (slot_info, &info))
+        continue;
+
+      rslot->read = TRUE;
+      rslot->generation = info.generation;
+
+      if (rslot->counter != NULL)
+        {
+          _dzl_counter_remote_retire (arena, g_steal_pointer (&rslot->counter));
+          ret = 1;
+        }
+
+      if (info.kind == COUNTER_KIND_TOMBSTONE)
+        continue;
+
+      if (!(counter = _dzl_counter_remote_new (arena, segment, &info, ncpu)))
+        {
+          ret = -1;
+          break;
+        }
+
+      rslot->counter = counter;
+      added = g_list_prepend (added, counter);
+      ret = 1;
+    }
 
-  header->size = (guint32)arena->data_length;
+  arena->counters = g_list_concat (arena->counters, g_list_reverse (added));
+
+  return ret;
 }
 
-static gboolean
-_dzl_counter_arena_init_remote (DzlCounterArena *arena,
-                                GPid             pid)
+/*
+ * Maps segment @index of the counters of @pid, adding the counters found
+ * in it to @arena. Returns the index of the following segment, 0 if there
+ * is none, or -1 on failure.
+ */
+static gint
+_dzl_counter_arena_map_remote (DzlCounterArena *arena,
+                               GPid             pid,
+                               guint            index)
 {
+  Segment segment = { 0 };
+  Segment *mapped;
   ShmHeader header;
   gssize count;
   gchar name [32];
   void *mem = NULL;
-  guint ncpu;
   guint n_counters;
-  guint i;
+  guint next;
   int fd = -1;
 
-  g_assert (arena != NULL);
-
-  ncpu = g_get_num_processors ();
-
-  arena->ref_count = 1;
-  arena->pid = pid;
-
-  g_snprintf (name, sizeof name, NAME_FORMAT, (int)pid);
+  _dzl_counter_segment_name (name, sizeof name, (int)pid, index);
 
   fd = shm_open (name, O_RDONLY, 0);
   if (fd < 0)
-    return FALSE;
+    return -1;
 
   count = pread (fd, &header, sizeof header, 0);
 
   if ((count != sizeof header) ||
       (header.magic != MAGIC) ||
       (header.size > COUNTER_MAX_SHM) ||
-      (header.ncpu > g_get_num_processors ()))
+      (header.ncpu > g_get_num_processors ()) ||
+      (header.segment != index))
     goto failure;
 
   n_counters = header.n_counters;
@@ -339,57 +629,48 @@ _dzl_counter_arena_init_remote (DzlCounterArena *arena,
       CELLS_PER_HEADER + (((n_counters / COUNTERS_PER_GROUP) + 1) * CELLS_PER_GROUP(header.ncpu)))
     goto failure;
 
-  mem = mmap (NULL, header.size, PROT_READ, MAP_SHARED, fd, 0);
-
-  if (mem == MAP_FAILED)
+  /* Not strictly required, but helpful for now */
+  if (header.first_offset != CELLS_PER_HEADER)
     goto failure;
 
-  arena->is_local_arena = FALSE;
-  arena->data_is_mmapped = TRUE;
-  arena->cells = mem;
-  arena->n_cells = header.size / DATA_CELL_SIZE;
-  arena->data_length = header.size;
-  arena->counters = NULL;
+  mem = mmap (NULL, header.size, PROT_READ, MAP_SHARED, fd, 0);
 
-  /* Not strictly required, but helpful for now */
-  if (header.first_offset != CELLS_PER_HEADER)
+  if (mem == MAP_FAILED)
     goto failure;
 
-  for (i = 0; i < n_counters; i++)
-    {
-      CounterInfo *info;
-      DzlCounter *counter;
-      guint group_start_cell;
-      guint group;
-      guint position;
+  close (fd);
 
-      group = i / COUNTERS_PER_GROUP;
-      position = i % COUNTERS_PER_GROUP;
-      group_start_cell = header.first_offset + (CELLS_PER_GROUP (ncpu) * group);
+  segment.is_mmapped = TRUE;
+  segment.cells = mem;
+  segment.n_cells = header.size / DATA_CELL_SIZE;
+  segment.data_length = header.size;
+  segment.remote_slots = g_array_new (FALSE, TRUE, sizeof (RemoteSlot));
 
-      if (group_start_cell + CELLS_PER_GROUP (ncpu) >= arena->n_cells)
-        goto failure;
+  g_array_append_val (arena->segments, segment);
+  mapped = &g_array_index (arena->segments, Segment, arena->segments->len - 1);
 
-      info = &(((CounterInfo *)&arena->cells[group_start_cell])[position]);
+  if (_dzl_counter_arena_refresh_segment (arena, mapped) < 0)
+    {
+      /* Drop whatever was found, the segment cannot be trusted */
+      for (guint i = 0; i < mapped->remote_slots->len; i++)
+        {
+          RemoteSlot *rslot = &g_array_index (mapped->remote_slots, RemoteSlot, i);
 
-      counter = g_new0 (DzlCounter, 1);
-      counter->category = g_strndup (info->category, sizeof info->category);
-      counter->name = g_strndup (info->name, sizeof info->name);
-      counter->description = g_strndup (info->description, sizeof info->description);
-      counter->values = (DzlCounterValue *)&arena->cells [info->cell].values[info->position];
+          if (rslot->counter != NULL)
+            _dzl_counter_remote_retire (arena, rslot->counter);
+        }
 
-#if 0
-      g_print ("Counter discovered: cell=%u position=%u category=%s name=%s values=%p offset=%lu\n",
-               info->cell, info->position, info->category, info->name, counter->values,
-               (guint8*)counter->values - (guint8*)mem);
-#endif
+      g_array_unref (mapped->remote_slots);
+      g_array_set_size (arena->segments, arena->segments->len - 1);
+      munmap (mem, header.size);
 
-      arena->counters = g_list_prepend (arena->counters, counter);
+      return -1;
     }
 
-  close (fd);
+  /* The link may have been added since we read the header */
+  next = ((volatile const ShmHeader *)mem)->next_segment;
 
-  return TRUE;
+  return (next == index + 1 && next < MAX_SEGMENTS) ? (gint)next : 0;
 
 failure:
   close (fd);
@@ -397,7 +678,50 @@ failure:
   if ((mem != NULL) && (mem != MAP_FAILED))
     munmap (mem, header.size);
 
-  return FALSE;
+  return -1;
+}
+
+static void
+_dzl_counter_free_remote (gpointer data)
+{
+  DzlCounter *counter = data;
+
+  g_free ((gchar *)counter->category);
+  g_free ((gchar *)counter->name);
+  g_free ((gchar *)counter->description);
+
+  /* Histograms were allocated with their counter as first member */
+  g_free (counter);
+}
+
+static gboolean
+_dzl_counter_arena_init_remote (DzlCounterArena *arena,
+                                GPid             pid)
+{
+  gint next = 0;
+
+  g_assert (arena != NULL);
+
+  arena->ref_count = 1;
+  arena->pid = pid;
+  arena->is_local_arena = FALSE;
+  arena->segments = g_array_new (FALSE, FALSE, sizeof (Segment));
+  arena->counters = NULL;
+
+  /*
+   * Follow the chain of segments. Failing to read one after the first
+   * (perhaps it was added while we were reading) only hides its counters.
+   */
+  do
+    {
+      next = _dzl_counter_arena_map_remote (arena, pid, next);
+
+      if (next < 0 && arena->segments->len == 0)
+        return FALSE;
+    }
+  while (next > 0);
+
+  return TRUE;
 }
 
 DzlCounterArena *
@@ -406,9 +730,13 @@ dzl_counter_arena_new_for_pid (GPid pid)
   DzlCounterArena *arena;
 
   arena = g_new0 (DzlCounterArena, 1);
+  arena->arena_is_malloced = TRUE;
 
   if (!_dzl_counter_arena_init_remote (arena, pid))
     {
+      g_list_free_full (g_steal_pointer (&arena->retired), _dzl_counter_free_remote);
+      g_clear_pointer (&arena->histograms, g_hash_table_unref);
+      g_clear_pointer (&arena->segments, g_array_unref);
       g_free (arena);
       return NULL;
     }
@@ -416,24 +744,105 @@ dzl_counter_arena_new_for_pid (GPid pid)
   return arena;
 }
 
-static void
-_dzl_counter_arena_destroy (DzlCounterArena *arena)
-{
-  g_assert (arena != NULL);
-
-  if (arena->data_is_mmapped)
-    munmap ((void *)arena->cells, arena->data_length);
-  else
+/**
+ * dzl_counter_arena_refresh:
+ * @arena: a #DzlCounterArena from dzl_counter_arena_new_for_pid()
+ *
+ * Updates @arena with the counters registered or unregistered by the
+ * remote process since @arena was created or last refreshed, including
+ * those of segments added in the meantime.
+ *
+ * Counters which were unregistered, or whose slot was reused by another
+ * counter, are no longer visited by dzl_counter_arena_foreach(). A reused
+ * slot shows up as a new #DzlCounter. Counters found previously remain
+ * valid until @arena is freed.
+ *
+ * This does nothing for the local arena, which is always up to date.
+ *
+ * Returns: %TRUE if the counters of @arena changed.
+ *
+ * Since: 3.46
+ */
+gboolean
+dzl_counter_arena_refresh (DzlCounterArena *arena)
+{
+  gboolean changed = FALSE;
+  guint n_segments;
+  gint next;
+
+  g_return_val_if_fail (arena != NULL, FALSE);
+
+  if (arena->is_local_arena)
+    return FALSE;
+
+  G_LOCK (reglock);
+
+  n_segments = arena->segments->len;
+
+  for (guint i = 0; i < n_segments; i++)
+    {
+      Segment *segment = &g_array_index (arena->segments, Segment, i);
+
+      /* A corrupt segment keeps the counters we found before */
+      if (_dzl_counter_arena_refresh_segment (arena, segment) > 0)
+        changed = TRUE;
+    }
+
+  /* Follow links to segments added since */
+  next = ((volatile const ShmHeader *)g_array_index (arena->segments, Segment, n_segments - 1).cells)->next_segment;
+
+  if (next != n_segments || next >= MAX_SEGMENTS)
+    next = 0;
+
+  while (next > 0)
+    next = _dzl_counter_arena_map_remote (arena, arena->pid, next);
+
+  if (arena->segments->len > n_segments)
+    changed = TRUE;
+
+  G_UNLOCK (reglock);
+
+  return changed;
+}
+
+static void
+_dzl_counter_arena_destroy (DzlCounterArena *arena)
+{
+  Slot *slot;
+
+  g_assert (arena != NULL);
+
+  for (guint i = 0; i < arena->segments->len; i++)
+    {
+      Segment *segment = &g_array_index (arena->segments, Segment, i);
+
+      g_clear_pointer (&segment->remote_slots, g_array_unref);
+
+      if (segment->is_mmapped)
+        munmap ((void *)segment->cells, segment->data_length);
+      else
 #ifdef G_OS_WIN32
-    /* Allocated with _aligned_malloc() */
-    _aligned_free (arena->cells);
+        /* Allocated with _aligned_malloc() */
+        _aligned_free (segment->cells);
 #else
-    g_free (arena->cells);
+        free (segment->cells);
 #endif
+    }
 
-  g_clear_pointer (&arena->counters, g_list_free);
+  if (arena->is_local_arena)
+    g_clear_pointer (&arena->counters, g_list_free);
+  else
+    g_list_free_full (g_steal_pointer (&arena->counters), _dzl_counter_free_remote);
+
+  g_list_free_full (g_steal_pointer (&arena->retired), _dzl_counter_free_remote);
 
-  arena->cells = NULL;
+  g_clear_pointer (&arena->segments, g_array_unref);
+  g_clear_pointer (&arena->histograms, g_hash_table_unref);
+  g_clear_pointer (&arena->slots, g_hash_table_unref);
+  while ((slot = g_queue_pop_head (&arena->free_counter_slots)))
+    g_free (slot);
+  while ((slot = g_queue_pop_head (&arena->free_histogram_slots)))
+    g_free (slot);
 
   if (arena->arena_is_malloced)
     g_free (arena);
@@ -482,90 +891,549 @@ dzl_counter_arena_unref (DzlCounterArena *arena)
  * @user_data: user data for @func
  *
  * Calls @func for every counter found in @area.
+ *
+ * The counters are collected while holding the registration lock, and
+ * @func is called after it was released, so @func may use the arena
+ * (such as with dzl_counter_arena_get_histogram()). Counters registered
+ * or unregistered by other threads meanwhile may or may not be seen.
  */
 void
 dzl_counter_arena_foreach (DzlCounterArena       *arena,
                            DzlCounterForeachFunc  func,
                            gpointer               user_data)
 {
-  GList *iter;
+  g_autoptr(GPtrArray) counters = NULL;
 
   g_return_if_fail (arena != NULL);
   g_return_if_fail (func != NULL);
 
-  for (iter = arena->counters; iter; iter = iter->next)
-    func (iter->data, user_data);
+  counters = g_ptr_array_new ();
+
+  G_LOCK (reglock);
+  for (const GList *iter = arena->counters; iter; iter = iter->next)
+    g_ptr_array_add (counters, iter->data);
+  G_UNLOCK (reglock);
+
+  for (guint i = 0; i < counters->len; i++)
+    func (g_ptr_array_index (counters, i), user_data);
 }
 
-void
-dzl_counter_arena_register (DzlCounterArena *arena,
-                            DzlCounter      *counter)
+/*
+ * Takes a new slot from the last segment of @arena, adding a segment if
+ * it is full. Histograms also take rows of buckets from the end of the
+ * segment, so that counter slots cannot be placed over them.
+ */
+static Slot *
+_dzl_counter_arena_new_slot (DzlCounterArena *arena,
+                             gboolean         is_histogram)
 {
-  CounterInfo *info;
+  Segment *segment;
+  Slot *slot;
+  gsize n_rows;
   guint group;
   guint ncpu;
   guint position;
   guint group_start_cell;
 
-  g_return_if_fail (arena != NULL);
-  g_return_if_fail (counter != NULL);
+  g_assert (arena != NULL);
 
-  if (!arena->is_local_arena)
+  ncpu = g_get_num_processors ();
+  n_rows = is_histogram ? CELLS_PER_HISTOGRAM_ROW * ncpu : 0;
+
+  for (guint i = 0; i < 2; i++)
     {
-      g_warning ("Cannot add counters to a remote arena.");
-      return;
-    }
+      gsize page_size = _dzl_counter_get_page_size ();
+      gsize size;
 
-  ncpu = g_get_num_processors ();
+      segment = &g_array_index (arena->segments, Segment, arena->segments->len - 1);
 
-  G_LOCK (reglock);
+      /*
+       * Get the counter group and position within the group of the counter.
+       */
+      group = segment->n_counters / COUNTERS_PER_GROUP;
+      position = segment->n_counters % COUNTERS_PER_GROUP;
 
-  /*
-   * Get the counter group and position within the group of the counter.
-   */
-  group = arena->n_counters / COUNTERS_PER_GROUP;
-  position = arena->n_counters % COUNTERS_PER_GROUP;
+      /*
+       * Get the starting cell for this group. Cells roughly map to cachelines.
+       */
+      group_start_cell = CELLS_PER_HEADER + (CELLS_PER_GROUP (ncpu) * group);
 
-  /*
-   * Get the starting cell for this group. Cells roughly map to cachelines.
-   */
-  group_start_cell = CELLS_PER_HEADER + (CELLS_PER_GROUP (ncpu) * group);
-  info = &((CounterInfo *)&arena->cells [group_start_cell])[position];
+      if (segment->n_counters < MAX_COUNTERS &&
+          segment->histogram_cell >= n_rows &&
+          group_start_cell + CELLS_PER_GROUP (ncpu) <= segment->histogram_cell - n_rows)
+        break;
+
+      if (i > 0)
+        return NULL;
+
+      /* The segment is full, make sure the next one fits the counter */
+      size = (CELLS_PER_HEADER + CELLS_PER_GROUP (ncpu) + n_rows) * DATA_CELL_SIZE;
+      size = MAX (page_size * ARENA_PAGES, ((size + page_size - 1) / page_size) * page_size);
+
+      if (size > COUNTER_MAX_SHM || !_dzl_counter_arena_add_segment (arena, size))
+        return NULL;
+    }
 
   g_assert (position < COUNTERS_PER_GROUP);
-  g_assert (group_start_cell < arena->n_cells);
+
+  slot = g_new0 (Slot, 1);
+  slot->header = (ShmHeader *)segment->cells;
+  slot->index = segment->n_counters;
+  slot->info = &((CounterInfo *)&segment->cells [group_start_cell])[position];
+  slot->info->cell = group_start_cell + (COUNTERS_PER_GROUP * CELLS_PER_INFO);
+  slot->info->position = position;
+
+  if (is_histogram)
+    {
+      segment->histogram_cell -= n_rows;
+      slot->info->data_cell = segment->histogram_cell;
+    }
+
+  segment->n_counters++;
+
+  return slot;
+}
+
+/*
+ * Places @counter in a free or new slot of @arena. @histogram is the
+ * histogram containing @counter, if any. Must be called with reglock held.
+ */
+static void
+_dzl_counter_arena_add (DzlCounterArena     *arena,
+                        DzlCounter          *counter,
+                        DzlCounterHistogram *histogram)
+{
+  GQueue *free_slots;
+  CounterInfo *info;
+  DataCell *cells;
+  Slot *slot;
+  guint ncpu;
+
+  g_assert (arena != NULL);
+  g_assert (counter != NULL);
+  g_assert (histogram == NULL || &histogram->counter == counter);
+
+  ncpu = g_get_num_processors ();
+  free_slots = histogram ? &arena->free_histogram_slots : &arena->free_counter_slots;
+
+  if (!(slot = g_queue_pop_head (free_slots)) &&
+      !(slot = _dzl_counter_arena_new_slot (arena, histogram != NULL)))
+    {
+      g_critical ("Counter arena is full, cannot register %s.%s",
+                  counter->category, counter->name);
+      /* Keep the counter usable, it just won't be visible in the arena */
+      counter->values = g_new0 (DzlCounterValue, ncpu);
+      if (histogram != NULL)
+        histogram->buckets = g_new0 (gint64, DZL_COUNTER_HISTOGRAM_N_BUCKETS * ncpu);
+      return;
+    }
+
+  info = slot->info;
+  cells = (DataCell *)slot->header;
+
+  /* Tell remote readers to ignore the slot until we are done */
+  info->generation++;
+  SLOT_BARRIER;
 
   /*
    * Store information about the counter in the SHM area. Also, update
    * the counter values pointer to map to the right cell in the SHM zone.
+   * A reused slot may still contain the values of the previous counter.
    */
-  info->cell = group_start_cell + (COUNTERS_PER_GROUP * CELLS_PER_INFO);
-  info->position = position;
+  info->kind = histogram ? COUNTER_KIND_HISTOGRAM : COUNTER_KIND_COUNTER;
   g_snprintf (info->category, sizeof info->category, "%s", counter->category);
   g_snprintf (info->description, sizeof info->description, "%s", counter->description);
   g_snprintf (info->name, sizeof info->name, "%s", counter->name);
-  counter->values = (DzlCounterValue *)&arena->cells [info->cell].values[info->position];
+  counter->values = (DzlCounterValue *)&cells [info->cell].values[info->position];
+  dzl_counter_reset (counter);
+
+  if (histogram != NULL)
+    {
+      histogram->buckets = (volatile gint64 *)&cells [info->data_cell];
+      memset ((gpointer)histogram->buckets, 0, CELLS_PER_HISTOGRAM_ROW * ncpu * DATA_CELL_SIZE);
+
+      if (arena->histograms == NULL)
+        arena->histograms = g_hash_table_new (NULL, NULL);
+      g_hash_table_add (arena->histograms, counter);
+    }
 
 #if 0
   g_print ("Counter registered: cell=%u position=%u category=%s name=%s\n",
            info->cell, info->position, info->category, info->name);
 #endif
 
+  SLOT_BARRIER;
+  info->generation++;
+
+  /*
+   * Now notify remote processes of the counter, if the slot is new.
+   */
+  DZL_MEMORY_BARRIER;
+  if (slot->header->n_counters <= slot->index)
+    slot->header->n_counters = slot->index + 1;
+
   /*
    * Track the counter address, so we can _foreach() them.
    */
   arena->counters = g_list_append (arena->counters, counter);
-  arena->n_counters++;
+  g_hash_table_insert (arena->slots, counter, slot);
+}
+
+void
+dzl_counter_arena_register (DzlCounterArena *arena,
+                            DzlCounter      *counter)
+{
+  g_return_if_fail (arena != NULL);
+  g_return_if_fail (counter != NULL);
+
+  if (!arena->is_local_arena)
+    {
+      g_warning ("Cannot add counters to a remote arena.");
+      return;
+    }
+
+  G_LOCK (reglock);
+  _dzl_counter_arena_add (arena, counter, NULL);
+  G_UNLOCK (reglock);
+}
+
+/**
+ * dzl_counter_arena_unregister:
+ * @arena: An #DzlCounterArena
+ * @counter: a counter or the counter of a histogram registered with @arena
+ *
+ * Removes @counter from @arena, so that its slot in the shared memory zone
+ * can be reused by another counter. This is done for you when a module
+ * using DZL_DEFINE_COUNTER() or DZL_DEFINE_HISTOGRAM() is unloaded.
+ *
+ * Updates to @counter after this are discarded.
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_arena_unregister (DzlCounterArena *arena,
+                              DzlCounter      *counter)
+{
+  static DzlCounterValue *discard_values;
+  static gint64 *discard_buckets;
+  gboolean is_histogram;
+  CounterInfo *info;
+  Slot *slot;
+  guint ncpu;
+
+  g_return_if_fail (arena != NULL);
+  g_return_if_fail (counter != NULL);
+
+  if (!arena->is_local_arena)
+    {
+      g_warning ("Cannot remove counters from a remote arena.");
+      return;
+    }
+
+  ncpu = g_get_num_processors ();
+
+  G_LOCK (reglock);
+
+  /* Counters registered while the arena was full have no slot */
+  if (!(slot = g_hash_table_lookup (arena->slots, counter)))
+    {
+      G_UNLOCK (reglock);
+      return;
+    }
+
+  g_hash_table_steal (arena->slots, counter);
+  arena->counters = g_list_remove (arena->counters, counter);
+  is_histogram = arena->histograms != NULL && g_hash_table_remove (arena->histograms, counter);
+
+  info = slot->info;
+  info->generation++;
+  SLOT_BARRIER;
+  info->kind = COUNTER_KIND_TOMBSTONE;
+  SLOT_BARRIER;
+  info->generation++;
+
+  g_queue_push_tail (is_histogram ? &arena->free_histogram_slots : &arena->free_counter_slots, slot);
 
   /*
-   * Now notify remote processes of the counter.
+   * Other threads may still be updating the counter, which must not
+   * land in the slot once it is reused.
    */
-  DZL_MEMORY_BARRIER;
-  ((ShmHeader *)&arena->cells[0])->n_counters++;
+  if (discard_values == NULL)
+    {
+      discard_values = g_new0 (DzlCounterValue, ncpu);
+      discard_buckets = g_new0 (gint64, DZL_COUNTER_HISTOGRAM_N_BUCKETS * ncpu);
+    }
+
+  counter->values = discard_values;
+  if (is_histogram)
+    ((DzlCounterHistogram *)counter)->buckets = discard_buckets;
+
+  G_UNLOCK (reglock);
+}
 
+/**
+ * dzl_counter_arena_register_histogram:
+ * @arena: An #DzlCounterArena
+ * @histogram: the histogram to register
+ *
+ * Registers @histogram with @arena, much like dzl_counter_arena_register().
+ * The counter of the histogram is visible with dzl_counter_arena_foreach()
+ * and holds the sum of the recorded values.
+ *
+ * This is usually done for you by DZL_DEFINE_HISTOGRAM().
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_arena_register_histogram (DzlCounterArena     *arena,
+                                      DzlCounterHistogram *histogram)
+{
+  g_return_if_fail (arena != NULL);
+  g_return_if_fail (histogram != NULL);
+
+  if (!arena->is_local_arena)
+    {
+      g_warning ("Cannot add counters to a remote arena.");
+      return;
+    }
+
+  G_LOCK (reglock);
+  _dzl_counter_arena_add (arena, &histogram->counter, histogram);
   G_UNLOCK (reglock);
 }
 
+/**
+ * dzl_counter_arena_get_histogram:
+ * @arena: An #DzlCounterArena
+ * @counter: a counter found in @arena
+ *
+ * Checks if @counter, as found with dzl_counter_arena_foreach(), is the
+ * counter of a histogram.
+ *
+ * Returns: (transfer none) (nullable): the histogram, or %NULL if @counter
+ *   is a plain counter.
+ *
+ * Since: 3.46
+ */
+DzlCounterHistogram *
+dzl_counter_arena_get_histogram (DzlCounterArena *arena,
+                                 DzlCounter      *counter)
+{
+  DzlCounterHistogram *ret = NULL;
+
+  g_return_val_if_fail (arena != NULL, NULL);
+  g_return_val_if_fail (counter != NULL, NULL);
+
+  G_LOCK (reglock);
+
+  /* The counter is the first member of the histogram */
+  if (arena->histograms != NULL && g_hash_table_contains (arena->histograms, counter))
+    ret = (DzlCounterHistogram *)counter;
+
+  G_UNLOCK (reglock);
+
+  return ret;
+}
+
+/**
+ * dzl_counter_histogram_get_buckets:
+ * @histogram: a #DzlCounterHistogram
+ * @buckets: (array fixed-size=160) (out caller-allocates): location for
+ *   %DZL_COUNTER_HISTOGRAM_N_BUCKETS values
+ *
+ * Gets the number of values recorded in each bucket of @histogram.
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_histogram_get_buckets (DzlCounterHistogram *histogram,
+                                   gint64              *buckets)
+{
+  guint ncpu;
+
+  g_return_if_fail (histogram != NULL);
+  g_return_if_fail (buckets != NULL);
+
+  ncpu = g_get_num_processors ();
+
+  memset (buckets, 0, sizeof (gint64) * DZL_COUNTER_HISTOGRAM_N_BUCKETS);
+
+  DZL_MEMORY_BARRIER;
+
+  for (guint i = 0; i < ncpu; i++)
+    {
+      volatile gint64 *row = &histogram->buckets [i * DZL_COUNTER_HISTOGRAM_N_BUCKETS];
+
+      for (guint j = 0; j < DZL_COUNTER_HISTOGRAM_N_BUCKETS; j++)
+        buckets [j] += row [j];
+    }
+}
+
+/**
+ * dzl_counter_histogram_add:
+ * @histogram: a #DzlCounterHistogram
+ * @value: the value to record
+ *
+ * Records @value in @histogram. This is what DZL_HISTOGRAM_ADD() uses where
+ * restartable sequences may be available.
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_histogram_add (DzlCounterHistogram *histogram,
+                           gint64               value)
+{
+  _dzl_counter_add_helper (&histogram->counter.values [0].value,
+                           sizeof (DzlCounterValue) / sizeof (gint64),
+                           value);
+  _dzl_counter_add_helper (&histogram->buckets [dzl_counter_histogram_bucket (value)],
+                           DZL_COUNTER_HISTOGRAM_N_BUCKETS,
+                           1);
+}
+
+/**
+ * dzl_counter_histogram_get_count:
+ * @histogram: a #DzlCounterHistogram
+ *
+ * Gets the number of values recorded in @histogram.
+ *
+ * Returns: the number of values
+ *
+ * Since: 3.46
+ */
+gint64
+dzl_counter_histogram_get_count (DzlCounterHistogram *histogram)
+{
+  gint64 buckets [DZL_COUNTER_HISTOGRAM_N_BUCKETS];
+  gint64 count = 0;
+
+  g_return_val_if_fail (histogram != NULL, 0);
+
+  dzl_counter_histogram_get_buckets (histogram, buckets);
+
+  for (guint i = 0; i < G_N_ELEMENTS (buckets); i++)
+    count += buckets [i];
+
+  return count;
+}
+
+/**
+ * dzl_counter_histogram_get_bucket_range:
+ * @bucket: the index of a bucket
+ * @begin: (out) (optional): the smallest value counted in @bucket
+ * @end: (out) (optional): the value after the largest counted in @bucket
+ *
+ * Gets the range of values counted in @bucket. The last bucket has no
+ * upper bound and @end is set to %G_MAXINT64.
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_histogram_get_bucket_range (guint   bucket,
+                                        gint64 *begin,
+                                        gint64 *end)
+{
+  gint64 first;
+  gint64 width;
+
+  g_return_if_fail (bucket < DZL_COUNTER_HISTOGRAM_N_BUCKETS);
+
+  if (bucket < 4)
+    {
+      first = bucket;
+      width = 1;
+    }
+  else
+    {
+      guint msb = (bucket >> 2) + 1;
+
+      width = G_GINT64_CONSTANT (1) << (msb - 2);
+      first = (4 + (bucket & 3)) * width;
+    }
+
+  if (begin != NULL)
+    *begin = first;
+
+  if (end != NULL)
+    *end = (bucket == DZL_COUNTER_HISTOGRAM_N_BUCKETS - 1) ? G_MAXINT64 : first + width;
+}
+
+/**
+ * dzl_counter_histogram_get_percentile:
+ * @histogram: a #DzlCounterHistogram
+ * @percentile: the percentile, between 0 and 100
+ *
+ * Gets an estimate of the value below which @percentile percent of the
+ * recorded values fall, such as 99.0 for the p99 latency. This is the
+ * largest value of the bucket holding that rank, so it may overestimate
+ * by up to 25%.
+ *
+ * Returns: the estimated value, or 0 if nothing was recorded
+ *
+ * Since: 3.46
+ */
+gint64
+dzl_counter_histogram_get_percentile (DzlCounterHistogram *histogram,
+                                      gdouble              percentile)
+{
+  gint64 buckets [DZL_COUNTER_HISTOGRAM_N_BUCKETS];
+  gint64 count = 0;
+  gint64 rank;
+  gint64 seen = 0;
+
+  g_return_val_if_fail (histogram != NULL, 0);
+  g_return_val_if_fail (percentile >= 0.0 && percentile <= 100.0, 0);
+
+  dzl_counter_histogram_get_buckets (histogram, buckets);
+
+  for (guint i = 0; i < G_N_ELEMENTS (buckets); i++)
+    count += buckets [i];
+
+  if (count == 0)
+    return 0;
+
+  rank = MAX (1, (gint64)((percentile / 100.0) * count + 0.5));
+
+  for (guint i = 0; i < G_N_ELEMENTS (buckets); i++)
+    {
+      seen += buckets [i];
+
+      if (seen >= rank)
+        {
+          gint64 end;
+
+          dzl_counter_histogram_get_bucket_range (i, NULL, &end);
+
+          return end == G_MAXINT64 ? end : end - 1;
+        }
+    }
+
+  return G_MAXINT64;
+}
+
+/**
+ * dzl_counter_histogram_reset:
+ * @histogram: a #DzlCounterHistogram
+ *
+ * Clears the values recorded in @histogram, including its counter.
+ *
+ * Since: 3.46
+ */
+void
+dzl_counter_histogram_reset (DzlCounterHistogram *histogram)
+{
+  guint ncpu;
+
+  g_return_if_fail (histogram != NULL);
+
+  ncpu = g_get_num_processors ();
+
+  for (guint i = 0; i < ncpu * DZL_COUNTER_HISTOGRAM_N_BUCKETS; i++)
+    histogram->buckets [i] = 0;
+
+  dzl_counter_reset (&histogram->counter);
+}
+
 #ifdef __linux__
 static void *
 _dzl_counter_find_getcpu_in_vdso (void)
@@ -637,9 +1505,175 @@ _dzl_counter_getcpu_rdtscp (void)
 }
 #endif
 
+/*
+ * @cells points to the cell of the first CPU, and the cell of each
+ * following CPU is @stride values further.
+ */
+static void
+_dzl_counter_add_getcpu (volatile gint64 *cells,
+                         gsize            stride,
+                         gint64           count)
+{
+#ifdef DZL_COUNTER_REQUIRES_ATOMIC
+  __sync_add_and_fetch ((gint64 *)cells, count);
+#else
+  cells [dzl_get_current_cpu () * stride] += count;
+#endif
+}
+
+#ifdef USE_RSEQ
+/*
+ * Restartable sequences let the kernel tell us which CPU we are running
+ * on through a per-thread struct rseq, and abort a critical section (by
+ * jumping to its abort handler) if the thread is pre-empted, migrated or
+ * signaled before reaching its end. The increment below is a single addq
+ * which commits the sequence, so it is either applied to the cell of the
+ * CPU we are still running on, or not at all and we retry.
+ *
+ * Newer glibc registers a struct rseq for every thread, which we must use
+ * as only one may be registered per thread. Otherwise we register our own
+ * lazily in each thread that increments a counter.
+ */
+#define RSEQ_ORIG_SIZE 32
+
+static guint _dzl_counter_rseq_ncpu;
+static __thread struct rseq _dzl_counter_rseq_area __attribute__((aligned (RSEQ_ORIG_SIZE))) = {
+  .cpu_id = (guint32)RSEQ_CPU_ID_UNINITIALIZED,
+};
+
+static inline volatile struct rseq *
+_dzl_counter_get_rseq (void)
+{
+#ifdef HAVE_SYS_RSEQ_H
+  if (__rseq_size > 0)
+    {
+      guint8 *tp;
+
+      /* __rseq_offset is relative to the thread pointer, %fs:0 on x86_64 */
+      __asm__ ("movq %%fs:0, %0" : "=r" (tp));
+
+      return (volatile struct rseq *)(gpointer)(tp + __rseq_offset);
+    }
+#endif
+
+  return &_dzl_counter_rseq_area;
+}
+
+static gboolean
+_dzl_counter_rseq_register (void)
+{
+  volatile struct rseq *rs = _dzl_counter_get_rseq ();
+
+  if ((gint32)rs->cpu_id >= 0)
+    return TRUE;
+
+#ifdef HAVE_SYS_RSEQ_H
+  /* Owned by glibc, which failed to register it */
+  if (__rseq_size > 0)
+    return FALSE;
+#endif
+
+  if ((gint32)rs->cpu_id == RSEQ_CPU_ID_UNINITIALIZED &&
+      syscall (__NR_rseq, rs, RSEQ_ORIG_SIZE, 0, RSEQ_SIG) == 0)
+    return TRUE;
+
+  rs->cpu_id = (guint32)RSEQ_CPU_ID_REGISTRATION_FAILED;
+
+  return FALSE;
+}
+
+static inline gboolean
+_dzl_counter_rseq_addq (volatile struct rseq *rs,
+                        gint32                cpu,
+                        volatile gint64      *cell,
+                        gint64                count)
+{
+  /*
+   * The struct rseq_cs descriptor (label 3) gives the start (1), length
+   * and abort handler (4) of the critical section, the latter preceded by
+   * RSEQ_SIG as the kernel requires. Once rseq_cs is set, we check that
+   * we are still on @cpu and commit with the addq.
+   */
+  __asm__ __volatile__ goto (
+    ".pushsection __rseq_cs, \"aw\"\n\t"
+    ".balign 32\n\t"
+    "3:\n\t"
+    ".long 0x0, 0x0\n\t"
+    ".quad 1f, (2f - 1f), 4f\n\t"
+    ".popsection\n\t"
+    "leaq 3b(%%rip), %%rax\n\t"
+    "movq %%rax, %[rseq_cs]\n\t"
+    "1:\n\t"
+    "cmpl %[cpu], %[cpu_id]\n\t"
+    "jnz %l[abort]\n\t"
+    "addq %[count], %[cell]\n\t"
+    "2:\n\t"
+    ".pushsection __rseq_failure, \"ax\"\n\t"
+    /* ud1 with the signature, so the handler is not reached by accident */
+    ".byte 0x0f, 0xb9, 0x3d\n\t"
+    ".long " G_STRINGIFY (RSEQ_SIG) "\n\t"
+    "4:\n\t"
+    "jmp %l[abort]\n\t"
+    ".popsection\n\t"
+    : /* no outputs */
+    : [cpu] "r" (cpu),
+      [cpu_id] "m" (rs->cpu_id),
+      [rseq_cs] "m" (rs->rseq_cs),
+      [cell] "m" (*cell),
+      [count] "er" (count)
+    : "memory", "cc", "rax"
+    : abort);
+
+  return TRUE;
+
+abort:
+  return FALSE;
+}
+
+static void
+_dzl_counter_add_rseq (volatile gint64 *cells,
+                       gsize            stride,
+                       gint64           count)
+{
+  volatile struct rseq *rs = _dzl_counter_get_rseq ();
+
+  for (;;)
+    {
+      gint32 cpu = (gint32)rs->cpu_id;
+
+      if (G_UNLIKELY (cpu < 0))
+        {
+          if (_dzl_counter_rseq_register ())
+            continue;
+          _dzl_counter_add_getcpu (cells, stride, count);
+          return;
+        }
+
+      /*
+       * With a restricted CPU affinity, the CPU number can be past the
+       * cells we have. Share a cell, which then requires an atomic.
+       */
+      if (G_UNLIKELY ((guint)cpu >= _dzl_counter_rseq_ncpu))
+        {
+          __sync_add_and_fetch ((gint64 *)&cells [(cpu % _dzl_counter_rseq_ncpu) * stride], count);
+          return;
+        }
+
+      if (G_LIKELY (_dzl_counter_rseq_addq (rs, cpu, &cells [cpu * stride], count)))
+        return;
+    }
+}
+#endif
+
 static void
 _dzl_counter_init_getcpu (void)
 {
+#ifdef USE_RSEQ
+  _dzl_counter_rseq_ncpu = g_get_num_processors ();
+
+  if (_dzl_counter_rseq_register ())
+    _dzl_counter_add_helper = _dzl_counter_add_rseq;
+#endif
 
 #ifdef DZL_HAVE_RDTSCP
   _dzl_counter_getcpu_helper = _dzl_counter_getcpu_rdtscp;
@@ -667,3 +1701,22 @@ dzl_get_current_cpu_call (void)
 {
   return _dzl_counter_getcpu_helper ();
 }
+
+/**
+ * _dzl_counter_uses_rseq:
+ *
+ * Checks if dzl_counter_add() uses restartable sequences, which requires
+ * both building with linux/rseq.h and a kernel that supports them. Only
+ * then are no increments lost.
+ *
+ * Returns: %TRUE if restartable sequences are used
+ */
+gboolean
+_dzl_counter_uses_rseq (void)
+{
+#ifdef USE_RSEQ
+  return _dzl_counter_add_helper == _dzl_counter_add_rseq;
+#else
+  return FALSE;
+#endif
+}
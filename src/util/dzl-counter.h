@@ -23,6 +23,7 @@
 #define DZL_COUNTER_H
 
 #include <glib-object.h>
+#include <time.h>
 
 #include "dzl-version-macros.h"
 
@@ -46,6 +47,13 @@
  * A loss can happen when the thread is pre-empted between the %rdtscp
  * instruction and the addq increment (on x86_64).
  *
+ * On Linux x86_64, when the kernel supports restartable sequences (rseq),
+ * the increment is instead performed in an rseq critical section. If the
+ * thread is pre-empted or migrated before the addq commits, the kernel
+ * aborts the sequence and it is retried on the new CPU. No values are lost
+ * and no memory barrier is needed. The implementation is selected when the
+ * library is loaded, falling back to the paths above.
+ *
  *
  * Using DzlCounter
  * ================
@@ -59,6 +67,22 @@
  *
  *   DZL_COUNTER_INC (Symbol);
  *
+ * To see the distribution of a value, such as the latency of an operation,
+ * define a histogram instead. Each recorded value is counted in one of
+ * DZL_COUNTER_HISTOGRAM_N_BUCKETS log-linear buckets, and added to the
+ * histogram's counter which therefore holds the sum of the values.
+ *
+ *   DZL_DEFINE_HISTOGRAM (Symbol, "Category", "Name", "Description")
+ *
+ *   DZL_HISTOGRAM_ADD (Symbol, value);
+ *
+ * DZL_COUNTER_TIME_BEGIN and DZL_COUNTER_TIME_END record the nanoseconds
+ * spent between them into a histogram.
+ *
+ *   DZL_COUNTER_TIME_BEGIN (Symbol);
+ *   do_something ();
+ *   DZL_COUNTER_TIME_END (Symbol);
+ *
  *
  * Architecture Support
  * ====================
@@ -79,7 +103,11 @@
  * DzlCounterArena provides a helper to walk through the counters in the
  * shared memory zone. dzl_counter_arena_foreach().
  *
- * You cannot remove a counter once it has been registered.
+ * Counters defined with DZL_DEFINE_COUNTER() and DZL_DEFINE_HISTOGRAM() are
+ * unregistered when their module is unloaded. Their slot in the shared
+ * memory zone is then marked as a tombstone, hidden from readers, and may be
+ * reused by the next counter registered. dzl_counter_arena_unregister() can
+ * be used for counters registered manually.
  *
  *
  * Accessing Counters Remotely
@@ -96,6 +124,9 @@
  *   arena = dzl_counter_arena_new_for_pid (other_process_pid);
  *   dzl_counter_arena_foreach (arena, my_counter_callback, user_data);
  *
+ * Call dzl_counter_arena_refresh() to pick up counters registered or
+ * unregistered by the other process since.
+ *
  *
  * Data Layout
  * ===========
@@ -114,12 +145,24 @@
  * The first two cells are the header which contain information about the
  * underlying shm file and how large the mmap() range should be.
  *
+ * When a shm file is full, another one is created and linked from the
+ * header of the previous one. The first is named "/DzlCounters-PID" and
+ * the following ones "/DzlCounters-PID-N", where N is the segment number
+ * that the previous header links to. Each has the same layout.
+ *
  * After that, begin the counters.
  *
  * The counters are layed out in groups of 8 counters.
  *
  *  [8 CounterInfo Structs (128-bytes each)][N_CPU Data Zones (64-byte each)]
  *
+ * The buckets of histograms are allocated from the end of the shared memory
+ * zone, growing downwards. Each CPU has a row of buckets, which is a whole
+ * number of cells, and the CounterInfo of the histogram points to the first.
+ *
+ * A CounterInfo has a generation which is odd while the counter using it is
+ * being replaced. Readers skip CounterInfos that change while being read.
+ *
  * See dzl-counter.c for more information on the contents of these structures.
  *
  *
@@ -171,6 +214,10 @@ G_BEGIN_DECLS
 # define DZL_COUNTER_REQUIRES_ATOMIC 1
 #endif
 
+#if defined(__linux__) && defined(__x86_64__)
+# define DZL_COUNTER_HAVE_RSEQ 1
+#endif
+
 /**
  * DZL_DEFINE_COUNTER:
  * @Identifier: The symbol name of the counter
@@ -182,15 +229,85 @@ G_BEGIN_DECLS
  * DZL_DEFINE_COUNTER (my_counter, "My", "Counter", "My Counter Description");
  * ]|
  */
-#define DZL_DEFINE_COUNTER(Identifier, Category, Name, Description)                 \
- static DzlCounter Identifier##_ctr = { NULL, Category, Name, Description };        \
- static void Identifier##_ctr_init (void) __attribute__((constructor));             \
- static void                                                                        \
- Identifier##_ctr_init (void)                                                       \
- {                                                                                  \
-   dzl_counter_arena_register (dzl_counter_arena_get_default(), &Identifier##_ctr); \
+#define DZL_DEFINE_COUNTER(Identifier, Category, Name, Description)                   \
+ static DzlCounter Identifier##_ctr = { NULL, Category, Name, Description };          \
+ static void Identifier##_ctr_init (void) __attribute__((constructor));               \
+ static void                                                                          \
+ Identifier##_ctr_init (void)                                                         \
+ {                                                                                    \
+   dzl_counter_arena_register (dzl_counter_arena_get_default(), &Identifier##_ctr);   \
+ }                                                                                    \
+ static void Identifier##_ctr_fini (void) __attribute__((destructor));                \
+ static void                                                                          \
+ Identifier##_ctr_fini (void)                                                         \
+ {                                                                                    \
+   dzl_counter_arena_unregister (dzl_counter_arena_get_default(), &Identifier##_ctr); \
  }
 
+/**
+ * DZL_COUNTER_HISTOGRAM_N_BUCKETS:
+ *
+ * The number of buckets in a histogram counter. Values below 4 have their
+ * own bucket, and every power of two above is split into 4 buckets, so
+ * that the bucket of a value is within 25% of it. The last bucket holds
+ * every value from 7 × 2^38, which is about 32 minutes in nanoseconds.
+ */
+#define DZL_COUNTER_HISTOGRAM_N_BUCKETS 160
+
+/**
+ * DZL_DEFINE_HISTOGRAM:
+ * @Identifier: The symbol name of the histogram
+ * @Category: A string category for the histogram.
+ * @Name: A string name for the histogram.
+ * @Description: A string description for the histogram.
+ *
+ * |[<!-- language="C" -->
+ * DZL_DEFINE_HISTOGRAM (my_histogram, "My", "Histogram", "My Histogram Description");
+ * ]|
+ *
+ * Since: 3.46
+ */
+#define DZL_DEFINE_HISTOGRAM(Identifier, Category, Name, Description)                           \
+ static DzlCounterHistogram Identifier##_hist = { { NULL, Category, Name, Description }, NULL }; \
+ static void Identifier##_hist_init (void) __attribute__((constructor));                        \
+ static void                                                                                    \
+ Identifier##_hist_init (void)                                                                  \
+ {                                                                                              \
+   dzl_counter_arena_register_histogram (dzl_counter_arena_get_default(), &Identifier##_hist);  \
+ }                                                                                              \
+ static void Identifier##_hist_fini (void) __attribute__((destructor));                         \
+ static void                                                                                    \
+ Identifier##_hist_fini (void)                                                                  \
+ {                                                                                              \
+   dzl_counter_arena_unregister (dzl_counter_arena_get_default(), &Identifier##_hist.counter);  \
+ }
+
+/**
+ * DZL_COUNTER_TIME_BEGIN:
+ * @Identifier: The identifier of the histogram.
+ *
+ * Starts timing an operation to be recorded in the histogram @Identifier
+ * with DZL_COUNTER_TIME_END(). This declares a variable, so it must be
+ * used where declarations are allowed, and only once per scope for a
+ * given histogram.
+ *
+ * Since: 3.46
+ */
+#define DZL_COUNTER_TIME_BEGIN(Identifier) \
+  gint64 Identifier##_time_begin = dzl_counter_get_time_nsec ()
+
+/**
+ * DZL_COUNTER_TIME_END:
+ * @Identifier: The identifier of the histogram.
+ *
+ * Records the number of nanoseconds elapsed since DZL_COUNTER_TIME_BEGIN()
+ * in the histogram @Identifier.
+ *
+ * Since: 3.46
+ */
+#define DZL_COUNTER_TIME_END(Identifier) \
+  DZL_HISTOGRAM_ADD (Identifier, dzl_counter_get_time_nsec () - Identifier##_time_begin)
+
 /**
  * DZL_COUNTER_INC:
  * @Identifier: The identifier of the counter.
@@ -229,12 +346,20 @@ G_BEGIN_DECLS
  * collisions. However, this is not guaranteed as the thread could be swapped
  * between the calls to %rdtscp and %addq (on 64-bit Intel).
  *
+ * On Linux x86_64, this calls dzl_counter_add() which uses a restartable
+ * sequence when the kernel supports it, so no increments are lost.
+ *
  * Other platforms have fallbacks which may give different guarantees, such as
  * using atomic operations (and therefore, memory barriers).
  *
  * See #DzlCounter for more information.
  */
-#ifdef DZL_COUNTER_REQUIRES_ATOMIC
+#if defined(DZL_COUNTER_HAVE_RSEQ)
+# define DZL_COUNTER_ADD(Identifier, Count)                  \
+  G_STMT_START {                                             \
+    dzl_counter_add (&Identifier##_ctr, ((gint64)(Count)));  \
+  } G_STMT_END
+#elif defined(DZL_COUNTER_REQUIRES_ATOMIC)
 # define DZL_COUNTER_ADD(Identifier, Count)                                          \
   G_STMT_START {                                                                     \
     __sync_add_and_fetch ((gint64 *)&Identifier##_ctr.values[0], ((gint64)(Count))); \
@@ -246,9 +371,44 @@ G_BEGIN_DECLS
   } G_STMT_END
 #endif
 
-typedef struct _DzlCounter      DzlCounter;
-typedef struct _DzlCounterArena DzlCounterArena;
-typedef struct _DzlCounterValue DzlCounterValue;
+/**
+ * DZL_HISTOGRAM_ADD:
+ * @Identifier: The identifier of the histogram.
+ * @Value: the value to record.
+ *
+ * Records @Value in the histogram @Identifier. The same guarantees as
+ * DZL_COUNTER_ADD() apply.
+ *
+ * Since: 3.46
+ */
+#if defined(DZL_COUNTER_HAVE_RSEQ)
+# define DZL_HISTOGRAM_ADD(Identifier, Value)                            \
+  G_STMT_START {                                                        \
+    dzl_counter_histogram_add (&Identifier##_hist, ((gint64)(Value)));  \
+  } G_STMT_END
+#elif defined(DZL_COUNTER_REQUIRES_ATOMIC)
+# define DZL_HISTOGRAM_ADD(Identifier, Value)                                                  \
+  G_STMT_START {                                                                              \
+    gint64 _dzl_hist_value = (Value);                                                         \
+    __sync_add_and_fetch ((gint64 *)&Identifier##_hist.counter.values[0], _dzl_hist_value);   \
+    __sync_add_and_fetch ((gint64 *)&Identifier##_hist.buckets[                               \
+                            dzl_counter_histogram_bucket (_dzl_hist_value)], 1);              \
+  } G_STMT_END
+#else
+# define DZL_HISTOGRAM_ADD(Identifier, Value)                                                  \
+  G_STMT_START {                                                                              \
+    gint64 _dzl_hist_value = (Value);                                                         \
+    guint _dzl_hist_cpu = dzl_get_current_cpu ();                                             \
+    Identifier##_hist.counter.values[_dzl_hist_cpu].value += _dzl_hist_value;                 \
+    Identifier##_hist.buckets[(_dzl_hist_cpu * DZL_COUNTER_HISTOGRAM_N_BUCKETS) +             \
+                              dzl_counter_histogram_bucket (_dzl_hist_value)]++;              \
+  } G_STMT_END
+#endif
+
+typedef struct _DzlCounter          DzlCounter;
+typedef struct _DzlCounterArena     DzlCounterArena;
+typedef struct _DzlCounterValue     DzlCounterValue;
+typedef struct _DzlCounterHistogram DzlCounterHistogram;
 
 /**
  * DzlCounterForeachFunc:
@@ -275,6 +435,59 @@ struct _DzlCounterValue
   gint64          padding [7];
 } __attribute__ ((aligned(8)));
 
+struct _DzlCounterHistogram
+{
+  /*< Private >*/
+  DzlCounter       counter;
+  volatile gint64 *buckets;
+} __attribute__ ((aligned(8)));
+
+/**
+ * dzl_counter_get_time_nsec:
+ *
+ * Gets the monotonic time in nanoseconds, as used by
+ * DZL_COUNTER_TIME_BEGIN() and DZL_COUNTER_TIME_END().
+ *
+ * Returns: the monotonic time in nanoseconds
+ *
+ * Since: 3.46
+ */
+static inline gint64
+dzl_counter_get_time_nsec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((gint64)ts.tv_sec * G_GINT64_CONSTANT (1000000000)) + ts.tv_nsec;
+}
+
+/**
+ * dzl_counter_histogram_bucket:
+ * @value: a value to record
+ *
+ * Gets the index of the bucket in which @value is counted. Negative
+ * values are counted in the first bucket.
+ *
+ * Returns: the bucket index, less than %DZL_COUNTER_HISTOGRAM_N_BUCKETS
+ *
+ * Since: 3.46
+ */
+static inline guint
+dzl_counter_histogram_bucket (gint64 value)
+{
+  guint msb;
+
+  if (value < 4)
+    return value < 0 ? 0 : (guint)value;
+
+  msb = 63 - __builtin_clzll ((guint64)value);
+
+  /* 4 buckets per power of two, using the 2 bits below the highest one */
+  return MIN (((msb - 1) << 2) | ((value >> (msb - 2)) & 3),
+              DZL_COUNTER_HISTOGRAM_N_BUCKETS - 1);
+}
+
 DZL_AVAILABLE_IN_ALL
 GType            dzl_counter_arena_get_type     (void);
 DZL_AVAILABLE_IN_ALL
@@ -283,6 +496,8 @@ DZL_AVAILABLE_IN_ALL
 DzlCounterArena *dzl_counter_arena_get_default  (void);
 DZL_AVAILABLE_IN_ALL
 DzlCounterArena *dzl_counter_arena_new_for_pid  (GPid                   pid);
+DZL_AVAILABLE_IN_3_46
+gboolean         dzl_counter_arena_refresh      (DzlCounterArena       *arena);
 DZL_AVAILABLE_IN_ALL
 DzlCounterArena *dzl_counter_arena_ref          (DzlCounterArena       *arena);
 DZL_AVAILABLE_IN_ALL
@@ -290,6 +505,9 @@ void             dzl_counter_arena_unref        (DzlCounterArena       *arena);
 DZL_AVAILABLE_IN_ALL
 void             dzl_counter_arena_register     (DzlCounterArena       *arena,
                                                  DzlCounter            *counter);
+DZL_AVAILABLE_IN_3_46
+void             dzl_counter_arena_unregister   (DzlCounterArena       *arena,
+                                                 DzlCounter            *counter);
 DZL_AVAILABLE_IN_ALL
 void             dzl_counter_arena_foreach      (DzlCounterArena       *arena,
                                                  DzlCounterForeachFunc  func,
@@ -298,6 +516,32 @@ DZL_AVAILABLE_IN_ALL
 void             dzl_counter_reset              (DzlCounter            *counter);
 DZL_AVAILABLE_IN_ALL
 gint64           dzl_counter_get                (DzlCounter            *counter);
+DZL_AVAILABLE_IN_3_46
+void             dzl_counter_add                (DzlCounter            *counter,
+                                                 gint64                 count);
+DZL_AVAILABLE_IN_3_46
+void                 dzl_counter_arena_register_histogram (DzlCounterArena     *arena,
+                                                           DzlCounterHistogram *histogram);
+DZL_AVAILABLE_IN_3_46
+DzlCounterHistogram *dzl_counter_arena_get_histogram      (DzlCounterArena     *arena,
+                                                           DzlCounter          *counter);
+DZL_AVAILABLE_IN_3_46
+void                 dzl_counter_histogram_reset          (DzlCounterHistogram *histogram);
+DZL_AVAILABLE_IN_3_46
+void                 dzl_counter_histogram_add            (DzlCounterHistogram *histogram,
+                                                           gint64               value);
+DZL_AVAILABLE_IN_3_46
+gint64               dzl_counter_histogram_get_count      (DzlCounterHistogram *histogram);
+DZL_AVAILABLE_IN_3_46
+void                 dzl_counter_histogram_get_buckets    (DzlCounterHistogram *histogram,
+                                                           gint64              *buckets);
+DZL_AVAILABLE_IN_3_46
+gint64               dzl_counter_histogram_get_percentile (DzlCounterHistogram *histogram,
+                                                           gdouble              percentile);
+DZL_AVAILABLE_IN_3_46
+void                 dzl_counter_histogram_get_bucket_range (guint              bucket,
+                                                             gint64            *begin,
+                                                             gint64            *end);
 
 G_END_DECLS
 
@@ -44,6 +44,13 @@
  *
  * To remove the highest priority item in the heap, use dzl_heap_extract().
  *
+ * If elements need to be removed or have their priority changed after they
+ * have been inserted, create the heap with dzl_heap_new_indexed(). The
+ * #DzlHeapIndexFunc is notified every time an element moves, so that the
+ * element can remember its position. It may then be removed with
+ * dzl_heap_extract_index() or, after changing its priority, moved into
+ * place with dzl_heap_update_index(), both in O(log n).
+ *
  * To free a heap, use dzl_heap_unref().
  *
  * Here is an example that stores integers in a #DzlHeap:
@@ -94,6 +101,7 @@ struct _DzlHeapReal
   guint           element_size;
   gsize           allocated_len;
   GCompareFunc    compare;
+  DzlHeapIndexFunc index_func;
   gchar           tmp[0];
 };
 
@@ -102,11 +110,18 @@ struct _DzlHeapReal
 #define heap_right(npos)    (((npos)*2)+2)
 #define heap_index(h,i)     ((h)->data + (i * (h)->element_size))
 #define heap_compare(h,a,b) ((h)->compare(heap_index(h,a), heap_index(h,b)))
+#define heap_moved(h,i)                                                 \
+  G_STMT_START {                                                        \
+      if ((h)->index_func != NULL)                                      \
+        (h)->index_func (heap_index (h, i), i);                         \
+ } G_STMT_END
 #define heap_swap(h,a,b)                                                \
   G_STMT_START {                                                        \
       memcpy ((h)->tmp, heap_index (h, a), (h)->element_size);          \
       memcpy (heap_index (h, a), heap_index (h, b), (h)->element_size); \
       memcpy (heap_index (h, b), (h)->tmp, (h)->element_size);          \
+      heap_moved (h, a);                                                \
+      heap_moved (h, b);                                                \
  } G_STMT_END
 
 /**
@@ -137,10 +152,41 @@ dzl_heap_new (guint        element_size,
     real->element_size = element_size;
     real->allocated_len = 0;
     real->compare = compare_func;
+    real->index_func = NULL;
 
     return (DzlHeap *)real;
 }
 
+/**
+ * dzl_heap_new_indexed:
+ * @element_size: the size of each element in the heap
+ * @compare_func: (scope async): a function to compare to elements
+ * @index_func: (scope async): a function notified when an element moves
+ *
+ * Like dzl_heap_new(), but @index_func is called with the new position of
+ * an element every time it is inserted or moved within the heap. This
+ * allows removing an element with dzl_heap_extract_index(), or updating
+ * its priority with dzl_heap_update_index(), without searching for it.
+ *
+ * Returns: (transfer full): A newly allocated #DzlHeap
+ *
+ * Since: 3.46
+ */
+DzlHeap *
+dzl_heap_new_indexed (guint            element_size,
+                      GCompareFunc     compare_func,
+                      DzlHeapIndexFunc index_func)
+{
+  DzlHeapReal *real;
+
+  g_return_val_if_fail (index_func, NULL);
+
+  if ((real = (DzlHeapReal *)dzl_heap_new (element_size, compare_func)))
+    real->index_func = index_func;
+
+  return (DzlHeap *)real;
+}
+
 /**
  * dzl_heap_ref:
  * @heap: An #DzlHeap
@@ -215,12 +261,89 @@ dzl_heap_real_shrink (DzlHeapReal *real)
                             real->element_size);
 }
 
+/*
+ * Moves the element at @ipos towards the root until its parent has a
+ * higher priority, returning its new position.
+ */
+static gssize
+dzl_heap_real_sift_up (DzlHeapReal *real,
+                       gssize       ipos)
+{
+  gssize ppos;
+
+  g_assert (real);
+
+  while (ipos > 0)
+    {
+      ppos = heap_parent (ipos);
+
+      if (heap_compare (real, ppos, ipos) >= 0)
+        break;
+
+      heap_swap (real, ppos, ipos);
+      ipos = ppos;
+    }
+
+  return ipos;
+}
+
+/*
+ * Moves the element at @ipos towards the leaves until both children have
+ * a lower priority, returning its new position.
+ */
+static gssize
+dzl_heap_real_sift_down (DzlHeapReal *real,
+                         gssize       ipos)
+{
+  gssize lpos;
+  gssize rpos;
+  gssize mpos;
+
+  g_assert (real);
+
+  while (TRUE)
+    {
+      lpos = heap_left (ipos);
+      rpos = heap_right (ipos);
+
+      if ((lpos < real->len) && (heap_compare (real, lpos, ipos) > 0))
+        mpos = lpos;
+      else
+        mpos = ipos;
+
+      if ((rpos < real->len) && (heap_compare (real, rpos, mpos) > 0))
+        mpos = rpos;
+
+      if (mpos == ipos)
+        break;
+
+      heap_swap (real, mpos, ipos);
+
+      ipos = mpos;
+    }
+
+  return ipos;
+}
+
+/*
+ * Restores the heap property for an element at @ipos that may be out of
+ * place in either direction.
+ */
+static void
+dzl_heap_real_sift (DzlHeapReal *real,
+                    gssize       ipos)
+{
+  g_assert (real);
+
+  if (dzl_heap_real_sift_up (real, ipos) == ipos)
+    dzl_heap_real_sift_down (real, ipos);
+}
+
 static void
 dzl_heap_real_insert_val (DzlHeapReal   *real,
                           gconstpointer  data)
 {
-  gint ipos;
-  gint ppos;
+  gssize ipos;
 
   g_assert (real);
   g_assert (data);
@@ -232,17 +355,10 @@ dzl_heap_real_insert_val (DzlHeapReal   *real,
           data,
           real->element_size);
 
-  ipos = real->len;
-  ppos = heap_parent (ipos);
-
-  while ((ipos > 0) && (heap_compare (real, ppos, ipos) < 0))
-    {
-      heap_swap (real, ppos, ipos);
-      ipos = ppos;
-      ppos = heap_parent (ipos);
-    }
+  ipos = real->len++;
+  heap_moved (real, ipos);
 
-  real->len++;
+  dzl_heap_real_sift_up (real, ipos);
 }
 
 void
@@ -268,10 +384,6 @@ dzl_heap_extract (DzlHeap  *heap,
                   gpointer  result)
 {
   DzlHeapReal *real = (DzlHeapReal *)heap;
-  gint ipos;
-  gint lpos;
-  gint rpos;
-  gint mpos;
 
   g_return_val_if_fail (heap, FALSE);
 
@@ -286,29 +398,9 @@ dzl_heap_extract (DzlHeap  *heap,
       memmove (real->data,
                heap_index (real, real->len),
                real->element_size);
+      heap_moved (real, 0);
 
-      ipos = 0;
-
-      while (TRUE)
-        {
-          lpos = heap_left (ipos);
-          rpos = heap_right (ipos);
-
-          if ((lpos < real->len) && (heap_compare (real, lpos, ipos) > 0))
-            mpos = lpos;
-          else
-            mpos = ipos;
-
-          if ((rpos < real->len) && (heap_compare (real, rpos, mpos) > 0))
-            mpos = rpos;
-
-          if (mpos == ipos)
-            break;
-
-          heap_swap (real, mpos, ipos);
-
-          ipos = mpos;
-        }
+      dzl_heap_real_sift_down (real, 0);
     }
 
   if ((real->len > MIN_HEAP_SIZE) && (real->allocated_len / 2) >= (gsize)real->len)
@@ -323,11 +415,6 @@ dzl_heap_extract_index (DzlHeap  *heap,
                         gpointer  result)
 {
   DzlHeapReal *real = (DzlHeapReal *)heap;
-  gssize ipos;
-  gssize lpos;
-  gssize mpos;
-  gssize ppos;
-  gssize rpos;
 
   g_return_val_if_fail (heap, FALSE);
   g_return_val_if_fail (index_ < G_MAXSSIZE, FALSE);
@@ -346,40 +433,9 @@ dzl_heap_extract_index (DzlHeap  *heap,
       memcpy (heap_index (real, index_),
               heap_index (real, real->len),
               real->element_size);
+      heap_moved (real, index_);
 
-      ipos = index_;
-      ppos = heap_parent (ipos);
-
-      while (heap_compare (real, ipos, ppos) > 0)
-        {
-          heap_swap (real, ipos, ppos);
-          ipos = ppos;
-          ppos = heap_parent (ppos);
-        }
-
-      if (ipos == (gssize)index_)
-        {
-          while (TRUE)
-            {
-              lpos = heap_left (ipos);
-              rpos = heap_right (ipos);
-
-              if ((lpos < real->len) && (heap_compare (real, lpos, ipos) > 0))
-                mpos = lpos;
-              else
-                mpos = ipos;
-
-              if ((rpos < real->len) && (heap_compare (real, rpos, mpos) > 0))
-                mpos = rpos;
-
-              if (mpos == ipos)
-                break;
-
-              heap_swap (real, mpos, ipos);
-
-              ipos = mpos;
-            }
-        }
+      dzl_heap_real_sift (real, index_);
     }
 
   if ((real->len > MIN_HEAP_SIZE) && (real->allocated_len / 2) >= (gsize)real->len)
@@ -387,3 +443,28 @@ dzl_heap_extract_index (DzlHeap  *heap,
 
   return TRUE;
 }
+
+/**
+ * dzl_heap_update_index:
+ * @heap: An #DzlHeap
+ * @index_: the position of the element
+ *
+ * Moves the element at @index_ into place after its priority has been
+ * changed, whether it was increased or decreased. This is O(log n).
+ *
+ * The position of an element is usually tracked with the #DzlHeapIndexFunc
+ * provided to dzl_heap_new_indexed().
+ *
+ * Since: 3.46
+ */
+void
+dzl_heap_update_index (DzlHeap *heap,
+                       gsize    index_)
+{
+  DzlHeapReal *real = (DzlHeapReal *)heap;
+
+  g_return_if_fail (heap);
+  g_return_if_fail (index_ < (gsize)real->len);
+
+  dzl_heap_real_sift (real, index_);
+}
@@ -32,6 +32,19 @@ G_BEGIN_DECLS
 
 typedef struct _DzlHeap DzlHeap;
 
+/**
+ * DzlHeapIndexFunc:
+ * @element: a pointer to the element within the heap
+ * @index_: the new position of the element
+ *
+ * Called by heaps created with dzl_heap_new_indexed() whenever an element
+ * is placed at a new position in the heap.
+ *
+ * Since: 3.46
+ */
+typedef void (*DzlHeapIndexFunc) (gpointer element,
+                                  gsize    index_);
+
 struct _DzlHeap
 {
   gchar *data;
@@ -43,6 +56,10 @@ GType      dzl_heap_get_type      (void);
 DZL_AVAILABLE_IN_ALL
 DzlHeap   *dzl_heap_new           (guint           element_size,
                                    GCompareFunc    compare_func);
+DZL_AVAILABLE_IN_3_46
+DzlHeap   *dzl_heap_new_indexed   (guint           element_size,
+                                   GCompareFunc    compare_func,
+                                   DzlHeapIndexFunc index_func);
 DZL_AVAILABLE_IN_ALL
 DzlHeap   *dzl_heap_ref           (DzlHeap        *heap);
 DZL_AVAILABLE_IN_ALL
@@ -58,6 +75,9 @@ DZL_AVAILABLE_IN_ALL
 gboolean   dzl_heap_extract_index (DzlHeap        *heap,
                                    gsize           index_,
                                    gpointer        result);
+DZL_AVAILABLE_IN_3_46
+void       dzl_heap_update_index  (DzlHeap        *heap,
+                                   gsize           index_);
 
 G_END_DECLS
 
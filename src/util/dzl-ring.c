@@ -38,6 +38,13 @@ typedef struct
   gboolean         looped;    /* Have we wrapped around at least once. */
   GDestroyNotify   destroy;   /* Destroy element callback. */
   volatile gint    ref_count; /* Hidden Reference count. */
+
+  /* Values pushed from other threads, waiting for dzl_ring_drain(). */
+  guint8          *pending;      /* Slots of pending values. */
+  volatile gint   *pending_seq;  /* Position + 1 once a slot is written. */
+  guint            pending_mask; /* Number of slots - 1. */
+  volatile gint    pending_head; /* Next position to drain. */
+  volatile gint    pending_tail; /* Next position to reserve. */
 } DzlRingImpl;
 
 G_DEFINE_BOXED_TYPE (DzlRing, dzl_ring, dzl_ring_ref, dzl_ring_unref)
@@ -69,6 +76,48 @@ dzl_ring_sized_new (guint          element_size,
   return (DzlRing *)ring_impl;
 }
 
+/**
+ * dzl_ring_sized_new_concurrent:
+ * @element_size: (in): The size per element.
+ * @reserved_size: (in): The number of elements to allocate.
+ * @pending_size: (in): The number of elements that can be pushed between
+ *   calls to dzl_ring_drain().
+ * @element_destroy: (in): Notification called when removing an element.
+ *
+ * Creates a new instance of #DzlRing like dzl_ring_sized_new(), which
+ * other threads can also add elements to with dzl_ring_push_vals().
+ *
+ * Pushed elements are queued without locking and are only appended to
+ * the ring when dzl_ring_drain() is called by the thread owning the ring.
+ * That thread can therefore keep reading the ring without synchronization.
+ *
+ * Returns: A new #DzlRing.
+ *
+ * Since: 3.46
+ */
+DzlRing *
+dzl_ring_sized_new_concurrent (guint          element_size,
+                               guint          reserved_size,
+                               guint          pending_size,
+                               GDestroyNotify element_destroy)
+{
+  DzlRingImpl *ring_impl;
+  guint n_slots = 1;
+
+  g_return_val_if_fail (pending_size > 0, NULL);
+  g_return_val_if_fail (pending_size <= G_MAXINT / 2, NULL);
+
+  while (n_slots < pending_size)
+    n_slots <<= 1;
+
+  ring_impl = (DzlRingImpl *)dzl_ring_sized_new (element_size, reserved_size, element_destroy);
+  ring_impl->pending = g_malloc_n (n_slots, element_size);
+  ring_impl->pending_seq = g_new0 (gint, n_slots);
+  ring_impl->pending_mask = n_slots - 1;
+
+  return (DzlRing *)ring_impl;
+}
+
 /**
  * dzl_ring_append_vals:
  * @ring: (in): A #DzlRing.
@@ -96,8 +145,7 @@ dzl_ring_append_vals (DzlRing        *ring,
 
   for (gint i = 0; i < (gint)len; i++)
     {
-      x = ring->pos - i;
-      x = (x >= 0) ? x : (gint)ring->len + x;
+      x = ring->pos;
       idx = ring->data + (ring_impl->elt_size * x);
       if (ring_impl->destroy && (ring_impl->looped == TRUE))
         ring_impl->destroy (idx);
@@ -114,6 +162,126 @@ dzl_ring_append_vals (DzlRing        *ring,
   return (guint)ret;
 }
 
+/**
+ * dzl_ring_push_vals:
+ * @ring: (in): A #DzlRing created with dzl_ring_sized_new_concurrent().
+ * @data: (in): A pointer to the array of values.
+ * @len: (in): The number of values.
+ *
+ * Queues @len values located at @data to be appended to @ring by the next
+ * call to dzl_ring_drain(). This may be called from any thread, and
+ * the values pushed by a thread keep their order.
+ *
+ * If there is not enough room for all of the values, because the ring is
+ * not drained often enough, none are queued and %FALSE is returned.
+ *
+ * Returns: %TRUE if the values were queued.
+ *
+ * Since: 3.46
+ */
+gboolean
+dzl_ring_push_vals (DzlRing       *ring,
+                    gconstpointer  data,
+                    guint          len)
+{
+  DzlRingImpl *ring_impl = (DzlRingImpl *)ring;
+  guint n_slots;
+  guint head;
+  guint tail;
+
+  g_return_val_if_fail (ring_impl != NULL, FALSE);
+  g_return_val_if_fail (ring_impl->pending != NULL, FALSE);
+  g_return_val_if_fail (len > 0, FALSE);
+
+  n_slots = ring_impl->pending_mask + 1;
+
+  if (len > n_slots)
+    return FALSE;
+
+  /*
+   * Reserve the positions by advancing the tail. The head is read first,
+   * so that it can only be behind the tail we compare it to.
+   */
+  do
+    {
+      head = (guint)g_atomic_int_get (&ring_impl->pending_head);
+      tail = (guint)g_atomic_int_get (&ring_impl->pending_tail);
+
+      if (tail - head > n_slots - len)
+        return FALSE;
+    }
+  while (!g_atomic_int_compare_and_exchange (&ring_impl->pending_tail, (gint)tail, (gint)(tail + len)));
+
+  for (guint i = 0; i < len; i++)
+    {
+      guint slot = (tail + i) & ring_impl->pending_mask;
+
+      memcpy (ring_impl->pending + (ring_impl->elt_size * slot),
+              (const guint8 *)data + (ring_impl->elt_size * i),
+              ring_impl->elt_size);
+
+      /* Publish the slot to dzl_ring_drain() */
+      g_atomic_int_set (&ring_impl->pending_seq [slot], (gint)(tail + i + 1));
+    }
+
+  return TRUE;
+}
+
+/**
+ * dzl_ring_drain:
+ * @ring: (in): A #DzlRing created with dzl_ring_sized_new_concurrent().
+ *
+ * Appends the values queued with dzl_ring_push_vals() to @ring, in the
+ * order they were reserved. A value still being written by another
+ * thread, and those after it, are left for the next call.
+ *
+ * At most the length of @ring values are appended, so the values appended
+ * are always the last ones of @ring when this returns.
+ *
+ * This must only be called from the thread owning @ring.
+ *
+ * Returns: the number of values appended.
+ *
+ * Since: 3.46
+ */
+guint
+dzl_ring_drain (DzlRing *ring)
+{
+  DzlRingImpl *ring_impl = (DzlRingImpl *)ring;
+  guint head;
+  guint n = 0;
+
+  g_return_val_if_fail (ring_impl != NULL, 0);
+  g_return_val_if_fail (ring_impl->pending != NULL, 0);
+
+  head = (guint)ring_impl->pending_head;
+
+  while (n < ring->len)
+    {
+      guint slot = head & ring_impl->pending_mask;
+      guint run = 0;
+
+      /* Find the published values up to the end of the slots */
+      while (slot + run <= ring_impl->pending_mask &&
+             n + run < ring->len &&
+             (guint)g_atomic_int_get (&ring_impl->pending_seq [slot + run]) == head + run + 1)
+        run++;
+
+      if (run == 0)
+        break;
+
+      dzl_ring_append_vals (ring, ring_impl->pending + (ring_impl->elt_size * slot), run);
+
+      head += run;
+      n += run;
+
+      /* Give the slots back to the producers */
+      g_atomic_int_set (&ring_impl->pending_head, (gint)head);
+    }
+
+  return n;
+}
+
 /**
  * dzl_ring_foreach:
  * @ring: (in): A #DzlRing.
@@ -165,6 +333,23 @@ dzl_ring_destroy (DzlRing *ring)
   if (ring_impl->destroy != NULL)
     dzl_ring_foreach (ring, (GFunc)ring_impl->destroy, NULL);
 
+  if (ring_impl->pending != NULL)
+    {
+      guint head = (guint)ring_impl->pending_head;
+      guint slot;
+
+      /* Release the values that were never drained */
+      while ((guint)ring_impl->pending_seq [slot = head & ring_impl->pending_mask] == head + 1)
+        {
+          if (ring_impl->destroy != NULL)
+            ring_impl->destroy (ring_impl->pending + (ring_impl->elt_size * slot));
+          head++;
+        }
+
+      g_free (ring_impl->pending);
+      g_free ((gpointer)ring_impl->pending_seq);
+    }
+
   g_free (ring_impl->data);
 
   g_slice_free (DzlRingImpl, ring_impl);
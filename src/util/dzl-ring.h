@@ -37,6 +37,20 @@ G_BEGIN_DECLS
  */
 #define dzl_ring_append_val(ring, val) dzl_ring_append_vals(ring, &(val), 1)
 
+/**
+ * dzl_ring_push_val:
+ * @ring: A #DzlRing.
+ * @val: A value to push to the #DzlRing.
+ *
+ * Queues a value to be appended to the ring buffer by dzl_ring_drain().
+ * @val must be a variable as it is referenced to.
+ *
+ * Returns: %TRUE if the value was queued.
+ *
+ * Since: 3.46
+ */
+#define dzl_ring_push_val(ring, val) dzl_ring_push_vals(ring, &(val), 1)
+
 /**
  * _dzl_ring_index: (skip)
  *
@@ -88,10 +102,21 @@ DZL_AVAILABLE_IN_ALL
 DzlRing *dzl_ring_sized_new   (guint           element_size,
                                guint           reserved_size,
                                GDestroyNotify  element_destroy);
+DZL_AVAILABLE_IN_3_46
+DzlRing *dzl_ring_sized_new_concurrent (guint           element_size,
+                                        guint           reserved_size,
+                                        guint           pending_size,
+                                        GDestroyNotify  element_destroy);
 DZL_AVAILABLE_IN_ALL
 guint    dzl_ring_append_vals (DzlRing         *ring,
                                gconstpointer   data,
                                guint           len);
+DZL_AVAILABLE_IN_3_46
+gboolean dzl_ring_push_vals   (DzlRing         *ring,
+                               gconstpointer   data,
+                               guint           len);
+DZL_AVAILABLE_IN_3_46
+guint    dzl_ring_drain       (DzlRing         *ring);
 DZL_AVAILABLE_IN_ALL
 void     dzl_ring_foreach     (DzlRing         *ring,
                                GFunc           func,
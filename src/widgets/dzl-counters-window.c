@@ -45,6 +45,9 @@ get_value_cell_data_func (GtkCellLayout   *cell_layout,
                           gpointer         user_data)
 {
   static PangoAttrList *attrs;
+  DzlCountersWindow *self = user_data;
+  DzlCountersWindowPrivate *priv = dzl_counters_window_get_instance_private (self);
+  DzlCounterHistogram *histogram = NULL;
   DzlCounter *counter = NULL;
   g_autofree gchar *str = NULL;
   gint64 value = 0;
@@ -60,7 +63,20 @@ get_value_cell_data_func (GtkCellLayout   *cell_layout,
   if (counter != NULL)
     value = dzl_counter_get (counter);
 
-  str = g_strdup_printf ("%"G_GINT64_FORMAT, value);
+  if (counter != NULL && priv->arena != NULL)
+    histogram = dzl_counter_arena_get_histogram (priv->arena, counter);
+
+  if (histogram != NULL)
+    {
+      /* Show the distribution rather than the sum of the values */
+      value = dzl_counter_histogram_get_count (histogram);
+      str = g_strdup_printf ("%"G_GINT64_FORMAT" (p50 %"G_GINT64_FORMAT", p99 %"G_GINT64_FORMAT")",
+                             value,
+                             dzl_counter_histogram_get_percentile (histogram, 50.0),
+                             dzl_counter_histogram_get_percentile (histogram, 99.0));
+    }
+  else
+    str = g_strdup_printf ("%"G_GINT64_FORMAT, value);
 
   g_object_set (cell,
                 "attributes", value == 0 ? attrs : NULL,
@@ -156,7 +172,7 @@ dzl_counters_window_init (DzlCountersWindow *self)
   gtk_cell_layout_set_cell_data_func (GTK_CELL_LAYOUT (priv->value_column),
                                       GTK_CELL_RENDERER (priv->value_cell),
                                       get_value_cell_data_func,
-                                      NULL, NULL);
+                                      self, NULL);
 }
 
 static void
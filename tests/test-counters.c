@@ -0,0 +1,523 @@
+#include <dazzle.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util/dzl-counter-private.h"
+
+#define N_THREADS    16
+#define N_ITERATIONS 200000
+#define N_DYNAMIC    3000
+
+DZL_DEFINE_COUNTER (test_counter, "Test", "Counter", "A counter for testing")
+DZL_DEFINE_HISTOGRAM (test_histogram, "Test", "Histogram", "A histogram for testing")
+DZL_DEFINE_COUNTER (test_stress, "Test", "Stress", "A counter incremented from many threads")
+DZL_DEFINE_HISTOGRAM (test_stress_histogram, "Test", "Stress Histogram", "A histogram updated from many threads")
+
+static void
+test_counters_histogram (void)
+{
+  DzlCounterArena *arena = dzl_counter_arena_get_default ();
+  gint64 buckets[DZL_COUNTER_HISTOGRAM_N_BUCKETS];
+  gint64 total = 0;
+  gint64 p50;
+  gint64 p99;
+
+  DZL_COUNTER_INC (test_counter);
+
+  g_assert (dzl_counter_arena_get_histogram (arena, &test_histogram_hist.counter) == &test_histogram_hist);
+  g_assert_null (dzl_counter_arena_get_histogram (arena, &test_counter_ctr));
+
+  dzl_counter_histogram_reset (&test_histogram_hist);
+  g_assert_cmpint (dzl_counter_histogram_get_count (&test_histogram_hist), ==, 0);
+  g_assert_cmpint (dzl_counter_histogram_get_percentile (&test_histogram_hist, 50.0), ==, 0);
+
+  for (gint64 i = 1; i <= 1000; i++)
+    DZL_HISTOGRAM_ADD (test_histogram, i);
+
+  /* The counter holds the sum of the values */
+  g_assert_cmpint (dzl_counter_histogram_get_count (&test_histogram_hist), ==, 1000);
+  g_assert_cmpint (dzl_counter_get (&test_histogram_hist.counter), ==, 500500);
+
+  dzl_counter_histogram_get_buckets (&test_histogram_hist, buckets);
+
+  for (guint i = 0; i < DZL_COUNTER_HISTOGRAM_N_BUCKETS; i++)
+    {
+      gint64 begin;
+      gint64 end;
+
+      dzl_counter_histogram_get_bucket_range (i, &begin, &end);
+      g_assert_cmpint (dzl_counter_histogram_bucket (begin), ==, i);
+      if (end != G_MAXINT64)
+        g_assert_cmpint (dzl_counter_histogram_bucket (end), ==, i + 1);
+
+      /* Values 1..1000 fill each bucket below 1000 completely */
+      if (begin >= 1 && end <= 1000)
+        g_assert_cmpint (buckets[i], ==, end - begin);
+
+      total += buckets[i];
+    }
+
+  g_assert_cmpint (total, ==, 1000);
+
+  /* Estimates may be up to 25% over */
+  p50 = dzl_counter_histogram_get_percentile (&test_histogram_hist, 50.0);
+  p99 = dzl_counter_histogram_get_percentile (&test_histogram_hist, 99.0);
+  g_assert_cmpint (p50, >=, 500);
+  g_assert_cmpint (p50, <=, 625);
+  g_assert_cmpint (p99, >=, 990);
+  g_assert_cmpint (p99, <=, 1250);
+  g_assert_cmpint (dzl_counter_histogram_get_percentile (&test_histogram_hist, 0.0), ==, 1);
+
+  dzl_counter_histogram_reset (&test_histogram_hist);
+  g_assert_cmpint (dzl_counter_get (&test_histogram_hist.counter), ==, 0);
+}
+
+static void
+test_counters_time (void)
+{
+  dzl_counter_histogram_reset (&test_histogram_hist);
+
+  {
+    DZL_COUNTER_TIME_BEGIN (test_histogram);
+    g_usleep (G_USEC_PER_SEC / 100);
+    DZL_COUNTER_TIME_END (test_histogram);
+  }
+
+  g_assert_cmpint (dzl_counter_histogram_get_count (&test_histogram_hist), ==, 1);
+  g_assert_cmpint (dzl_counter_get (&test_histogram_hist.counter), >=, 10 * 1000 * 1000);
+  g_assert_cmpint (dzl_counter_histogram_get_percentile (&test_histogram_hist, 50.0), >=, 10 * 1000 * 1000);
+}
+
+static void
+test_counters_sampler (void)
+{
+  g_autoptr(GOutputStream) stream = g_memory_output_stream_new_resizable ();
+  g_autoptr(DzlCounterSampler) sampler = NULL;
+  g_autoptr(DzlCounterLog) log = NULL;
+  g_autoptr(DzlCounterLog) truncated = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GBytes) partial = NULL;
+  g_autoptr(GError) error = NULL;
+  gint64 base;
+  guint counter;
+  gboolean r;
+
+  sampler = dzl_counter_sampler_new (dzl_counter_arena_get_default (), stream);
+  base = dzl_counter_get (&test_counter_ctr);
+
+  for (guint i = 0; i < 3; i++)
+    {
+      DZL_COUNTER_ADD (test_counter, 10);
+      r = dzl_counter_sampler_sample (sampler, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_usleep (G_USEC_PER_SEC / 100);
+    }
+
+  /* A decrease is encoded as a negative delta */
+  DZL_COUNTER_SUB (test_counter, 25);
+  r = dzl_counter_sampler_sample (sampler, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  r = g_output_stream_close (stream, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (stream));
+  log = dzl_counter_log_new_from_bytes (bytes, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (log);
+
+  g_assert_cmpint (dzl_counter_log_get_n_samples (log), ==, 4);
+  g_assert_true (dzl_counter_log_lookup (log, "Test", "Counter", &counter));
+  g_assert_cmpstr (dzl_counter_log_get_description (log, counter), ==, "A counter for testing");
+  g_assert_false (dzl_counter_log_lookup (log, "Test", "Missing", &counter));
+
+  g_assert_cmpint (dzl_counter_log_get_value (log, 0, counter), ==, base + 10);
+  g_assert_cmpint (dzl_counter_log_get_value (log, 1, counter), ==, base + 20);
+  g_assert_cmpint (dzl_counter_log_get_value (log, 2, counter), ==, base + 30);
+  g_assert_cmpint (dzl_counter_log_get_value (log, 3, counter), ==, base + 5);
+
+  g_assert_cmpfloat (dzl_counter_log_get_rate (log, 0, counter), ==, 0.0);
+  g_assert_cmpfloat (dzl_counter_log_get_rate (log, 1, counter), >, 0.0);
+  g_assert_cmpfloat (dzl_counter_log_get_rate (log, 3, counter), <, 0.0);
+  g_assert_cmpfloat (dzl_counter_log_get_rate_between (log, 0, 2, counter), >, 0.0);
+
+  g_assert_cmpint (dzl_counter_log_find_sample (log, 0), ==, 0);
+  g_assert_cmpint (dzl_counter_log_find_sample (log, dzl_counter_log_get_sample_time (log, 2)), ==, 2);
+  g_assert_cmpint (dzl_counter_log_find_sample (log, G_MAXINT64), ==, 3);
+
+  /* A partially written record at the end is ignored */
+  partial = g_bytes_new_from_bytes (bytes, 0, g_bytes_get_size (bytes) - 1);
+  truncated = dzl_counter_log_new_from_bytes (partial, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (truncated);
+  g_assert_cmpint (dzl_counter_log_get_n_samples (truncated), ==, 3);
+}
+
+static void
+append_samples (GFile  *file,
+                gint64  add)
+{
+  g_autoptr(GFileOutputStream) stream = NULL;
+  g_autoptr(DzlCounterSampler) sampler = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean r;
+
+  stream = g_file_append_to (file, G_FILE_CREATE_NONE, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (stream);
+
+  sampler = dzl_counter_sampler_new (dzl_counter_arena_get_default (), G_OUTPUT_STREAM (stream));
+
+  for (guint i = 0; i < 2; i++)
+    {
+      DZL_COUNTER_ADD (test_counter, add);
+      r = dzl_counter_sampler_sample (sampler, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+    }
+
+  r = g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+}
+
+static void
+test_counters_sampler_append (void)
+{
+  g_autoptr(DzlCounterLog) first = NULL;
+  g_autoptr(DzlCounterLog) log = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree gchar *tmpdir = NULL;
+  g_autofree gchar *path = NULL;
+  gint64 base;
+  guint counter;
+
+  tmpdir = g_dir_make_tmp ("test-counters-XXXXXX", &error);
+  g_assert_no_error (error);
+  path = g_build_filename (tmpdir, "counters.log", NULL);
+  file = g_file_new_for_path (path);
+
+  base = dzl_counter_get (&test_counter_ctr);
+
+  append_samples (file, 1);
+  first = dzl_counter_log_new_for_file (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (first);
+
+  /* A second recording appends another header to the same file */
+  append_samples (file, 100);
+  log = dzl_counter_log_new_for_file (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (log);
+
+  /* Counters of both sessions are merged by category and name */
+  g_assert_cmpint (dzl_counter_log_get_n_samples (log), ==, 4);
+  g_assert_cmpint (dzl_counter_log_get_n_counters (log), ==, dzl_counter_log_get_n_counters (first));
+  g_assert_true (dzl_counter_log_lookup (log, "Test", "Counter", &counter));
+
+  g_assert_cmpint (dzl_counter_log_get_value (log, 0, counter), ==, base + 1);
+  g_assert_cmpint (dzl_counter_log_get_value (log, 1, counter), ==, base + 2);
+  g_assert_cmpint (dzl_counter_log_get_value (log, 2, counter), ==, base + 102);
+  g_assert_cmpint (dzl_counter_log_get_value (log, 3, counter), ==, base + 202);
+
+  g_assert_cmpint (dzl_counter_log_get_sample_time (log, 2), >=, dzl_counter_log_get_sample_time (log, 1));
+
+  g_file_delete (file, NULL, NULL);
+  g_rmdir (tmpdir);
+}
+
+typedef struct
+{
+  guint  n_counters;
+  gint64 sum;
+} DynamicState;
+
+static void
+count_dynamic (DzlCounter *counter,
+               gpointer    user_data)
+{
+  DynamicState *state = user_data;
+
+  if (g_strcmp0 (counter->category, "Dynamic") == 0)
+    {
+      state->n_counters++;
+      state->sum += dzl_counter_get (counter);
+    }
+}
+
+static void
+assert_dynamic (guint  n_counters,
+                gint64 sum)
+{
+  DzlCounterArena *remote;
+  DynamicState state = { 0 };
+
+  dzl_counter_arena_foreach (dzl_counter_arena_get_default (), count_dynamic, &state);
+  g_assert_cmpint (state.n_counters, ==, n_counters);
+  g_assert_cmpint (state.sum, ==, sum);
+
+  /* The shared memory zone may not be available, such as in a sandbox */
+  if (!(remote = dzl_counter_arena_new_for_pid (getpid ())))
+    return;
+
+  memset (&state, 0, sizeof state);
+  dzl_counter_arena_foreach (remote, count_dynamic, &state);
+  g_assert_cmpint (state.n_counters, ==, n_counters);
+  g_assert_cmpint (state.sum, ==, sum);
+
+  dzl_counter_arena_unref (remote);
+}
+
+static void
+test_counters_unregister (void)
+{
+  DzlCounterArena *arena = dzl_counter_arena_get_default ();
+  DzlCounterHistogram first = { { NULL, "Dynamic Histogram", "First", "" }, NULL };
+  DzlCounterHistogram second = { { NULL, "Dynamic Histogram", "Second", "" }, NULL };
+  DzlCounter *counters;
+  volatile gint64 *buckets;
+  gchar **names;
+  gint64 odd_sum = 0;
+  gint64 sum = 0;
+
+  /* Enough counters to need more than one shared memory segment */
+  counters = g_new0 (DzlCounter, N_DYNAMIC);
+  names = g_new0 (gchar *, N_DYNAMIC + 1);
+
+  for (guint i = 0; i < N_DYNAMIC; i++)
+    {
+      names[i] = g_strdup_printf ("Counter %u", i);
+      counters[i].category = "Dynamic";
+      counters[i].name = names[i];
+      counters[i].description = "";
+      dzl_counter_arena_register (arena, &counters[i]);
+      dzl_counter_add (&counters[i], i);
+      sum += i;
+      if (i % 2)
+        odd_sum += i;
+    }
+
+  assert_dynamic (N_DYNAMIC, sum);
+
+  for (guint i = 0; i < N_DYNAMIC; i += 2)
+    dzl_counter_arena_unregister (arena, &counters[i]);
+
+  assert_dynamic (N_DYNAMIC / 2, odd_sum);
+
+  /* Updates to unregistered counters are discarded */
+  dzl_counter_add (&counters[0], 100);
+  assert_dynamic (N_DYNAMIC / 2, odd_sum);
+
+  /* Reused slots do not keep the values of their previous counter */
+  for (guint i = 0; i < N_DYNAMIC; i += 2)
+    {
+      dzl_counter_arena_register (arena, &counters[i]);
+      g_assert_cmpint (dzl_counter_get (&counters[i]), ==, 0);
+    }
+
+  assert_dynamic (N_DYNAMIC, odd_sum);
+
+  dzl_counter_arena_register_histogram (arena, &first);
+  dzl_counter_histogram_add (&first, 1000);
+  buckets = first.buckets;
+  dzl_counter_arena_unregister (arena, &first.counter);
+  g_assert_null (dzl_counter_arena_get_histogram (arena, &first.counter));
+
+  dzl_counter_arena_register_histogram (arena, &second);
+  g_assert_true (second.buckets == buckets);
+  g_assert_true (dzl_counter_arena_get_histogram (arena, &second.counter) == &second);
+  g_assert_cmpint (dzl_counter_histogram_get_count (&second), ==, 0);
+  g_assert_cmpint (dzl_counter_get (&second.counter), ==, 0);
+
+  /* Unknown counters are ignored */
+  dzl_counter_arena_unregister (arena, &first.counter);
+
+  dzl_counter_arena_unregister (arena, &second.counter);
+  for (guint i = 0; i < N_DYNAMIC; i++)
+    dzl_counter_arena_unregister (arena, &counters[i]);
+
+  assert_dynamic (0, 0);
+
+  g_strfreev (names);
+  g_free (counters);
+}
+
+static void
+count_refreshed (DzlCounter *counter,
+                 gpointer    user_data)
+{
+  DynamicState *state = user_data;
+
+  if (g_strcmp0 (counter->category, "Refresh") == 0)
+    {
+      state->n_counters++;
+      state->sum += dzl_counter_get (counter);
+    }
+}
+
+static void
+assert_refreshed (DzlCounterArena *remote,
+                  guint            n_counters,
+                  gint64           sum)
+{
+  DynamicState state = { 0 };
+
+  dzl_counter_arena_foreach (remote, count_refreshed, &state);
+  g_assert_cmpint (state.n_counters, ==, n_counters);
+  g_assert_cmpint (state.sum, ==, sum);
+}
+
+static void
+test_counters_refresh (void)
+{
+  DzlCounterArena *arena = dzl_counter_arena_get_default ();
+  DzlCounterArena *remote;
+  DzlCounter *counters;
+  gchar **names;
+  gint64 odd_sum = 0;
+  gint64 sum = 0;
+
+  /* The shared memory zone may not be available, such as in a sandbox */
+  if (!(remote = dzl_counter_arena_new_for_pid (getpid ())))
+    {
+      g_test_skip ("Counters are not shared");
+      return;
+    }
+
+  g_assert_false (dzl_counter_arena_refresh (remote));
+  g_assert_false (dzl_counter_arena_refresh (arena));
+
+  /* Registered after the remote arena was opened, spanning new segments */
+  counters = g_new0 (DzlCounter, N_DYNAMIC);
+  names = g_new0 (gchar *, N_DYNAMIC + 1);
+
+  for (guint i = 0; i < N_DYNAMIC; i++)
+    {
+      names[i] = g_strdup_printf ("Counter %u", i);
+      counters[i].category = "Refresh";
+      counters[i].name = names[i];
+      counters[i].description = "";
+      dzl_counter_arena_register (arena, &counters[i]);
+      dzl_counter_add (&counters[i], i);
+      sum += i;
+      if (i % 2)
+        odd_sum += i;
+    }
+
+  assert_refreshed (remote, 0, 0);
+  g_assert_true (dzl_counter_arena_refresh (remote));
+  assert_refreshed (remote, N_DYNAMIC, sum);
+  g_assert_false (dzl_counter_arena_refresh (remote));
+
+  for (guint i = 0; i < N_DYNAMIC; i += 2)
+    dzl_counter_arena_unregister (arena, &counters[i]);
+
+  g_assert_true (dzl_counter_arena_refresh (remote));
+  assert_refreshed (remote, N_DYNAMIC / 2, odd_sum);
+
+  /* Reused slots are found again, as new counters */
+  for (guint i = 0; i < N_DYNAMIC; i += 2)
+    {
+      dzl_counter_arena_register (arena, &counters[i]);
+      dzl_counter_add (&counters[i], 1);
+    }
+
+  g_assert_true (dzl_counter_arena_refresh (remote));
+  assert_refreshed (remote, N_DYNAMIC, odd_sum + N_DYNAMIC / 2);
+
+  for (guint i = 0; i < N_DYNAMIC; i++)
+    dzl_counter_arena_unregister (arena, &counters[i]);
+
+  g_assert_true (dzl_counter_arena_refresh (remote));
+  assert_refreshed (remote, 0, 0);
+
+  dzl_counter_arena_unref (remote);
+  g_strfreev (names);
+  g_free (counters);
+}
+
+/*
+ * DZL_COUNTER_ADD() only goes through the library when this file was built
+ * for restartable sequences, and the library only uses them if it was built
+ * with linux/rseq.h and the kernel supports them.
+ */
+static gboolean
+uses_rseq (void)
+{
+#ifdef DZL_COUNTER_HAVE_RSEQ
+  return _dzl_counter_uses_rseq ();
+#else
+  return FALSE;
+#endif
+}
+
+static gpointer
+stress_worker (gpointer data)
+{
+  for (guint i = 0; i < N_ITERATIONS; i++)
+    {
+      DZL_COUNTER_INC (test_stress);
+      DZL_HISTOGRAM_ADD (test_stress_histogram, i % 1000);
+
+      /* Encourage pre-emption and migration between updates */
+      if (i % 1024 == 0)
+        g_thread_yield ();
+    }
+
+  return NULL;
+}
+
+static void
+test_counters_stress (void)
+{
+  GThread *threads[N_THREADS];
+  gint64 expected = N_THREADS * N_ITERATIONS;
+  gint64 value;
+  gint64 count;
+
+  dzl_counter_reset (&test_stress_ctr);
+  dzl_counter_histogram_reset (&test_stress_histogram_hist);
+
+  for (guint i = 0; i < N_THREADS; i++)
+    threads[i] = g_thread_new ("stress", stress_worker, NULL);
+
+  for (guint i = 0; i < N_THREADS; i++)
+    g_thread_join (threads[i]);
+
+  value = dzl_counter_get (&test_stress_ctr);
+  count = dzl_counter_histogram_get_count (&test_stress_histogram_hist);
+
+  /* Without restartable sequences, increments may be lost on migration */
+  if (uses_rseq ())
+    {
+      g_assert_cmpint (value, ==, expected);
+      g_assert_cmpint (count, ==, expected);
+    }
+  else
+    {
+      g_test_message ("rseq unavailable, lost %"G_GINT64_FORMAT" increments",
+                      expected - value);
+      g_assert_cmpint (value, <=, expected);
+      g_assert_cmpint (count, <=, expected);
+    }
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Dazzle/Counters/histogram", test_counters_histogram);
+  g_test_add_func ("/Dazzle/Counters/time", test_counters_time);
+  g_test_add_func ("/Dazzle/Counters/stress", test_counters_stress);
+  g_test_add_func ("/Dazzle/Counters/sampler", test_counters_sampler);
+  g_test_add_func ("/Dazzle/Counters/sampler-append", test_counters_sampler_append);
+  g_test_add_func ("/Dazzle/Counters/unregister", test_counters_unregister);
+  g_test_add_func ("/Dazzle/Counters/refresh", test_counters_refresh);
+  return g_test_run ();
+}
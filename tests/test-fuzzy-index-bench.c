@@ -0,0 +1,157 @@
+#include <dazzle.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+static void
+query_cb (GObject      *object,
+          GAsyncResult *result,
+          gpointer      user_data)
+{
+  GAsyncResult **ret = user_data;
+
+  *ret = g_object_ref (result);
+}
+
+static GListModel *
+run_query (DzlFuzzyIndex *index,
+           const gchar   *query,
+           guint          max_matches,
+           gint64        *elapsed)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GError) error = NULL;
+  GListModel *ret;
+  gint64 begin;
+
+  begin = g_get_monotonic_time ();
+
+  dzl_fuzzy_index_query_async (index, query, max_matches, NULL, query_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  if (!(ret = dzl_fuzzy_index_query_finish (index, result, &error)))
+    g_error ("%s", error->message);
+
+  *elapsed += g_get_monotonic_time () - begin;
+
+  return ret;
+}
+
+static void
+check_same_head (GListModel *all,
+                 GListModel *some)
+{
+  guint n_items = g_list_model_get_n_items (some);
+
+  g_assert_cmpint (n_items, <=, g_list_model_get_n_items (all));
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(DzlFuzzyIndexMatch) a = g_list_model_get_item (all, i);
+      g_autoptr(DzlFuzzyIndexMatch) b = g_list_model_get_item (some, i);
+
+      g_assert_cmpstr (dzl_fuzzy_index_match_get_key (a), ==, dzl_fuzzy_index_match_get_key (b));
+    }
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  static const gchar *default_queries[] = { "g", "gw", "gtkwid", "gtk_widget_show", NULL };
+  g_autoptr(DzlFuzzyIndexBuilder) builder = NULL;
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  const gchar * const *queries = default_queries;
+  gint n_keys = 400000;
+  gint max_matches = 50;
+  gint iterations = 5;
+  gint n_threads = 1;
+  const GOptionEntry entries[] = {
+    { "keys", 'k', 0, G_OPTION_ARG_INT, &n_keys, "Number of keys to index", "400000" },
+    { "max-matches", 'm', 0, G_OPTION_ARG_INT, &max_matches, "Number of matches to request", "50" },
+    { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Number of runs per query", "5" },
+    { "threads", 't', 0, G_OPTION_ARG_INT, &n_threads, "Number of threads per query, 0 for all processors", "1" },
+    { NULL }
+  };
+  gint fd;
+
+  context = g_option_context_new ("[QUERY...] - compare bounded and unbounded fuzzy queries");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (argc > 1)
+    queries = (const gchar * const *)&argv[1];
+
+  if (-1 == (fd = g_file_open_tmp ("test-fuzzy-index-bench-XXXXXX.gvariant", &path, &error)))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  g_close (fd, NULL);
+
+  file = g_file_new_for_path (path);
+  builder = dzl_fuzzy_index_builder_new ();
+
+  for (gint i = 0; i < n_keys; i++)
+    {
+      static const gchar *prefixes[] = { "gtk_widget", "g_object", "gdk_window", "dzl_tree", "pango_layout" };
+      static const gchar *suffixes[] = { "show", "get_name", "set_property", "queue_draw", "hide_all" };
+      g_autofree gchar *key = NULL;
+
+      key = g_strdup_printf ("%s_%s_%d",
+                             prefixes [i % G_N_ELEMENTS (prefixes)],
+                             suffixes [(i / G_N_ELEMENTS (prefixes)) % G_N_ELEMENTS (suffixes)],
+                             i);
+      dzl_fuzzy_index_builder_insert (builder, key, g_variant_new_int32 (i), i % 4);
+    }
+
+  if (!dzl_fuzzy_index_builder_write (builder, file, G_PRIORITY_DEFAULT, NULL, &error))
+    g_error ("%s", error->message);
+
+  index = dzl_fuzzy_index_new ();
+
+  if (!dzl_fuzzy_index_load_file (index, file, NULL, &error))
+    g_error ("%s", error->message);
+
+  dzl_fuzzy_index_set_n_threads (index, MAX (0, n_threads));
+
+  g_print ("%d keys, %d max matches, %d iterations, %d threads\n",
+           n_keys, max_matches, iterations, n_threads);
+
+  for (guint i = 0; queries[i] != NULL; i++)
+    {
+      gint64 sorted = 0;
+      gint64 bounded = 0;
+      guint n_items = 0;
+
+      for (gint j = 0; j < iterations; j++)
+        {
+          g_autoptr(GListModel) all = run_query (index, queries[i], 0, &sorted);
+          g_autoptr(GListModel) some = run_query (index, queries[i], max_matches, &bounded);
+
+          check_same_head (all, some);
+          n_items = g_list_model_get_n_items (all);
+        }
+
+      g_print ("%-20s %8u candidates   sort+truncate: %8.3lf msec   top-k: %8.3lf msec\n",
+               queries[i],
+               n_items,
+               sorted / 1000.0 / MAX (1, iterations),
+               bounded / 1000.0 / MAX (1, iterations));
+    }
+
+  g_file_delete (file, NULL, NULL);
+
+  return EXIT_SUCCESS;
+}
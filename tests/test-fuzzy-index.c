@@ -17,6 +17,8 @@
  */
 
 #include <dazzle.h>
+#include <glib/gstdio.h>
+#include <string.h>
 
 static GMainLoop *main_loop;
 
@@ -253,6 +255,978 @@ test_index_basic (void)
   g_object_unref (file);
 }
 
+static void
+query_sync_cb (GObject      *object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  GAsyncResult **ret = user_data;
+
+  *ret = g_object_ref (result);
+}
+
+static GListModel *
+query_sync (DzlFuzzyIndex *index,
+            const gchar   *query,
+            guint          max_matches)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  GError *error = NULL;
+  GListModel *ret;
+
+  dzl_fuzzy_index_query_async (index, query, max_matches, NULL, query_sync_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  ret = dzl_fuzzy_index_query_finish (index, result, &error);
+  g_assert_no_error (error);
+  g_assert (ret != NULL);
+
+  return ret;
+}
+
+static void
+assert_same_head (GListModel *expected,
+                  GListModel *model,
+                  guint       n_items)
+{
+  g_assert_cmpint (g_list_model_get_n_items (model), ==, MIN (n_items, g_list_model_get_n_items (expected)));
+
+  n_items = g_list_model_get_n_items (model);
+
+  for (guint j = 0; j < n_items; j++)
+    {
+      g_autoptr(DzlFuzzyIndexMatch) a = g_list_model_get_item (expected, j);
+      g_autoptr(DzlFuzzyIndexMatch) b = g_list_model_get_item (model, j);
+
+      g_assert_cmpstr (dzl_fuzzy_index_match_get_key (a), ==, dzl_fuzzy_index_match_get_key (b));
+      g_assert_cmpfloat (dzl_fuzzy_index_match_get_score (a), ==, dzl_fuzzy_index_match_get_score (b));
+    }
+}
+
+static void
+write_items_index (GFile    *file,
+                   guint     format_version,
+                   gboolean  compress_tables,
+                   guint64   memory_budget)
+{
+  g_autoptr(DzlFuzzyIndexBuilder) builder = NULL;
+  GError *error = NULL;
+  gboolean r;
+
+  builder = dzl_fuzzy_index_builder_new ();
+  dzl_fuzzy_index_builder_set_format_version (builder, format_version);
+  dzl_fuzzy_index_builder_set_compress_tables (builder, compress_tables);
+  dzl_fuzzy_index_builder_set_memory_budget (builder, memory_budget);
+
+  for (guint i = 0; i < 2000; i++)
+    {
+      g_autofree gchar *key = g_strdup_printf ("item_%u_%s", i, (i % 3) ? "foo" : "bar");
+
+      dzl_fuzzy_index_builder_insert (builder, key, g_variant_new_uint32 (i), i % 8);
+    }
+
+  r = dzl_fuzzy_index_builder_write (builder, file, G_PRIORITY_LOW, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static DzlFuzzyIndex *
+load_index (GFile *file)
+{
+  DzlFuzzyIndex *index;
+  GError *error = NULL;
+  gboolean r;
+
+  index = dzl_fuzzy_index_new ();
+  r = dzl_fuzzy_index_load_file (index, file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  return index;
+}
+
+static const gchar *item_queries[] = { "i", "it", "i5f", "m_0_", NULL };
+
+static void
+test_index_max_matches (void)
+{
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(GFile) file = NULL;
+  GError *error = NULL;
+  gboolean r;
+
+  file = g_file_new_for_path ("index-max-matches.gvariant");
+  write_items_index (file, 1, FALSE, 0);
+  index = load_index (file);
+
+  /*
+   * The bounded selection must produce exactly the head of the
+   * fully sorted result set, including ordering of ties.
+   */
+  for (guint i = 0; item_queries[i] != NULL; i++)
+    {
+      g_autoptr(GListModel) all = query_sync (index, item_queries[i], 0);
+      g_autoptr(GListModel) some = query_sync (index, item_queries[i], 25);
+
+      assert_same_head (all, some, 25);
+    }
+
+  r = g_file_delete (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static void
+test_index_n_threads (void)
+{
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(DzlFuzzyIndex) parallel = NULL;
+  g_autoptr(GFile) file = NULL;
+  GError *error = NULL;
+  gboolean r;
+
+  file = g_file_new_for_path ("index-n-threads.gvariant");
+  write_items_index (file, 1, FALSE, 0);
+  index = load_index (file);
+  parallel = load_index (file);
+
+  dzl_fuzzy_index_set_n_threads (parallel, 4);
+  g_assert_cmpint (dzl_fuzzy_index_get_n_threads (parallel), ==, 4);
+
+  for (guint i = 0; item_queries[i] != NULL; i++)
+    {
+      g_autoptr(GListModel) all = query_sync (index, item_queries[i], 0);
+      g_autoptr(GListModel) all_parallel = query_sync (parallel, item_queries[i], 0);
+      g_autoptr(GListModel) some = query_sync (index, item_queries[i], 25);
+      g_autoptr(GListModel) some_parallel = query_sync (parallel, item_queries[i], 25);
+
+      assert_same_head (all, all_parallel, G_MAXUINT);
+      assert_same_head (some, some_parallel, 25);
+    }
+
+  r = g_file_delete (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static void
+test_index_format_version (void)
+{
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(DzlFuzzyIndex) mapped = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFile) file2 = NULL;
+  g_autofree gchar *contents = NULL;
+  GError *error = NULL;
+  gsize len = 0;
+  gboolean r;
+
+  file = g_file_new_for_path ("index-format-v1.gvariant");
+  file2 = g_file_new_for_path ("index-format-v2.gvariant");
+  write_items_index (file, 1, FALSE, 0);
+  write_items_index (file2, 2, FALSE, 0);
+
+  r = g_file_load_contents (file2, NULL, &contents, &len, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+  g_assert_cmpint (len, >, 8);
+  g_assert (memcmp (contents, "DzlFzIdx", 8) == 0);
+
+  index = load_index (file);
+  mapped = load_index (file2);
+
+  for (guint i = 0; item_queries[i] != NULL; i++)
+    {
+      g_autoptr(GListModel) a = query_sync (index, item_queries[i], 0);
+      g_autoptr(GListModel) b = query_sync (mapped, item_queries[i], 0);
+      g_autoptr(GListModel) c = query_sync (mapped, item_queries[i], 25);
+
+      assert_same_head (a, b, G_MAXUINT);
+      assert_same_head (a, c, 25);
+    }
+
+  r = g_file_delete (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  r = g_file_delete (file2, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+typedef struct
+{
+  guint position;
+  guint lookaside_id;
+} LegacyItem;
+
+static gint
+legacy_item_compare (gconstpointer a,
+                     gconstpointer b)
+{
+  const LegacyItem *itema = a;
+  const LegacyItem *itemb = b;
+  gint ret;
+
+  /* How version 1 builders sorted tables before 3.46 */
+  ret = itema->lookaside_id - itemb->lookaside_id;
+
+  if (ret == 0)
+    ret = itema->position - itemb->position;
+
+  return ret;
+}
+
+static void
+write_legacy_order (GFile *file)
+{
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariant) tables = NULL;
+  g_autoptr(GVariant) legacy = NULL;
+  GVariantDict dict;
+  GVariantDict legacy_tables;
+  GVariantIter iter;
+  const gchar *ch;
+  GVariant *table;
+  gchar *contents = NULL;
+  GError *error = NULL;
+  gboolean reordered = FALSE;
+  gsize len = 0;
+  gboolean r;
+
+  r = g_file_load_contents (file, NULL, &contents, &len, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  variant = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT, contents, len, FALSE, g_free, contents);
+  g_variant_ref_sink (variant);
+
+  g_variant_dict_init (&dict, variant);
+  tables = g_variant_dict_lookup_value (&dict, "tables", G_VARIANT_TYPE_VARDICT);
+  g_assert (tables != NULL);
+
+  g_variant_dict_init (&legacy_tables, NULL);
+  g_variant_iter_init (&iter, tables);
+
+  while (g_variant_iter_next (&iter, "{&sv}", &ch, &table))
+    {
+      g_autoptr(GArray) items = NULL;
+      gconstpointer data;
+      gsize n_items = 0;
+
+      data = g_variant_get_fixed_array (table, &n_items, sizeof (LegacyItem));
+      items = g_array_sized_new (FALSE, FALSE, sizeof (LegacyItem), n_items);
+      g_array_append_vals (items, data, n_items);
+      g_array_sort (items, legacy_item_compare);
+
+      reordered |= memcmp (items->data, data, n_items * sizeof (LegacyItem)) != 0;
+
+      g_variant_dict_insert_value (&legacy_tables, ch,
+                                   g_variant_new_fixed_array ((const GVariantType *)"(uu)",
+                                                              items->data,
+                                                              items->len,
+                                                              sizeof (LegacyItem)));
+      g_variant_unref (table);
+    }
+
+  /* Make sure the test actually covers a table out of unsigned order */
+  g_assert (reordered);
+
+  g_variant_dict_insert_value (&dict, "tables", g_variant_dict_end (&legacy_tables));
+  legacy = g_variant_ref_sink (g_variant_dict_end (&dict));
+
+  r = g_file_replace_contents (file,
+                               g_variant_get_data (legacy),
+                               g_variant_get_size (legacy),
+                               NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL,
+                               &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static void
+test_index_legacy_order (void)
+{
+  static const gchar *queries[] = { "i", "it", "m_1", "m9", NULL };
+  g_autoptr(DzlFuzzyIndex) legacy = NULL;
+  g_autoptr(DzlFuzzyIndex) mapped = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFile) file2 = NULL;
+  GError *error = NULL;
+  gboolean r;
+
+  file = g_file_new_for_path ("index-legacy-order-v1.gvariant");
+  file2 = g_file_new_for_path ("index-legacy-order-v2.gvariant");
+
+  for (guint version = 1; version <= 2; version++)
+    {
+      g_autoptr(DzlFuzzyIndexBuilder) builder = dzl_fuzzy_index_builder_new ();
+
+      dzl_fuzzy_index_builder_set_format_version (builder, version);
+
+      /* Priorities of 128 and up set the high bit of the lookaside_id */
+      for (guint i = 0; i < 500; i++)
+        {
+          g_autofree gchar *key = g_strdup_printf ("item_%u", i);
+
+          dzl_fuzzy_index_builder_insert (builder, key, g_variant_new_uint32 (i), (i % 2) ? 200 : 0);
+        }
+
+      r = dzl_fuzzy_index_builder_write (builder, version == 1 ? file : file2,
+                                         G_PRIORITY_LOW, NULL, &error);
+      g_assert_no_error (error);
+      g_assert (r);
+    }
+
+  write_legacy_order (file);
+
+  legacy = load_index (file);
+  mapped = load_index (file2);
+
+  for (guint i = 0; queries[i] != NULL; i++)
+    {
+      g_autoptr(GListModel) a = query_sync (mapped, queries[i], 0);
+      g_autoptr(GListModel) b = query_sync (legacy, queries[i], 0);
+
+      g_assert_cmpint (g_list_model_get_n_items (a), >, 0);
+      assert_same_head (a, b, G_MAXUINT);
+    }
+
+  r = g_file_delete (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  r = g_file_delete (file2, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static GListModel *
+refine_sync (GListModel  *cursor,
+             const gchar *query,
+             guint        max_matches)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  GError *error = NULL;
+  GListModel *ret;
+
+  dzl_fuzzy_index_cursor_refine_async (DZL_FUZZY_INDEX_CURSOR (cursor),
+                                       query, max_matches, NULL,
+                                       query_sync_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  ret = dzl_fuzzy_index_cursor_refine_finish (DZL_FUZZY_INDEX_CURSOR (cursor), result, &error);
+  g_assert_no_error (error);
+  g_assert (DZL_IS_FUZZY_INDEX_CURSOR (ret));
+
+  return ret;
+}
+
+static void
+test_index_refine (void)
+{
+  static const gchar *steps[] = { "i", "it", "it 5", "it5f", "it5fo", "bar", "b r", NULL };
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(GListModel) cursor = NULL;
+  g_autoptr(GFile) file = NULL;
+  GError *error = NULL;
+  gboolean r;
+
+  file = g_file_new_for_path ("index-refine.gvariant");
+  write_items_index (file, 1, FALSE, 0);
+  index = load_index (file);
+
+  /*
+   * Each step either extends the previous query, in which case only the
+   * previous candidates are searched, or replaces it, in which case a full
+   * query is performed. Both must match running the query directly.
+   */
+  for (guint i = 0; steps[i] != NULL; i++)
+    {
+      g_autoptr(GListModel) expected = query_sync (index, steps[i], 0);
+      g_autoptr(GListModel) expected_some = query_sync (index, steps[i], 10);
+      g_autoptr(GListModel) refined_some = NULL;
+      g_autoptr(GListModel) refined = NULL;
+
+      if (cursor == NULL)
+        {
+          cursor = query_sync (index, steps[i], 10);
+          assert_same_head (expected_some, cursor, 10);
+          continue;
+        }
+
+      refined_some = refine_sync (cursor, steps[i], 10);
+      refined = refine_sync (cursor, steps[i], 0);
+
+      assert_same_head (expected_some, refined_some, 10);
+      assert_same_head (expected, refined, G_MAXUINT);
+
+      g_clear_object (&cursor);
+      cursor = g_steal_pointer (&refined_some);
+    }
+
+  r = g_file_delete (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static void
+test_index_refine_pending (void)
+{
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(DzlFuzzyIndexCursor) cursor = NULL;
+  g_autoptr(GAsyncResult) init_result = NULL;
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GListModel) refined = NULL;
+  g_autoptr(GListModel) base = NULL;
+  g_autoptr(GFile) file = NULL;
+  GError *error = NULL;
+  gboolean refinable = TRUE;
+  gboolean r;
+
+  file = g_file_new_for_path ("index-refine-pending.gvariant");
+  write_items_index (file, 1, FALSE, 0);
+  index = load_index (file);
+
+  cursor = g_object_new (DZL_TYPE_FUZZY_INDEX_CURSOR,
+                         "index", index,
+                         "query", "it",
+                         "refinable", TRUE,
+                         NULL);
+  g_async_initable_init_async (G_ASYNC_INITABLE (cursor), G_PRIORITY_LOW, NULL, query_sync_cb, &init_result);
+
+  /* The cursor is not populated until its initialization is finished */
+  dzl_fuzzy_index_cursor_refine_async (cursor, "it5", 0, NULL, query_sync_cb, &result);
+
+  while (result == NULL || init_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_null (dzl_fuzzy_index_cursor_refine_finish (cursor, result, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_PENDING);
+  g_clear_error (&error);
+  g_clear_object (&result);
+
+  r = g_async_initable_init_finish (G_ASYNC_INITABLE (cursor), init_result, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  refined = refine_sync (G_LIST_MODEL (cursor), "it5", 0);
+  g_assert_cmpint (g_list_model_get_n_items (refined), >, 0);
+
+  /* Only cursors that asked for it keep their candidates */
+  base = query_sync (index, "it", 0);
+  g_object_get (base, "refinable", &refinable, NULL);
+  g_assert_false (refinable);
+  g_object_get (refined, "refinable", &refinable, NULL);
+  g_assert_true (refinable);
+
+  r = g_file_delete (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static void
+test_index_compress_tables (void)
+{
+  static const gchar *steps[] = { "i", "it", "it5", "it5fo", NULL };
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(DzlFuzzyIndex) compressed = NULL;
+  g_autoptr(GFileInfo) info = NULL;
+  g_autoptr(GFileInfo) info2 = NULL;
+  g_autoptr(GListModel) cursor = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFile) file2 = NULL;
+  GError *error = NULL;
+  gboolean r;
+
+  file = g_file_new_for_path ("index-compress-raw.gvariant");
+  file2 = g_file_new_for_path ("index-compress.gvariant");
+  write_items_index (file, 2, FALSE, 0);
+  write_items_index (file2, 2, TRUE, 0);
+
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE, 0, NULL, &error);
+  g_assert_no_error (error);
+  info2 = g_file_query_info (file2, G_FILE_ATTRIBUTE_STANDARD_SIZE, 0, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (g_file_info_get_size (info2), <, g_file_info_get_size (info));
+
+  index = load_index (file);
+  compressed = load_index (file2);
+
+  for (guint i = 0; item_queries[i] != NULL; i++)
+    {
+      g_autoptr(GListModel) a = query_sync (index, item_queries[i], 0);
+      g_autoptr(GListModel) b = query_sync (compressed, item_queries[i], 0);
+      g_autoptr(GListModel) c = query_sync (compressed, item_queries[i], 25);
+
+      assert_same_head (a, b, G_MAXUINT);
+      assert_same_head (a, c, 25);
+    }
+
+  /* Refining only decodes the blocks containing previous candidates */
+  for (guint i = 0; steps[i] != NULL; i++)
+    {
+      g_autoptr(GListModel) expected = query_sync (index, steps[i], 0);
+      g_autoptr(GListModel) refined = NULL;
+
+      if (cursor == NULL)
+        refined = query_sync (compressed, steps[i], 0);
+      else
+        refined = refine_sync (cursor, steps[i], 0);
+
+      assert_same_head (expected, refined, G_MAXUINT);
+
+      g_clear_object (&cursor);
+      cursor = g_steal_pointer (&refined);
+    }
+
+  r = g_file_delete (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  r = g_file_delete (file2, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static void
+test_index_memory_budget_v1 (void)
+{
+  g_autoptr(DzlFuzzyIndexBuilder) builder = dzl_fuzzy_index_builder_new ();
+  g_autoptr(GFile) file = g_file_new_for_path ("index-memory-v1.gvariant");
+  GError *error = NULL;
+  gboolean r;
+
+  /* Version 1 cannot honor a budget, so it must not ignore it either */
+  dzl_fuzzy_index_builder_set_memory_budget (builder, 16 * 1024);
+  dzl_fuzzy_index_builder_insert (builder, "foo", g_variant_new_uint32 (1), 0);
+
+  r = dzl_fuzzy_index_builder_write (builder, file, G_PRIORITY_LOW, NULL, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+  g_assert (!r);
+  g_assert (!g_file_query_exists (file, NULL));
+  g_clear_error (&error);
+}
+
+static void
+test_index_memory_budget (void)
+{
+  /* A small budget forces many sorted runs to be merged, a tiny one
+   * forces several merge passes with the smallest fan-in.
+   */
+  static const guint64 budgets[] = { 16 * 1024, 512 };
+
+  for (guint i = 0; i < 2; i++)
+    {
+      g_autoptr(GFile) file = g_file_new_for_path ("index-memory.gvariant");
+      g_autoptr(GFile) file2 = g_file_new_for_path ("index-memory-budget.gvariant");
+      g_autofree gchar *contents = NULL;
+      GError *error = NULL;
+      gsize len = 0;
+      gboolean r;
+
+      write_items_index (file, 2, i, 0);
+
+      r = g_file_load_contents (file, NULL, &contents, &len, NULL, &error);
+      g_assert_no_error (error);
+      g_assert (r);
+
+      for (guint k = 0; k < G_N_ELEMENTS (budgets); k++)
+        {
+          g_autoptr(DzlFuzzyIndex) index = NULL;
+          g_autofree gchar *contents2 = NULL;
+          gsize len2 = 0;
+
+          write_items_index (file2, 2, i, budgets[k]);
+
+          r = g_file_load_contents (file2, NULL, &contents2, &len2, NULL, &error);
+          g_assert_no_error (error);
+          g_assert (r);
+
+          g_assert_cmpint (len, ==, len2);
+          g_assert (memcmp (contents, contents2, len) == 0);
+
+          index = load_index (file2);
+
+          for (guint j = 0; item_queries[j] != NULL; j++)
+            {
+              g_autoptr(GListModel) model = query_sync (index, item_queries[j], 0);
+
+              g_assert_cmpint (g_list_model_get_n_items (model), >, 0);
+            }
+        }
+
+      r = g_file_delete (file, NULL, &error);
+      g_assert_no_error (error);
+      g_assert (r);
+
+      r = g_file_delete (file2, NULL, &error);
+      g_assert_no_error (error);
+      g_assert (r);
+    }
+}
+
+static gboolean
+is_subsequence (const gchar *needle,
+                const gchar *haystack)
+{
+  for (; *haystack && *needle; haystack++)
+    {
+      if (*haystack == *needle)
+        needle++;
+    }
+
+  return *needle == '\0';
+}
+
+static void
+test_index_long_query (void)
+{
+  static const gchar *queries[] = { "item_1_foo", "itm19f", "item_1999_bar", "tm__o", "item_7_b", NULL };
+  g_autoptr(GFile) file = g_file_new_for_path ("index-long-query.gvariant");
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  GError *error = NULL;
+  gboolean r;
+
+  write_items_index (file, 2, TRUE, 0);
+  index = load_index (file);
+
+  /* Every key containing the query as a subsequence must match, only once */
+  for (guint i = 0; queries[i] != NULL; i++)
+    {
+      g_autoptr(GListModel) model = query_sync (index, queries[i], 0);
+      guint n_expected = 0;
+      guint n_items;
+
+      for (guint j = 0; j < 2000; j++)
+        {
+          g_autofree gchar *key = g_strdup_printf ("item_%u_%s", j, (j % 3) ? "foo" : "bar");
+
+          if (is_subsequence (queries[i], key))
+            n_expected++;
+        }
+
+      n_items = g_list_model_get_n_items (model);
+      g_assert_cmpint (n_items, ==, n_expected);
+
+      for (guint j = 0; j < n_items; j++)
+        {
+          g_autoptr(DzlFuzzyIndexMatch) match = g_list_model_get_item (model, j);
+
+          g_assert (is_subsequence (queries[i], dzl_fuzzy_index_match_get_key (match)));
+        }
+    }
+
+  r = g_file_delete (file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+}
+
+static DzlFuzzyIndex *
+write_entries_index (GFile       *file,
+                     const gchar *first_key,
+                     ...)
+{
+  g_autoptr(DzlFuzzyIndexBuilder) builder = dzl_fuzzy_index_builder_new ();
+  GError *error = NULL;
+  const gchar *key;
+  gboolean r;
+  va_list args;
+
+  va_start (args, first_key);
+  for (key = first_key; key != NULL; key = va_arg (args, const gchar *))
+    dzl_fuzzy_index_builder_insert (builder, key, g_variant_new_uint32 (va_arg (args, guint)), 0);
+  va_end (args);
+
+  r = dzl_fuzzy_index_builder_write (builder, file, G_PRIORITY_LOW, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  return load_index (file);
+}
+
+static gint
+compare_strptr (gconstpointer a,
+                gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar * const *)a, *(const gchar * const *)b);
+}
+
+static gchar *
+segmented_query_sync (DzlFuzzySegmentedIndex *index,
+                      const gchar            *query,
+                      guint                   max_matches)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GListModel) model = NULL;
+  g_autoptr(GPtrArray) found = g_ptr_array_new_with_free_func (g_free);
+  GError *error = NULL;
+  guint n_items;
+
+  dzl_fuzzy_segmented_index_query_async (index, query, max_matches, NULL, query_sync_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  model = dzl_fuzzy_segmented_index_query_finish (index, result, &error);
+  g_assert_no_error (error);
+  g_assert (model != NULL);
+
+  n_items = g_list_model_get_n_items (model);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(DzlFuzzyIndexMatch) match = g_list_model_get_item (model, i);
+
+      g_ptr_array_add (found, g_strdup_printf ("%s=%u",
+                                               dzl_fuzzy_index_match_get_key (match),
+                                               g_variant_get_uint32 (dzl_fuzzy_index_match_get_document (match))));
+    }
+
+  /* Scores differ between segments, so compare by contents */
+  g_ptr_array_sort (found, compare_strptr);
+  g_ptr_array_add (found, NULL);
+
+  return g_strjoinv (" ", (gchar **)found->pdata);
+}
+
+static void
+compact_cb (GObject      *object,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+  GError *error = NULL;
+  gboolean r;
+
+  r = dzl_fuzzy_segmented_index_compact_finish (DZL_FUZZY_SEGMENTED_INDEX (object), result, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  g_main_loop_quit (main_loop);
+}
+
+static void
+assert_segmented_query (DzlFuzzySegmentedIndex *index,
+                        const gchar            *query,
+                        const gchar            *expected)
+{
+  g_autofree gchar *found = segmented_query_sync (index, query, 0);
+
+  g_assert_cmpstr (found, ==, expected);
+}
+
+static void
+test_segmented_index (void)
+{
+  g_autoptr(GFile) base_file = g_file_new_for_path ("index-segment-base.gvariant");
+  g_autoptr(GFile) delta_file = g_file_new_for_path ("index-segment-delta.gvariant");
+  g_autoptr(GFile) compact_file = g_file_new_for_path ("index-segment-compact.gvariant");
+  g_autoptr(DzlFuzzySegmentedIndex) index = dzl_fuzzy_segmented_index_new ();
+  g_autoptr(DzlFuzzyIndexBuilder) builder = dzl_fuzzy_index_builder_new ();
+  g_autoptr(DzlFuzzyIndex) base = NULL;
+  g_autoptr(DzlFuzzyIndex) delta = NULL;
+  g_autofree gchar *limited = NULL;
+
+  base = write_entries_index (base_file,
+                              "alpha", 1,
+                              "beta", 2,
+                              "gamma", 3,
+                              "delta", 4,
+                              NULL);
+  delta = write_entries_index (delta_file,
+                               "bet", 2,
+                               "epsilon", 6,
+                               NULL);
+
+  dzl_fuzzy_segmented_index_add_segment (index, base);
+  g_assert_cmpint (dzl_fuzzy_segmented_index_get_n_segments (index), ==, 1);
+  assert_segmented_query (index, "a", "alpha=1 beta=2 delta=4 gamma=3");
+
+  /* Newer segments replace documents in older segments */
+  dzl_fuzzy_segmented_index_add_segment (index, delta);
+  g_assert_cmpint (dzl_fuzzy_segmented_index_get_n_segments (index), ==, 2);
+  assert_segmented_query (index, "a", "alpha=1 delta=4 gamma=3");
+  assert_segmented_query (index, "e", "bet=2 delta=4 epsilon=6");
+
+  /* Tombstones by key and by document */
+  dzl_fuzzy_segmented_index_remove_key (index, "gamma");
+  dzl_fuzzy_segmented_index_remove_document (index, g_variant_new_uint32 (4));
+  assert_segmented_query (index, "a", "alpha=1");
+  assert_segmented_query (index, "e", "bet=2 epsilon=6");
+
+  limited = segmented_query_sync (index, "a", 1);
+  g_assert_cmpint (strlen (limited), >, 0);
+  g_assert (strchr (limited, ' ') == NULL);
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  dzl_fuzzy_segmented_index_compact_async (index, builder, compact_file, G_PRIORITY_LOW, NULL, compact_cb, NULL);
+  g_main_loop_run (main_loop);
+  g_clear_pointer (&main_loop, g_main_loop_unref);
+
+  g_assert_cmpint (dzl_fuzzy_segmented_index_get_n_segments (index), ==, 1);
+  assert_segmented_query (index, "a", "alpha=1");
+  assert_segmented_query (index, "e", "bet=2 epsilon=6");
+
+  g_file_delete (base_file, NULL, NULL);
+  g_file_delete (delta_file, NULL, NULL);
+  g_file_delete (compact_file, NULL, NULL);
+}
+
+static void
+test_segmented_index_shared_key (void)
+{
+  g_autoptr(GFile) base_file = g_file_new_for_path ("index-shared-base.gvariant");
+  g_autoptr(GFile) delta_file = g_file_new_for_path ("index-shared-delta.gvariant");
+  g_autoptr(GFile) compact_file = g_file_new_for_path ("index-shared-compact.gvariant");
+  g_autoptr(DzlFuzzySegmentedIndex) index = dzl_fuzzy_segmented_index_new ();
+  g_autoptr(DzlFuzzyIndexBuilder) builder = dzl_fuzzy_index_builder_new ();
+  g_autoptr(DzlFuzzyIndex) base = NULL;
+  g_autoptr(DzlFuzzyIndex) delta = NULL;
+
+  /* Two documents with an "init" key */
+  base = write_entries_index (base_file,
+                              "init", 1,
+                              "main", 1,
+                              "init", 2,
+                              "quit", 2,
+                              NULL);
+
+  /* Only the first document is indexed again, without "main" */
+  delta = write_entries_index (delta_file,
+                               "init", 1,
+                               "start", 1,
+                               NULL);
+
+  dzl_fuzzy_segmented_index_add_segment (index, base);
+  dzl_fuzzy_segmented_index_add_segment (index, delta);
+
+  assert_segmented_query (index, "init", "init=1 init=2");
+  assert_segmented_query (index, "main", "");
+  assert_segmented_query (index, "quit", "quit=2");
+  assert_segmented_query (index, "start", "start=1");
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  dzl_fuzzy_segmented_index_compact_async (index, builder, compact_file, G_PRIORITY_LOW, NULL, compact_cb, NULL);
+  g_main_loop_run (main_loop);
+  g_clear_pointer (&main_loop, g_main_loop_unref);
+
+  assert_segmented_query (index, "init", "init=1 init=2");
+  assert_segmented_query (index, "main", "");
+  assert_segmented_query (index, "quit", "quit=2");
+
+  g_file_delete (base_file, NULL, NULL);
+  g_file_delete (delta_file, NULL, NULL);
+  g_file_delete (compact_file, NULL, NULL);
+}
+
+typedef struct
+{
+  gchar        *dir;
+  GCancellable *cancellable;
+  gint          done;
+} CancelWatch;
+
+static gpointer
+cancel_on_temp_file (gpointer data)
+{
+  CancelWatch *watch = data;
+
+  /* Cancel as soon as GIO creates the temporary file for g_file_replace() */
+  while (!g_atomic_int_get (&watch->done))
+    {
+      g_autoptr(GDir) dir = g_dir_open (watch->dir, 0, NULL);
+      const gchar *name;
+
+      while (dir != NULL && (name = g_dir_read_name (dir)))
+        {
+          if (g_str_has_prefix (name, ".goutputstream-"))
+            {
+              g_cancellable_cancel (watch->cancellable);
+              return NULL;
+            }
+        }
+    }
+
+  return NULL;
+}
+
+static void
+test_index_cancel_write (void)
+{
+  g_autoptr(DzlFuzzyIndexBuilder) builder = NULL;
+  g_autoptr(DzlFuzzyIndex) index = NULL;
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  g_autoptr(GListModel) model = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GBytes) before = NULL;
+  g_autoptr(GBytes) after = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *dir = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *data = NULL;
+  CancelWatch watch = { 0 };
+  GThread *thread;
+  gsize len;
+  gboolean r;
+
+  dir = g_dir_make_tmp ("test-fuzzy-index-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  path = g_build_filename (dir, "index.gvariant", NULL);
+  file = g_file_new_for_path (path);
+  write_items_index (file, 2, FALSE, 0);
+
+  r = g_file_get_contents (path, &data, &len, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+  before = g_bytes_new_take (g_steal_pointer (&data), len);
+
+  builder = dzl_fuzzy_index_builder_new ();
+  dzl_fuzzy_index_builder_set_format_version (builder, 2);
+
+  for (guint i = 0; i < 200000; i++)
+    {
+      g_autofree gchar *key = g_strdup_printf ("cancelled_item_%u", i);
+
+      dzl_fuzzy_index_builder_insert (builder, key, g_variant_new_uint32 (i), 0);
+    }
+
+  watch.dir = dir;
+  watch.cancellable = cancellable;
+  thread = g_thread_new ("cancel-write", cancel_on_temp_file, &watch);
+
+  r = dzl_fuzzy_index_builder_write (builder, file, G_PRIORITY_LOW, cancellable, &error);
+
+  g_atomic_int_set (&watch.done, TRUE);
+  g_thread_join (thread);
+
+  if (r)
+    {
+      g_test_skip ("The index was written before it could be cancelled");
+    }
+  else
+    {
+      g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+      /* The previous index must still be there, untouched */
+      r = g_file_get_contents (path, &data, &len, NULL);
+      g_assert (r);
+      after = g_bytes_new_take (g_steal_pointer (&data), len);
+      g_assert (g_bytes_equal (before, after));
+
+      index = load_index (file);
+      model = query_sync (index, "item", 1);
+      g_assert_cmpint (g_list_model_get_n_items (model), ==, 1);
+    }
+
+  g_file_delete (file, NULL, NULL);
+  g_rmdir (dir);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
@@ -260,5 +1234,18 @@ main (gint   argc,
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/Dazzle/Fuzzy/IndexBuilder/basic", test_index_builder_basic);
   g_test_add_func ("/Dazzle/Fuzzy/Index/basic", test_index_basic);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/max-matches", test_index_max_matches);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/n-threads", test_index_n_threads);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/refine", test_index_refine);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/refine-pending", test_index_refine_pending);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/format-version", test_index_format_version);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/legacy-order", test_index_legacy_order);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/compress-tables", test_index_compress_tables);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/memory-budget", test_index_memory_budget);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/memory-budget-v1", test_index_memory_budget_v1);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/long-query", test_index_long_query);
+  g_test_add_func ("/Dazzle/Fuzzy/Index/cancel-write", test_index_cancel_write);
+  g_test_add_func ("/Dazzle/Fuzzy/SegmentedIndex/basic", test_segmented_index);
+  g_test_add_func ("/Dazzle/Fuzzy/SegmentedIndex/shared-key", test_segmented_index_shared_key);
   return g_test_run ();
 }
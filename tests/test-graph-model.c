@@ -50,11 +50,255 @@ test_basic (void)
   g_value_unset (&value);
 }
 
+static void
+assert_spans (DzlGraphModel *model,
+              guint          column,
+              gint64         first,
+              gint64         last)
+{
+  DzlGraphModelSpan spans[2];
+  gint64 expected = first;
+  guint n_spans;
+
+  n_spans = dzl_graph_view_model_get_spans (model, column, spans);
+  g_assert_cmpint (n_spans, >=, 1);
+
+  for (guint i = 0; i < n_spans; i++)
+    {
+      for (guint j = 0; j < spans[i].n_values; j++)
+        {
+          g_assert_cmpint (spans[i].timestamps[j], ==, expected);
+          g_assert_cmpfloat (spans[i].values[j], ==, expected * 0.5);
+          expected++;
+        }
+    }
+
+  g_assert_cmpint (expected, ==, last + 1);
+}
+
+static void
+test_spans (void)
+{
+  g_autoptr(DzlGraphModel) model = g_object_new (DZL_TYPE_GRAPH_MODEL, "max-samples", 10, NULL);
+  g_autoptr(DzlGraphColumn) column = dzl_graph_view_column_new ("foo", G_TYPE_DOUBLE);
+  DzlGraphModelSpan spans[2];
+  DzlGraphModelIter iter;
+  guint idx;
+
+  idx = dzl_graph_view_model_add_column (model, column);
+  g_assert_cmpint (dzl_graph_view_model_get_spans (model, idx, spans), ==, 0);
+
+  for (gint64 i = 1; i <= 3; i++)
+    {
+      dzl_graph_view_model_push (model, &iter, i);
+      dzl_graph_view_model_iter_set (&iter, idx, i * 0.5, -1);
+    }
+
+  g_assert_cmpint (dzl_graph_view_model_get_spans (model, idx, spans), ==, 1);
+  assert_spans (model, idx, 1, 3);
+
+  /* Once the ring wraps, samples are split at the end of the ring */
+  for (gint64 i = 4; i <= 25; i++)
+    {
+      dzl_graph_view_model_push (model, &iter, i);
+      dzl_graph_view_model_iter_set (&iter, idx, i * 0.5, -1);
+    }
+
+  g_assert_cmpint (dzl_graph_view_model_get_spans (model, idx, spans), ==, 2);
+  assert_spans (model, idx, 16, 25);
+
+  dzl_graph_view_model_set_max_samples (model, 4);
+  assert_spans (model, idx, 22, 25);
+
+  dzl_graph_view_model_set_max_samples (model, 20);
+  assert_spans (model, idx, 22, 25);
+
+  dzl_graph_view_model_push (model, &iter, 26);
+  dzl_graph_view_model_iter_set (&iter, idx, 13.0, -1);
+  assert_spans (model, idx, 22, 26);
+}
+
+static gdouble
+sample_value (gint64 i)
+{
+  return (i % 97) - (i % 13) * 5.0;
+}
+
+static void
+test_decimated (void)
+{
+  g_autoptr(DzlGraphModel) model = g_object_new (DZL_TYPE_GRAPH_MODEL, "max-samples", 5000, NULL);
+  g_autoptr(DzlGraphColumn) column = dzl_graph_view_column_new ("foo", G_TYPE_DOUBLE);
+  DzlGraphModelIter iter;
+  guint idx;
+
+  idx = dzl_graph_view_model_add_column (model, column);
+
+  for (gint64 i = 1; i <= 20000; i++)
+    {
+      dzl_graph_view_model_push (model, &iter, i * 10);
+      dzl_graph_view_model_iter_set (&iter, idx, sample_value (i), -1);
+
+      /* Compare the cached buckets to those of a model with only the ring */
+      if (i % 1000 == 0)
+        {
+          g_autoptr(DzlGraphModel) fresh = g_object_new (DZL_TYPE_GRAPH_MODEL, "max-samples", 5000, NULL);
+          g_autoptr(DzlGraphColumn) fresh_column = dzl_graph_view_column_new ("foo", G_TYPE_DOUBLE);
+          const gint64 *timestamps;
+          const gint64 *fresh_timestamps;
+          const gdouble *values;
+          const gdouble *fresh_values;
+          gint64 end = i * 10;
+          gint64 begin = end - 30000;
+          gdouble min = G_MAXDOUBLE;
+          gdouble max = -G_MAXDOUBLE;
+          gboolean found_min = FALSE;
+          gboolean found_max = FALSE;
+          guint n;
+
+          dzl_graph_view_model_add_column (fresh, fresh_column);
+
+          for (gint64 j = MAX (1, i - 4999); j <= i; j++)
+            {
+              dzl_graph_view_model_push (fresh, &iter, j * 10);
+              dzl_graph_view_model_iter_set (&iter, 0, sample_value (j), -1);
+
+              if (j * 10 >= begin)
+                {
+                  min = MIN (min, sample_value (j));
+                  max = MAX (max, sample_value (j));
+                }
+            }
+
+          n = dzl_graph_view_model_get_decimated (model, idx, begin, end, 100, &timestamps, &values);
+          g_assert_cmpint (n, <=, 4 * 102);
+          g_assert_cmpint (timestamps[n - 1], ==, end);
+
+          for (guint k = 0; k < n; k++)
+            {
+              if (k > 0)
+                g_assert_cmpint (timestamps[k], >, timestamps[k - 1]);
+              found_min |= values[k] == min;
+              found_max |= values[k] == max;
+            }
+
+          g_assert_true (found_min);
+          g_assert_true (found_max);
+
+          g_assert_cmpint (dzl_graph_view_model_get_decimated (fresh, 0, begin, end, 100,
+                                                                &fresh_timestamps, &fresh_values), ==, n);
+
+          for (guint k = 0; k < n; k++)
+            {
+              g_assert_cmpint (timestamps[k], ==, fresh_timestamps[k]);
+              g_assert_cmpfloat (values[k], ==, fresh_values[k]);
+            }
+        }
+    }
+}
+
+#define N_PUSH_THREADS 4
+#define N_PUSH_SAMPLES 50
+
+typedef struct
+{
+  DzlGraphModel *model;
+  guint          thread;
+} PushThread;
+
+static gpointer
+push_concurrent_thread (gpointer data)
+{
+  PushThread *state = data;
+
+  /* Each thread pushes timestamps thread * 1000 + 1 .. thread * 1000 + N */
+  for (guint i = 1; i <= N_PUSH_SAMPLES; i++)
+    {
+      gdouble values[2] = { state->thread, i * 0.5 };
+
+      g_assert_true (dzl_graph_view_model_push_concurrent (state->model,
+                                                           state->thread * 1000 + i,
+                                                           values, 2));
+    }
+
+  return NULL;
+}
+
+static void
+count_changed (DzlGraphModel *model,
+               guint         *n_changed)
+{
+  (*n_changed)++;
+}
+
+static void
+test_push_concurrent (void)
+{
+  g_autoptr(DzlGraphModel) model = dzl_graph_view_model_new ();
+  g_autoptr(DzlGraphColumn) threads = dzl_graph_view_column_new ("thread", G_TYPE_INT64);
+  g_autoptr(DzlGraphColumn) values = dzl_graph_view_column_new ("value", G_TYPE_DOUBLE);
+  GThread *workers[N_PUSH_THREADS];
+  PushThread states[N_PUSH_THREADS];
+  gint64 last[N_PUSH_THREADS + 1] = { 0 };
+  DzlGraphModelIter iter;
+  guint n_changed = 0;
+  guint n_samples = 0;
+
+  dzl_graph_view_model_set_max_samples (model, N_PUSH_THREADS * N_PUSH_SAMPLES + 1);
+  dzl_graph_view_model_add_column (model, threads);
+  dzl_graph_view_model_add_column (model, values);
+  g_signal_connect (model, "changed", G_CALLBACK (count_changed), &n_changed);
+
+  for (guint i = 0; i < N_PUSH_THREADS; i++)
+    {
+      states[i].model = model;
+      states[i].thread = i + 1;
+      workers[i] = g_thread_new ("push", push_concurrent_thread, &states[i]);
+    }
+
+  for (guint i = 0; i < N_PUSH_THREADS; i++)
+    g_thread_join (workers[i]);
+
+  /* Nothing is added until the main context drains the queue */
+  g_assert_cmpint (n_changed, ==, 0);
+
+  while (n_changed < N_PUSH_THREADS * N_PUSH_SAMPLES)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (dzl_graph_view_model_get_iter_first (model, &iter));
+
+  do
+    {
+      gint64 timestamp = dzl_graph_view_model_iter_get_timestamp (&iter);
+      gint64 thread = 0;
+      gdouble value = 0;
+
+      dzl_graph_view_model_iter_get (&iter, 0, &thread, 1, &value, -1);
+
+      g_assert_cmpint (thread, >=, 1);
+      g_assert_cmpint (thread, <=, N_PUSH_THREADS);
+      g_assert_cmpint (timestamp / 1000, ==, thread);
+      g_assert_cmpfloat (value, ==, (timestamp % 1000) * 0.5);
+
+      /* Samples of each thread are added in the order they were pushed */
+      g_assert_cmpint (timestamp, >, last[thread]);
+      last[thread] = timestamp;
+
+      n_samples++;
+    }
+  while (dzl_graph_view_model_iter_next (&iter));
+
+  g_assert_cmpint (n_samples, ==, N_PUSH_THREADS * N_PUSH_SAMPLES);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/Dazzle/GraphModel/basic", test_basic);
+  g_test_add_func ("/Dazzle/GraphModel/spans", test_spans);
+  g_test_add_func ("/Dazzle/GraphModel/decimated", test_decimated);
+  g_test_add_func ("/Dazzle/GraphModel/push-concurrent", test_push_concurrent);
   return g_test_run ();
 }
@@ -158,6 +158,99 @@ test_DzlHeap_extract_int (void)
    dzl_heap_unref (heap);
 }
 
+typedef struct
+{
+   gint  priority;
+   gsize index;
+} Indexed;
+
+static int
+cmpindexed (gconstpointer a,
+            gconstpointer b)
+{
+   const Indexed *ai = *(const Indexed **)a;
+   const Indexed *bi = *(const Indexed **)b;
+
+   return ai->priority - bi->priority;
+}
+
+static void
+set_index (gpointer element,
+           gsize    index_)
+{
+   Indexed *item = *(Indexed **)element;
+
+   item->index = index_;
+}
+
+static void
+assert_indexed_heap (DzlHeap *heap)
+{
+   gsize i;
+
+   for (i = 0; i < heap->len; i++) {
+      Indexed *item = dzl_heap_index (heap, Indexed *, i);
+
+      g_assert_cmpint (item->index, ==, i);
+      if (i > 0)
+         g_assert_cmpint (item->priority, <=, dzl_heap_index (heap, Indexed *, (i - 1) / 2)->priority);
+   }
+}
+
+static void
+test_DzlHeap_indexed (void)
+{
+   g_autoptr(GRand) rand = g_rand_new_with_seed (42);
+   Indexed items[1000];
+   gboolean alive[1000];
+   DzlHeap *heap;
+   Indexed *item;
+   gint last = G_MAXINT;
+   guint i;
+
+   heap = dzl_heap_new_indexed (sizeof (Indexed *), cmpindexed, set_index);
+
+   for (i = 0; i < G_N_ELEMENTS (items); i++) {
+      item = &items[i];
+      item->priority = g_rand_int_range (rand, 0, 500);
+      dzl_heap_insert_val (heap, item);
+      alive[i] = TRUE;
+   }
+
+   assert_indexed_heap (heap);
+
+   /* Increase, decrease and remove items by their tracked position */
+   for (i = 0; i < 2000; i++) {
+      guint j = g_rand_int_range (rand, 0, G_N_ELEMENTS (items));
+
+      if (!alive[j])
+         continue;
+
+      g_assert (dzl_heap_index (heap, Indexed *, items[j].index) == &items[j]);
+
+      if (i % 3 == 0) {
+         g_assert (dzl_heap_extract_index (heap, items[j].index, &item));
+         g_assert (item == &items[j]);
+         alive[j] = FALSE;
+      } else {
+         items[j].priority = g_rand_int_range (rand, 0, 500);
+         dzl_heap_update_index (heap, items[j].index);
+      }
+
+      if (i % 100 == 0)
+         assert_indexed_heap (heap);
+   }
+
+   assert_indexed_heap (heap);
+
+   while (dzl_heap_extract (heap, &item)) {
+      g_assert_cmpint (item->priority, <=, last);
+      last = item->priority;
+   }
+
+   dzl_heap_unref (heap);
+}
+
 int
 main (gint   argc,
       gchar *argv[])
@@ -168,6 +261,7 @@ main (gint   argc,
    g_test_add_func ("/Dazzle/Heap/insert_and_extract<gpointer>", test_DzlHeap_insert_val_ptr);
    g_test_add_func ("/Dazzle/Heap/insert_and_extract<Tuple>", test_DzlHeap_insert_val_tuple);
    g_test_add_func ("/Dazzle/Heap/extract_index<int>", test_DzlHeap_extract_int);
+   g_test_add_func ("/Dazzle/Heap/indexed", test_DzlHeap_indexed);
 
    return g_test_run ();
 }
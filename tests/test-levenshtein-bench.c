@@ -0,0 +1,160 @@
+#include <dazzle.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The row based implementation dzl_levenshtein() used previously, kept
+ * here to compare against.
+ */
+static gint
+classic_levenshtein (const gchar *needle,
+                     const gchar *haystack)
+{
+  const gchar *s;
+  const gchar *t;
+  gint *v0;
+  gint *v1;
+  gint haystack_char_len;
+  gint ret;
+  gint i;
+  gint j;
+
+  if (!g_strcmp0 (needle, haystack))
+    return 0;
+  else if (!*needle)
+    return g_utf8_strlen (haystack, -1);
+  else if (!*haystack)
+    return g_utf8_strlen (needle, -1);
+
+  haystack_char_len = g_utf8_strlen (haystack, -1);
+
+  v0 = g_new0 (gint, haystack_char_len + 1);
+  v1 = g_new0 (gint, haystack_char_len + 1);
+
+  for (i = 0; i < haystack_char_len + 1; i++)
+    v0[i] = i;
+
+  for (i = 0, s = needle; *s; i++, s = g_utf8_next_char (s))
+    {
+      gunichar sc = g_utf8_get_char (s);
+
+      v1[0] = i + 1;
+
+      for (j = 0, t = haystack; *t; j++, t = g_utf8_next_char (t))
+        {
+          gunichar tc = g_utf8_get_char (t);
+          gint cost = (sc == tc) ? 0 : 1;
+
+          v1[j+1] = MIN (v1[j] + 1, MIN (v0[j+1] + 1, v0[j] + cost));
+        }
+
+      memcpy (v0, v1, sizeof (gint) * (haystack_char_len + 1));
+    }
+
+  ret = v1[haystack_char_len];
+
+  g_free (v0);
+  g_free (v1);
+
+  return ret;
+}
+
+static gchar *
+random_word (GRand *rand,
+             guint  min_len,
+             guint  max_len)
+{
+  static const gchar *parts[] = { "gtk", "widget", "show", "get", "name", "set", "property", "_", "dzl", "tree" };
+  GString *str = g_string_new (NULL);
+  guint len = g_rand_int_range (rand, min_len, max_len + 1);
+
+  while (str->len < len)
+    g_string_append (str, parts[g_rand_int_range (rand, 0, G_N_ELEMENTS (parts))]);
+
+  g_string_truncate (str, len);
+
+  return g_string_free (str, FALSE);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GPtrArray) words = NULL;
+  g_autoptr(GPtrArray) needles = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GRand) rand = NULL;
+  gint n_words = 10000;
+  gint n_needles = 20;
+  gint max_len = 40;
+  gint max_distance = 3;
+  const GOptionEntry entries[] = {
+    { "words", 'w', 0, G_OPTION_ARG_INT, &n_words, "Number of words to rank", "10000" },
+    { "needles", 'n', 0, G_OPTION_ARG_INT, &n_needles, "Number of needles to rank against", "20" },
+    { "length", 'l', 0, G_OPTION_ARG_INT, &max_len, "Maximum word length", "40" },
+    { "max-distance", 'd', 0, G_OPTION_ARG_INT, &max_distance, "Distance for the bounded variant", "3" },
+    { NULL }
+  };
+  gint64 classic = 0;
+  gint64 full = 0;
+  gint64 bounded = 0;
+  guint n_close = 0;
+
+  context = g_option_context_new ("- compare levenshtein implementations");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  rand = g_rand_new_with_seed (42);
+  words = g_ptr_array_new_with_free_func (g_free);
+  needles = g_ptr_array_new_with_free_func (g_free);
+
+  for (gint i = 0; i < n_words; i++)
+    g_ptr_array_add (words, random_word (rand, 1, MAX (1, max_len)));
+
+  for (gint i = 0; i < n_needles; i++)
+    g_ptr_array_add (needles, random_word (rand, 1, MAX (1, max_len)));
+
+  for (guint i = 0; i < needles->len; i++)
+    {
+      const gchar *needle = g_ptr_array_index (needles, i);
+
+      for (guint j = 0; j < words->len; j++)
+        {
+          const gchar *word = g_ptr_array_index (words, j);
+          gint64 begin;
+          gint a;
+          gint b;
+          gint c;
+
+          begin = g_get_monotonic_time ();
+          a = classic_levenshtein (needle, word);
+          classic += g_get_monotonic_time () - begin;
+
+          begin = g_get_monotonic_time ();
+          b = dzl_levenshtein (needle, word);
+          full += g_get_monotonic_time () - begin;
+
+          begin = g_get_monotonic_time ();
+          c = dzl_levenshtein_bounded (needle, word, max_distance);
+          bounded += g_get_monotonic_time () - begin;
+
+          g_assert_cmpint (a, ==, b);
+          g_assert_cmpint (c, ==, MIN (a, max_distance + 1));
+
+          n_close += (c <= max_distance);
+        }
+    }
+
+  g_print ("%d needles x %d words, up to %d characters, %u within %d\n",
+           n_needles, n_words, max_len, n_close, max_distance);
+  g_print ("classic: %8.3lf msec   dzl_levenshtein: %8.3lf msec   bounded: %8.3lf msec\n",
+           classic / 1000.0, full / 1000.0, bounded / 1000.0);
+
+  return EXIT_SUCCESS;
+}
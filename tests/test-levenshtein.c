@@ -12,12 +12,15 @@ test_levenshtein_basic (void)
 {
   static const WordCheck check[] = {
     { "gtk", "gkt", 2 },
-    { "LibreFreeOpen", "Cromulent", 10 },
+    { "LibreFreeOpen", "Cromulent", 11 },
     { "Xorg", "Wayland", 7 },
     { "glib", "gobject", 6 },
     { "gbobject", "gobject", 1 },
     { "flip", "fliiiip", 3 },
     { "flip", "fliiiipper", 6 },
+    { "ab", "a", 1 },
+    { "", "abc", 3 },
+    { "caf\xc3\xa9", "cafe", 1 },
     { NULL }
   };
 
@@ -29,11 +32,77 @@ test_levenshtein_basic (void)
     }
 }
 
+static gint
+reference_levenshtein (const gchar *needle,
+                       const gchar *haystack)
+{
+  g_autofree gunichar *a = g_utf8_to_ucs4_fast (needle, -1, NULL);
+  g_autofree gunichar *b = g_utf8_to_ucs4_fast (haystack, -1, NULL);
+  glong m = g_utf8_strlen (needle, -1);
+  glong n = g_utf8_strlen (haystack, -1);
+  g_autofree gint *prev = g_new (gint, n + 1);
+  g_autofree gint *cur = g_new (gint, n + 1);
+
+  for (glong j = 0; j <= n; j++)
+    prev[j] = j;
+
+  for (glong i = 1; i <= m; i++)
+    {
+      gint *tmp;
+
+      cur[0] = i;
+
+      for (glong j = 1; j <= n; j++)
+        cur[j] = MIN (MIN (cur[j - 1], prev[j]) + 1, prev[j - 1] + (a[i - 1] != b[j - 1]));
+
+      tmp = prev;
+      prev = cur;
+      cur = tmp;
+    }
+
+  return prev[n];
+}
+
+static gchar *
+random_word (GRand *rand,
+             guint  max_len)
+{
+  static const gchar *alphabet[] = { "a", "b", "c", "\xc3\xa9", "\xe2\x82\xac" };
+  guint n_chars = g_rand_boolean (rand) ? 3 : G_N_ELEMENTS (alphabet);
+  guint len = g_rand_int_range (rand, 0, max_len);
+  GString *str = g_string_new (NULL);
+
+  for (guint i = 0; i < len; i++)
+    g_string_append (str, alphabet[g_rand_int_range (rand, 0, n_chars)]);
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+test_levenshtein_random (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (1234);
+
+  /* Covers both the bit-parallel (<= 64 chars) and banded implementations */
+  for (guint i = 0; i < 5000; i++)
+    {
+      guint max_len = (i % 4 == 0) ? 150 : 40;
+      g_autofree gchar *a = random_word (rand, max_len);
+      g_autofree gchar *b = random_word (rand, max_len);
+      gint expected = reference_levenshtein (a, b);
+      gint max_distance = g_rand_int_range (rand, 0, 12);
+
+      g_assert_cmpint (dzl_levenshtein (a, b), ==, expected);
+      g_assert_cmpint (dzl_levenshtein_bounded (a, b, max_distance), ==, MIN (expected, max_distance + 1));
+    }
+}
+
 gint
 main (gint argc,
       gchar *argv[])
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/Dazzle/Levenshtein/basic", test_levenshtein_basic);
+  g_test_add_func ("/Dazzle/Levenshtein/random", test_levenshtein_random);
   return g_test_run ();
 }
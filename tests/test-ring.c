@@ -233,6 +233,100 @@ test_DzlRing_foreach (void)
   dzl_ring_unref (ring);
 }
 
+#define N_PRODUCERS 4
+#define N_PUSHED    100000
+
+typedef struct
+{
+  DzlRing *ring;
+  guint    producer;
+} Producer;
+
+static gpointer
+test_DzlRing_push_worker (gpointer data)
+{
+  Producer *producer = data;
+  guint i = 0;
+
+  while (i < N_PUSHED)
+    {
+      gint64 batch[8];
+      guint len = MIN (1 + (i % G_N_ELEMENTS (batch)), N_PUSHED - i);
+
+      for (guint j = 0; j < len; j++)
+        batch[j] = ((gint64)producer->producer << 32) | (i + j);
+
+      /* Wait for the consumer to make room */
+      if (!dzl_ring_push_vals (producer->ring, batch, len))
+        {
+          g_thread_yield ();
+          continue;
+        }
+
+      i += len;
+    }
+
+  return NULL;
+}
+
+static void
+test_DzlRing_push (void)
+{
+  Producer producers[N_PRODUCERS];
+  GThread *threads[N_PRODUCERS];
+  guint next[N_PRODUCERS] = { 0 };
+  DzlRing *ring;
+  guint total = 0;
+  gint64 v;
+
+  ring = dzl_ring_sized_new_concurrent (sizeof (gint64), 1024, 1024, NULL);
+
+  v = 1;
+  g_assert_true (dzl_ring_push_val (ring, v));
+  g_assert_cmpint (dzl_ring_drain (ring), ==, 1);
+  g_assert_cmpint (dzl_ring_get_index (ring, gint64, -1), ==, 1);
+  g_assert_cmpint (dzl_ring_drain (ring), ==, 0);
+
+  /* Nothing is queued once the ring is not drained often enough */
+  for (v = 0; v < 1024; v++)
+    g_assert_true (dzl_ring_push_val (ring, v));
+  g_assert_false (dzl_ring_push_val (ring, v));
+  g_assert_cmpint (dzl_ring_drain (ring), ==, 1024);
+  g_assert_cmpint (dzl_ring_get_index (ring, gint64, -1), ==, 1023);
+
+  for (guint i = 0; i < N_PRODUCERS; i++)
+    {
+      producers[i].ring = ring;
+      producers[i].producer = i;
+      threads[i] = g_thread_new ("producer", test_DzlRing_push_worker, &producers[i]);
+    }
+
+  while (total < N_PRODUCERS * N_PUSHED)
+    {
+      guint n = dzl_ring_drain (ring);
+
+      /* Values of each producer arrive in order */
+      for (gint i = -(gint)n; i < 0; i++)
+        {
+          v = dzl_ring_get_index (ring, gint64, i);
+          g_assert_cmpint (v & G_MAXUINT32, ==, next[v >> 32]);
+          next[v >> 32]++;
+        }
+
+      total += n;
+    }
+
+  for (guint i = 0; i < N_PRODUCERS; i++)
+    {
+      g_thread_join (threads[i]);
+      g_assert_cmpint (next[i], ==, N_PUSHED);
+    }
+
+  g_assert_cmpint (dzl_ring_drain (ring), ==, 0);
+
+  dzl_ring_unref (ring);
+}
+
 gint
 main (gint   argc,   /* IN */
       gchar *argv[]) /* IN */
@@ -245,6 +339,7 @@ main (gint   argc,   /* IN */
 	g_test_add_func ("/Dazzle/Ring/with_int", test_DzlRing_with_int);
 	g_test_add_func ("/Dazzle/Ring/with_array", test_DzlRing_with_array);
 	g_test_add_func ("/Dazzle/Ring/foreach", test_DzlRing_foreach);
+	g_test_add_func ("/Dazzle/Ring/push", test_DzlRing_push);
 
 	return g_test_run ();
 }
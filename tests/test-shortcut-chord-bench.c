@@ -0,0 +1,135 @@
+#include <dazzle.h>
+#include <stdlib.h>
+
+static DzlShortcutChord *
+create_chord (guint i)
+{
+  static const gchar *modifiers[] = { "", "<control>", "<alt>", "<control><shift>", "<super>" };
+  g_autoptr(GString) str = g_string_new (NULL);
+  guint len = 1 + (i % 3);
+
+  for (guint j = 0; j < len; j++)
+    {
+      if (j > 0)
+        g_string_append_c (str, '|');
+      g_string_append (str, modifiers[(i / (j + 1)) % G_N_ELEMENTS (modifiers)]);
+      g_string_append_c (str, 'a' + (i / (j + 3)) % 26);
+    }
+
+  return dzl_shortcut_chord_new_from_string (str->str);
+}
+
+static DzlShortcutChordTable *
+load_table (GPtrArray *chords,
+            gboolean   frozen,
+            gint64    *elapsed)
+{
+  DzlShortcutChordTable *table = dzl_shortcut_chord_table_new ();
+  gint64 begin = g_get_monotonic_time ();
+
+  if (frozen)
+    dzl_shortcut_chord_table_freeze (table);
+
+  for (guint i = 0; i < chords->len; i++)
+    dzl_shortcut_chord_table_add (table, g_ptr_array_index (chords, i), GUINT_TO_POINTER (i + 1));
+
+  if (frozen)
+    dzl_shortcut_chord_table_thaw (table);
+
+  *elapsed += g_get_monotonic_time () - begin;
+
+  return table;
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GPtrArray) chords = NULL;
+  g_autoptr(GPtrArray) presses = NULL;
+  g_autoptr(GError) error = NULL;
+  DzlShortcutChordTable *table = NULL;
+  gint n_chords = 5000;
+  gint iterations = 5;
+  const GOptionEntry entries[] = {
+    { "chords", 'c', 0, G_OPTION_ARG_INT, &n_chords, "Number of chords to load", "5000" },
+    { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Number of runs", "5" },
+    { NULL }
+  };
+  gint64 incremental = 0;
+  gint64 bulk = 0;
+  gint64 lookup = 0;
+  guint n_lookups = 0;
+  guint n_equal = 0;
+
+  context = g_option_context_new ("- measure shortcut theme load and lookup");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  chords = g_ptr_array_new_with_free_func ((GDestroyNotify)dzl_shortcut_chord_free);
+
+  for (gint i = 0; i < n_chords; i++)
+    g_ptr_array_add (chords, create_chord (i));
+
+  for (gint i = 0; i < iterations; i++)
+    {
+      g_clear_pointer (&table, dzl_shortcut_chord_table_free);
+      table = load_table (chords, FALSE, &incremental);
+      g_clear_pointer (&table, dzl_shortcut_chord_table_free);
+      table = load_table (chords, TRUE, &bulk);
+    }
+
+  /* Each chord is typed one key at a time, so lookup every prefix */
+  presses = g_ptr_array_new_with_free_func ((GDestroyNotify)dzl_shortcut_chord_free);
+
+  for (guint i = 0; i < chords->len; i++)
+    {
+      g_autofree gchar *accel = dzl_shortcut_chord_to_string (g_ptr_array_index (chords, i));
+      g_auto(GStrv) keys = g_strsplit (accel, "|", 0);
+      guint len = g_strv_length (keys);
+
+      for (guint j = 1; j <= len; j++)
+        {
+          g_autofree gchar *prefix = NULL;
+          gchar *tmp = keys[j];
+
+          keys[j] = NULL;
+          prefix = g_strjoinv ("|", keys);
+          keys[j] = tmp;
+
+          g_ptr_array_add (presses, dzl_shortcut_chord_new_from_string (prefix));
+        }
+    }
+
+  for (gint i = 0; i < iterations; i++)
+    {
+      gint64 begin = g_get_monotonic_time ();
+
+      for (guint j = 0; j < presses->len; j++)
+        {
+          gpointer data;
+
+          if (dzl_shortcut_chord_table_lookup (table, g_ptr_array_index (presses, j), &data) == DZL_SHORTCUT_MATCH_EQUAL)
+            n_equal++;
+        }
+
+      lookup += g_get_monotonic_time () - begin;
+      n_lookups += presses->len;
+    }
+
+  g_print ("%u chords, %d iterations\n", chords->len, iterations);
+  g_print ("load one at a time: %8.3lf msec\n", incremental / 1000.0 / MAX (1, iterations));
+  g_print ("load frozen:        %8.3lf msec\n", bulk / 1000.0 / MAX (1, iterations));
+  g_print ("lookup per key:     %8.3lf usec (%u of %u equal)\n",
+           lookup / (gdouble)MAX (1, n_lookups), n_equal, n_lookups);
+
+  g_clear_pointer (&table, dzl_shortcut_chord_table_free);
+
+  return EXIT_SUCCESS;
+}
@@ -59,6 +59,129 @@ test_dzl_shortcut_chord_basic (void)
   g_clear_pointer (&table, dzl_shortcut_chord_table_free);
 }
 
+static DzlShortcutChord *
+random_chord (GRand *rand)
+{
+  static const gchar *modifiers[] = { "", "<control>", "<alt>", "<control><shift>" };
+  g_autoptr(GString) str = g_string_new (NULL);
+  guint len = g_rand_int_range (rand, 1, 4);
+
+  for (guint i = 0; i < len; i++)
+    {
+      if (i > 0)
+        g_string_append_c (str, '|');
+      g_string_append (str, modifiers[g_rand_int_range (rand, 0, G_N_ELEMENTS (modifiers))]);
+      g_string_append_c (str, 'a' + g_rand_int_range (rand, 0, 6));
+    }
+
+  return dzl_shortcut_chord_new_from_string (str->str);
+}
+
+static DzlShortcutMatch
+reference_lookup (GPtrArray              *chords,
+                  const DzlShortcutChord *chord,
+                  gpointer               *data)
+{
+  DzlShortcutMatch ret = DZL_SHORTCUT_MATCH_NONE;
+
+  *data = NULL;
+
+  for (guint i = 0; i < chords->len; i++)
+    {
+      const DzlShortcutChord *item = g_ptr_array_index (chords, i);
+
+      if (item == NULL)
+        continue;
+
+      switch (dzl_shortcut_chord_match (chord, item))
+        {
+        case DZL_SHORTCUT_MATCH_EQUAL:
+          *data = GUINT_TO_POINTER (i + 1);
+          return DZL_SHORTCUT_MATCH_EQUAL;
+
+        case DZL_SHORTCUT_MATCH_PARTIAL:
+          ret = DZL_SHORTCUT_MATCH_PARTIAL;
+          break;
+
+        case DZL_SHORTCUT_MATCH_NONE:
+        default:
+          break;
+        }
+    }
+
+  return ret;
+}
+
+static void
+assert_lookups (DzlShortcutChordTable *table,
+                GPtrArray             *chords,
+                GRand                 *rand)
+{
+  for (guint i = 0; i < 2000; i++)
+    {
+      g_autoptr(DzlShortcutChord) chord = random_chord (rand);
+      DzlShortcutMatch expected;
+      DzlShortcutMatch match;
+      gpointer expected_data;
+      gpointer data;
+
+      expected = reference_lookup (chords, chord, &expected_data);
+      match = dzl_shortcut_chord_table_lookup (table, chord, &data);
+
+      g_assert_cmpint (match, ==, expected);
+      g_assert (data == expected_data);
+    }
+}
+
+static void
+test_dzl_shortcut_chord_table_bulk (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (1234);
+  g_autoptr(GHashTable) seen = g_hash_table_new (dzl_shortcut_chord_hash, dzl_shortcut_chord_equal);
+  g_autoptr(GPtrArray) chords = g_ptr_array_new_with_free_func ((GDestroyNotify)dzl_shortcut_chord_free);
+  DzlShortcutChordTable *table;
+
+  table = dzl_shortcut_chord_table_new ();
+
+  for (guint i = 0; i < 400; i++)
+    {
+      DzlShortcutChord *chord = random_chord (rand);
+
+      /* Chords added after the freeze are merged when we lookup or thaw */
+      if (i == 200)
+        dzl_shortcut_chord_table_freeze (table);
+
+      if (i == 300)
+        assert_lookups (table, chords, rand);
+
+      if (g_hash_table_contains (seen, chord))
+        {
+          dzl_shortcut_chord_free (chord);
+          continue;
+        }
+
+      g_hash_table_add (seen, chord);
+      g_ptr_array_add (chords, chord);
+      dzl_shortcut_chord_table_add (table, chord, GUINT_TO_POINTER (chords->len));
+    }
+
+  dzl_shortcut_chord_table_thaw (table);
+  g_assert_cmpint (dzl_shortcut_chord_table_size (table), ==, chords->len);
+  assert_lookups (table, chords, rand);
+
+  for (guint i = 0; i < chords->len; i += 3)
+    {
+      g_assert_true (dzl_shortcut_chord_table_remove (table, g_ptr_array_index (chords, i)));
+      g_hash_table_remove (seen, g_ptr_array_index (chords, i));
+      dzl_shortcut_chord_free (g_ptr_array_index (chords, i));
+      g_ptr_array_index (chords, i) = NULL;
+    }
+
+  assert_lookups (table, chords, rand);
+
+  g_clear_pointer (&table, dzl_shortcut_chord_table_free);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
@@ -66,6 +189,7 @@ main (gint   argc,
   g_test_init (&argc, &argv, NULL);
 
   g_test_add_func ("/Dazzle/Shortcut/Chord", test_dzl_shortcut_chord_basic);
+  g_test_add_func ("/Dazzle/Shortcut/ChordTable/bulk", test_dzl_shortcut_chord_table_bulk);
 
   return g_test_run ();
 }
@@ -1,7 +1,31 @@
 #include <dazzle.h>
+#include <glib/gstdio.h>
+#include <utime.h>
 
 #include "shortcuts/dzl-shortcut-private.h"
 
+static void
+remove_tree (const gchar *path)
+{
+  g_autoptr(GDir) dir = NULL;
+  const gchar *name;
+
+  if ((dir = g_dir_open (path, 0, NULL)))
+    {
+      while ((name = g_dir_read_name (dir)))
+        {
+          g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+          if (g_file_test (child, G_FILE_TEST_IS_DIR))
+            remove_tree (child);
+          else
+            g_unlink (child);
+        }
+    }
+
+  g_rmdir (path);
+}
+
 static void
 test_shortcut_theme_basic (void)
 {
@@ -37,6 +61,180 @@ test_shortcut_theme_basic (void)
   g_assert (context == NULL);
 }
 
+static void
+test_shortcut_theme_compiled (void)
+{
+  g_autoptr(DzlShortcutTheme) theme = NULL;
+  g_autoptr(DzlShortcutTheme) compiled_theme = NULL;
+  g_autoptr(GVariant) compiled = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *contents = NULL;
+  g_autofree gchar *saved = NULL;
+  g_autofree gchar *compiled_saved = NULL;
+  g_autofree gchar *tmpdir = NULL;
+  g_autofree gchar *parsed_path = NULL;
+  g_autofree gchar *compiled_path = NULL;
+  gsize len = 0;
+
+  path = g_build_filename (TEST_DATA_DIR, "keythemes", "test.keytheme", NULL);
+
+  if (!g_file_get_contents (path, &contents, &len, &error))
+    g_error ("%s", error->message);
+
+  g_assert_null (_dzl_shortcut_theme_compile ("<keytheme></context>", -1, &error));
+  g_assert_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE);
+  g_clear_error (&error);
+
+  compiled = _dzl_shortcut_theme_compile (contents, len, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (compiled);
+
+  /* Loading the compiled theme must produce the same theme as parsing */
+  theme = dzl_shortcut_theme_new (NULL);
+  dzl_shortcut_theme_load_from_data (theme, contents, len, &error);
+  g_assert_no_error (error);
+
+  compiled_theme = dzl_shortcut_theme_new (NULL);
+  _dzl_shortcut_theme_load_from_compiled (compiled_theme, compiled, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpstr ("test", ==, dzl_shortcut_theme_get_name (compiled_theme));
+  g_assert_cmpstr ("Test theme", ==, dzl_shortcut_theme_get_subtitle (compiled_theme));
+  g_assert_nonnull (dzl_shortcut_theme_find_context_by_name (compiled_theme, "GtkWindow"));
+
+  tmpdir = g_dir_make_tmp ("test-shortcut-theme-XXXXXX", &error);
+  g_assert_no_error (error);
+  parsed_path = g_build_filename (tmpdir, "parsed.keytheme", NULL);
+  compiled_path = g_build_filename (tmpdir, "compiled.keytheme", NULL);
+
+  dzl_shortcut_theme_save_to_path (theme, parsed_path, NULL, &error);
+  g_assert_no_error (error);
+  dzl_shortcut_theme_save_to_path (compiled_theme, compiled_path, NULL, &error);
+  g_assert_no_error (error);
+
+  g_file_get_contents (parsed_path, &saved, NULL, &error);
+  g_assert_no_error (error);
+  g_file_get_contents (compiled_path, &compiled_saved, NULL, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpstr (saved, ==, compiled_saved);
+
+  remove_tree (tmpdir);
+}
+
+static void
+write_keytheme (const gchar *path,
+                const gchar *contents,
+                time_t       mtime)
+{
+  g_autoptr(GError) error = NULL;
+  struct utimbuf times = { mtime, mtime };
+
+  g_file_set_contents (path, contents, -1, &error);
+  g_assert_no_error (error);
+
+  /* The cache does not trust files modified within the last second */
+  g_assert_cmpint (g_utime (path, &times), ==, 0);
+}
+
+static time_t
+get_mtime (const gchar *path)
+{
+  GStatBuf st;
+
+  g_assert_cmpint (g_stat (path, &st), ==, 0);
+
+  return st.st_mtime;
+}
+
+static gboolean
+cache_contains (const gchar *cache_path,
+                const gchar *name)
+{
+  g_autofree gchar *contents = NULL;
+  gsize len = 0;
+
+  if (!g_file_get_contents (cache_path, &contents, &len, NULL))
+    return FALSE;
+
+  /* Strings are stored verbatim in the serialized GVariant */
+  return g_strstr_len (contents, len, name) != NULL;
+}
+
+static void
+test_shortcut_theme_manager_cache (void)
+{
+  g_autoptr(DzlShortcutManager) manager = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *search_dir = NULL;
+  g_autofree gchar *theme_path = NULL;
+  g_autofree gchar *data_path = NULL;
+  g_autofree gchar *contents = NULL;
+  g_autofree gchar *changed = NULL;
+  g_autofree gchar *checksum = NULL;
+  g_autofree gchar *cache_name = NULL;
+  g_autofree gchar *cache_path = NULL;
+  g_auto(GStrv) parts = NULL;
+  DzlShortcutTheme *theme;
+  struct utimbuf old_times;
+  time_t now = time (NULL);
+
+  data_path = g_build_filename (TEST_DATA_DIR, "keythemes", "test.keytheme", NULL);
+  g_file_get_contents (data_path, &contents, NULL, &error);
+  g_assert_no_error (error);
+
+  search_dir = g_dir_make_tmp ("test-shortcut-theme-XXXXXX", &error);
+  g_assert_no_error (error);
+  theme_path = g_build_filename (search_dir, "test.keytheme", NULL);
+  write_keytheme (theme_path, contents, now - 100);
+
+  /* XDG_CACHE_HOME points to a temporary directory, see main() */
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, search_dir, -1);
+  cache_name = g_strdup_printf ("%s.keythemes", checksum);
+  cache_path = g_build_filename (g_get_user_cache_dir (), "libdazzle", "keythemes", cache_name, NULL);
+
+  manager = g_object_new (DZL_TYPE_SHORTCUT_MANAGER, NULL);
+  dzl_shortcut_manager_append_search_path (manager, search_dir);
+
+  /* The first load compiles the theme and writes the cache */
+  dzl_shortcut_manager_reload (manager, NULL);
+  theme = dzl_shortcut_manager_get_theme_by_name (manager, "test");
+  g_assert_nonnull (theme);
+  g_assert_cmpstr ("Test theme", ==, dzl_shortcut_theme_get_subtitle (theme));
+  g_assert_true (g_file_test (cache_path, G_FILE_TEST_IS_REGULAR));
+  g_assert_true (cache_contains (cache_path, "test.keytheme"));
+
+  /* An unchanged file is reused, so the cache is not rewritten */
+  old_times.actime = old_times.modtime = now - 1000;
+  g_assert_cmpint (g_utime (cache_path, &old_times), ==, 0);
+  dzl_shortcut_manager_reload (manager, NULL);
+  g_assert_cmpint (get_mtime (cache_path), ==, now - 1000);
+  theme = dzl_shortcut_manager_get_theme_by_name (manager, "test");
+  g_assert_nonnull (theme);
+  g_assert_cmpstr ("Test theme", ==, dzl_shortcut_theme_get_subtitle (theme));
+
+  /* A modified file is compiled again */
+  parts = g_strsplit (contents, "Test theme", 2);
+  changed = g_strjoinv ("Changed theme", parts);
+  write_keytheme (theme_path, changed, now - 50);
+  dzl_shortcut_manager_reload (manager, NULL);
+  g_assert_cmpint (get_mtime (cache_path), !=, now - 1000);
+  theme = dzl_shortcut_manager_get_theme_by_name (manager, "test");
+  g_assert_nonnull (theme);
+  g_assert_cmpstr ("Changed theme", ==, dzl_shortcut_theme_get_subtitle (theme));
+
+  /* A removed file is dropped from the cache */
+  g_assert_cmpint (g_utime (cache_path, &old_times), ==, 0);
+  g_assert_cmpint (g_unlink (theme_path), ==, 0);
+  dzl_shortcut_manager_reload (manager, NULL);
+  g_assert_cmpint (get_mtime (cache_path), !=, now - 1000);
+  g_assert_false (cache_contains (cache_path, "test.keytheme"));
+  g_assert_null (dzl_shortcut_manager_get_theme_by_name (manager, "test"));
+
+  remove_tree (search_dir);
+}
+
 static void
 key_callback (GtkWidget *widget,
               gpointer   data)
@@ -95,13 +293,93 @@ test_shortcut_theme_manager (void)
   g_assert_cmpint (r, ==, GDK_EVENT_STOP);
 }
 
+static void
+test_shortcut_controller_chain (void)
+{
+  DzlShortcutController *root;
+  DzlShortcutController *inner;
+  DzlShortcutController *outer;
+  GPtrArray *chain;
+  GPtrArray *cached;
+  GtkWidget *window;
+  GtkWidget *outer_box;
+  GtkWidget *inner_box;
+  GtkWidget *label;
+
+  window = gtk_offscreen_window_new ();
+  outer_box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  inner_box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  label = gtk_label_new (NULL);
+  gtk_container_add (GTK_CONTAINER (window), outer_box);
+  gtk_container_add (GTK_CONTAINER (outer_box), inner_box);
+  gtk_container_add (GTK_CONTAINER (inner_box), label);
+
+  root = dzl_shortcut_controller_find (window);
+  inner = dzl_shortcut_controller_find (inner_box);
+
+  chain = _dzl_shortcut_controller_get_chain (root, label);
+  g_assert_cmpint (chain->len, ==, 2);
+  g_assert (g_ptr_array_index (chain, 0) == inner);
+  g_assert (g_ptr_array_index (chain, 1) == root);
+
+  /* The chain is reused until something changes */
+  cached = _dzl_shortcut_controller_get_chain (root, label);
+  g_assert (cached == chain);
+  g_ptr_array_unref (cached);
+  g_ptr_array_unref (chain);
+
+  /* New controllers are picked up */
+  outer = dzl_shortcut_controller_find (outer_box);
+  chain = _dzl_shortcut_controller_get_chain (root, label);
+  g_assert_cmpint (chain->len, ==, 3);
+  g_assert (g_ptr_array_index (chain, 0) == inner);
+  g_assert (g_ptr_array_index (chain, 1) == outer);
+  g_assert (g_ptr_array_index (chain, 2) == root);
+  g_ptr_array_unref (chain);
+
+  /* So is moving the widget within the hierarchy */
+  g_object_ref (label);
+  gtk_container_remove (GTK_CONTAINER (inner_box), label);
+  gtk_container_add (GTK_CONTAINER (outer_box), label);
+  g_object_unref (label);
+
+  chain = _dzl_shortcut_controller_get_chain (root, label);
+  g_assert_cmpint (chain->len, ==, 2);
+  g_assert (g_ptr_array_index (chain, 0) == outer);
+  g_assert (g_ptr_array_index (chain, 1) == root);
+  g_ptr_array_unref (chain);
+
+  /* And a different focus widget */
+  chain = _dzl_shortcut_controller_get_chain (root, inner_box);
+  g_assert_cmpint (chain->len, ==, 3);
+  g_assert (g_ptr_array_index (chain, 0) == inner);
+  g_ptr_array_unref (chain);
+
+  gtk_widget_destroy (window);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
 {
+  g_autofree gchar *cache_dir = NULL;
+  gint ret;
+
+  /* Keep the keytheme caches out of the user's cache directory */
+  cache_dir = g_dir_make_tmp ("test-shortcut-theme-cache-XXXXXX", NULL);
+  g_assert_nonnull (cache_dir);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
   gtk_init (&argc, &argv);
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/Dazzle/ShortcutTheme/basic", test_shortcut_theme_basic);
+  g_test_add_func ("/Dazzle/ShortcutTheme/compiled", test_shortcut_theme_compiled);
+  g_test_add_func ("/Dazzle/ShortcutTheme/manager-cache", test_shortcut_theme_manager_cache);
   g_test_add_func ("/Dazzle/ShortcutTheme/manager", test_shortcut_theme_manager);
-  return g_test_run ();
+  g_test_add_func ("/Dazzle/ShortcutTheme/chain", test_shortcut_controller_chain);
+  ret = g_test_run ();
+
+  remove_tree (cache_dir);
+
+  return ret;
 }
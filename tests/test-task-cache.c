@@ -1,4 +1,5 @@
 #include <dazzle.h>
+#include <string.h>
 
 static GMainLoop *main_loop;
 static DzlTaskCache *cache;
@@ -110,6 +111,429 @@ test_task_cache_raw_value (void)
   g_main_loop_unref (main_loop);
 }
 
+#define N_THREADS 8
+#define N_KEYS    64
+
+static gint n_populated;
+
+static void
+populate_callback_threaded (DzlTaskCache  *self,
+                            gconstpointer  key,
+                            GTask         *task,
+                            gpointer       user_data)
+{
+  g_atomic_int_inc (&n_populated);
+  g_task_return_pointer (task, g_strdup_printf ("value-%s", (const gchar *)key), g_free);
+}
+
+static void
+get_threaded_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  guint *n_active = user_data;
+  g_autofree gchar *ret = NULL;
+  GError *error = NULL;
+
+  ret = dzl_task_cache_get_finish (DZL_TASK_CACHE (object), result, &error);
+  g_assert_no_error (error);
+  g_assert (g_str_has_prefix (ret, "value-"));
+
+  (*n_active)--;
+}
+
+static gpointer
+threaded_worker (gpointer data)
+{
+  DzlTaskCache *threaded_cache = data;
+  GMainContext *context = g_main_context_new ();
+  guint n_active = 0;
+
+  g_main_context_push_thread_default (context);
+
+  for (guint i = 0; i < N_KEYS; i++)
+    {
+      g_autofree gchar *key = g_strdup_printf ("%u", i);
+
+      n_active++;
+      dzl_task_cache_get_async (threaded_cache, key, FALSE, NULL, get_threaded_cb, &n_active);
+    }
+
+  while (n_active > 0)
+    g_main_context_iteration (context, TRUE);
+
+  for (guint i = 0; i < N_KEYS; i++)
+    {
+      g_autofree gchar *key = g_strdup_printf ("%u", i);
+      g_autofree gchar *expected = g_strdup_printf ("value-%u", i);
+      g_autofree gchar *value = dzl_task_cache_lookup (threaded_cache, key);
+
+      g_assert_cmpstr (value, ==, expected);
+    }
+
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+
+  return NULL;
+}
+
+static void
+test_task_cache_thread_safe (void)
+{
+  g_autoptr(DzlTaskCache) threaded_cache = NULL;
+  g_autoptr(GPtrArray) values = NULL;
+  GThread *threads[N_THREADS];
+
+  threaded_cache = g_object_new (DZL_TYPE_TASK_CACHE,
+                                 "key-hash-func", g_str_hash,
+                                 "key-equal-func", g_str_equal,
+                                 "key-copy-func", g_strdup,
+                                 "key-destroy-func", g_free,
+                                 "value-copy-func", g_strdup,
+                                 "value-destroy-func", g_free,
+                                 "populate-callback", populate_callback_threaded,
+                                 "time-to-live", (gint64)0,
+                                 "thread-safe", TRUE,
+                                 NULL);
+
+  for (guint i = 0; i < N_THREADS; i++)
+    threads[i] = g_thread_new ("test-task-cache", threaded_worker, threaded_cache);
+
+  for (guint i = 0; i < N_THREADS; i++)
+    g_thread_join (threads[i]);
+
+  /* Concurrent requests for the same key must share a single populate */
+  g_assert_cmpint (n_populated, ==, N_KEYS);
+
+  values = dzl_task_cache_get_values (threaded_cache);
+  g_assert_cmpint (values->len, ==, N_KEYS);
+
+  g_assert_true (dzl_task_cache_evict (threaded_cache, "0"));
+  g_assert_null (dzl_task_cache_lookup (threaded_cache, "0"));
+
+  dzl_task_cache_evict_all (threaded_cache);
+  g_assert_null (dzl_task_cache_lookup (threaded_cache, "1"));
+}
+
+static void
+populate_callback_echo (DzlTaskCache  *self,
+                        gconstpointer  key,
+                        GTask         *task,
+                        gpointer       user_data)
+{
+  g_task_return_pointer (task, g_strdup (key), g_free);
+}
+
+static gsize
+strlen_cost_func (gconstpointer value)
+{
+  return strlen (value);
+}
+
+static void
+store_result_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **ret = user_data;
+
+  *ret = g_object_ref (result);
+}
+
+static gchar *
+cache_get_sync_full (DzlTaskCache  *self,
+                     const gchar   *key,
+                     GError       **error)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+
+  dzl_task_cache_get_async (self, key, FALSE, NULL, store_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  return dzl_task_cache_get_finish (self, result, error);
+}
+
+static gchar *
+cache_get_sync (DzlTaskCache *self,
+                const gchar  *key)
+{
+  GError *error = NULL;
+  gchar *ret;
+
+  ret = cache_get_sync_full (self, key, &error);
+  g_assert_no_error (error);
+
+  return ret;
+}
+
+#ifndef G_OS_WIN32
+static void
+find_counter_cb (DzlCounter *counter,
+                 gpointer    user_data)
+{
+  gpointer *pair = user_data;
+
+  if (g_strcmp0 (counter->category, "TaskCache") == 0 &&
+      g_strcmp0 (counter->name, pair[0]) == 0)
+    pair[1] = counter;
+}
+
+static DzlCounter *
+find_counter (const gchar *name)
+{
+  gpointer pair[2] = { (gpointer)name, NULL };
+
+  dzl_counter_arena_foreach (dzl_counter_arena_get_default (), find_counter_cb, pair);
+
+  return pair[1];
+}
+
+static gint64
+get_counter (const gchar *name)
+{
+  DzlCounter *counter = find_counter (name);
+
+  g_assert_nonnull (counter);
+
+  return dzl_counter_get (counter);
+}
+#endif
+
+static void
+test_task_cache_max_cost (void)
+{
+  g_autoptr(DzlTaskCache) lru_cache = NULL;
+  g_autofree gchar *a = NULL;
+  g_autofree gchar *b = NULL;
+  g_autofree gchar *c = NULL;
+  g_autofree gchar *d = NULL;
+  g_autofree gchar *b2 = NULL;
+
+  lru_cache = g_object_new (DZL_TYPE_TASK_CACHE,
+                            "key-hash-func", g_str_hash,
+                            "key-equal-func", g_str_equal,
+                            "key-copy-func", g_strdup,
+                            "key-destroy-func", g_free,
+                            "value-copy-func", g_strdup,
+                            "value-destroy-func", g_free,
+                            "value-cost-func", strlen_cost_func,
+                            "populate-callback", populate_callback_echo,
+                            "time-to-live", (gint64)0,
+                            "max-cost", (guint64)10,
+                            NULL);
+  dzl_task_cache_set_name (lru_cache, "lru");
+
+#ifndef G_OS_WIN32
+  /* Counters are only registered once the cache is used */
+  g_assert_null (find_counter ("lru Hits"));
+#endif
+
+  /* "aaaa" is evicted to make room for "cccc" */
+  a = cache_get_sync (lru_cache, "aaaa");
+  b = cache_get_sync (lru_cache, "bbbb");
+  c = cache_get_sync (lru_cache, "cccc");
+  g_assert_null (dzl_task_cache_peek (lru_cache, "aaaa"));
+
+  /* Touching "bbbb" makes "cccc" the least recently used */
+  b2 = cache_get_sync (lru_cache, "bbbb");
+  g_assert_cmpstr (b2, ==, "bbbb");
+  d = cache_get_sync (lru_cache, "dddd");
+
+  g_assert_null (dzl_task_cache_peek (lru_cache, "cccc"));
+  g_assert_cmpstr (dzl_task_cache_peek (lru_cache, "bbbb"), ==, "bbbb");
+  g_assert_cmpstr (dzl_task_cache_peek (lru_cache, "dddd"), ==, "dddd");
+
+  /* An item over the limit by itself is still cached */
+  g_clear_pointer (&a, g_free);
+  a = cache_get_sync (lru_cache, "aaaaaaaaaaaa");
+  g_assert_cmpstr (dzl_task_cache_peek (lru_cache, "aaaaaaaaaaaa"), ==, a);
+  g_assert_null (dzl_task_cache_peek (lru_cache, "bbbb"));
+  g_assert_null (dzl_task_cache_peek (lru_cache, "dddd"));
+
+#ifndef G_OS_WIN32
+  g_assert_cmpint (get_counter ("lru Hits"), ==, 1);
+  g_assert_cmpint (get_counter ("lru Misses"), ==, 5);
+  g_assert_cmpint (get_counter ("lru Evictions"), ==, 4);
+  g_assert_cmpint (get_counter ("lru Cost"), ==, 12);
+
+  /* The counters go away with the cache */
+  g_clear_object (&lru_cache);
+  g_assert_null (find_counter ("lru Hits"));
+#endif
+}
+
+static gint n_failures;
+
+static void
+populate_callback_fail (DzlTaskCache  *self,
+                        gconstpointer  key,
+                        GTask         *task,
+                        gpointer       user_data)
+{
+  n_failures++;
+  g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "%s not found", (const gchar *)key);
+}
+
+static void
+test_task_cache_error_time_to_live (void)
+{
+  g_autoptr(DzlTaskCache) error_cache = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *ret = NULL;
+
+  error_cache = g_object_new (DZL_TYPE_TASK_CACHE,
+                              "key-hash-func", g_str_hash,
+                              "key-equal-func", g_str_equal,
+                              "key-copy-func", g_strdup,
+                              "key-destroy-func", g_free,
+                              "value-copy-func", g_strdup,
+                              "value-destroy-func", g_free,
+                              "populate-callback", populate_callback_fail,
+                              "time-to-live", (gint64)0,
+                              "error-time-to-live", (gint64)60000,
+                              NULL);
+
+  ret = cache_get_sync_full (error_cache, "foo", &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_null (ret);
+  g_clear_error (&error);
+
+  /* The second request is answered from the cached error */
+  ret = cache_get_sync_full (error_cache, "foo", &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_null (ret);
+  g_clear_error (&error);
+  g_assert_cmpint (n_failures, ==, 1);
+
+  /* Errors are not values */
+  g_assert_null (dzl_task_cache_peek (error_cache, "foo"));
+  g_assert_null (dzl_task_cache_lookup (error_cache, "foo"));
+
+  g_assert_true (dzl_task_cache_evict (error_cache, "foo"));
+  ret = cache_get_sync_full (error_cache, "foo", &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_cmpint (n_failures, ==, 2);
+}
+
+static gint n_refreshes;
+
+static void
+populate_callback_counter (DzlTaskCache  *self,
+                           gconstpointer  key,
+                           GTask         *task,
+                           gpointer       user_data)
+{
+  g_task_return_pointer (task, g_strdup_printf ("%s-%d", (const gchar *)key, ++n_refreshes), g_free);
+}
+
+static void
+test_task_cache_stale_while_revalidate (void)
+{
+  g_autoptr(DzlTaskCache) stale_cache = NULL;
+  g_autoptr(GAsyncResult) result1 = NULL;
+  g_autoptr(GAsyncResult) result2 = NULL;
+  g_autofree gchar *first = NULL;
+  g_autofree gchar *stale1 = NULL;
+  g_autofree gchar *stale2 = NULL;
+  g_autofree gchar *fresh = NULL;
+
+  stale_cache = g_object_new (DZL_TYPE_TASK_CACHE,
+                              "key-hash-func", g_str_hash,
+                              "key-equal-func", g_str_equal,
+                              "key-copy-func", g_strdup,
+                              "key-destroy-func", g_free,
+                              "value-copy-func", g_strdup,
+                              "value-destroy-func", g_free,
+                              "populate-callback", populate_callback_counter,
+                              "time-to-live", (gint64)10,
+                              "stale-while-revalidate", (gint64)60000,
+                              NULL);
+
+  first = cache_get_sync (stale_cache, "foo");
+  g_assert_cmpstr (first, ==, "foo-1");
+
+  g_usleep (20 * G_TIME_SPAN_MILLISECOND);
+
+  /* Both requests get the stale value, but only one refresh is started */
+  dzl_task_cache_get_async (stale_cache, "foo", FALSE, NULL, store_result_cb, &result1);
+  dzl_task_cache_get_async (stale_cache, "foo", FALSE, NULL, store_result_cb, &result2);
+  g_assert_cmpint (n_refreshes, ==, 2);
+
+  while (result1 == NULL || result2 == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  stale1 = dzl_task_cache_get_finish (stale_cache, result1, NULL);
+  stale2 = dzl_task_cache_get_finish (stale_cache, result2, NULL);
+  g_assert_cmpstr (stale1, ==, "foo-1");
+  g_assert_cmpstr (stale2, ==, "foo-1");
+
+  while (g_strcmp0 (dzl_task_cache_peek (stale_cache, "foo"), "foo-2") != 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  fresh = cache_get_sync (stale_cache, "foo");
+  g_assert_cmpstr (fresh, ==, "foo-2");
+  g_assert_cmpint (n_refreshes, ==, 2);
+}
+
+static gboolean refresh_fails;
+static gint n_attempts;
+
+static void
+populate_callback_flaky (DzlTaskCache  *self,
+                         gconstpointer  key,
+                         GTask         *task,
+                         gpointer       user_data)
+{
+  n_attempts++;
+
+  if (refresh_fails)
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "%s failed", (const gchar *)key);
+  else
+    g_task_return_pointer (task, g_strdup (key), g_free);
+}
+
+static void
+test_task_cache_stale_refresh_error (void)
+{
+  g_autoptr(DzlTaskCache) stale_cache = NULL;
+
+  stale_cache = g_object_new (DZL_TYPE_TASK_CACHE,
+                              "key-hash-func", g_str_hash,
+                              "key-equal-func", g_str_equal,
+                              "key-copy-func", g_strdup,
+                              "key-destroy-func", g_free,
+                              "value-copy-func", g_strdup,
+                              "value-destroy-func", g_free,
+                              "populate-callback", populate_callback_flaky,
+                              "time-to-live", (gint64)10,
+                              "stale-while-revalidate", (gint64)60000,
+                              "error-time-to-live", (gint64)60000,
+                              NULL);
+
+  g_free (cache_get_sync (stale_cache, "foo"));
+  g_assert_cmpint (n_attempts, ==, 1);
+
+  g_usleep (20 * G_TIME_SPAN_MILLISECOND);
+  refresh_fails = TRUE;
+
+  /* The stale value is served and a refresh started, which fails */
+  for (guint i = 0; i < 3; i++)
+    {
+      g_autofree gchar *stale = cache_get_sync (stale_cache, "foo");
+
+      g_assert_cmpstr (stale, ==, "foo");
+
+      while (g_main_context_iteration (NULL, FALSE))
+        ;
+    }
+
+  /* The failure is not retried within the error-time-to-live */
+  g_assert_cmpint (n_attempts, ==, 2);
+  g_assert_cmpstr (dzl_task_cache_peek (stale_cache, "foo"), ==, "foo");
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
@@ -117,5 +541,10 @@ main (gint   argc,
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/Dazzle/TaskCache/basic", test_task_cache);
   g_test_add_func ("/Dazzle/TaskCache/raw-value", test_task_cache_raw_value);
+  g_test_add_func ("/Dazzle/TaskCache/thread-safe", test_task_cache_thread_safe);
+  g_test_add_func ("/Dazzle/TaskCache/max-cost", test_task_cache_max_cost);
+  g_test_add_func ("/Dazzle/TaskCache/error-time-to-live", test_task_cache_error_time_to_live);
+  g_test_add_func ("/Dazzle/TaskCache/stale-while-revalidate", test_task_cache_stale_while_revalidate);
+  g_test_add_func ("/Dazzle/TaskCache/stale-refresh-error", test_task_cache_stale_refresh_error);
   return g_test_run ();
 }
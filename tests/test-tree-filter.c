@@ -0,0 +1,293 @@
+/* test-tree-filter.c
+ *
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <dazzle.h>
+
+#define TREE_DEPTH 3
+
+static gboolean have_display;
+
+/*
+ * Builds two children for every node above TREE_DEPTH, named after their
+ * position such as "1:0:1". Only the children of the top level rows are
+ * built up front, the rest when expanded or built for the filter.
+ */
+static void
+build_children_cb (DzlTreeBuilder *builder,
+                   DzlTreeNode    *node,
+                   GHashTable     *nodes)
+{
+  const gchar *text = dzl_tree_node_get_text (node);
+  guint depth = 0;
+
+  if (text != NULL)
+    {
+      depth = 1;
+      for (const gchar *c = text; *c; c++)
+        depth += *c == ':';
+    }
+
+  if (depth >= TREE_DEPTH)
+    return;
+
+  for (guint i = 0; i < 2; i++)
+    {
+      g_autofree gchar *child_text = NULL;
+      DzlTreeNode *child;
+
+      if (text != NULL)
+        child_text = g_strdup_printf ("%s:%u", text, i);
+      else
+        child_text = g_strdup_printf ("%u", i);
+
+      child = dzl_tree_node_new ();
+      dzl_tree_node_set_text (child, child_text);
+      dzl_tree_node_set_children_possible (child, depth + 1 < TREE_DEPTH);
+      g_hash_table_insert (nodes, g_steal_pointer (&child_text), g_object_ref (child));
+      dzl_tree_node_append (node, child);
+    }
+}
+
+static gboolean
+filter_func (DzlTree     *tree,
+             DzlTreeNode *node,
+             gpointer     user_data)
+{
+  const gchar * const *needle = user_data;
+
+  return g_strcmp0 (dzl_tree_node_get_text (node), *needle) == 0;
+}
+
+static DzlTree *
+create_tree (GHashTable *nodes,
+             gboolean    builds_children)
+{
+  g_autoptr(DzlTreeBuilder) builder = dzl_tree_builder_new ();
+  DzlTree *tree;
+
+  tree = g_object_ref_sink (g_object_new (DZL_TYPE_TREE,
+                                          "filter-builds-children", builds_children,
+                                          NULL));
+  g_signal_connect (builder, "build-children", G_CALLBACK (build_children_cb), nodes);
+  dzl_tree_add_builder (tree, builder);
+  dzl_tree_set_root (tree, dzl_tree_node_new ());
+
+  return tree;
+}
+
+static void
+destroy_tree (DzlTree *tree)
+{
+  gtk_widget_destroy (GTK_WIDGET (tree));
+  g_object_unref (tree);
+}
+
+static gboolean
+is_visible (DzlTree     *tree,
+            DzlTreeNode *node)
+{
+  GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW (tree));
+  GtkTreeIter child_iter;
+  GtkTreeIter iter;
+
+  g_assert_true (GTK_IS_TREE_MODEL_FILTER (model));
+
+  if (!dzl_tree_node_get_iter (node, &child_iter))
+    return FALSE;
+
+  return gtk_tree_model_filter_convert_child_iter_to_iter (GTK_TREE_MODEL_FILTER (model),
+                                                           &iter, &child_iter);
+}
+
+static void
+assert_visible (DzlTree     *tree,
+                GHashTable  *nodes,
+                const gchar *text,
+                gboolean     visible)
+{
+  DzlTreeNode *node = g_hash_table_lookup (nodes, text);
+
+  g_assert_nonnull (node);
+  g_assert_cmpint (is_visible (tree, node), ==, visible);
+}
+
+static void
+iterate_main_loop (void)
+{
+  for (guint i = 0; i < 10000 && g_main_context_iteration (NULL, FALSE); i++)
+    { /* Do Nothing */ }
+}
+
+static void
+test_tree_filter_ancestors (void)
+{
+  g_autoptr(GHashTable) nodes = NULL;
+  g_autoptr(DzlTreeNode) needle = NULL;
+  const gchar *criteria = "needle";
+  DzlTree *tree;
+
+  if (!have_display)
+    {
+      g_test_skip ("No display");
+      return;
+    }
+
+  nodes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  tree = create_tree (nodes, FALSE);
+  dzl_tree_set_filter (tree, filter_func, &criteria, NULL);
+
+  assert_visible (tree, nodes, "0", FALSE);
+  assert_visible (tree, nodes, "1", FALSE);
+
+  /* A matching row deep in the tree makes its ancestors visible */
+  needle = g_object_ref_sink (dzl_tree_node_new ());
+  dzl_tree_node_set_text (needle, "needle");
+  dzl_tree_node_append (g_hash_table_lookup (nodes, "1:0"), needle);
+
+  g_assert_true (is_visible (tree, needle));
+  assert_visible (tree, nodes, "1", TRUE);
+  assert_visible (tree, nodes, "1:0", TRUE);
+  assert_visible (tree, nodes, "1:1", FALSE);
+  assert_visible (tree, nodes, "0", FALSE);
+
+  /* And hides them again once it is removed */
+  dzl_tree_node_remove (g_hash_table_lookup (nodes, "1:0"), needle);
+
+  assert_visible (tree, nodes, "1", FALSE);
+  assert_visible (tree, nodes, "0", FALSE);
+
+  /* New criteria are picked up by a refilter */
+  criteria = "0:1";
+  dzl_tree_refilter (tree);
+
+  assert_visible (tree, nodes, "0", TRUE);
+  assert_visible (tree, nodes, "0:1", TRUE);
+  assert_visible (tree, nodes, "0:0", FALSE);
+  assert_visible (tree, nodes, "1", FALSE);
+
+  destroy_tree (tree);
+}
+
+static void
+stop_row_inserted (GtkTreeModel *model,
+                   GtkTreePath  *path,
+                   GtkTreeIter  *iter,
+                   guint        *n_stopped)
+{
+  if (*n_stopped == 0)
+    {
+      g_signal_stop_emission_by_name (model, "row-inserted");
+      (*n_stopped)++;
+    }
+}
+
+static void
+test_tree_filter_stop_emission (void)
+{
+  g_autoptr(GHashTable) nodes = NULL;
+  g_autoptr(DzlTreeNode) needle = NULL;
+  g_autoptr(DzlTreeNode) second = NULL;
+  const gchar *criteria = "needle";
+  GtkTreeModel *store;
+  DzlTree *tree;
+  guint n_stopped = 0;
+
+  if (!have_display)
+    {
+      g_test_skip ("No display");
+      return;
+    }
+
+  nodes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  tree = create_tree (nodes, FALSE);
+  dzl_tree_set_filter (tree, filter_func, &criteria, NULL);
+
+  store = gtk_tree_model_filter_get_model (GTK_TREE_MODEL_FILTER (gtk_tree_view_get_model (GTK_TREE_VIEW (tree))));
+  g_signal_connect (store, "row-inserted", G_CALLBACK (stop_row_inserted), &n_stopped);
+
+  /* The after handler never runs for this insertion */
+  needle = g_object_ref_sink (dzl_tree_node_new ());
+  dzl_tree_node_set_text (needle, "needle");
+  dzl_tree_node_append (g_hash_table_lookup (nodes, "1:0"), needle);
+  g_assert_cmpint (n_stopped, ==, 1);
+
+  /* The next change must not pick up the stale ancestor updates */
+  second = g_object_ref_sink (dzl_tree_node_new ());
+  dzl_tree_node_set_text (second, "needle");
+  dzl_tree_node_append (g_hash_table_lookup (nodes, "0:1"), second);
+
+  assert_visible (tree, nodes, "0", TRUE);
+  assert_visible (tree, nodes, "0:1", TRUE);
+  assert_visible (tree, nodes, "0:0", FALSE);
+
+  /* The stopped update is flushed once the main loop runs */
+  iterate_main_loop ();
+
+  assert_visible (tree, nodes, "1", TRUE);
+  assert_visible (tree, nodes, "1:0", TRUE);
+  assert_visible (tree, nodes, "1:1", FALSE);
+
+  destroy_tree (tree);
+}
+
+static void
+test_tree_filter_builds_children (void)
+{
+  g_autoptr(GHashTable) nodes = NULL;
+  const gchar *criteria = "1:1:0";
+  DzlTree *tree;
+
+  if (!have_display)
+    {
+      g_test_skip ("No display");
+      return;
+    }
+
+  nodes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  tree = create_tree (nodes, TRUE);
+  dzl_tree_set_filter (tree, filter_func, &criteria, NULL);
+
+  /* Nothing below the second level has been built yet */
+  g_assert_null (g_hash_table_lookup (nodes, "1:1:0"));
+  assert_visible (tree, nodes, "1", FALSE);
+
+  iterate_main_loop ();
+
+  assert_visible (tree, nodes, "1", TRUE);
+  assert_visible (tree, nodes, "1:1", TRUE);
+  assert_visible (tree, nodes, "1:1:0", TRUE);
+  assert_visible (tree, nodes, "1:1:1", FALSE);
+  assert_visible (tree, nodes, "1:0", FALSE);
+  assert_visible (tree, nodes, "0", FALSE);
+
+  destroy_tree (tree);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  have_display = gtk_init_check (&argc, &argv);
+  g_test_add_func ("/Dazzle/Tree/Filter/ancestors", test_tree_filter_ancestors);
+  g_test_add_func ("/Dazzle/Tree/Filter/stop-emission", test_tree_filter_stop_emission);
+  g_test_add_func ("/Dazzle/Tree/Filter/builds-children", test_tree_filter_builds_children);
+  return g_test_run ();
+}
@@ -0,0 +1,252 @@
+/* test-tree-index.c
+ *
+ * Copyright 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <dazzle.h>
+
+#define TREE_DEPTH 3
+
+static gboolean have_display;
+
+/*
+ * Builds two children for every file node above TREE_DEPTH, named
+ * "<index><suffix>", and a child holding a plain GObject so that the
+ * tree mixes item types.
+ */
+static void
+build_children_cb (DzlTreeBuilder  *builder,
+                   DzlTreeNode     *node,
+                   const gchar    **suffix)
+{
+  g_autoptr(DzlTreeNode) other = NULL;
+  g_autoptr(GObject) other_item = NULL;
+  g_autofree gchar *path = NULL;
+  GObject *item = dzl_tree_node_get_item (node);
+  guint depth = 0;
+
+  if (!G_IS_FILE (item))
+    return;
+
+  path = g_file_get_path (G_FILE (item));
+  for (const gchar *c = path + 1; *c; c++)
+    depth += *c == '/';
+
+  if (depth >= TREE_DEPTH)
+    return;
+
+  for (guint i = 0; i < 2; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("%u%s", i, *suffix);
+      g_autoptr(GFile) file = g_file_get_child (G_FILE (item), name);
+      DzlTreeNode *child = dzl_tree_node_new ();
+
+      dzl_tree_node_set_item (child, G_OBJECT (file));
+      dzl_tree_node_set_text (child, name);
+      dzl_tree_node_set_children_possible (child, depth + 1 < TREE_DEPTH);
+      dzl_tree_node_set_reset_on_collapse (child, TRUE);
+      dzl_tree_node_append (node, child);
+    }
+
+  other_item = g_object_new (G_TYPE_OBJECT, NULL);
+  other = g_object_ref_sink (dzl_tree_node_new ());
+  dzl_tree_node_set_item (other, other_item);
+  dzl_tree_node_append (node, other);
+}
+
+static DzlTreeNode *
+create_root (const gchar *path)
+{
+  g_autoptr(GFile) file = g_file_new_for_path (path);
+  DzlTreeNode *root = dzl_tree_node_new ();
+
+  dzl_tree_node_set_item (root, G_OBJECT (file));
+
+  return root;
+}
+
+static DzlTreeNode *
+find_path (DzlTree     *tree,
+           const gchar *path)
+{
+  g_autoptr(GFile) file = g_file_new_for_path (path);
+
+  return dzl_tree_find_custom (tree, (GEqualFunc)g_file_equal, file);
+}
+
+static gboolean
+check_index_cb (GtkTreeModel *model,
+                GtkTreePath  *path,
+                GtkTreeIter  *iter,
+                gpointer      user_data)
+{
+  g_autoptr(DzlTreeNode) node = NULL;
+  DzlTree *tree = user_data;
+  GObject *item;
+
+  gtk_tree_model_get (model, iter, 0, &node, -1);
+
+  /* Every node in the store can be found, whether indexed or not */
+  if (node != NULL && (item = dzl_tree_node_get_item (node)))
+    {
+      g_assert_true (dzl_tree_find_item (tree, item) == node);
+
+      if (G_IS_FILE (item))
+        g_assert_true (dzl_tree_find_custom (tree, (GEqualFunc)g_file_equal, item) == node);
+    }
+
+  return FALSE;
+}
+
+static void
+check_index (DzlTree *tree)
+{
+  GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW (tree));
+
+  gtk_tree_model_foreach (model, check_index_cb, tree);
+}
+
+static void
+assert_found (DzlTree     *tree,
+              const gchar *path,
+              gboolean     found)
+{
+  DzlTreeNode *node = find_path (tree, path);
+  GtkTreeIter iter;
+
+  if (found)
+    {
+      g_assert_nonnull (node);
+      g_assert_true (dzl_tree_node_get_iter (node, &iter));
+    }
+  else
+    {
+      g_assert_null (node);
+    }
+
+  check_index (tree);
+}
+
+static void
+test_tree_index (void)
+{
+  g_autoptr(DzlTreeBuilder) builder = NULL;
+  g_autoptr(DzlTreeNode) added = NULL;
+  g_autoptr(GFile) renamed = NULL;
+  g_autoptr(GObject) other = NULL;
+  const gchar *suffix = "";
+  DzlTreeNode *root;
+  DzlTreeNode *node;
+  DzlTree *tree;
+
+  if (!have_display)
+    {
+      g_test_skip ("No display");
+      return;
+    }
+
+  tree = g_object_ref_sink (g_object_new (DZL_TYPE_TREE, NULL));
+  builder = dzl_tree_builder_new ();
+  g_signal_connect (builder, "build-children", G_CALLBACK (build_children_cb), &suffix);
+  dzl_tree_add_builder (tree, builder);
+  dzl_tree_set_root (tree, create_root ("/r"));
+  root = dzl_tree_get_root (tree);
+
+  /* Enabling the index picks up the existing nodes */
+  dzl_tree_set_index_funcs (tree, G_TYPE_FILE, g_file_hash, (GEqualFunc)g_file_equal);
+  assert_found (tree, "/r/0", TRUE);
+  assert_found (tree, "/r/1/0", TRUE);
+  assert_found (tree, "/r/1/0/0", FALSE);
+
+  /* Insert */
+  added = g_object_ref_sink (create_root ("/r/added"));
+  dzl_tree_node_append (root, added);
+  assert_found (tree, "/r/added", TRUE);
+
+  /* Set the item of a node in the tree, to another file or another type */
+  renamed = g_file_new_for_path ("/r/renamed");
+  dzl_tree_node_set_item (added, G_OBJECT (renamed));
+  assert_found (tree, "/r/added", FALSE);
+  assert_found (tree, "/r/renamed", TRUE);
+
+  other = g_object_new (G_TYPE_OBJECT, NULL);
+  dzl_tree_node_set_item (added, other);
+  assert_found (tree, "/r/renamed", FALSE);
+  g_assert_true (dzl_tree_find_item (tree, other) == added);
+
+  dzl_tree_node_set_item (added, G_OBJECT (renamed));
+  assert_found (tree, "/r/renamed", TRUE);
+
+  /* Remove */
+  dzl_tree_node_remove (root, added);
+  assert_found (tree, "/r/renamed", FALSE);
+  g_assert_null (dzl_tree_find_item (tree, G_OBJECT (renamed)));
+
+  /* Invalidate rebuilds the children with new items */
+  suffix = "b";
+  dzl_tree_node_invalidate (find_path (tree, "/r/0"));
+  assert_found (tree, "/r/0/0", FALSE);
+  assert_found (tree, "/r/0/0b", TRUE);
+  assert_found (tree, "/r/1/0", TRUE);
+
+  /* Expanding builds the children, collapsing with reset-on-collapse drops them */
+  node = find_path (tree, "/r/0/0b");
+  g_assert_true (dzl_tree_node_get_reset_on_collapse (node));
+  dzl_tree_node_expand (node, TRUE);
+  assert_found (tree, "/r/0/0b/0b", TRUE);
+
+  suffix = "c";
+  dzl_tree_node_collapse (node);
+  assert_found (tree, "/r/0/0b/0b", FALSE);
+  assert_found (tree, "/r/0/0b", TRUE);
+
+  /* Rebuild */
+  suffix = "d";
+  dzl_tree_rebuild (tree);
+  assert_found (tree, "/r/0", FALSE);
+  assert_found (tree, "/r/0/0b", FALSE);
+  assert_found (tree, "/r/0d", TRUE);
+  assert_found (tree, "/r/1d/1d", TRUE);
+
+  /* A new root replaces every node */
+  dzl_tree_set_root (tree, create_root ("/s"));
+  assert_found (tree, "/r/0d", FALSE);
+  assert_found (tree, "/s/0d", TRUE);
+  assert_found (tree, "/s/0d/1d", TRUE);
+
+  /*
+   * Dropping the index falls back to walking the tree. Only identity
+   * lookups are safe then, g_file_equal() would see the other items.
+   */
+  node = find_path (tree, "/s/0d");
+  dzl_tree_set_index_funcs (tree, G_TYPE_OBJECT, NULL, NULL);
+  g_assert_true (dzl_tree_find_item (tree, dzl_tree_node_get_item (node)) == node);
+
+  gtk_widget_destroy (GTK_WIDGET (tree));
+  g_object_unref (tree);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  have_display = gtk_init_check (&argc, &argv);
+  g_test_add_func ("/Dazzle/Tree/Index/lookups", test_tree_index);
+  return g_test_run ();
+}
@@ -18,23 +18,41 @@
 
 #include <dazzle.h>
 #include <errno.h>
+#include <glib-unix.h>
+#include <signal.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+typedef struct
+{
+  DzlCounterArena *arena;
+  guint            n_counters;
+} ListCounters;
+
 static void
 foreach_cb (DzlCounter *counter,
             gpointer    user_data)
 {
-  guint *n_counters = user_data;
+  ListCounters *list = user_data;
+  DzlCounterHistogram *histogram;
 
-  (*n_counters)++;
+  list->n_counters++;
 
   g_print ("%-20s : %-32s : %20"G_GINT64_FORMAT" : %-s\n",
            counter->category,
            counter->name,
            dzl_counter_get (counter),
            counter->description);
+
+  if ((histogram = dzl_counter_arena_get_histogram (list->arena, counter)))
+    g_print ("%-20s : %-32s : %20"G_GINT64_FORMAT" : "
+             "p50 %"G_GINT64_FORMAT"  p90 %"G_GINT64_FORMAT"  p99 %"G_GINT64_FORMAT"\n",
+             "", "  (count)",
+             dzl_counter_histogram_get_count (histogram),
+             dzl_counter_histogram_get_percentile (histogram, 50.0),
+             dzl_counter_histogram_get_percentile (histogram, 90.0),
+             dzl_counter_histogram_get_percentile (histogram, 99.0));
 }
 
 static gboolean
@@ -61,17 +79,148 @@ int_parse_with_range (gint        *value,
   return TRUE;
 }
 
+static gboolean
+record_counters (DzlCounterArena *arena,
+                 const gchar     *path,
+                 guint            interval)
+{
+  g_autoptr(GFile) file = g_file_new_for_commandline_arg (path);
+  g_autoptr(GFileOutputStream) stream = NULL;
+  g_autoptr(DzlCounterSampler) sampler = NULL;
+  g_autoptr(GMainLoop) main_loop = NULL;
+  g_autoptr(GError) error = NULL;
+
+  if (!(stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error)))
+    {
+      fprintf (stderr, "Failed to open %s: %s\n", path, error->message);
+      return FALSE;
+    }
+
+  sampler = dzl_counter_sampler_new (arena, G_OUTPUT_STREAM (stream));
+  dzl_counter_sampler_set_interval (sampler, interval);
+
+  if (!dzl_counter_sampler_sample (sampler, &error))
+    {
+      fprintf (stderr, "Failed to write %s: %s\n", path, error->message);
+      return FALSE;
+    }
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_unix_signal_add (SIGINT, (GSourceFunc)g_main_loop_quit, main_loop);
+  g_unix_signal_add (SIGTERM, (GSourceFunc)g_main_loop_quit, main_loop);
+
+  fprintf (stderr, "Recording counters every %u msec to %s, press Ctrl+C to stop.\n",
+           interval, path);
+
+  dzl_counter_sampler_start (sampler);
+  g_main_loop_run (main_loop);
+  dzl_counter_sampler_stop (sampler);
+
+  /* Record the final values too */
+  if (!dzl_counter_sampler_sample (sampler, &error) ||
+      !g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error))
+    {
+      fprintf (stderr, "Failed to write %s: %s\n", path, error->message);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+replay_counters (const gchar *path)
+{
+  g_autoptr(GFile) file = g_file_new_for_commandline_arg (path);
+  g_autoptr(DzlCounterLog) log = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_samples;
+  guint n_counters;
+
+  if (!(log = dzl_counter_log_new_for_file (file, NULL, &error)))
+    {
+      fprintf (stderr, "Failed to load %s: %s\n", path, error->message);
+      return FALSE;
+    }
+
+  n_samples = dzl_counter_log_get_n_samples (log);
+  n_counters = dzl_counter_log_get_n_counters (log);
+
+  /* Print the counters which changed in every sample, and how fast */
+  for (guint i = 1; i < n_samples; i++)
+    {
+      g_autoptr(GDateTime) dt = NULL;
+      g_autofree gchar *str = NULL;
+
+      dt = g_date_time_new_from_unix_local (dzl_counter_log_get_sample_time (log, i) / G_USEC_PER_SEC);
+      str = g_date_time_format (dt, "%F %T");
+
+      g_print ("%s\n", str);
+
+      for (guint j = 0; j < n_counters; j++)
+        {
+          gint64 value = dzl_counter_log_get_value (log, i, j);
+
+          if (value == dzl_counter_log_get_value (log, i - 1, j))
+            continue;
+
+          g_print ("  %-20s : %-32s : %20"G_GINT64_FORMAT" : %14.2lf/sec\n",
+                   dzl_counter_log_get_category (log, j),
+                   dzl_counter_log_get_name (log, j),
+                   value,
+                   dzl_counter_log_get_rate (log, i, j));
+        }
+    }
+
+  g_print ("Replayed %u samples of %u counters\n", n_samples, n_counters);
+
+  return TRUE;
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
 {
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *record = NULL;
+  g_autofree gchar *replay = NULL;
   DzlCounterArena *arena;
-  guint n_counters = 0;
+  ListCounters list = { 0 };
+  gint interval = 1000;
   gint pid;
+  GOptionEntry entries[] = {
+    { "record", 'r', 0, G_OPTION_ARG_FILENAME, &record,
+      "Record the counters of PID to FILE until interrupted", "FILE" },
+    { "interval", 'i', 0, G_OPTION_ARG_INT, &interval,
+      "The number of milliseconds between recorded samples", "MSEC" },
+    { "replay", 'p', 0, G_OPTION_ARG_FILENAME, &replay,
+      "Print the counter changes recorded in FILE", "FILE" },
+    { NULL }
+  };
+
+  context = g_option_context_new ("[PID | SHM_PATH]");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (replay != NULL)
+    return replay_counters (replay) ? EXIT_SUCCESS : EXIT_FAILURE;
 
   if (argc != 2)
     {
-      fprintf (stderr, "usage: %s [PID | SHM_PATH]\n", argv [0]);
+      fprintf (stderr, "usage: %s [--record FILE] [PID | SHM_PATH]\n"
+                       "       %s --replay FILE\n",
+               argv [0], argv [0]);
+      return EXIT_FAILURE;
+    }
+
+  if (interval < 1)
+    {
+      fprintf (stderr, "The interval must be a positive number of milliseconds.\n");
       return EXIT_FAILURE;
     }
 
@@ -92,6 +241,15 @@ main (gint   argc,
       return EXIT_FAILURE;
     }
 
+  if (record != NULL)
+    {
+      gboolean ret = record_counters (arena, record, interval);
+
+      dzl_counter_arena_unref (arena);
+
+      return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
   g_print ("%-20s : %-32s : %20s : %-72s\n",
            "      Category",
            "             Name", "Value", "Description");
@@ -99,12 +257,13 @@ main (gint   argc,
            "-------------------------------- : "
            "-------------------- : "
            "------------------------------------------------------------------------\n");
-  dzl_counter_arena_foreach (arena, foreach_cb, &n_counters);
+  list.arena = arena;
+  dzl_counter_arena_foreach (arena, foreach_cb, &list);
   g_print ("-------------------- : "
            "-------------------------------- : "
            "-------------------- : "
            "------------------------------------------------------------------------\n");
-  g_print ("Discovered %u counters\n", n_counters);
+  g_print ("Discovered %u counters\n", list.n_counters);
 
   return EXIT_SUCCESS;
 }